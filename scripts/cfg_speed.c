@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <config/backend.h>
+#include <utils/linked_list.h>
+
+static void usage()
+{
+	printf("usage: cfg_speed configs lookups\n");
+	exit(1);
+}
+
+/**
+ * Backend providing synthetic configs
+ */
+static backend_t backend;
+
+/**
+ * Synthetic peer configs
+ */
+static linked_list_t *configs;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+static enumerator_t *create_peer_cfg_enumerator(backend_t *this,
+								identification_t *me, identification_t *other)
+{
+	return configs->create_enumerator(configs);
+}
+
+static bool ike_filter(void *data, peer_cfg_t **in, ike_cfg_t **out)
+{
+	*out = (*in)->get_ike_cfg(*in);
+	return TRUE;
+}
+
+static enumerator_t *create_ike_cfg_enumerator(backend_t *this,
+											   host_t *me, host_t *other)
+{
+	return enumerator_create_filter(configs->create_enumerator(configs),
+									(void*)ike_filter, NULL, NULL);
+}
+
+static peer_cfg_t *get_peer_cfg_by_name(backend_t *this, char *name)
+{
+	return NULL;
+}
+
+/**
+ * Get the remote address of config i
+ */
+static void get_addr(int i, char *buf, size_t len)
+{
+	snprintf(buf, len, "10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff,
+			 i & 0xff);
+}
+
+/**
+ * Get the remote identity of config i
+ */
+static void get_id(int i, char *buf, size_t len)
+{
+	snprintf(buf, len, "peer-%d@strongswan.org", i);
+}
+
+/**
+ * Create a peer config for a remote peer with a distinct address and identity
+ */
+static peer_cfg_t *create_config(int i)
+{
+	ike_cfg_t *ike_cfg;
+	peer_cfg_t *peer_cfg;
+	auth_cfg_t *auth;
+	char addr[32], id[64], name[32];
+
+	get_addr(i, addr, sizeof(addr));
+	get_id(i, id, sizeof(id));
+	snprintf(name, sizeof(name), "peer-%d", i);
+
+	ike_cfg = ike_cfg_create(TRUE, FALSE, "%any", TRUE, IKEV2_UDP_PORT,
+							 addr, FALSE, IKEV2_UDP_PORT);
+	peer_cfg = peer_cfg_create(name, IKEV2, ike_cfg, CERT_SEND_IF_ASKED,
+							   UNIQUE_NO, 1, 0, 0, 0, 0, FALSE, FALSE, 0, 0,
+							   FALSE, NULL, NULL);
+	auth = auth_cfg_create();
+	auth->add(auth, AUTH_RULE_IDENTITY,
+			  identification_create_from_string("moon.strongswan.org"));
+	peer_cfg->add_auth_cfg(peer_cfg, auth, TRUE);
+	auth = auth_cfg_create();
+	auth->add(auth, AUTH_RULE_IDENTITY, identification_create_from_string(id));
+	peer_cfg->add_auth_cfg(peer_cfg, auth, FALSE);
+	return peer_cfg;
+}
+
+/**
+ * Look up the ike and peer config of random peers, returns lookups per second
+ */
+static double run_lookups(int count, int lookups)
+{
+	enumerator_t *enumerator;
+	identification_t *other_id;
+	ike_cfg_t *ike_cfg;
+	peer_cfg_t *peer_cfg;
+	host_t *me, *other;
+	struct timespec timing;
+	char addr[32], id[64], name[32];
+	double elapsed = 0;
+	int i, n;
+
+	me = host_create_from_string("192.168.0.1", IKEV2_UDP_PORT);
+	for (i = 0; i < lookups; i++)
+	{
+		n = random() % count;
+		get_addr(n, addr, sizeof(addr));
+		get_id(n, id, sizeof(id));
+		snprintf(name, sizeof(name), "peer-%d", n);
+		other = host_create_from_string(addr, IKEV2_UDP_PORT);
+		other_id = identification_create_from_string(id);
+
+		start_timing(&timing);
+		ike_cfg = charon->backends->get_ike_cfg(charon->backends, me, other);
+		enumerator = charon->backends->create_peer_cfg_enumerator(
+							charon->backends, me, other, NULL, other_id, IKEV2);
+		if (!enumerator->enumerate(enumerator, &peer_cfg) ||
+			!streq(peer_cfg->get_name(peer_cfg), name) || !ike_cfg)
+		{
+			printf("no matching config found for '%s'\n", name);
+			exit(1);
+		}
+		enumerator->destroy(enumerator);
+		ike_cfg->destroy(ike_cfg);
+		elapsed += end_timing(&timing);
+
+		other_id->destroy(other_id);
+		other->destroy(other);
+	}
+	me->destroy(me);
+	return lookups / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec timing;
+	int count, lookups, i;
+
+	library_init(NULL);
+	atexit(library_deinit);
+	if (!libhydra_init("cfg_speed"))
+	{
+		return 1;
+	}
+	atexit(libhydra_deinit);
+	if (!libcharon_init("cfg_speed"))
+	{
+		return 1;
+	}
+	atexit(libcharon_deinit);
+
+	if (argc < 3)
+	{
+		usage();
+	}
+	count = atoi(argv[1]);
+	lookups = atoi(argv[2]);
+
+	configs = linked_list_create();
+	for (i = 0; i < count; i++)
+	{
+		configs->insert_last(configs, create_config(i));
+	}
+	backend = (backend_t){
+		.create_peer_cfg_enumerator = create_peer_cfg_enumerator,
+		.create_ike_cfg_enumerator = create_ike_cfg_enumerator,
+		.get_peer_cfg_by_name = get_peer_cfg_by_name,
+	};
+	charon->backends->add_backend(charon->backends, &backend);
+
+	printf("%d configs, linear search: %8.1f lookups/s\n",
+		   count, run_lookups(count, lookups));
+
+	charon->backends->changed(charon->backends, &backend);
+	start_timing(&timing);
+	run_lookups(count, 1);
+	printf("%d configs, building index: %8.3fs\n", count, end_timing(&timing));
+	printf("%d configs, indexed:        %8.1f lookups/s\n",
+		   count, run_lookups(count, lookups));
+
+	charon->backends->remove_backend(charon->backends, &backend);
+	configs->destroy_offset(configs, offsetof(peer_cfg_t, destroy));
+	return 0;
+}
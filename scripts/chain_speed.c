@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <debug.h>
+#include <credentials/sets/mem_cred.h>
+#include <credentials/certificates/x509.h>
+
+static void usage()
+{
+	printf("usage: chain_speed cas certs lookups\n");
+	exit(1);
+}
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Create a certificate for subject, self-signed if no issuer given
+ */
+static certificate_t *create_cert(char *subject, private_key_t *key,
+								  certificate_t *issuer, x509_flag_t flags,
+								  int serial)
+{
+	identification_t *id;
+	certificate_t *cert;
+	public_key_t *public;
+
+	id = identification_create_from_string(subject);
+	public = key->get_public_key(key);
+	if (issuer)
+	{
+		cert = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+						BUILD_SIGNING_KEY, key, BUILD_SIGNING_CERT, issuer,
+						BUILD_PUBLIC_KEY, public, BUILD_SUBJECT, id,
+						BUILD_SERIAL, chunk_from_thing(serial),
+						BUILD_X509_FLAG, flags, BUILD_END);
+	}
+	else
+	{
+		cert = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+						BUILD_SIGNING_KEY, key, BUILD_PUBLIC_KEY, public,
+						BUILD_SUBJECT, id, BUILD_SERIAL,
+						chunk_from_thing(serial), BUILD_X509_FLAG, flags,
+						BUILD_END);
+	}
+	public->destroy(public);
+	id->destroy(id);
+	if (!cert)
+	{
+		printf("creating certificate '%s' failed\n", subject);
+		exit(1);
+	}
+	return cert;
+}
+
+/**
+ * Issue certs end entity certificates by cas intermediate CAs below a root
+ */
+static void create_pki(mem_cred_t *creds, int cas, int certs)
+{
+	private_key_t *key;
+	certificate_t *root, **ca, *cert;
+	char buf[64];
+	int i;
+
+	key = lib->creds->create(lib->creds, CRED_PRIVATE_KEY, KEY_RSA,
+							 BUILD_KEY_SIZE, 1024, BUILD_END);
+	if (!key)
+	{
+		printf("generating key failed\n");
+		exit(1);
+	}
+	/* all certificates share a key, we measure verification, not keygen */
+	root = create_cert("C=CH, O=strongSwan, CN=Root CA", key, NULL,
+					   X509_CA, 1);
+	root = creds->add_cert_ref(creds, TRUE, root);
+	ca = calloc(cas, sizeof(certificate_t*));
+	for (i = 0; i < cas; i++)
+	{
+		snprintf(buf, sizeof(buf), "C=CH, O=strongSwan, CN=CA-%d", i);
+		ca[i] = create_cert(buf, key, root, X509_CA, i + 2);
+		ca[i] = creds->add_cert_ref(creds, FALSE, ca[i]);
+	}
+	for (i = 0; i < certs; i++)
+	{
+		snprintf(buf, sizeof(buf), "C=CH, O=strongSwan, CN=peer-%d", i);
+		cert = create_cert(buf, key, ca[i % cas], X509_NONE, i + 2);
+		creds->add_cert(creds, FALSE, cert);
+	}
+	for (i = 0; i < cas; i++)
+	{
+		ca[i]->destroy(ca[i]);
+	}
+	free(ca);
+	root->destroy(root);
+	key->destroy(key);
+}
+
+/**
+ * Verify trust chains of random peers, returns verifications per second
+ */
+static double verify_chains(int certs, int lookups)
+{
+	struct timespec timing;
+	enumerator_t *enumerator;
+	identification_t *id;
+	certificate_t *cert;
+	double elapsed = 0;
+	char buf[64];
+	int i;
+
+	for (i = 0; i < lookups; i++)
+	{
+		snprintf(buf, sizeof(buf), "C=CH, O=strongSwan, CN=peer-%d",
+				 (int)(random() % certs));
+		id = identification_create_from_string(buf);
+		start_timing(&timing);
+		enumerator = lib->credmgr->create_trusted_enumerator(lib->credmgr,
+												KEY_ANY, id, FALSE);
+		if (!enumerator->enumerate(enumerator, &cert, NULL))
+		{
+			printf("no trusted certificate found for '%Y'\n", id);
+			exit(1);
+		}
+		enumerator->destroy(enumerator);
+		elapsed += end_timing(&timing);
+		id->destroy(id);
+	}
+	return lookups / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	u_int hits, misses, evictions;
+	mem_cred_t *creds;
+	int cas, certs, lookups;
+
+	library_init(NULL);
+	dbg_default_set_level(0);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS);
+	atexit(library_deinit);
+
+	if (argc < 4)
+	{
+		usage();
+	}
+	cas = max(1, atoi(argv[1]));
+	certs = max(1, atoi(argv[2]));
+	lookups = atoi(argv[3]);
+
+	creds = mem_cred_create();
+	lib->credmgr->add_set(lib->credmgr, &creds->set);
+	create_pki(creds, cas, certs);
+
+	printf("%d certificates by %d CAs: %8.1f verifications/s\n", certs, cas,
+		   verify_chains(certs, lookups));
+	if (lib->credmgr->get_cache_stats(lib->credmgr, &hits, &misses,
+									  &evictions))
+	{
+		printf("certificate cache: %u hits, %u misses, %u evictions\n",
+			   hits, misses, evictions);
+	}
+
+	lib->credmgr->remove_set(lib->credmgr, &creds->set);
+	creds->destroy(creds);
+	return 0;
+}
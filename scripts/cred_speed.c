@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <credentials/sets/mem_cred.h>
+#include <credentials/certificates/x509.h>
+
+static void usage()
+{
+	printf("usage: cred_speed shared certs lookups\n");
+	exit(1);
+}
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Create the identity of peer i
+ */
+static identification_t *create_id(int i)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "C=CH, O=strongSwan, CN=peer-%d", i);
+	return identification_create_from_string(buf);
+}
+
+/**
+ * Add a shared key for each of count peers, returns the time spent
+ */
+static double add_shared(mem_cred_t *creds, int count)
+{
+	struct timespec timing;
+	shared_key_t *shared;
+	char buf[32];
+	double elapsed = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(buf, sizeof(buf), "secret-%d", i);
+		shared = shared_key_create(SHARED_IKE,
+								chunk_clone(chunk_create(buf, strlen(buf))));
+		start_timing(&timing);
+		creds->add_shared(creds, shared, create_id(i), NULL);
+		elapsed += end_timing(&timing);
+	}
+	return elapsed;
+}
+
+/**
+ * Add certificates for count peers, returns the time spent
+ */
+static double add_certs(mem_cred_t *creds, private_key_t *key, int count)
+{
+	struct timespec timing;
+	certificate_t *cert;
+	public_key_t *public;
+	identification_t *id;
+	double elapsed = 0;
+	chunk_t serial;
+	int i;
+
+	public = key->get_public_key(key);
+	for (i = 0; i < count; i++)
+	{
+		id = create_id(i);
+		serial = chunk_from_thing(i);
+		cert = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+							BUILD_SIGNING_KEY, key, BUILD_PUBLIC_KEY, public,
+							BUILD_SUBJECT, id, BUILD_SERIAL, serial,
+							BUILD_END);
+		id->destroy(id);
+		if (!cert)
+		{
+			printf("creating certificate failed\n");
+			exit(1);
+		}
+		start_timing(&timing);
+		creds->add_cert(creds, FALSE, cert);
+		elapsed += end_timing(&timing);
+	}
+	public->destroy(public);
+	return elapsed;
+}
+
+/**
+ * Look up shared keys of random peers, returns lookups per second
+ */
+static double lookup_shared(mem_cred_t *creds, int count, int lookups)
+{
+	struct timespec timing;
+	enumerator_t *enumerator;
+	identification_t *me, *other;
+	shared_key_t *shared;
+	double elapsed = 0;
+	int i;
+
+	me = identification_create_from_string("moon.strongswan.org");
+	for (i = 0; i < lookups; i++)
+	{
+		other = create_id(random() % count);
+		start_timing(&timing);
+		enumerator = creds->set.create_shared_enumerator(&creds->set,
+												SHARED_IKE, me, other);
+		if (!enumerator->enumerate(enumerator, &shared, NULL, NULL))
+		{
+			printf("no shared key found for '%Y'\n", other);
+			exit(1);
+		}
+		enumerator->destroy(enumerator);
+		elapsed += end_timing(&timing);
+		other->destroy(other);
+	}
+	me->destroy(me);
+	return lookups / elapsed;
+}
+
+/**
+ * Look up certificates of random peers, returns lookups per second
+ */
+static double lookup_certs(mem_cred_t *creds, int count, int lookups)
+{
+	struct timespec timing;
+	enumerator_t *enumerator;
+	identification_t *id;
+	certificate_t *cert;
+	double elapsed = 0;
+	int i;
+
+	for (i = 0; i < lookups; i++)
+	{
+		id = create_id(random() % count);
+		start_timing(&timing);
+		enumerator = creds->set.create_cert_enumerator(&creds->set,
+										CERT_X509, KEY_ANY, id, FALSE);
+		if (!enumerator->enumerate(enumerator, &cert))
+		{
+			printf("no certificate found for '%Y'\n", id);
+			exit(1);
+		}
+		enumerator->destroy(enumerator);
+		elapsed += end_timing(&timing);
+		id->destroy(id);
+	}
+	return lookups / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	private_key_t *key;
+	mem_cred_t *creds;
+	int shared, certs, lookups;
+
+	library_init(NULL);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS);
+	atexit(library_deinit);
+
+	if (argc < 4)
+	{
+		usage();
+	}
+	shared = atoi(argv[1]);
+	certs = atoi(argv[2]);
+	lookups = atoi(argv[3]);
+
+	creds = mem_cred_create();
+	if (shared)
+	{
+		printf("adding %d shared keys: %8.3fs\n", shared,
+			   add_shared(creds, shared));
+		printf("%d shared keys: %8.1f lookups/s\n", shared,
+			   lookup_shared(creds, shared, lookups));
+	}
+	if (certs)
+	{
+		key = lib->creds->create(lib->creds, CRED_PRIVATE_KEY, KEY_RSA,
+								 BUILD_KEY_SIZE, 1024, BUILD_END);
+		if (!key)
+		{
+			printf("generating key failed\n");
+			return 1;
+		}
+		printf("adding %d certificates: %8.3fs\n", certs,
+			   add_certs(creds, key, certs));
+		printf("%d certificates: %8.1f lookups/s\n", certs,
+			   lookup_certs(creds, certs, lookups));
+		key->destroy(key);
+	}
+	creds->destroy(creds);
+	return 0;
+}
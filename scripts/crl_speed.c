@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <library.h>
+#include <debug.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <utils/linked_list.h>
+#include <credentials/sets/mem_cred.h>
+#include <credentials/certificates/x509.h>
+
+static void usage()
+{
+	printf("usage: crl_speed threads auths delay [timeout]\n");
+	exit(1);
+}
+
+/**
+ * URL the CRL gets served from
+ */
+static char *crl_uri = "http://crl.strongswan.org/ca.crl";
+
+/**
+ * Encoding of the CRL served by the HTTP stub
+ */
+static chunk_t crl_encoding;
+
+/**
+ * Time in ms the HTTP stub takes to serve the CRL
+ */
+static int delay;
+
+/**
+ * Requests served by the HTTP stub
+ */
+static int requests;
+
+/**
+ * Lock for requests
+ */
+static mutex_t *mutex;
+
+/**
+ * Number of authentications per thread
+ */
+static int auths;
+
+/**
+ * Authentications failed
+ */
+static int failed;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Fetch function of the HTTP stub, serves the CRL after a delay
+ */
+static status_t stub_fetch(fetcher_t *this, char *uri, chunk_t *result)
+{
+	if (!streq(uri, crl_uri))
+	{
+		return NOT_FOUND;
+	}
+	mutex->lock(mutex);
+	requests++;
+	mutex->unlock(mutex);
+	usleep(delay * 1000);
+	*result = chunk_clone(crl_encoding);
+	return SUCCESS;
+}
+
+/**
+ * Create an instance of the HTTP stub
+ */
+static fetcher_t *stub_create()
+{
+	fetcher_t *this;
+
+	INIT(this,
+		.fetch = (void*)stub_fetch,
+		.set_option = (void*)return_true,
+		.destroy = (void*)free,
+	);
+	return this;
+}
+
+/**
+ * Create a CA, its CRL, and a certificate for each thread
+ */
+static certificate_t **create_pki(mem_cred_t *creds, int count)
+{
+	private_key_t *key;
+	public_key_t *public;
+	certificate_t *ca, *crl, **certs;
+	identification_t *id;
+	linked_list_t *cdps;
+	x509_cdp_t cdp = {
+		.uri = crl_uri,
+	};
+	time_t now;
+	char buf[64];
+	int i;
+
+	key = lib->creds->create(lib->creds, CRED_PRIVATE_KEY, KEY_RSA,
+							 BUILD_KEY_SIZE, 1024, BUILD_END);
+	if (!key)
+	{
+		printf("generating key failed\n");
+		exit(1);
+	}
+	public = key->get_public_key(key);
+	id = identification_create_from_string("C=CH, O=strongSwan, CN=CA");
+	ca = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+					BUILD_SIGNING_KEY, key, BUILD_PUBLIC_KEY, public,
+					BUILD_SUBJECT, id, BUILD_SERIAL, chunk_from_chars(0x01),
+					BUILD_X509_FLAG, X509_CA, BUILD_END);
+	id->destroy(id);
+	now = time(NULL);
+	crl = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509_CRL,
+					BUILD_SIGNING_KEY, key, BUILD_SIGNING_CERT, ca,
+					BUILD_NOT_BEFORE_TIME, now,
+					BUILD_NOT_AFTER_TIME, now + 86400,
+					BUILD_SERIAL, chunk_from_chars(0x01), BUILD_END);
+	if (!ca || !crl || !crl->get_encoding(crl, CERT_ASN1_DER, &crl_encoding))
+	{
+		printf("creating CA or CRL failed\n");
+		exit(1);
+	}
+	crl->destroy(crl);
+	ca = creds->add_cert_ref(creds, TRUE, ca);
+
+	cdps = linked_list_create();
+	cdps->insert_last(cdps, &cdp);
+	certs = calloc(count, sizeof(certificate_t*));
+	for (i = 0; i < count; i++)
+	{
+		snprintf(buf, sizeof(buf), "C=CH, O=strongSwan, CN=peer-%d", i);
+		id = identification_create_from_string(buf);
+		certs[i] = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+					BUILD_SIGNING_KEY, key, BUILD_SIGNING_CERT, ca,
+					BUILD_PUBLIC_KEY, public, BUILD_SUBJECT, id,
+					BUILD_SERIAL, chunk_from_thing(i),
+					BUILD_CRL_DISTRIBUTION_POINTS, cdps, BUILD_END);
+		id->destroy(id);
+		if (!certs[i])
+		{
+			printf("creating certificate failed\n");
+			exit(1);
+		}
+		certs[i] = creds->add_cert_ref(creds, FALSE, certs[i]);
+	}
+	cdps->destroy(cdps);
+	ca->destroy(ca);
+	public->destroy(public);
+	key->destroy(key);
+	return certs;
+}
+
+/**
+ * Verify the trust chain of a certificate, including its revocation status
+ */
+static void *run_auths(certificate_t *cert)
+{
+	enumerator_t *enumerator;
+	certificate_t *current;
+	int i;
+
+	for (i = 0; i < auths; i++)
+	{
+		enumerator = lib->credmgr->create_trusted_enumerator(lib->credmgr,
+									KEY_ANY, cert->get_subject(cert), TRUE);
+		if (!enumerator->enumerate(enumerator, &current, NULL))
+		{
+			mutex->lock(mutex);
+			failed++;
+			mutex->unlock(mutex);
+		}
+		enumerator->destroy(enumerator);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec timing;
+	certificate_t **certs;
+	thread_t **threads;
+	mem_cred_t *creds;
+	int count, i;
+
+	if (argc < 4)
+	{
+		usage();
+	}
+	count = max(1, atoi(argv[1]));
+	auths = atoi(argv[2]);
+	delay = atoi(argv[3]);
+
+	library_init(NULL);
+	dbg_default_set_level(0);
+	atexit(library_deinit);
+	if (argc > 4)
+	{
+		lib->settings->set_str(lib->settings,
+					"libstrongswan.plugins.revocation.timeout", argv[4]);
+	}
+	if (!lib->plugins->load(lib->plugins, NULL, PLUGINS " revocation"))
+	{
+		return 1;
+	}
+	mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	lib->fetcher->add_fetcher(lib->fetcher, stub_create, "http://");
+	creds = mem_cred_create();
+	lib->credmgr->add_set(lib->credmgr, &creds->set);
+	certs = create_pki(creds, count);
+
+	threads = calloc(count, sizeof(thread_t*));
+	start_timing(&timing);
+	for (i = 0; i < count; i++)
+	{
+		threads[i] = thread_create((void*)run_auths, certs[i]);
+	}
+	for (i = 0; i < count; i++)
+	{
+		threads[i]->join(threads[i]);
+	}
+	printf("%d authentications by %d threads, %dms CRL delay: %8.3fs, "
+		   "%d CRL fetches, %d failed\n", auths * count, count, delay,
+		   end_timing(&timing), requests, failed);
+
+	for (i = 0; i < count; i++)
+	{
+		certs[i]->destroy(certs[i]);
+	}
+	free(certs);
+	free(threads);
+	lib->credmgr->remove_set(lib->credmgr, &creds->set);
+	creds->destroy(creds);
+	lib->fetcher->remove_fetcher(lib->fetcher, stub_create);
+	mutex->destroy(mutex);
+	chunk_free(&crl_encoding);
+	/* concurrent authentications must share a single fetch */
+	return (requests == 1 && failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <encoding/message.h>
+#include <encoding/payloads/cert_payload.h>
+
+static void usage()
+{
+	printf("usage: gen_speed rounds certs [certsize]\n");
+	exit(1);
+}
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Build an IKE_AUTH request carrying certs CERT payloads
+ */
+static message_t *build_message(ike_sa_id_t *id, host_t *host, chunk_t cert,
+								int certs)
+{
+	message_t *message;
+	int i;
+
+	message = message_create(IKEV2_MAJOR_VERSION, IKEV2_MINOR_VERSION);
+	message->set_exchange_type(message, IKE_AUTH);
+	message->set_request(message, TRUE);
+	message->set_message_id(message, 1);
+	message->set_ike_sa_id(message, id);
+	message->set_source(message, host->clone(host));
+	message->set_destination(message, host->clone(host));
+	for (i = 0; i < certs; i++)
+	{
+		message->add_payload(message, (payload_t*)
+					cert_payload_create_custom(CERTIFICATE, ENC_X509_SIGNATURE,
+											   chunk_clone(cert)));
+	}
+	return message;
+}
+
+int main(int argc, char *argv[])
+{
+	message_t *message;
+	packet_t *packet;
+	ike_sa_id_t *id;
+	host_t *host;
+	chunk_t cert;
+	struct timespec timing;
+	int rounds, certs, size = 1200, i;
+	double elapsed;
+
+	library_init(NULL);
+	atexit(library_deinit);
+	if (!libhydra_init("gen_speed"))
+	{
+		return 1;
+	}
+	atexit(libhydra_deinit);
+	if (!libcharon_init("gen_speed"))
+	{
+		return 1;
+	}
+	atexit(libcharon_deinit);
+
+	if (argc < 3)
+	{
+		usage();
+	}
+	rounds = atoi(argv[1]);
+	certs = atoi(argv[2]);
+	if (argc > 3)
+	{
+		size = atoi(argv[3]);
+	}
+
+	cert = chunk_alloca(size);
+	memset(cert.ptr, 0x42, cert.len);
+	id = ike_sa_id_create(IKEV2_MAJOR_VERSION, 1, 2, TRUE);
+	host = host_create_from_string("192.168.0.1", 500);
+
+	elapsed = 0;
+	for (i = 0; i < rounds; i++)
+	{
+		message = build_message(id, host, cert, certs);
+		start_timing(&timing);
+		if (message->generate(message, NULL, &packet) != SUCCESS)
+		{
+			printf("generating message failed\n");
+			return 1;
+		}
+		elapsed += end_timing(&timing);
+		packet->destroy(packet);
+		message->destroy(message);
+	}
+	printf("%d IKE_AUTH messages with %d %d byte CERT payloads: %8.1f/s\n",
+		   rounds, certs, size, rounds / elapsed);
+
+	host->destroy(host);
+	id->destroy(id);
+	return 0;
+}
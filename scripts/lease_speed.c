@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <debug.h>
+#include <hydra.h>
+#include <threading/thread.h>
+#include <utils/linked_list.h>
+
+static void usage()
+{
+	printf("usage: lease_speed plugins uri leases [threads [rounds]]\n");
+	exit(1);
+}
+
+/**
+ * Pool to acquire leases from
+ */
+static char *pool = "bench";
+
+/**
+ * Number of leases per thread
+ */
+static int leases;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Create the attr-sql tables and a pool providing enough addresses
+ */
+static bool create_pool(char *uri, int addresses)
+{
+	database_t *db;
+	u_int32_t addr;
+	int i, id;
+	char *tables[] = {
+		"DROP TABLE IF EXISTS identities",
+		"CREATE TABLE identities (id INTEGER NOT NULL PRIMARY KEY "
+			"AUTOINCREMENT, type INTEGER NOT NULL, data BLOB NOT NULL, "
+			"UNIQUE (type, data))",
+		"DROP TABLE IF EXISTS pools",
+		"CREATE TABLE pools (id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"name TEXT NOT NULL UNIQUE, start BLOB NOT NULL, "
+			"end BLOB NOT NULL, timeout INTEGER NOT NULL)",
+		"DROP TABLE IF EXISTS addresses",
+		"CREATE TABLE addresses (id INTEGER NOT NULL PRIMARY KEY "
+			"AUTOINCREMENT, pool INTEGER NOT NULL, address BLOB NOT NULL, "
+			"identity INTEGER NOT NULL, acquired INTEGER NOT NULL, "
+			"released INTEGER NOT NULL)",
+		"CREATE INDEX addresses_pool ON addresses (pool)",
+		"CREATE INDEX addresses_address ON addresses (address)",
+		"CREATE INDEX addresses_identity ON addresses (identity)",
+		"DROP TABLE IF EXISTS leases",
+		"CREATE TABLE leases (id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"address INTEGER NOT NULL, identity INTEGER NOT NULL, "
+			"acquired INTEGER NOT NULL, released INTEGER NOT NULL)",
+	};
+
+	db = lib->db->create(lib->db, uri);
+	if (!db)
+	{
+		printf("opening database '%s' failed\n", uri);
+		return FALSE;
+	}
+	for (i = 0; i < countof(tables); i++)
+	{
+		if (db->execute(db, NULL, tables[i]) < 0)
+		{
+			db->destroy(db);
+			return FALSE;
+		}
+	}
+	addr = htonl(0x0a000001);
+	if (db->execute(db, &id,
+			"INSERT INTO pools (name, start, end, timeout) VALUES (?, ?, ?, ?)",
+			DB_TEXT, pool, DB_BLOB, chunk_from_thing(addr),
+			DB_BLOB, chunk_from_thing(addr), DB_UINT, 3600) != 1)
+	{
+		db->destroy(db);
+		return FALSE;
+	}
+	db->execute(db, NULL, "BEGIN TRANSACTION");
+	for (i = 0; i < addresses; i++)
+	{
+		addr = htonl(0x0a000001 + i);
+		db->execute(db, NULL,
+			"INSERT INTO addresses (pool, address, identity, acquired, released) "
+			"VALUES (?, ?, ?, ?, ?)",
+			DB_UINT, id, DB_BLOB, chunk_from_thing(addr),
+			DB_UINT, 0, DB_UINT, 0, DB_UINT, 1);
+	}
+	db->execute(db, NULL, "END TRANSACTION");
+	db->destroy(db);
+	return TRUE;
+}
+
+/**
+ * Acquire and release leases for distinct identities
+ */
+static void *run_leases(uintptr_t offset)
+{
+	identification_t *id;
+	linked_list_t *pools;
+	host_t *vip;
+	char buf[64];
+	int i;
+
+	pools = linked_list_create();
+	pools->insert_last(pools, pool);
+	for (i = 0; i < leases; i++)
+	{
+		snprintf(buf, sizeof(buf), "peer-%d@strongswan.org",
+				 (int)(offset + i));
+		id = identification_create_from_string(buf);
+		vip = hydra->attributes->acquire_address(hydra->attributes, pools,
+												 id, NULL);
+		if (!vip)
+		{
+			printf("acquiring lease for '%Y' failed\n", id);
+		}
+		else
+		{
+			hydra->attributes->release_address(hydra->attributes, pools,
+											   vip, id);
+			vip->destroy(vip);
+		}
+		id->destroy(id);
+	}
+	pools->destroy(pools);
+	return NULL;
+}
+
+/**
+ * Run a round of lease acquisitions and releases, returns leases per second
+ */
+static double run_round(int count)
+{
+	thread_t **threads;
+	struct timespec timing;
+	int i;
+
+	threads = calloc(count, sizeof(thread_t*));
+	start_timing(&timing);
+	for (i = 0; i < count; i++)
+	{
+		threads[i] = thread_create((void*)run_leases,
+								   (void*)(uintptr_t)(i * leases));
+	}
+	for (i = 0; i < count; i++)
+	{
+		threads[i]->join(threads[i]);
+	}
+	free(threads);
+	return leases * count / end_timing(&timing);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = 1, rounds = 2, i;
+	double rate = 0;
+
+	if (argc < 4)
+	{
+		usage();
+	}
+	leases = atoi(argv[3]);
+	if (argc > 4)
+	{
+		count = atoi(argv[4]);
+	}
+	if (argc > 5)
+	{
+		rounds = atoi(argv[5]);
+	}
+
+	library_init(NULL);
+	dbg_default_set_level(0);
+	if (!libhydra_init("lease_speed"))
+	{
+		return 1;
+	}
+	lib->settings->set_str(lib->settings,
+						   "libhydra.plugins.attr-sql.database", argv[2]);
+	if (!lib->plugins->load(lib->plugins, NULL, argv[1]) ||
+		!create_pool(argv[2], leases * count))
+	{
+		return 1;
+	}
+
+	/* the first round assigns new leases, later rounds reuse them */
+	printf("%d new leases by %d threads:      %8.1f/s\n",
+		   leases * count, count, run_round(count));
+	for (i = 1; i < rounds; i++)
+	{
+		rate += run_round(count);
+	}
+	if (rounds > 1)
+	{
+		printf("%d existing leases by %d threads: %8.1f/s\n",
+			   leases * count, count, rate / (rounds - 1));
+	}
+
+	lib->plugins->unload(lib->plugins);
+	libhydra_deinit();
+	library_deinit();
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <library.h>
+#include <debug.h>
+#include <ipsec_sa_mgr.h>
+
+static void usage()
+{
+	printf("usage: sa_speed sas lookups\n");
+	exit(1);
+}
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Install count inbound and outbound SAs, with SPIs and reqids 1 to count
+ */
+static void add_sas(ipsec_sa_mgr_t *sas, int count)
+{
+	lifetime_cfg_t lifetime = {
+		.time = {
+			.life = 3600,
+		},
+	};
+	traffic_selector_t *ts;
+	host_t *local, *remote;
+	mark_t mark = {};
+	char key[16] = {};
+	int i;
+
+	local = host_create_from_string("192.168.0.1", 4500);
+	remote = host_create_from_string("192.168.0.2", 4500);
+	ts = traffic_selector_create_from_string(0, TS_IPV4_ADDR_RANGE,
+						"10.0.0.0", 0, "10.255.255.255", 65535);
+	for (i = 1; i <= count; i++)
+	{
+		if (sas->add_sa(sas, remote, local, htonl(i), IPPROTO_ESP, i, mark,
+					0, &lifetime, ENCR_AES_CBC, chunk_from_thing(key),
+					AUTH_HMAC_SHA1_96, chunk_from_thing(key), MODE_TUNNEL,
+					IPCOMP_NONE, 0, TRUE, FALSE, TRUE, ts, ts) != SUCCESS ||
+			sas->add_sa(sas, local, remote, htonl(count + i), IPPROTO_ESP, i,
+					mark, 0, &lifetime, ENCR_AES_CBC, chunk_from_thing(key),
+					AUTH_HMAC_SHA1_96, chunk_from_thing(key), MODE_TUNNEL,
+					IPCOMP_NONE, 0, TRUE, FALSE, FALSE, ts, ts) != SUCCESS)
+		{
+			printf("adding SA failed\n");
+			exit(1);
+		}
+	}
+	ts->destroy(ts);
+	remote->destroy(remote);
+	local->destroy(local);
+}
+
+/**
+ * Check out random inbound SAs by SPI, returns lookups per second
+ */
+static double lookup_spi(ipsec_sa_mgr_t *sas, int count, int lookups)
+{
+	struct timespec timing;
+	ipsec_sa_t *sa;
+	host_t *local;
+	int i;
+
+	local = host_create_from_string("192.168.0.1", 4500);
+	start_timing(&timing);
+	for (i = 0; i < lookups; i++)
+	{
+		sa = sas->checkout_by_spi(sas, htonl(random() % count + 1), local);
+		if (!sa)
+		{
+			printf("SA lookup by SPI failed\n");
+			exit(1);
+		}
+		sas->checkin(sas, sa);
+	}
+	local->destroy(local);
+	return lookups / end_timing(&timing);
+}
+
+/**
+ * Check out random outbound SAs by reqid, returns lookups per second
+ */
+static double lookup_reqid(ipsec_sa_mgr_t *sas, int count, int lookups)
+{
+	struct timespec timing;
+	ipsec_sa_t *sa;
+	int i;
+
+	start_timing(&timing);
+	for (i = 0; i < lookups; i++)
+	{
+		sa = sas->checkout_by_reqid(sas, random() % count + 1, FALSE);
+		if (!sa)
+		{
+			printf("SA lookup by reqid failed\n");
+			exit(1);
+		}
+		sas->checkin(sas, sa);
+	}
+	return lookups / end_timing(&timing);
+}
+
+int main(int argc, char *argv[])
+{
+	ipsec_sa_mgr_t *sas;
+	int count, lookups;
+
+	library_init(NULL);
+	dbg_default_set_level(0);
+	lib->plugins->load(lib->plugins, NULL, PLUGINS);
+	atexit(library_deinit);
+
+	if (argc < 3)
+	{
+		usage();
+	}
+	count = max(1, atoi(argv[1]));
+	lookups = atoi(argv[2]);
+
+	sas = ipsec_sa_mgr_create();
+	add_sas(sas, count);
+	printf("%d SAs: %10.1f lookups/s by SPI, %10.1f lookups/s by reqid\n",
+		   count * 2, lookup_spi(sas, count, lookups),
+		   lookup_reqid(sas, count, lookups));
+	sas->destroy(sas);
+	return 0;
+}
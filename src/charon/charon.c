@@ -246,7 +246,7 @@ static void initialize_loggers(bool use_stderr, level_t levels[])
 	sys_logger_t *sys_logger;
 	file_logger_t *file_logger;
 	enumerator_t *enumerator;
-	char *identifier, *facility, *filename;
+	char *identifier, *facility, *filename, *overflow;
 	int loggers_defined = 0;
 	debug_t group;
 	level_t  def;
@@ -330,6 +330,20 @@ static void initialize_loggers(bool use_stderr, level_t levels[])
 							"charon.filelog.%s.time_format", NULL, filename),
 						lib->settings->get_bool(lib->settings,
 							"charon.filelog.%s.ike_name", FALSE, filename));
+		if (lib->settings->get_bool(lib->settings,
+							"charon.filelog.%s.async", FALSE, filename))
+		{
+			overflow = lib->settings->get_str(lib->settings,
+							"charon.filelog.%s.async_overflow", "block", filename);
+			if (!file_logger->set_async(file_logger,
+						lib->settings->get_int(lib->settings,
+							"charon.filelog.%s.async_buffer", 65536, filename),
+						streq(overflow, "drop")))
+			{
+				DBG1(DBG_DMN, "writing to log file %s asynchronously failed",
+					 filename);
+			}
+		}
 		def = lib->settings->get_int(lib->settings,
 									 "charon.filelog.%s.default", 1, filename);
 		for (group = 0; group < DBG_MAX; group++)
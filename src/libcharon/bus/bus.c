@@ -22,8 +22,31 @@
 #include <threading/thread_value.h>
 #include <threading/mutex.h>
 #include <threading/rwlock.h>
+#include <threading/spinlock.h>
 
 typedef struct private_bus_t private_bus_t;
+typedef struct entry_t entry_t;
+typedef struct listeners_t listeners_t;
+
+/**
+ * Listener hooks, used to index the per-hook listener subsets
+ */
+typedef enum {
+	HOOK_ALERT,
+	HOOK_IKE_STATE_CHANGE,
+	HOOK_CHILD_STATE_CHANGE,
+	HOOK_MESSAGE,
+	HOOK_AUTHORIZE,
+	HOOK_NARROW,
+	HOOK_IKE_KEYS,
+	HOOK_CHILD_KEYS,
+	HOOK_IKE_UPDOWN,
+	HOOK_IKE_REKEY,
+	HOOK_IKE_REESTABLISH,
+	HOOK_CHILD_UPDOWN,
+	HOOK_CHILD_REKEY,
+	HOOK_MAX,
+} hook_t;
 
 /**
  * Private data of a bus_t object.
@@ -39,6 +62,17 @@ struct private_bus_t {
 	 */
 	linked_list_t *listeners;
 
+	/**
+	 * Immutable snapshot of the registered listeners used for dispatching,
+	 * replaced whenever a listener gets registered or unregistered
+	 */
+	listeners_t *current;
+
+	/**
+	 * Lock to acquire a reference to the current snapshot
+	 */
+	spinlock_t *lock;
+
 	/**
 	 * List of registered loggers for each log group as log_entry_t.
 	 * Loggers are ordered by descending log level.
@@ -53,7 +87,7 @@ struct private_bus_t {
 	level_t max_level[DBG_MAX + 1];
 
 	/**
-	 * Mutex for the list of listeners, recursively.
+	 * Mutex for the list of listeners, serializes updates of the snapshot
 	 */
 	mutex_t *mutex;
 
@@ -68,8 +102,6 @@ struct private_bus_t {
 	thread_value_t *thread_sa;
 };
 
-typedef struct entry_t entry_t;
-
 /**
  * a listener entry
  */
@@ -85,6 +117,66 @@ struct entry_t {
 	 */
 	int calling;
 
+	/**
+	 * listener got unregistered, don't call it anymore
+	 */
+	bool removed;
+
+	/**
+	 * serializes calls to this listener, recursively
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * references held by the list of listeners and snapshots
+	 */
+	refcount_t refs;
+
+	/**
+	 * number of hook invocations
+	 */
+	u_int calls;
+
+	/**
+	 * total time spent in hooks, in us
+	 */
+	u_int64_t usec;
+
+	/**
+	 * longest time spent in a single hook invocation, in us
+	 */
+	u_int max_usec;
+};
+
+/**
+ * Snapshot of the registered listeners
+ */
+struct listeners_t {
+
+	/**
+	 * references held by the bus and dispatching threads
+	 */
+	refcount_t refs;
+
+	/**
+	 * all registered listeners
+	 */
+	entry_t **all;
+
+	/**
+	 * number of registered listeners
+	 */
+	int count;
+
+	/**
+	 * listeners implementing a hook, for each hook
+	 */
+	entry_t **hooks[HOOK_MAX];
+
+	/**
+	 * number of listeners implementing a hook, for each hook
+	 */
+	int counts[HOOK_MAX];
 };
 
 typedef struct log_entry_t log_entry_t;
@@ -106,6 +198,161 @@ struct log_entry_t {
 
 };
 
+/**
+ * Release a reference to a listener entry
+ */
+static void entry_put(entry_t *entry)
+{
+	if (ref_put(&entry->refs))
+	{
+		entry->mutex->destroy(entry->mutex);
+		free(entry);
+	}
+}
+
+/**
+ * Release a reference to a snapshot
+ */
+static void listeners_put(listeners_t *listeners)
+{
+	int i;
+
+	if (ref_put(&listeners->refs))
+	{
+		for (i = 0; i < listeners->count; i++)
+		{
+			entry_put(listeners->all[i]);
+		}
+		for (i = 0; i < HOOK_MAX; i++)
+		{
+			free(listeners->hooks[i]);
+		}
+		free(listeners->all);
+		free(listeners);
+	}
+}
+
+/**
+ * Check if a listener implements a hook
+ */
+static bool implements(listener_t *listener, hook_t hook)
+{
+	switch (hook)
+	{
+		case HOOK_ALERT:
+			return listener->alert != NULL;
+		case HOOK_IKE_STATE_CHANGE:
+			return listener->ike_state_change != NULL;
+		case HOOK_CHILD_STATE_CHANGE:
+			return listener->child_state_change != NULL;
+		case HOOK_MESSAGE:
+			return listener->message != NULL;
+		case HOOK_AUTHORIZE:
+			return listener->authorize != NULL;
+		case HOOK_NARROW:
+			return listener->narrow != NULL;
+		case HOOK_IKE_KEYS:
+			return listener->ike_keys != NULL;
+		case HOOK_CHILD_KEYS:
+			return listener->child_keys != NULL;
+		case HOOK_IKE_UPDOWN:
+			return listener->ike_updown != NULL;
+		case HOOK_IKE_REKEY:
+			return listener->ike_rekey != NULL;
+		case HOOK_IKE_REESTABLISH:
+			return listener->ike_reestablish != NULL;
+		case HOOK_CHILD_UPDOWN:
+			return listener->child_updown != NULL;
+		case HOOK_CHILD_REKEY:
+			return listener->child_rekey != NULL;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Replace the current snapshot after the list of listeners changed, this->mutex
+ * must be held
+ */
+static void update_listeners(private_bus_t *this)
+{
+	enumerator_t *enumerator;
+	listeners_t *listeners, *old;
+	entry_t *entry;
+	int i;
+
+	INIT(listeners,
+		.refs = 1,
+		.all = calloc(this->listeners->get_count(this->listeners) + 1,
+					  sizeof(entry_t*)),
+	);
+	enumerator = this->listeners->create_enumerator(this->listeners);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		ref_get(&entry->refs);
+		listeners->all[listeners->count++] = entry;
+	}
+	enumerator->destroy(enumerator);
+
+	for (i = 0; i < HOOK_MAX; i++)
+	{
+		listeners->hooks[i] = calloc(listeners->count + 1, sizeof(entry_t*));
+		enumerator = this->listeners->create_enumerator(this->listeners);
+		while (enumerator->enumerate(enumerator, &entry))
+		{
+			if (implements(entry->listener, i))
+			{
+				listeners->hooks[i][listeners->counts[i]++] = entry;
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+
+	this->lock->lock(this->lock);
+	old = this->current;
+	this->current = listeners;
+	this->lock->unlock(this->lock);
+
+	if (old)
+	{
+		listeners_put(old);
+	}
+}
+
+/**
+ * Get a reference to the current snapshot of listeners
+ */
+static listeners_t *get_listeners(private_bus_t *this)
+{
+	listeners_t *listeners;
+
+	this->lock->lock(this->lock);
+	listeners = this->current;
+	ref_get(&listeners->refs);
+	this->lock->unlock(this->lock);
+	return listeners;
+}
+
+/**
+ * Remove an entry from the list of listeners
+ */
+static void remove_entry(private_bus_t *this, entry_t *entry)
+{
+	bool found = FALSE;
+
+	this->mutex->lock(this->mutex);
+	if (this->listeners->remove(this->listeners, entry, NULL))
+	{
+		update_listeners(this);
+		found = TRUE;
+	}
+	this->mutex->unlock(this->mutex);
+	if (found)
+	{
+		entry_put(entry);
+	}
+}
+
 METHOD(bus_t, add_listener, void,
 	private_bus_t *this, listener_t *listener)
 {
@@ -113,10 +360,13 @@ METHOD(bus_t, add_listener, void,
 
 	INIT(entry,
 		.listener = listener,
+		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+		.refs = 1,
 	);
 
 	this->mutex->lock(this->mutex);
 	this->listeners->insert_last(this->listeners, entry);
+	update_listeners(this);
 	this->mutex->unlock(this->mutex);
 }
 
@@ -124,21 +374,32 @@ METHOD(bus_t, remove_listener, void,
 	private_bus_t *this, listener_t *listener)
 {
 	enumerator_t *enumerator;
-	entry_t *entry;
+	entry_t *current, *entry = NULL;
 
 	this->mutex->lock(this->mutex);
 	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	while (enumerator->enumerate(enumerator, &current))
 	{
-		if (entry->listener == listener)
+		if (current->listener == listener)
 		{
-			this->listeners->remove_at(this->listeners, enumerator);
-			free(entry);
+			entry = current;
+			ref_get(&entry->refs);
 			break;
 		}
 	}
 	enumerator->destroy(enumerator);
 	this->mutex->unlock(this->mutex);
+
+	if (entry)
+	{
+		/* wait until other threads returned from the listener, threads still
+		 * using an old snapshot skip it afterwards */
+		entry->mutex->lock(entry->mutex);
+		entry->removed = TRUE;
+		entry->mutex->unlock(entry->mutex);
+		remove_entry(this, entry);
+		entry_put(entry);
+	}
 }
 
 /**
@@ -336,135 +597,153 @@ METHOD(bus_t, log_, void,
 }
 
 /**
- * unregister a listener
+ * Prepare calling a listener, returns TRUE with the listener locked if it
+ * should be called
+ */
+static bool enter_listener(entry_t *entry, timeval_t *start)
+{
+	entry->mutex->lock(entry->mutex);
+	if (entry->calling || entry->removed)
+	{
+		entry->mutex->unlock(entry->mutex);
+		return FALSE;
+	}
+	entry->calling++;
+	time_monotonic(start);
+	return TRUE;
+}
+
+/**
+ * Account the time spent in a listener and unregister it if requested
  */
-static inline void unregister_listener(private_bus_t *this, entry_t *entry,
-									   enumerator_t *enumerator)
+static void leave_listener(private_bus_t *this, entry_t *entry,
+						   timeval_t *start, bool keep)
 {
-	this->listeners->remove_at(this->listeners, enumerator);
-	free(entry);
+	timeval_t end;
+	u_int usec;
+
+	time_monotonic(&end);
+	usec = (end.tv_sec - start->tv_sec) * 1000000 +
+		   (end.tv_usec - start->tv_usec);
+	entry->calls++;
+	entry->usec += usec;
+	entry->max_usec = max(entry->max_usec, usec);
+	entry->calling--;
+	if (!keep)
+	{
+		entry->removed = TRUE;
+	}
+	entry->mutex->unlock(entry->mutex);
+	if (!keep)
+	{
+		remove_entry(this, entry);
+	}
 }
 
 METHOD(bus_t, alert, void,
 	private_bus_t *this, alert_t alert, ...)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	va_list args;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_ALERT]; i++)
 	{
-		if (entry->calling || !entry->listener->alert)
+		entry = listeners->hooks[HOOK_ALERT][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		va_start(args, alert);
 		keep = entry->listener->alert(entry->listener, ike_sa, alert, args);
 		va_end(args);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_state_change, void,
 	private_bus_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_IKE_STATE_CHANGE]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_state_change)
+		entry = listeners->hooks[HOOK_IKE_STATE_CHANGE][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_state_change(entry->listener, ike_sa, state);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_state_change, void,
 	private_bus_t *this, child_sa_t *child_sa, child_sa_state_t state)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_CHILD_STATE_CHANGE]; i++)
 	{
-		if (entry->calling || !entry->listener->child_state_change)
+		entry = listeners->hooks[HOOK_CHILD_STATE_CHANGE][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_state_change(entry->listener, ike_sa,
 												   child_sa, state);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, message, void,
 	private_bus_t *this, message_t *message, bool incoming, bool plain)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_MESSAGE]; i++)
 	{
-		if (entry->calling || !entry->listener->message)
+		entry = listeners->hooks[HOOK_MESSAGE][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->message(entry->listener, ike_sa,
 										message, incoming, plain);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_keys, void,
@@ -472,150 +751,130 @@ METHOD(bus_t, ike_keys, void,
 	chunk_t dh_other, chunk_t nonce_i, chunk_t nonce_r,
 	ike_sa_t *rekey, shared_key_t *shared)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_IKE_KEYS]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_keys)
+		entry = listeners->hooks[HOOK_IKE_KEYS][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_keys(entry->listener, ike_sa, dh, dh_other,
 										 nonce_i, nonce_r, rekey, shared);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_keys, void,
 	private_bus_t *this, child_sa_t *child_sa, bool initiator,
 	diffie_hellman_t *dh, chunk_t nonce_i, chunk_t nonce_r)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_CHILD_KEYS]; i++)
 	{
-		if (entry->calling || !entry->listener->child_keys)
+		entry = listeners->hooks[HOOK_CHILD_KEYS][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_keys(entry->listener, ike_sa,
 								child_sa, initiator, dh, nonce_i, nonce_r);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_updown, void,
 	private_bus_t *this, child_sa_t *child_sa, bool up)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_CHILD_UPDOWN]; i++)
 	{
-		if (entry->calling || !entry->listener->child_updown)
+		entry = listeners->hooks[HOOK_CHILD_UPDOWN][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_updown(entry->listener,
 											 ike_sa, child_sa, up);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, child_rekey, void,
 	private_bus_t *this, child_sa_t *old, child_sa_t *new)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_CHILD_REKEY]; i++)
 	{
-		if (entry->calling || !entry->listener->child_rekey)
+		entry = listeners->hooks[HOOK_CHILD_REKEY][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->child_rekey(entry->listener, ike_sa,
 											old, new);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_updown, void,
 	private_bus_t *this, ike_sa_t *ike_sa, bool up)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_IKE_UPDOWN]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_updown)
+		entry = listeners->hooks[HOOK_IKE_UPDOWN][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_updown(entry->listener, ike_sa, up);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 
 	/* a down event for IKE_SA implicitly downs all CHILD_SAs */
 	if (!up)
@@ -635,90 +894,78 @@ METHOD(bus_t, ike_updown, void,
 METHOD(bus_t, ike_rekey, void,
 	private_bus_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_IKE_REKEY]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_rekey)
+		entry = listeners->hooks[HOOK_IKE_REKEY][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_rekey(entry->listener, old, new);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, ike_reestablish, void,
 	private_bus_t *this, ike_sa_t *old, ike_sa_t *new)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_IKE_REESTABLISH]; i++)
 	{
-		if (entry->calling || !entry->listener->ike_reestablish)
+		entry = listeners->hooks[HOOK_IKE_REESTABLISH][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->ike_reestablish(entry->listener, old, new);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 }
 
 METHOD(bus_t, authorize, bool,
 	private_bus_t *this, bool final)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep, success = TRUE;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_AUTHORIZE]; i++)
 	{
-		if (entry->calling || !entry->listener->authorize)
+		entry = listeners->hooks[HOOK_AUTHORIZE][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->authorize(entry->listener, ike_sa,
 										  final, &success);
-		entry->calling--;
-		if (!keep)
-		{
-			unregister_listener(this, entry, enumerator);
-		}
+		leave_listener(this, entry, &start, keep);
 		if (!success)
 		{
 			break;
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	listeners_put(listeners);
 	return success;
 }
 
@@ -726,32 +973,83 @@ METHOD(bus_t, narrow, void,
 	private_bus_t *this, child_sa_t *child_sa, narrow_hook_t type,
 	linked_list_t *local, linked_list_t *remote)
 {
-	enumerator_t *enumerator;
+	listeners_t *listeners;
 	ike_sa_t *ike_sa;
 	entry_t *entry;
+	timeval_t start;
 	bool keep;
+	int i;
 
 	ike_sa = this->thread_sa->get(this->thread_sa);
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->listeners->create_enumerator(this->listeners);
-	while (enumerator->enumerate(enumerator, &entry))
+	listeners = get_listeners(this);
+	for (i = 0; i < listeners->counts[HOOK_NARROW]; i++)
 	{
-		if (entry->calling || !entry->listener->narrow)
+		entry = listeners->hooks[HOOK_NARROW][i];
+		if (!enter_listener(entry, &start))
 		{
 			continue;
 		}
-		entry->calling++;
 		keep = entry->listener->narrow(entry->listener, ike_sa, child_sa,
 									   type, local, remote);
-		entry->calling--;
-		if (!keep)
+		leave_listener(this, entry, &start, keep);
+	}
+	listeners_put(listeners);
+}
+
+/**
+ * Enumerator over listener statistics
+ */
+typedef struct {
+	/** implements enumerator_t */
+	enumerator_t public;
+	/** snapshot we enumerate */
+	listeners_t *listeners;
+	/** current index */
+	int i;
+} stats_enumerator_t;
+
+METHOD(enumerator_t, stats_enumerate, bool,
+	stats_enumerator_t *this, listener_t **listener, u_int *calls,
+	u_int64_t *usec, u_int *max_usec)
+{
+	entry_t *entry;
+
+	while (this->i < this->listeners->count)
+	{
+		entry = this->listeners->all[this->i++];
+		if (!entry->removed)
 		{
-			unregister_listener(this, entry, enumerator);
+			*listener = entry->listener;
+			*calls = entry->calls;
+			*usec = entry->usec;
+			*max_usec = entry->max_usec;
+			return TRUE;
 		}
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	return FALSE;
+}
+
+METHOD(enumerator_t, stats_destroy, void,
+	stats_enumerator_t *this)
+{
+	listeners_put(this->listeners);
+	free(this);
+}
+
+METHOD(bus_t, create_listener_enumerator, enumerator_t*,
+	private_bus_t *this)
+{
+	stats_enumerator_t *enumerator;
+
+	INIT(enumerator,
+		.public = {
+			.enumerate = (void*)_stats_enumerate,
+			.destroy = _stats_destroy,
+		},
+		.listeners = get_listeners(this),
+	);
+	return &enumerator->public;
 }
 
 METHOD(bus_t, destroy, void,
@@ -764,9 +1062,11 @@ METHOD(bus_t, destroy, void,
 	}
 	this->loggers[DBG_MAX]->destroy_function(this->loggers[DBG_MAX],
 											 (void*)free);
-	this->listeners->destroy_function(this->listeners, (void*)free);
+	this->listeners->destroy_function(this->listeners, (void*)entry_put);
+	listeners_put(this->current);
 	this->thread_sa->destroy(this->thread_sa);
 	this->log_lock->destroy(this->log_lock);
+	this->lock->destroy(this->lock);
 	this->mutex->destroy(this->mutex);
 	free(this);
 }
@@ -802,10 +1102,12 @@ bus_t *bus_create()
 			.child_rekey = _child_rekey,
 			.authorize = _authorize,
 			.narrow = _narrow,
+			.create_listener_enumerator = _create_listener_enumerator,
 			.destroy = _destroy,
 		},
 		.listeners = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.lock = spinlock_create(),
 		.log_lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.thread_sa = thread_value_create(NULL),
 	);
@@ -815,6 +1117,7 @@ bus_t *bus_create()
 		this->loggers[group] = linked_list_create();
 		this->max_level[group] = LEVEL_SILENT;
 	}
+	update_listeners(this);
 
 	return &this->public;
 }
@@ -131,7 +131,9 @@ struct bus_t {
 	 *
 	 * A registered listener receives all events which are sent to the bus.
 	 * The listener is passive; the thread which emitted the event
-	 * processes the listener routine.
+	 * processes the listener routine. Events are dispatched without holding
+	 * a bus wide lock, only hooks of the same listener are never called
+	 * concurrently.
 	 *
 	 * @param listener	listener to register.
 	 */
@@ -140,6 +142,9 @@ struct bus_t {
 	/**
 	 * Unregister a listener from the bus.
 	 *
+	 * If other threads currently call a hook of the listener, this call
+	 * blocks until they returned.
+	 *
 	 * @param listener	listener to unregister.
 	 */
 	void (*remove_listener) (bus_t *this, listener_t *listener);
@@ -343,6 +348,17 @@ struct bus_t {
 	 */
 	void (*child_rekey)(bus_t *this, child_sa_t *old, child_sa_t *new);
 
+	/**
+	 * Create an enumerator over registered listeners and their statistics.
+	 *
+	 * The enumerator returns the listener, the number of hook invocations,
+	 * the total time spent in its hooks in us (u_int64_t) and the longest
+	 * time spent in a single invocation in us.
+	 *
+	 * @return		enumerator over (listener_t*, u_int, u_int64_t, u_int)
+	 */
+	enumerator_t* (*create_listener_enumerator)(bus_t *this);
+
 	/**
 	 * Destroy the event bus.
 	 */
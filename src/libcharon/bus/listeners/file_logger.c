@@ -17,12 +17,92 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "file_logger.h"
 
 #include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <threading/thread.h>
+#include <threading/thread_value.h>
+#include <utils/linked_list.h>
+
+/**
+ * Interval in ms the writer thread flushes buffered messages in async mode
+ */
+#define FLUSH_INTERVAL 100
+
+/**
+ * Minimum size of the per-thread buffers in async mode
+ */
+#define MIN_BUFFER_SIZE 4096
 
 typedef struct private_file_logger_t private_file_logger_t;
+typedef struct buffer_t buffer_t;
+
+/**
+ * Per-thread state of a logger
+ */
+struct buffer_t {
+
+	/**
+	 * Logger this buffer belongs to
+	 */
+	private_file_logger_t *logger;
+
+	/**
+	 * Second the cached timestamp has been formatted for
+	 */
+	time_t time;
+
+	/**
+	 * Cached timestamp
+	 */
+	char timestr[128];
+
+	/**
+	 * Formatted log lines not yet written, async mode only
+	 */
+	char *buf;
+
+	/**
+	 * Size of buf
+	 */
+	size_t size;
+
+	/**
+	 * Number of bytes used in buf
+	 */
+	size_t used;
+
+	/**
+	 * Number of messages dropped since the last flush
+	 */
+	u_int dropped;
+
+	/**
+	 * Writer thread has been asked to flush this buffer
+	 */
+	bool notified;
+
+	/**
+	 * Thread owning this buffer terminated, destroy after the next flush
+	 */
+	bool orphaned;
+
+	/**
+	 * Lock for buf, only contended while the writer thread flushes it.
+	 * While the ref_get()/cas_bool() builtins would allow a lock-free ring
+	 * buffer, blocking on overflow requires a mutex for condvar anyway.
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Signaled by the writer thread after flushing the buffer
+	 */
+	condvar_t *condvar;
+};
 
 /**
  * Private data of a file_logger_t object
@@ -55,26 +135,311 @@ struct private_file_logger_t {
 	bool ike_name;
 
 	/**
-	 * Mutex to ensure multi-line log messages are not torn apart
+	 * Mutex to ensure multi-line log messages are not torn apart, in async
+	 * mode it protects the list of buffers and the writer state
 	 */
 	mutex_t *mutex;
+
+	/**
+	 * Per-thread buffer_t
+	 */
+	thread_value_t *buffers;
+
+	/**
+	 * All buffer_t objects currently allocated
+	 */
+	linked_list_t *list;
+
+	/**
+	 * Thread writing buffered messages in async mode, NULL if synchronous
+	 */
+	thread_t *writer;
+
+	/**
+	 * Signals the writer thread to flush buffers
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Flush requested before the interval elapsed
+	 */
+	bool flush;
+
+	/**
+	 * Writer thread should terminate after the next flush
+	 */
+	bool terminate;
+
+	/**
+	 * Size of the per-thread buffers
+	 */
+	size_t size;
+
+	/**
+	 * Drop messages if a buffer is full instead of blocking
+	 */
+	bool drop;
+
+	/**
+	 * Total number of dropped messages
+	 */
+	u_int dropped;
 };
 
-METHOD(logger_t, log_, void,
-	private_file_logger_t *this, debug_t group, level_t level, int thread,
-	ike_sa_t* ike_sa, const char *message)
+/**
+ * Destroy a buffer_t
+ */
+static void buffer_destroy(buffer_t *buffer)
+{
+	if (buffer->mutex)
+	{
+		buffer->mutex->destroy(buffer->mutex);
+		buffer->condvar->destroy(buffer->condvar);
+	}
+	free(buffer->buf);
+	free(buffer);
+}
+
+/**
+ * Called if a thread terminates, buffers still holding messages get destroyed
+ * by the writer thread
+ */
+static void buffer_cleanup(buffer_t *buffer)
+{
+	private_file_logger_t *this = buffer->logger;
+
+	this->mutex->lock(this->mutex);
+	if (this->writer)
+	{
+		buffer->mutex->lock(buffer->mutex);
+		buffer->orphaned = TRUE;
+		buffer->mutex->unlock(buffer->mutex);
+	}
+	else
+	{
+		this->list->remove(this->list, buffer, NULL);
+		buffer_destroy(buffer);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Get the buffer of the calling thread, create one if necessary
+ */
+static buffer_t *get_buffer(private_file_logger_t *this)
+{
+	buffer_t *buffer;
+
+	buffer = this->buffers->get(this->buffers);
+	if (!buffer)
+	{
+		INIT(buffer,
+			.logger = this,
+		);
+		this->mutex->lock(this->mutex);
+		if (this->writer)
+		{
+			buffer->size = this->size;
+			buffer->buf = malloc(buffer->size);
+			buffer->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+			buffer->condvar = condvar_create(CONDVAR_TYPE_DEFAULT);
+		}
+		this->list->insert_last(this->list, buffer);
+		this->mutex->unlock(this->mutex);
+		this->buffers->set(this->buffers, buffer);
+	}
+	return buffer;
+}
+
+/**
+ * Get the timestamp for the current second, formatted once per thread
+ */
+static char *get_timestr(private_file_logger_t *this, buffer_t *buffer)
 {
-	char timestr[128], namestr[128] = "";
-	const char *current = message, *next;
 	struct tm tm;
 	time_t t;
 
-	if (this->time_format)
+	t = time(NULL);
+	if (t != buffer->time)
 	{
-		t = time(NULL);
 		localtime_r(&t, &tm);
-		strftime(timestr, sizeof(timestr), this->time_format, &tm);
+		strftime(buffer->timestr, sizeof(buffer->timestr),
+				 this->time_format, &tm);
+		buffer->time = t;
 	}
+	return buffer->timestr;
+}
+
+/**
+ * Ask the writer thread to flush all buffers
+ */
+static void wakeup(private_file_logger_t *this)
+{
+	this->mutex->lock(this->mutex);
+	this->flush = TRUE;
+	this->condvar->signal(this->condvar);
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Reserve len bytes in the buffer, returns TRUE with the buffer locked if
+ * successful, FALSE if the message got dropped
+ */
+static bool reserve(private_file_logger_t *this, buffer_t *buffer, size_t len)
+{
+	buffer->mutex->lock(buffer->mutex);
+	while (buffer->size - buffer->used < len)
+	{
+		if (!buffer->used)
+		{	/* message does not fit into an empty buffer */
+			buffer->buf = realloc(buffer->buf, len);
+			buffer->size = len;
+			break;
+		}
+		if (this->drop)
+		{
+			buffer->dropped++;
+			buffer->mutex->unlock(buffer->mutex);
+			wakeup(this);
+			return FALSE;
+		}
+		/* the writer locks the buffers while holding its own mutex */
+		buffer->mutex->unlock(buffer->mutex);
+		wakeup(this);
+		buffer->mutex->lock(buffer->mutex);
+		if (buffer->size - buffer->used >= len)
+		{
+			break;
+		}
+		buffer->condvar->wait(buffer->condvar, buffer->mutex);
+	}
+	return TRUE;
+}
+
+/**
+ * Write all data to the file, bypassing stdio buffering
+ */
+static void write_all(private_file_logger_t *this, char *buf, size_t len)
+{
+	ssize_t written;
+	int fd;
+
+	fd = fileno(this->out);
+	while (len)
+	{
+		written = write(fd, buf, len);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		buf += written;
+		len -= written;
+	}
+}
+
+/**
+ * Writer thread, collects the buffers of all threads and writes them to the
+ * file with a single write() per flush
+ */
+static void *write_buffers(private_file_logger_t *this)
+{
+	enumerator_t *enumerator;
+	buffer_t *buffer;
+	char *out = NULL, timestr[128] = "";
+	size_t size = 0, len;
+	u_int dropped;
+	bool terminate = FALSE;
+	struct tm tm;
+	time_t t;
+	int pos;
+
+	this->mutex->lock(this->mutex);
+	while (!terminate)
+	{
+		if (!this->flush && !this->terminate)
+		{
+			this->condvar->timed_wait(this->condvar, this->mutex,
+									  FLUSH_INTERVAL);
+		}
+		terminate = this->terminate;
+		this->flush = FALSE;
+		len = dropped = 0;
+
+		enumerator = this->list->create_enumerator(this->list);
+		while (enumerator->enumerate(enumerator, &buffer))
+		{
+			buffer->mutex->lock(buffer->mutex);
+			if (len + buffer->used > size)
+			{
+				size = max(len + buffer->used, 2 * size);
+				out = realloc(out, size);
+			}
+			memcpy(out + len, buffer->buf, buffer->used);
+			len += buffer->used;
+			buffer->used = 0;
+			buffer->notified = FALSE;
+			dropped += buffer->dropped;
+			buffer->dropped = 0;
+			buffer->condvar->broadcast(buffer->condvar);
+			if (buffer->orphaned)
+			{
+				this->list->remove_at(this->list, enumerator);
+				buffer->mutex->unlock(buffer->mutex);
+				buffer_destroy(buffer);
+				continue;
+			}
+			buffer->mutex->unlock(buffer->mutex);
+		}
+		enumerator->destroy(enumerator);
+		this->dropped += dropped;
+		this->mutex->unlock(this->mutex);
+
+		if (dropped)
+		{
+			if (len + 256 > size)
+			{
+				size = len + 256;
+				out = realloc(out, size);
+			}
+			if (this->time_format)
+			{
+				t = time(NULL);
+				localtime_r(&t, &tm);
+				strftime(timestr, sizeof(timestr), this->time_format, &tm);
+				strcat(timestr, " ");
+			}
+			pos = snprintf(out + len, size - len, "%s%.2d[%N] dropped %u "
+						   "log messages, buffer full\n", timestr,
+						   thread_current_id(), debug_names, DBG_DMN, dropped);
+			if (pos > 0 && pos < size - len)
+			{
+				len += pos;
+			}
+		}
+		write_all(this, out, len);
+
+		this->mutex->lock(this->mutex);
+	}
+	this->mutex->unlock(this->mutex);
+	free(out);
+	return NULL;
+}
+
+METHOD(logger_t, log_, void,
+	private_file_logger_t *this, debug_t group, level_t level, int thread,
+	ike_sa_t* ike_sa, const char *message)
+{
+	char prefix[256], namestr[128] = "", *pos;
+	const char *current = message, *next;
+	size_t prefix_len, len = 0;
+	buffer_t *buffer;
+	bool notify;
+
+	buffer = get_buffer(this);
 	if (this->ike_name && ike_sa)
 	{
 		if (ike_sa->get_peer_cfg(ike_sa))
@@ -92,31 +457,91 @@ METHOD(logger_t, log_, void,
 	{
 		namestr[0] = '\0';
 	}
+	if (this->time_format)
+	{
+		snprintf(prefix, sizeof(prefix), "%s %.2d[%N]%s ",
+				 get_timestr(this, buffer), thread, debug_names, group,
+				 namestr);
+	}
+	else
+	{
+		snprintf(prefix, sizeof(prefix), "%.2d[%N]%s ",
+				 thread, debug_names, group, namestr);
+	}
+	prefix_len = strlen(prefix);
 
-	/* prepend a prefix in front of every line */
-	this->mutex->lock(this->mutex);
+	if (!this->writer)
+	{
+		/* prepend a prefix in front of every line */
+		this->mutex->lock(this->mutex);
+		while (TRUE)
+		{
+			next = strchr(current, '\n');
+			if (next == NULL)
+			{
+				fprintf(this->out, "%s%s\n", prefix, current);
+				break;
+			}
+			fprintf(this->out, "%s%.*s\n", prefix, (int)(next - current),
+					current);
+			current = next + 1;
+		}
+		this->mutex->unlock(this->mutex);
+		return;
+	}
+
+	/* the message is formatted without holding any shared lock */
+	while (TRUE)
+	{
+		next = strchr(current, '\n');
+		len += prefix_len + 1;
+		if (next == NULL)
+		{
+			len += strlen(current);
+			break;
+		}
+		len += next - current;
+		current = next + 1;
+	}
+	if (!reserve(this, buffer, len))
+	{
+		return;
+	}
+	pos = buffer->buf + buffer->used;
+	current = message;
 	while (TRUE)
 	{
 		next = strchr(current, '\n');
-		if (this->time_format)
+		memcpy(pos, prefix, prefix_len);
+		pos += prefix_len;
+		if (next == NULL)
 		{
-			fprintf(this->out, "%s %.2d[%N]%s ",
-					timestr, thread, debug_names, group, namestr);
+			len = strlen(current);
 		}
 		else
 		{
-			fprintf(this->out, "%.2d[%N]%s ",
-					thread, debug_names, group, namestr);
+			len = next - current;
 		}
+		memcpy(pos, current, len);
+		pos += len;
+		*pos++ = '\n';
 		if (next == NULL)
 		{
-			fprintf(this->out, "%s\n", current);
 			break;
 		}
-		fprintf(this->out, "%.*s\n", (int)(next - current), current);
 		current = next + 1;
 	}
-	this->mutex->unlock(this->mutex);
+	buffer->used = pos - buffer->buf;
+	notify = !buffer->notified && buffer->used > buffer->size / 2;
+	if (notify)
+	{
+		buffer->notified = TRUE;
+	}
+	buffer->mutex->unlock(buffer->mutex);
+	if (notify)
+	{
+		wakeup(this);
+	}
 }
 
 METHOD(logger_t, get_level, level_t,
@@ -141,9 +566,61 @@ METHOD(file_logger_t, set_level, void,
 	}
 }
 
+METHOD(file_logger_t, set_async, bool,
+	private_file_logger_t *this, size_t size, bool drop)
+{
+	this->mutex->lock(this->mutex);
+	if (this->writer || this->list->get_count(this->list))
+	{	/* buffers of threads that already logged are synchronous */
+		this->mutex->unlock(this->mutex);
+		return FALSE;
+	}
+	this->size = max(size, MIN_BUFFER_SIZE);
+	this->drop = drop;
+	fflush(this->out);
+	this->writer = thread_create((thread_main_t)write_buffers, this);
+	this->mutex->unlock(this->mutex);
+	return this->writer != NULL;
+}
+
+METHOD(file_logger_t, get_dropped, u_int,
+	private_file_logger_t *this)
+{
+	enumerator_t *enumerator;
+	buffer_t *buffer;
+	u_int dropped;
+
+	this->mutex->lock(this->mutex);
+	dropped = this->dropped;
+	if (this->writer)
+	{
+		enumerator = this->list->create_enumerator(this->list);
+		while (enumerator->enumerate(enumerator, &buffer))
+		{
+			buffer->mutex->lock(buffer->mutex);
+			dropped += buffer->dropped;
+			buffer->mutex->unlock(buffer->mutex);
+		}
+		enumerator->destroy(enumerator);
+	}
+	this->mutex->unlock(this->mutex);
+	return dropped;
+}
+
 METHOD(file_logger_t, destroy, void,
 	private_file_logger_t *this)
 {
+	if (this->writer)
+	{
+		this->mutex->lock(this->mutex);
+		this->terminate = TRUE;
+		this->condvar->signal(this->condvar);
+		this->mutex->unlock(this->mutex);
+		this->writer->join(this->writer);
+	}
+	this->buffers->destroy(this->buffers);
+	this->list->destroy_function(this->list, (void*)buffer_destroy);
+	this->condvar->destroy(this->condvar);
 	if (this->out != stdout && this->out != stderr)
 	{
 		fclose(this->out);
@@ -166,12 +643,17 @@ file_logger_t *file_logger_create(FILE *out, char *time_format, bool ike_name)
 				.get_level = _get_level,
 			},
 			.set_level = _set_level,
+			.set_async = _set_async,
+			.get_dropped = _get_dropped,
 			.destroy = _destroy,
 		},
 		.out = out,
 		.time_format = time_format,
 		.ike_name = ike_name,
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.buffers = thread_value_create((thread_cleanup_t)buffer_cleanup),
+		.list = linked_list_create(),
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
 	set_level(this, DBG_ANY, LEVEL_SILENT);
@@ -43,6 +43,28 @@ struct file_logger_t {
 	 */
 	void (*set_level) (file_logger_t *this, debug_t group, level_t level);
 
+	/**
+	 * Write log messages asynchronously.
+	 *
+	 * Messages get formatted into a buffer of the logging thread and are
+	 * written by a dedicated thread, periodically or whenever a buffer is
+	 * half full. Messages of different threads thus may not be in
+	 * chronological order. Must be called before the logger is registered.
+	 *
+	 * @param size		size of the per-thread buffers in bytes
+	 * @param drop		TRUE to drop messages if a buffer is full, FALSE to
+	 *					block the logging thread until it got written
+	 * @return			TRUE if writer thread started
+	 */
+	bool (*set_async) (file_logger_t *this, size_t size, bool drop);
+
+	/**
+	 * Get the number of messages dropped due to full buffers in async mode.
+	 *
+	 * @return			number of dropped messages
+	 */
+	u_int (*get_dropped) (file_logger_t *this);
+
 	/**
 	 * Destroys a file_logger_t object.
 	 */
@@ -19,7 +19,9 @@
 
 #include <daemon.h>
 #include <utils/linked_list.h>
+#include <utils/hashtable.h>
 #include <threading/rwlock.h>
+#include <threading/mutex.h>
 
 
 typedef struct private_backend_manager_t private_backend_manager_t;
@@ -35,7 +37,7 @@ struct private_backend_manager_t {
 	backend_manager_t public;
 
 	/**
-	 * list of registered backends
+	 * list of registered backends, as backend_entry_t
 	 */
 	linked_list_t *backends;
 
@@ -43,8 +45,74 @@ struct private_backend_manager_t {
 	 * rwlock for backends
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * mutex to build and invalidate config indices
+	 */
+	mutex_t *mutex;
 };
 
+/**
+ * Config of an index, with its position in the enumeration of the backend
+ */
+typedef struct {
+	/** ike_cfg_t or peer_cfg_t */
+	void *cfg;
+	/** position in backend */
+	u_int pos;
+} index_entry_t;
+
+/**
+ * Index entries sharing the same key
+ */
+typedef struct {
+	/** host_t or identification_t */
+	void *key;
+	/** index_entry_t, ordered by position */
+	linked_list_t *entries;
+} index_bucket_t;
+
+/**
+ * Index of the configs of a backend.
+ *
+ * Configs are indexed by the remote address of their ike_cfg, if it is a
+ * literal IP address, and by the first remote identity, if it does not
+ * contain wildcards. All other configs are kept in lists of configs matching
+ * any address or identity, respectively.
+ */
+typedef struct {
+	/** ike_cfg_t entries, by remote address */
+	hashtable_t *ike_addrs;
+	/** ike_cfg_t entries not indexed by address */
+	linked_list_t *ike_any;
+	/** all ike_cfg_t entries */
+	linked_list_t *ike_all;
+	/** peer_cfg_t entries, by remote address */
+	hashtable_t *peer_addrs;
+	/** peer_cfg_t entries not indexed by address */
+	linked_list_t *peer_any_addr;
+	/** peer_cfg_t entries, by remote identity */
+	hashtable_t *peer_ids;
+	/** peer_cfg_t entries not indexed by identity */
+	linked_list_t *peer_any_id;
+	/** all peer_cfg_t entries */
+	linked_list_t *peer_all;
+	/** reference count */
+	refcount_t refs;
+} config_index_t;
+
+/**
+ * Registered backend
+ */
+typedef struct {
+	/** backend */
+	backend_t *backend;
+	/** TRUE if the backend reports changes of its configs */
+	bool indexed;
+	/** index of the configs of an indexed backend, NULL if outdated */
+	config_index_t *index;
+} backend_entry_t;
+
 /**
  * match of an ike_cfg
  */
@@ -55,6 +123,383 @@ typedef enum ike_cfg_match_t {
 	MATCH_OTHER = 0x08,
 } ike_cfg_match_t;
 
+/**
+ * Hash a host address
+ */
+static u_int host_hash(host_t *host)
+{
+	return chunk_hash(host->get_address(host));
+}
+
+/**
+ * Compare two host addresses
+ */
+static bool host_equals(host_t *a, host_t *b)
+{
+	return a->ip_equals(a, b);
+}
+
+/**
+ * Destroy a host used as index key
+ */
+static void destroy_host(host_t *host)
+{
+	host->destroy(host);
+}
+
+/**
+ * Hash an identity
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Compare two identities
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Destroy an identity used as index key
+ */
+static void destroy_id(identification_t *id)
+{
+	id->destroy(id);
+}
+
+/**
+ * Add an entry to the bucket of a key, takes ownership of key
+ */
+static void bucket_add(hashtable_t *table, void *key, index_entry_t *entry,
+					   void (*destroy)(void*))
+{
+	index_bucket_t *bucket;
+
+	bucket = table->get(table, key);
+	if (bucket)
+	{
+		destroy(key);
+	}
+	else
+	{
+		INIT(bucket,
+			.key = key,
+			.entries = linked_list_create(),
+		);
+		table->put(table, key, bucket);
+	}
+	bucket->entries->insert_last(bucket->entries, entry);
+}
+
+/**
+ * Get the entries of a key, NULL if none
+ */
+static linked_list_t *bucket_get(hashtable_t *table, void *key)
+{
+	index_bucket_t *bucket;
+
+	bucket = table->get(table, key);
+	return bucket ? bucket->entries : NULL;
+}
+
+/**
+ * Destroy all buckets of a table
+ */
+static void buckets_destroy(hashtable_t *table, void (*destroy)(void*))
+{
+	enumerator_t *enumerator;
+	index_bucket_t *bucket;
+	void *key;
+
+	enumerator = table->create_enumerator(table);
+	while (enumerator->enumerate(enumerator, &key, &bucket))
+	{
+		bucket->entries->destroy(bucket->entries);
+		destroy(bucket->key);
+		free(bucket);
+	}
+	enumerator->destroy(enumerator);
+	table->destroy(table);
+}
+
+/**
+ * Get the remote address of an ike_cfg, if it can be indexed
+ */
+static host_t *get_index_addr(ike_cfg_t *ike_cfg)
+{
+	host_t *host;
+	bool allow_any;
+	char *addr;
+
+	addr = ike_cfg->get_other_addr(ike_cfg, &allow_any);
+	if (allow_any)
+	{
+		return NULL;
+	}
+	/* DNS names might resolve differently later, use the any list */
+	host = host_create_from_string(addr, 0);
+	if (host && host->is_anyaddr(host))
+	{
+		host->destroy(host);
+		return NULL;
+	}
+	return host;
+}
+
+/**
+ * Get the remote identity of a peer_cfg, if it can be indexed
+ */
+static identification_t *get_index_id(peer_cfg_t *peer_cfg)
+{
+	identification_t *id = NULL;
+	enumerator_t *enumerator;
+	auth_cfg_t *auth;
+
+	/* compare first auth config only, as in get_peer_match() */
+	enumerator = peer_cfg->create_auth_cfg_enumerator(peer_cfg, FALSE);
+	if (enumerator->enumerate(enumerator, &auth))
+	{
+		id = auth->get(auth, AUTH_RULE_IDENTITY);
+		if (id && !id->contains_wildcards(id))
+		{
+			id = id->clone(id);
+		}
+		else
+		{
+			id = NULL;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return id;
+}
+
+/**
+ * Build the index of a backend
+ */
+static config_index_t *index_create(backend_t *backend)
+{
+	config_index_t *index;
+	enumerator_t *enumerator;
+	index_entry_t *entry;
+	identification_t *id;
+	ike_cfg_t *ike_cfg;
+	peer_cfg_t *peer_cfg;
+	host_t *host;
+	u_int pos = 0;
+
+	INIT(index,
+		.ike_addrs = hashtable_create((hashtable_hash_t)host_hash,
+									  (hashtable_equals_t)host_equals, 32),
+		.ike_any = linked_list_create(),
+		.ike_all = linked_list_create(),
+		.peer_addrs = hashtable_create((hashtable_hash_t)host_hash,
+									   (hashtable_equals_t)host_equals, 32),
+		.peer_any_addr = linked_list_create(),
+		.peer_ids = hashtable_create((hashtable_hash_t)id_hash,
+									 (hashtable_equals_t)id_equals, 32),
+		.peer_any_id = linked_list_create(),
+		.peer_all = linked_list_create(),
+		.refs = 1,
+	);
+
+	enumerator = backend->create_ike_cfg_enumerator(backend, NULL, NULL);
+	while (enumerator->enumerate(enumerator, &ike_cfg))
+	{
+		INIT(entry,
+			.cfg = ike_cfg->get_ref(ike_cfg),
+			.pos = pos++,
+		);
+		index->ike_all->insert_last(index->ike_all, entry);
+		host = get_index_addr(ike_cfg);
+		if (host)
+		{
+			bucket_add(index->ike_addrs, host, entry, (void*)destroy_host);
+		}
+		else
+		{
+			index->ike_any->insert_last(index->ike_any, entry);
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	pos = 0;
+	enumerator = backend->create_peer_cfg_enumerator(backend, NULL, NULL);
+	while (enumerator->enumerate(enumerator, &peer_cfg))
+	{
+		INIT(entry,
+			.cfg = peer_cfg->get_ref(peer_cfg),
+			.pos = pos++,
+		);
+		index->peer_all->insert_last(index->peer_all, entry);
+		host = get_index_addr(peer_cfg->get_ike_cfg(peer_cfg));
+		if (host)
+		{
+			bucket_add(index->peer_addrs, host, entry, (void*)destroy_host);
+		}
+		else
+		{
+			index->peer_any_addr->insert_last(index->peer_any_addr, entry);
+		}
+		id = get_index_id(peer_cfg);
+		if (id)
+		{
+			bucket_add(index->peer_ids, id, entry, (void*)destroy_id);
+		}
+		else
+		{
+			index->peer_any_id->insert_last(index->peer_any_id, entry);
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	DBG2(DBG_CFG, "indexed %d ike and %d peer configs",
+		 index->ike_all->get_count(index->ike_all),
+		 index->peer_all->get_count(index->peer_all));
+	return index;
+}
+
+/**
+ * Release a reference to an index
+ */
+static void index_release(config_index_t *index)
+{
+	index_entry_t *entry;
+
+	if (ref_put(&index->refs))
+	{
+		buckets_destroy(index->ike_addrs, (void*)destroy_host);
+		buckets_destroy(index->peer_addrs, (void*)destroy_host);
+		buckets_destroy(index->peer_ids, (void*)destroy_id);
+		index->ike_any->destroy(index->ike_any);
+		index->peer_any_addr->destroy(index->peer_any_addr);
+		index->peer_any_id->destroy(index->peer_any_id);
+		while (index->ike_all->remove_last(index->ike_all,
+										   (void**)&entry) == SUCCESS)
+		{
+			((ike_cfg_t*)entry->cfg)->destroy(entry->cfg);
+			free(entry);
+		}
+		index->ike_all->destroy(index->ike_all);
+		while (index->peer_all->remove_last(index->peer_all,
+											(void**)&entry) == SUCCESS)
+		{
+			((peer_cfg_t*)entry->cfg)->destroy(entry->cfg);
+			free(entry);
+		}
+		index->peer_all->destroy(index->peer_all);
+		free(index);
+	}
+}
+
+/**
+ * Get the (possibly rebuilt) index of an indexed backend, NULL if not indexed
+ */
+static config_index_t *index_get(private_backend_manager_t *this,
+								 backend_entry_t *entry)
+{
+	config_index_t *index = NULL;
+
+	this->mutex->lock(this->mutex);
+	if (entry->indexed)
+	{
+		if (!entry->index)
+		{
+			entry->index = index_create(entry->backend);
+		}
+		index = entry->index;
+		ref_get(&index->refs);
+	}
+	this->mutex->unlock(this->mutex);
+	return index;
+}
+
+/**
+ * Get candidate configs of an index from a bucket and a list of configs
+ * matching any key, in the order of the backend
+ */
+static linked_list_t *get_candidates(linked_list_t *bucket,
+									 linked_list_t *any)
+{
+	enumerator_t *a, *b;
+	index_entry_t *ea = NULL, *eb = NULL;
+	linked_list_t *candidates;
+	bool more_a, more_b;
+
+	candidates = linked_list_create();
+	if (!bucket)
+	{
+		bucket = candidates;
+	}
+	a = bucket->create_enumerator(bucket);
+	b = any->create_enumerator(any);
+	more_a = a->enumerate(a, &ea);
+	more_b = b->enumerate(b, &eb);
+	while (more_a || more_b)
+	{
+		if (more_a && (!more_b || ea->pos < eb->pos))
+		{
+			candidates->insert_last(candidates, ea->cfg);
+			more_a = a->enumerate(a, &ea);
+		}
+		else
+		{
+			candidates->insert_last(candidates, eb->cfg);
+			more_b = b->enumerate(b, &eb);
+		}
+	}
+	a->destroy(a);
+	b->destroy(b);
+	return candidates;
+}
+
+/**
+ * Get the number of candidates get_candidates() would return
+ */
+static int count_candidates(linked_list_t *bucket, linked_list_t *any)
+{
+	return (bucket ? bucket->get_count(bucket) : 0) + any->get_count(any);
+}
+
+/**
+ * Candidate configs enumerated from an index
+ */
+typedef struct {
+	/** candidate configs */
+	linked_list_t *list;
+	/** index holding references to the configs */
+	config_index_t *index;
+} candidates_t;
+
+/**
+ * Clean up candidates after enumeration
+ */
+static void candidates_destroy(candidates_t *candidates)
+{
+	candidates->list->destroy(candidates->list);
+	index_release(candidates->index);
+	free(candidates);
+}
+
+/**
+ * Enumerate candidate configs, releases the index when done
+ */
+static enumerator_t *create_candidate_enumerator(linked_list_t *list,
+												 config_index_t *index)
+{
+	candidates_t *candidates;
+
+	INIT(candidates,
+		.list = list,
+		.index = index,
+	);
+	return enumerator_create_cleaner(list->create_enumerator(list),
+									 (void*)candidates_destroy, candidates);
+}
+
 /**
  * data to pass nested IKE enumerator
  */
@@ -67,9 +512,27 @@ typedef struct {
 /**
  * inner enumerator constructor for IKE cfgs
  */
-static enumerator_t *ike_enum_create(backend_t *backend, ike_data_t *data)
+static enumerator_t *ike_enum_create(backend_entry_t *entry, ike_data_t *data)
 {
-	return backend->create_ike_cfg_enumerator(backend, data->me, data->other);
+	config_index_t *index;
+	linked_list_t *list;
+
+	index = index_get(data->this, entry);
+	if (!index)
+	{
+		return entry->backend->create_ike_cfg_enumerator(entry->backend,
+														 data->me, data->other);
+	}
+	if (data->other)
+	{
+		list = get_candidates(bucket_get(index->ike_addrs, data->other),
+							  index->ike_any);
+	}
+	else
+	{
+		list = get_candidates(NULL, index->ike_all);
+	}
+	return create_candidate_enumerator(list, index);
 }
 
 /**
@@ -262,7 +725,9 @@ static int get_version_match(ike_version_t cfg, ike_version_t req)
  * data to pass nested peer enumerator
  */
 typedef struct {
+	private_backend_manager_t *this;
 	rwlock_t *lock;
+	host_t *other_host;
 	identification_t *me;
 	identification_t *other;
 } peer_data_t;
@@ -279,9 +744,41 @@ typedef struct {
 /**
  * inner enumerator constructor for peer cfgs
  */
-static enumerator_t *peer_enum_create(backend_t *backend, peer_data_t *data)
+static enumerator_t *peer_enum_create(backend_entry_t *entry,
+									  peer_data_t *data)
 {
-	return backend->create_peer_cfg_enumerator(backend, data->me, data->other);
+	config_index_t *index;
+	linked_list_t *addrs = NULL, *ids = NULL, *list;
+
+	index = index_get(data->this, entry);
+	if (!index)
+	{
+		return entry->backend->create_peer_cfg_enumerator(entry->backend,
+														  data->me, data->other);
+	}
+	if (data->other_host)
+	{
+		addrs = bucket_get(index->peer_addrs, data->other_host);
+	}
+	if (data->other && !data->other->contains_wildcards(data->other))
+	{
+		ids = bucket_get(index->peer_ids, data->other);
+	}
+	/* use the smaller of both candidate sets */
+	if (data->other_host && (!ids || count_candidates(addrs,
+			index->peer_any_addr) <= count_candidates(ids, index->peer_any_id)))
+	{
+		list = get_candidates(addrs, index->peer_any_addr);
+	}
+	else if (ids)
+	{
+		list = get_candidates(ids, index->peer_any_id);
+	}
+	else
+	{
+		list = get_candidates(NULL, index->peer_all);
+	}
+	return create_candidate_enumerator(list, index);
 }
 
 /**
@@ -359,7 +856,9 @@ METHOD(backend_manager_t, create_peer_cfg_enumerator, enumerator_t*,
 	linked_list_t *configs, *helper;
 
 	INIT(data,
+		.this = this,
 		.lock = this->lock,
+		.other_host = other,
 		.me = my_id,
 		.other = other_id,
 	);
@@ -416,41 +915,98 @@ METHOD(backend_manager_t, create_peer_cfg_enumerator, enumerator_t*,
 METHOD(backend_manager_t, get_peer_cfg_by_name, peer_cfg_t*,
 	private_backend_manager_t *this, char *name)
 {
-	backend_t *backend;
+	backend_entry_t *entry;
 	peer_cfg_t *config = NULL;
 	enumerator_t *enumerator;
 
 	this->lock->read_lock(this->lock);
 	enumerator = this->backends->create_enumerator(this->backends);
-	while (config == NULL && enumerator->enumerate(enumerator, (void**)&backend))
+	while (config == NULL && enumerator->enumerate(enumerator, (void**)&entry))
 	{
-		config = backend->get_peer_cfg_by_name(backend, name);
+		config = entry->backend->get_peer_cfg_by_name(entry->backend, name);
 	}
 	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 	return config;
 }
 
+/**
+ * Destroy a backend entry
+ */
+static void entry_destroy(backend_entry_t *entry)
+{
+	if (entry->index)
+	{
+		index_release(entry->index);
+	}
+	free(entry);
+}
+
 METHOD(backend_manager_t, remove_backend, void,
 	private_backend_manager_t *this, backend_t *backend)
 {
+	enumerator_t *enumerator;
+	backend_entry_t *entry;
+
 	this->lock->write_lock(this->lock);
-	this->backends->remove(this->backends, backend, NULL);
+	enumerator = this->backends->create_enumerator(this->backends);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		if (entry->backend == backend)
+		{
+			this->backends->remove_at(this->backends, enumerator);
+			entry_destroy(entry);
+		}
+	}
+	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 }
 
 METHOD(backend_manager_t, add_backend, void,
 	private_backend_manager_t *this, backend_t *backend)
 {
+	backend_entry_t *entry;
+
+	INIT(entry,
+		.backend = backend,
+	);
 	this->lock->write_lock(this->lock);
-	this->backends->insert_last(this->backends, backend);
+	this->backends->insert_last(this->backends, entry);
+	this->lock->unlock(this->lock);
+}
+
+METHOD(backend_manager_t, changed, void,
+	private_backend_manager_t *this, backend_t *backend)
+{
+	enumerator_t *enumerator;
+	backend_entry_t *entry;
+
+	this->lock->read_lock(this->lock);
+	enumerator = this->backends->create_enumerator(this->backends);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		if (entry->backend == backend)
+		{
+			this->mutex->lock(this->mutex);
+			/* drop the index immediately to release removed configs */
+			entry->indexed = TRUE;
+			if (entry->index)
+			{
+				index_release(entry->index);
+				entry->index = NULL;
+			}
+			this->mutex->unlock(this->mutex);
+		}
+	}
+	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 }
 
 METHOD(backend_manager_t, destroy, void,
 	private_backend_manager_t *this)
 {
-	this->backends->destroy(this->backends);
+	this->backends->destroy_function(this->backends, (void*)entry_destroy);
+	this->mutex->destroy(this->mutex);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -470,10 +1026,12 @@ backend_manager_t *backend_manager_create()
 			.create_peer_cfg_enumerator = _create_peer_cfg_enumerator,
 			.add_backend = _add_backend,
 			.remove_backend = _remove_backend,
+			.changed = _changed,
 			.destroy = _destroy,
 		},
 		.backends = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 	);
 
 	return &this->public;
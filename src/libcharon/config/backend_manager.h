@@ -100,6 +100,18 @@ struct backend_manager_t {
 	 */
 	void (*remove_backend)(backend_manager_t *this, backend_t *backend);
 
+	/**
+	 * Notify the manager that the set of configs of a backend changed.
+	 *
+	 * Backends calling this method get their configs indexed by remote
+	 * address and identity, which avoids a linear search on each lookup.
+	 * Such a backend must call this method whenever it adds or removes
+	 * configs, but not while holding a lock it acquires in its enumerators.
+	 *
+	 * @param backend			backend that changed
+	 */
+	void (*changed)(backend_manager_t *this, backend_t *backend);
+
 	/**
 	 * Destroys a backend_manager_t object.
 	 */
@@ -26,6 +26,7 @@
 #include <library.h>
 #include <plugins/plugin_feature.h>
 #include <config/proposal.h>
+#include <encoding/generator.h>
 #include <kernel/kernel_handler.h>
 #include <processing/jobs/start_action_job.h>
 
@@ -251,6 +252,7 @@ void libcharon_deinit()
 {
 	destroy((private_daemon_t*)charon);
 	charon = NULL;
+	generator_deinit();
 }
 
 /**
@@ -259,6 +261,7 @@ void libcharon_deinit()
 bool libcharon_init(const char *name)
 {
 	daemon_create(name);
+	generator_init();
 
 	/* for uncritical pseudo random numbers */
 	srandom(time(NULL) + getpid());
@@ -25,6 +25,7 @@
 #include <library.h>
 #include <daemon.h>
 #include <utils/linked_list.h>
+#include <threading/thread_value.h>
 #include <encoding/payloads/payload.h>
 #include <encoding/payloads/proposal_substructure.h>
 #include <encoding/payloads/transform_substructure.h>
@@ -48,14 +49,42 @@
  * Generating is done in a data buffer.
  * This is the start size of this buffer in bytes.
  */
-#define GENERATOR_DATA_BUFFER_SIZE 500
+#define GENERATOR_DATA_BUFFER_SIZE 512
 
 /**
- * Number of bytes to increase the buffer, if it is too small.
+ * Number of buffers cached per thread, a message and its encryption payload
+ * get generated with nested generators.
  */
-#define GENERATOR_DATA_BUFFER_INCREASE_VALUE 500
+#define GENERATOR_CACHED_BUFFERS 2
+
+/**
+ * Maximum size of a buffer to keep in the cache.
+ */
+#define GENERATOR_CACHED_BUFFER_MAX 65536
 
 typedef struct private_generator_t private_generator_t;
+typedef struct buffer_cache_t buffer_cache_t;
+
+/**
+ * Buffers of destroyed generators, reused by the same thread.
+ */
+struct buffer_cache_t {
+
+	/**
+	 * Cached buffers.
+	 */
+	chunk_t buffers[GENERATOR_CACHED_BUFFERS];
+
+	/**
+	 * Number of cached buffers.
+	 */
+	int count;
+};
+
+/**
+ * Thread-local buffer_cache_t, NULL if not initialized.
+ */
+static thread_value_t *cache = NULL;
 
 /**
  * Private part of a generator_t object.
@@ -153,24 +182,29 @@ static u_int32_t get_offset(private_generator_t *this)
  */
 static void make_space_available(private_generator_t *this, int bits)
 {
-	while ((get_space(this) * 8 - this->current_bit) < bits)
-	{
-		int old_buffer_size, new_buffer_size, out_position_offset;
-
-		old_buffer_size = get_size(this);
-		new_buffer_size = old_buffer_size + GENERATOR_DATA_BUFFER_INCREASE_VALUE;
-		out_position_offset = this->out_position - this->buffer;
+	int old_buffer_size, new_buffer_size, out_position_offset;
 
-		if (this->debug)
-		{
-			DBG2(DBG_ENC, "increasing gen buffer from %d to %d byte",
-				 old_buffer_size, new_buffer_size);
-		}
+	if ((get_space(this) * 8 - this->current_bit) >= bits)
+	{
+		return;
+	}
+	old_buffer_size = new_buffer_size = get_size(this);
+	out_position_offset = this->out_position - this->buffer;
+	while (((new_buffer_size - out_position_offset) * 8 -
+			this->current_bit) < bits)
+	{
+		new_buffer_size *= 2;
+	}
 
-		this->buffer = realloc(this->buffer,new_buffer_size);
-		this->out_position = (this->buffer + out_position_offset);
-		this->roof_position = (this->buffer + new_buffer_size);
+	if (this->debug)
+	{
+		DBG2(DBG_ENC, "increasing gen buffer from %d to %d byte",
+			 old_buffer_size, new_buffer_size);
 	}
+
+	this->buffer = realloc(this->buffer, new_buffer_size);
+	this->out_position = (this->buffer + out_position_offset);
+	this->roof_position = (this->buffer + new_buffer_size);
 }
 
 /**
@@ -451,6 +485,8 @@ METHOD(generator_t, generate_payload, void,
 	this->data_struct = payload;
 	payload_type = payload->get_type(payload);
 
+	/* grow the buffer once for the whole payload, if necessary */
+	make_space_available(this, payload->get_length(payload) * 8);
 	offset_start = this->out_position - this->buffer;
 
 	if (this->debug)
@@ -573,16 +609,63 @@ METHOD(generator_t, generate_payload, void,
 METHOD(generator_t, destroy, void,
 	private_generator_t *this)
 {
-	free(this->buffer);
+	buffer_cache_t *buffers = NULL;
+
+	if (cache && get_size(this) <= GENERATOR_CACHED_BUFFER_MAX)
+	{
+		buffers = cache->get(cache);
+		if (!buffers)
+		{
+			INIT(buffers);
+			cache->set(cache, buffers);
+		}
+	}
+	if (buffers && buffers->count < GENERATOR_CACHED_BUFFERS)
+	{	/* the buffer might contain plaintext of encrypted payloads */
+		memwipe(this->buffer, get_length(this));
+		buffers->buffers[buffers->count++] = chunk_create(this->buffer,
+														   get_size(this));
+	}
+	else
+	{
+		free(this->buffer);
+	}
 	free(this);
 }
 
+/**
+ * Destroy a buffer_cache_t
+ */
+static void cache_destroy(buffer_cache_t *buffers)
+{
+	while (buffers->count)
+	{
+		free(buffers->buffers[--buffers->count].ptr);
+	}
+	free(buffers);
+}
+
 /*
  * Described in header
  */
 generator_t *generator_create()
 {
 	private_generator_t *this;
+	buffer_cache_t *buffers = NULL;
+	chunk_t buffer;
+
+	if (cache)
+	{
+		buffers = cache->get(cache);
+	}
+	if (buffers && buffers->count)
+	{
+		buffer = buffers->buffers[--buffers->count];
+	}
+	else
+	{
+		buffer = chunk_alloc(GENERATOR_DATA_BUFFER_SIZE);
+	}
 
 	INIT(this,
 		.public = {
@@ -590,12 +673,12 @@ generator_t *generator_create()
 			.generate_payload = _generate_payload,
 			.destroy = _destroy,
 		},
-		.buffer = malloc(GENERATOR_DATA_BUFFER_SIZE),
+		.buffer = buffer.ptr,
 		.debug = TRUE,
 	);
 
 	this->out_position = this->buffer;
-	this->roof_position = this->buffer + GENERATOR_DATA_BUFFER_SIZE;
+	this->roof_position = this->buffer + buffer.len;
 
 	return &this->public;
 }
@@ -611,3 +694,20 @@ generator_t *generator_create_no_dbg()
 
 	return &this->public;
 }
+
+/*
+ * Described in header
+ */
+void generator_init()
+{
+	cache = thread_value_create((thread_cleanup_t)cache_destroy);
+}
+
+/*
+ * Described in header
+ */
+void generator_deinit()
+{
+	DESTROY_IF(cache);
+	cache = NULL;
+}
@@ -79,5 +79,18 @@ generator_t *generator_create(void);
  */
 generator_t *generator_create_no_dbg(void);
 
+/**
+ * Initialize the cache that lets generators reuse the buffers of previously
+ * destroyed generators of the same thread.
+ *
+ * Without calling this function, each generator allocates its own buffer.
+ */
+void generator_init();
+
+/**
+ * Release the buffers cached by generator_init().
+ */
+void generator_deinit();
+
 
 #endif /** GENERATOR_H_ @}*/
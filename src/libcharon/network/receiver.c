@@ -69,6 +69,11 @@ struct private_receiver_t {
 	 */
 	mutex_t *esp_cb_mutex;
 
+	/**
+	 * Mutex for cookie secrets and hasher, shared by all receiver threads
+	 */
+	mutex_t *cookie_mutex;
+
 	/**
 	 * current secret to use for cookie calculation
 	 */
@@ -315,6 +320,47 @@ static bool cookie_required(private_receiver_t *this,
 	return FALSE;
 }
 
+/**
+ * Send a COOKIE notify in response to an IKE_SA_INIT, cookie_mutex is held
+ */
+static void send_cookie(private_receiver_t *this, message_t *message,
+						u_int32_t now)
+{
+	chunk_t cookie;
+
+	DBG2(DBG_NET, "received packet from: %#H to %#H",
+		 message->get_source(message),
+		 message->get_destination(message));
+	if (!cookie_build(this, message, now - this->secret_offset,
+					  chunk_from_thing(this->secret), &cookie))
+	{
+		return;
+	}
+	DBG2(DBG_NET, "sending COOKIE notify to %H",
+		 message->get_source(message));
+	send_notify(message, IKEV2_MAJOR_VERSION, IKE_SA_INIT, COOKIE, cookie);
+	chunk_free(&cookie);
+	if (++this->secret_used > COOKIE_REUSE)
+	{
+		char secret[SECRET_LENGTH];
+
+		DBG1(DBG_NET, "generating new cookie secret after %d uses",
+			 this->secret_used);
+		if (this->rng->get_bytes(this->rng, SECRET_LENGTH, secret))
+		{
+			memcpy(this->secret_old, this->secret, SECRET_LENGTH);
+			memcpy(this->secret, secret, SECRET_LENGTH);
+			memwipe(secret, SECRET_LENGTH);
+			this->secret_switch = now;
+			this->secret_used = 0;
+		}
+		else
+		{
+			DBG1(DBG_NET, "failed to allocated cookie secret, keeping old");
+		}
+	}
+}
+
 /**
  * Check if we should drop IKE_SA_INIT because of cookie/overload checking
  */
@@ -328,43 +374,22 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 										charon->ike_sa_manager, NULL);
 
 	/* check for cookies in IKEv2 */
-	if (message->get_major_version(message) == IKEV2_MAJOR_VERSION &&
-		cookie_required(this, half_open, now) && !check_cookie(this, message))
+	if (message->get_major_version(message) == IKEV2_MAJOR_VERSION)
 	{
-		chunk_t cookie;
+		bool drop;
 
-		DBG2(DBG_NET, "received packet from: %#H to %#H",
-			 message->get_source(message),
-			 message->get_destination(message));
-		if (!cookie_build(this, message, now - this->secret_offset,
-						  chunk_from_thing(this->secret), &cookie))
+		this->cookie_mutex->lock(this->cookie_mutex);
+		drop = cookie_required(this, half_open, now) &&
+			   !check_cookie(this, message);
+		if (drop)
 		{
-			return TRUE;
+			send_cookie(this, message, now);
 		}
-		DBG2(DBG_NET, "sending COOKIE notify to %H",
-			 message->get_source(message));
-		send_notify(message, IKEV2_MAJOR_VERSION, IKE_SA_INIT, COOKIE, cookie);
-		chunk_free(&cookie);
-		if (++this->secret_used > COOKIE_REUSE)
+		this->cookie_mutex->unlock(this->cookie_mutex);
+		if (drop)
 		{
-			char secret[SECRET_LENGTH];
-
-			DBG1(DBG_NET, "generating new cookie secret after %d uses",
-				 this->secret_used);
-			if (this->rng->get_bytes(this->rng, SECRET_LENGTH, secret))
-			{
-				memcpy(this->secret_old, this->secret, SECRET_LENGTH);
-				memcpy(this->secret, secret, SECRET_LENGTH);
-				memwipe(secret, SECRET_LENGTH);
-				this->secret_switch = now;
-				this->secret_used = 0;
-			}
-			else
-			{
-				DBG1(DBG_NET, "failed to allocated cookie secret, keeping old");
-			}
+			return TRUE;
 		}
-		return TRUE;
 	}
 
 	/* check if peer has too many IKE_SAs half open */
@@ -607,6 +632,7 @@ METHOD(receiver_t, destroy, void,
 	this->rng->destroy(this->rng);
 	this->hasher->destroy(this->hasher);
 	this->esp_cb_mutex->destroy(this->esp_cb_mutex);
+	this->cookie_mutex->destroy(this->cookie_mutex);
 	free(this);
 }
 
@@ -617,6 +643,7 @@ receiver_t *receiver_create()
 {
 	private_receiver_t *this;
 	u_int32_t now = time_monotonic(NULL);
+	int threads, i;
 
 	INIT(this,
 		.public = {
@@ -625,6 +652,7 @@ receiver_t *receiver_create()
 			.destroy = _destroy,
 		},
 		.esp_cb_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.cookie_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.secret_switch = now,
 		.secret_offset = random() % now,
 	);
@@ -673,9 +701,16 @@ receiver_t *receiver_create()
 	}
 	memcpy(this->secret_old, this->secret, SECRET_LENGTH);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create_with_prio((callback_job_cb_t)receive_packets,
-			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	/* the socket implementation may provide a socket per receiver thread */
+	threads = max(1, lib->settings->get_int(lib->settings,
+				"%s.receiver_threads", 1, charon->name));
+	for (i = 0; i < threads; i++)
+	{
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+				(callback_job_cb_t)receive_packets, this, NULL,
+				(callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	}
 
 	return &this->public;
 }
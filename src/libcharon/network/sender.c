@@ -28,16 +28,16 @@
 #include <threading/mutex.h>
 
 
+/** Maximum number of packets passed to the socket at once */
+#define SEND_BATCH 16
+
 typedef struct private_sender_t private_sender_t;
+typedef struct send_queue_t send_queue_t;
 
 /**
- * Private data of a sender_t object.
+ * Queue of packets, drained by a single sender thread
  */
-struct private_sender_t {
-	/**
-	 * Public part of a sender_t object.
-	 */
-	sender_t public;
+struct send_queue_t {
 
 	/**
 	 * The packets are stored in a linked list
@@ -59,6 +59,41 @@ struct private_sender_t {
 	 */
 	condvar_t *sent;
 
+	/**
+	 * Maximum number of packets queued
+	 */
+	u_int peak;
+
+	/**
+	 * Number of batches passed to the socket
+	 */
+	u_int batches;
+
+	/**
+	 * Number of packets passed to the socket
+	 */
+	u_int packets;
+};
+
+/**
+ * Private data of a sender_t object.
+ */
+struct private_sender_t {
+	/**
+	 * Public part of a sender_t object.
+	 */
+	sender_t public;
+
+	/**
+	 * Send queues, packets to the same destination use the same queue
+	 */
+	send_queue_t *queues;
+
+	/**
+	 * Number of send queues/threads
+	 */
+	int count;
+
 	/**
 	 * Delay for sending outgoing packets, to simulate larger RTT
 	 */
@@ -83,10 +118,22 @@ struct private_sender_t {
 METHOD(sender_t, send_no_marker, void,
 	private_sender_t *this, packet_t *packet)
 {
-	this->mutex->lock(this->mutex);
-	this->list->insert_last(this->list, packet);
-	this->got->signal(this->got);
-	this->mutex->unlock(this->mutex);
+	send_queue_t *queue = this->queues;
+	host_t *dst;
+	u_int count;
+
+	if (this->count > 1)
+	{
+		dst = packet->get_destination(packet);
+		queue += chunk_hash_inc(dst->get_address(dst),
+								dst->get_port(dst)) % this->count;
+	}
+	queue->mutex->lock(queue->mutex);
+	queue->list->insert_last(queue->list, packet);
+	count = queue->list->get_count(queue->list);
+	queue->peak = max(queue->peak, count);
+	queue->got->signal(queue->got);
+	queue->mutex->unlock(queue->mutex);
 }
 
 METHOD(sender_t, send_, void,
@@ -135,51 +182,99 @@ METHOD(sender_t, send_, void,
 /**
  * Job callback function to send packets
  */
-static job_requeue_t send_packets(private_sender_t *this)
+static job_requeue_t send_packets(send_queue_t *queue)
 {
-	packet_t *packet;
+	packet_t *packets[SEND_BATCH];
 	bool oldstate;
+	int i, count = 0;
 
-	this->mutex->lock(this->mutex);
-	while (this->list->get_count(this->list) == 0)
+	queue->mutex->lock(queue->mutex);
+	while (queue->list->get_count(queue->list) == 0)
 	{
 		/* add cleanup handler, wait for packet, remove cleanup handler */
-		thread_cleanup_push((thread_cleanup_t)this->mutex->unlock, this->mutex);
+		thread_cleanup_push((thread_cleanup_t)queue->mutex->unlock,
+							queue->mutex);
 		oldstate = thread_cancelability(TRUE);
 
-		this->got->wait(this->got, this->mutex);
+		queue->got->wait(queue->got, queue->mutex);
 
 		thread_cancelability(oldstate);
 		thread_cleanup_pop(FALSE);
 	}
-	this->list->remove_first(this->list, (void**)&packet);
-	this->sent->signal(this->sent);
-	this->mutex->unlock(this->mutex);
+	/* coalesce all queued packets, up to a batch */
+	while (count < SEND_BATCH &&
+		   queue->list->remove_first(queue->list,
+									 (void**)&packets[count]) == SUCCESS)
+	{
+		count++;
+	}
+	queue->batches++;
+	queue->packets += count;
+	queue->sent->signal(queue->sent);
+	queue->mutex->unlock(queue->mutex);
 
-	charon->socket->send(charon->socket, packet);
-	packet->destroy(packet);
+	charon->socket->send_batch(charon->socket, packets, count);
+	for (i = 0; i < count; i++)
+	{
+		packets[i]->destroy(packets[i]);
+	}
 	return JOB_REQUEUE_DIRECT;
 }
 
 METHOD(sender_t, flush, void,
 	private_sender_t *this)
 {
-	/* send all packets in the queue */
-	this->mutex->lock(this->mutex);
-	while (this->list->get_count(this->list))
+	send_queue_t *queue;
+	int i;
+
+	/* send all packets in the queues */
+	for (i = 0; i < this->count; i++)
 	{
-		this->sent->wait(this->sent, this->mutex);
+		queue = &this->queues[i];
+		queue->mutex->lock(queue->mutex);
+		while (queue->list->get_count(queue->list))
+		{
+			queue->sent->wait(queue->sent, queue->mutex);
+		}
+		queue->mutex->unlock(queue->mutex);
+	}
+}
+
+METHOD(sender_t, get_stats, void,
+	private_sender_t *this, u_int *queued, u_int *peak, u_int *batches,
+	u_int *packets)
+{
+	send_queue_t *queue;
+	int i;
+
+	*queued = *peak = *batches = *packets = 0;
+	for (i = 0; i < this->count; i++)
+	{
+		queue = &this->queues[i];
+		queue->mutex->lock(queue->mutex);
+		*queued += queue->list->get_count(queue->list);
+		*peak = max(*peak, queue->peak);
+		*batches += queue->batches;
+		*packets += queue->packets;
+		queue->mutex->unlock(queue->mutex);
 	}
-	this->mutex->unlock(this->mutex);
 }
 
 METHOD(sender_t, destroy, void,
 	private_sender_t *this)
 {
-	this->list->destroy_offset(this->list, offsetof(packet_t, destroy));
-	this->got->destroy(this->got);
-	this->sent->destroy(this->sent);
-	this->mutex->destroy(this->mutex);
+	send_queue_t *queue;
+	int i;
+
+	for (i = 0; i < this->count; i++)
+	{
+		queue = &this->queues[i];
+		queue->list->destroy_offset(queue->list, offsetof(packet_t, destroy));
+		queue->got->destroy(queue->got);
+		queue->sent->destroy(queue->sent);
+		queue->mutex->destroy(queue->mutex);
+	}
+	free(this->queues);
 	free(this);
 }
 
@@ -189,18 +284,19 @@ METHOD(sender_t, destroy, void,
 sender_t * sender_create()
 {
 	private_sender_t *this;
+	send_queue_t *queue;
+	int i;
 
 	INIT(this,
 		.public = {
 			.send = _send_,
 			.send_no_marker = _send_no_marker,
 			.flush = _flush,
+			.get_stats = _get_stats,
 			.destroy = _destroy,
 		},
-		.list = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
-		.got = condvar_create(CONDVAR_TYPE_DEFAULT),
-		.sent = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.count = max(1, lib->settings->get_int(lib->settings,
+								"%s.sender_threads", 1, charon->name)),
 		.send_delay = lib->settings->get_int(lib->settings,
 								"%s.send_delay", 0, charon->name),
 		.send_delay_type = lib->settings->get_int(lib->settings,
@@ -211,10 +307,20 @@ sender_t * sender_create()
 								"%s.send_delay_response", TRUE, charon->name),
 	);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create_with_prio((callback_job_cb_t)send_packets,
-			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	this->queues = calloc(this->count, sizeof(send_queue_t));
+	for (i = 0; i < this->count; i++)
+	{
+		queue = &this->queues[i];
+		queue->list = linked_list_create();
+		queue->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+		queue->got = condvar_create(CONDVAR_TYPE_DEFAULT);
+		queue->sent = condvar_create(CONDVAR_TYPE_DEFAULT);
+
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+				(callback_job_cb_t)send_packets, queue, NULL,
+				(callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	}
 
 	return &this->public;
 }
-
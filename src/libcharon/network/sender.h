@@ -58,6 +58,17 @@ struct sender_t {
 	 */
 	void (*flush)(sender_t *this);
 
+	/**
+	 * Get statistics about the send queues.
+	 *
+	 * @param queued	number of packets currently queued
+	 * @param peak		maximum number of packets queued in a single queue
+	 * @param batches	number of batches passed to the socket
+	 * @param packets	number of packets passed to the socket
+	 */
+	void (*get_stats)(sender_t *this, u_int *queued, u_int *peak,
+					  u_int *batches, u_int *packets);
+
 	/**
 	 * Destroys a sender object.
 	 */
@@ -67,6 +67,19 @@ struct socket_t {
 	 */
 	status_t (*send) (socket_t *this, packet_t *packet);
 
+	/**
+	 * Send multiple packets at once, optional.
+	 *
+	 * Packets to the same destination are sent in the given order.
+	 *
+	 * @param packets		array of packet_t to send
+	 * @param count			number of packets in array
+	 * @return
+	 *						- SUCCESS when all packets successfully sent
+	 *						- FAILED when unable to send some packets
+	 */
+	status_t (*send_batch) (socket_t *this, packet_t *packets[], int count);
+
 	/**
 	 * Get the port this socket is listening on.
 	 *
@@ -52,6 +52,18 @@ struct socket_manager_t {
 	 */
 	status_t (*send) (socket_manager_t *this, packet_t *packet);
 
+	/**
+	 * Send multiple packets using the registered socket.
+	 *
+	 * @param packets		array of packets to send out
+	 * @param count			number of packets in array
+	 * @return
+	 *						- SUCCESS when all packets successfully sent
+	 *						- FAILED when unable to send some packets
+	 */
+	status_t (*send_batch) (socket_manager_t *this, packet_t *packets[],
+							int count);
+
 	/**
 	 * Get the port the registered socket is listening on.
 	 *
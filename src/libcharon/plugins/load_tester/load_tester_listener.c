@@ -41,6 +41,11 @@ struct private_load_tester_listener_t {
 	 */
 	u_int established;
 
+	/**
+	 * Number of SAs established as initiator
+	 */
+	u_int initiated;
+
 	/**
 	 * Number of terminated SAs
 	 */
@@ -69,7 +74,7 @@ METHOD(listener_t, ike_updown, bool,
 
 		if (id->is_initiator(id))
 		{
-			if (this->shutdown_on == this->established)
+			if (this->shutdown_on == ++this->initiated)
 			{
 				DBG1(DBG_CFG, "load-test complete, raising SIGTERM");
 				kill(0, SIGTERM);
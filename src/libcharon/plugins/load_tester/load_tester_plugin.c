@@ -18,6 +18,7 @@
 #include "load_tester_creds.h"
 #include "load_tester_ipsec.h"
 #include "load_tester_listener.h"
+#include "load_tester_stats.h"
 #include "load_tester_diffie_hellman.h"
 
 #include <unistd.h>
@@ -55,6 +56,11 @@ struct private_load_tester_plugin_t {
 	 */
 	load_tester_listener_t *listener;
 
+	/**
+	 * handshake statistics, if enabled
+	 */
+	load_tester_stats_t *stats;
+
 	/**
 	 * number of iterations per thread
 	 */
@@ -193,6 +199,16 @@ static bool register_load_tester(private_load_tester_plugin_t *this,
 		this->listener = load_tester_listener_create(shutdown_on);
 		charon->bus->add_listener(charon->bus, &this->listener->listener);
 
+		if (lib->settings->get_bool(lib->settings,
+				"%s.plugins.load-tester.stats", FALSE, charon->name))
+		{
+			this->stats = load_tester_stats_create(
+					lib->settings->get_int(lib->settings,
+						"%s.plugins.load-tester.stats_interval", 0,
+						charon->name));
+			charon->bus->add_listener(charon->bus, &this->stats->listener);
+		}
+
 		for (i = 0; i < this->initiators; i++)
 		{
 			lib->processor->queue_job(lib->processor, (job_t*)
@@ -212,6 +228,13 @@ static bool register_load_tester(private_load_tester_plugin_t *this,
 		charon->backends->remove_backend(charon->backends, &this->config->backend);
 		lib->credmgr->remove_set(lib->credmgr, &this->creds->credential_set);
 		charon->bus->remove_listener(charon->bus, &this->listener->listener);
+		if (this->stats)
+		{
+			charon->bus->remove_listener(charon->bus, &this->stats->listener);
+			this->stats->report(this->stats);
+			this->stats->destroy(this->stats);
+			this->stats = NULL;
+		}
 		this->config->destroy(this->config);
 		this->creds->destroy(this->creds);
 		this->listener->destroy(this->listener);
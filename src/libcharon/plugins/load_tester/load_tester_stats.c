@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "load_tester_stats.h"
+
+#include <time.h>
+#include <stdlib.h>
+
+#include <daemon.h>
+#include <threading/mutex.h>
+#include <threading/thread_value.h>
+#include <utils/hashtable.h>
+
+typedef struct private_load_tester_stats_t private_load_tester_stats_t;
+
+/**
+ * Statistics for IKE_SAs of one role
+ */
+typedef struct {
+
+	/**
+	 * Number of established IKE_SAs
+	 */
+	u_int established;
+
+	/**
+	 * Number of currently half-open IKE_SAs
+	 */
+	u_int half_open;
+
+	/**
+	 * Maximum number of half-open IKE_SAs
+	 */
+	u_int half_open_peak;
+
+	/**
+	 * Handshake latencies, in us
+	 */
+	u_int32_t *latencies;
+
+	/**
+	 * Number of latencies allocated
+	 */
+	u_int size;
+} role_stats_t;
+
+/**
+ * Responder CPU time spent for one exchange type
+ */
+typedef struct {
+
+	/**
+	 * Number of requests processed
+	 */
+	u_int requests;
+
+	/**
+	 * Accumulated CPU time, in us
+	 */
+	u_int64_t cpu;
+} exchange_stats_t;
+
+/**
+ * Handshake of an IKE_SA in progress
+ */
+typedef struct {
+
+	/**
+	 * Time the first message has been sent or received
+	 */
+	timeval_t start;
+
+	/**
+	 * TRUE if we are the original initiator
+	 */
+	bool initiator;
+} handshake_t;
+
+/**
+ * Request currently processed by a thread
+ */
+typedef struct {
+
+	/**
+	 * Exchange type of the request
+	 */
+	exchange_type_t type;
+
+	/**
+	 * Thread CPU time when the request was received, in us
+	 */
+	u_int64_t start;
+
+	/**
+	 * TRUE if waiting for the response to be sent
+	 */
+	bool active;
+} request_t;
+
+/**
+ * Private data of an load_tester_stats_t object
+ */
+struct private_load_tester_stats_t {
+
+	/**
+	 * Public part
+	 */
+	load_tester_stats_t public;
+
+	/**
+	 * Handshakes in progress, handshake_t indexed by IKE_SA unique ID
+	 */
+	hashtable_t *handshakes;
+
+	/**
+	 * Statistics for responder (0) and initiator (1) role
+	 */
+	role_stats_t roles[2];
+
+	/**
+	 * Statistics per exchange type
+	 */
+	exchange_stats_t exchanges[256];
+
+	/**
+	 * Request processed by the current thread, request_t
+	 */
+	thread_value_t *request;
+
+	/**
+	 * Time the first handshake started
+	 */
+	timeval_t first;
+
+	/**
+	 * Time the last IKE_SA got established
+	 */
+	timeval_t last;
+
+	/**
+	 * Log statistics every interval seconds
+	 */
+	u_int interval;
+
+	/**
+	 * Time statistics have been logged last
+	 */
+	time_t reported;
+
+	/**
+	 * Lock for all statistics
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * Hashtable hash function
+ */
+static u_int hash(void *key)
+{
+	return (uintptr_t)key;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool equals(void *a, void *b)
+{
+	return a == b;
+}
+
+/**
+ * Get the difference between two timevals, in us
+ */
+static u_int64_t time_diff(timeval_t *start, timeval_t *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000LL +
+			end->tv_usec - start->tv_usec;
+}
+
+/**
+ * Get the CPU time consumed by the current thread, in us
+ */
+static u_int64_t thread_cpu()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+	{
+		return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * Check if a message initiates the setup of an IKE_SA
+ */
+static bool is_initial(message_t *message)
+{
+	if (message->get_message_id(message) != 0)
+	{
+		return FALSE;
+	}
+	switch (message->get_exchange_type(message))
+	{
+		case IKE_SA_INIT:
+		case IKE_SESSION_RESUME:
+		case ID_PROT:
+		case AGGRESSIVE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Start tracking the handshake of an IKE_SA, if not done yet
+ */
+static void handshake_start(private_load_tester_stats_t *this,
+							ike_sa_t *ike_sa)
+{
+	ike_sa_id_t *id = ike_sa->get_id(ike_sa);
+	void *key = (void*)(uintptr_t)ike_sa->get_unique_id(ike_sa);
+	handshake_t *handshake;
+	role_stats_t *role;
+
+	this->mutex->lock(this->mutex);
+	if (!this->handshakes->get(this->handshakes, key))
+	{
+		INIT(handshake,
+			.initiator = id->is_initiator(id),
+		);
+		time_monotonic(&handshake->start);
+		if (!this->first.tv_sec && !this->first.tv_usec)
+		{
+			this->first = handshake->start;
+		}
+		this->handshakes->put(this->handshakes, key, handshake);
+
+		role = &this->roles[handshake->initiator];
+		role->half_open++;
+		role->half_open_peak = max(role->half_open_peak, role->half_open);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Stop tracking the handshake of an IKE_SA, record it if established
+ */
+static void handshake_done(private_load_tester_stats_t *this,
+						   ike_sa_t *ike_sa, bool established)
+{
+	void *key = (void*)(uintptr_t)ike_sa->get_unique_id(ike_sa);
+	handshake_t *handshake;
+	role_stats_t *role;
+	bool report = FALSE;
+	timeval_t now;
+
+	this->mutex->lock(this->mutex);
+	handshake = this->handshakes->remove(this->handshakes, key);
+	if (handshake)
+	{
+		role = &this->roles[handshake->initiator];
+		role->half_open--;
+		if (established)
+		{
+			time_monotonic(&now);
+			if (role->established == role->size)
+			{
+				role->size = max(1024, role->size * 2);
+				role->latencies = realloc(role->latencies,
+										  role->size * sizeof(u_int32_t));
+			}
+			role->latencies[role->established++] =
+									time_diff(&handshake->start, &now);
+			this->last = now;
+			if (this->interval &&
+				now.tv_sec >= this->reported + this->interval)
+			{
+				this->reported = now.tv_sec;
+				report = TRUE;
+			}
+		}
+		free(handshake);
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (report)
+	{
+		this->public.report(&this->public);
+	}
+}
+
+/**
+ * Remember CPU time when starting to process a request
+ */
+static void request_start(private_load_tester_stats_t *this,
+						  exchange_type_t type)
+{
+	request_t *request;
+
+	request = this->request->get(this->request);
+	if (!request)
+	{
+		INIT(request);
+		this->request->set(this->request, request);
+	}
+	request->type = type;
+	request->active = TRUE;
+	request->start = thread_cpu();
+}
+
+/**
+ * Account CPU time when sending the response to a request
+ */
+static void request_done(private_load_tester_stats_t *this)
+{
+	request_t *request;
+	u_int64_t cpu;
+
+	request = this->request->get(this->request);
+	if (request && request->active)
+	{
+		cpu = thread_cpu() - request->start;
+		request->active = FALSE;
+
+		this->mutex->lock(this->mutex);
+		this->exchanges[request->type].requests++;
+		this->exchanges[request->type].cpu += cpu;
+		this->mutex->unlock(this->mutex);
+	}
+}
+
+METHOD(listener_t, message_hook, bool,
+	private_load_tester_stats_t *this, ike_sa_t *ike_sa, message_t *message,
+	bool incoming, bool plain)
+{
+	if (plain || !ike_sa)
+	{	/* measure including parsing/decryption and generation/encryption */
+		return TRUE;
+	}
+	if (message->get_request(message))
+	{
+		if (incoming)
+		{
+			request_start(this, message->get_exchange_type(message));
+		}
+		if (is_initial(message))
+		{
+			handshake_start(this, ike_sa);
+		}
+	}
+	else if (!incoming)
+	{
+		request_done(this);
+	}
+	return TRUE;
+}
+
+METHOD(listener_t, ike_updown, bool,
+	private_load_tester_stats_t *this, ike_sa_t *ike_sa, bool up)
+{
+	if (up)
+	{
+		handshake_done(this, ike_sa, TRUE);
+	}
+	return TRUE;
+}
+
+METHOD(listener_t, ike_state_change, bool,
+	private_load_tester_stats_t *this, ike_sa_t *ike_sa, ike_sa_state_t state)
+{
+	if (state == IKE_DESTROYING)
+	{
+		handshake_done(this, ike_sa, FALSE);
+	}
+	return TRUE;
+}
+
+/**
+ * Compare two latencies for qsort()
+ */
+static int latency_cmp(const void *a, const void *b)
+{
+	u_int32_t x = *(u_int32_t*)a, y = *(u_int32_t*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Get a percentile of sorted latencies, in us
+ */
+static u_int32_t percentile(role_stats_t *role, u_int permille)
+{
+	u_int rank;
+
+	rank = ((u_int64_t)role->established * permille + 999) / 1000;
+	return role->latencies[max(rank, 1) - 1];
+}
+
+METHOD(load_tester_stats_t, report, void,
+	private_load_tester_stats_t *this)
+{
+	char *names[] = { "responder", "initiator" };
+	role_stats_t *role;
+	exchange_stats_t *exchange;
+	u_int64_t elapsed = 0, rate;
+	u_int32_t p50, p99, p999;
+	timeval_t end;
+	int i;
+
+	this->mutex->lock(this->mutex);
+	if (this->first.tv_sec || this->first.tv_usec)
+	{
+		end = this->last;
+		if (!end.tv_sec && !end.tv_usec)
+		{	/* nothing established yet */
+			time_monotonic(&end);
+		}
+		elapsed = time_diff(&this->first, &end);
+	}
+	elapsed = max(elapsed, 1);
+	DBG1(DBG_CFG, "load-test statistics over %u.%03us:",
+		 (u_int)(elapsed / 1000000), (u_int)(elapsed / 1000 % 1000));
+	for (i = 0; i < countof(this->roles); i++)
+	{
+		role = &this->roles[i];
+		if (!role->established && !role->half_open_peak)
+		{
+			continue;
+		}
+		rate = role->established * 100000000LL / elapsed;
+		DBG1(DBG_CFG, "  %s: %u IKE_SAs established, %u.%02u/s, "
+			 "%u half-open, peak %u", names[i], role->established,
+			 (u_int)(rate / 100), (u_int)(rate % 100),
+			 role->half_open, role->half_open_peak);
+		if (role->established)
+		{
+			qsort(role->latencies, role->established, sizeof(u_int32_t),
+				  latency_cmp);
+			p50 = percentile(role, 500);
+			p99 = percentile(role, 990);
+			p999 = percentile(role, 999);
+			DBG1(DBG_CFG, "    latency p50 %u.%03ums, p99 %u.%03ums, "
+				 "p999 %u.%03ums", p50 / 1000, p50 % 1000,
+				 p99 / 1000, p99 % 1000, p999 / 1000, p999 % 1000);
+		}
+	}
+	for (i = 0; i < countof(this->exchanges); i++)
+	{
+		exchange = &this->exchanges[i];
+		if (exchange->requests)
+		{
+			DBG1(DBG_CFG, "  %N: %u requests, %u.%03ums responder CPU time "
+				 "per request", exchange_type_names, i, exchange->requests,
+				 (u_int)(exchange->cpu / exchange->requests / 1000),
+				 (u_int)(exchange->cpu / exchange->requests % 1000));
+		}
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(load_tester_stats_t, destroy, void,
+	private_load_tester_stats_t *this)
+{
+	enumerator_t *enumerator;
+	handshake_t *handshake;
+	void *key;
+
+	enumerator = this->handshakes->create_enumerator(this->handshakes);
+	while (enumerator->enumerate(enumerator, &key, &handshake))
+	{
+		free(handshake);
+	}
+	enumerator->destroy(enumerator);
+	this->handshakes->destroy(this->handshakes);
+	this->request->destroy(this->request);
+	this->mutex->destroy(this->mutex);
+	free(this->roles[0].latencies);
+	free(this->roles[1].latencies);
+	free(this);
+}
+
+/**
+ * See header
+ */
+load_tester_stats_t *load_tester_stats_create(u_int interval)
+{
+	private_load_tester_stats_t *this;
+
+	INIT(this,
+		.public = {
+			.listener = {
+				.message = _message_hook,
+				.ike_updown = _ike_updown,
+				.ike_state_change = _ike_state_change,
+			},
+			.report = _report,
+			.destroy = _destroy,
+		},
+		.handshakes = hashtable_create(hash, equals, 1024),
+		.request = thread_value_create(free),
+		.interval = interval,
+		.reported = time_monotonic(NULL),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	return &this->public;
+}
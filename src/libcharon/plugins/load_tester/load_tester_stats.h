@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup load_tester_stats_t load_tester_stats
+ * @{ @ingroup load_tester
+ */
+
+#ifndef LOAD_TESTER_STATS_H_
+#define LOAD_TESTER_STATS_H_
+
+#include <bus/bus.h>
+
+typedef struct load_tester_stats_t load_tester_stats_t;
+
+/**
+ * Collect handshake statistics during a load test.
+ *
+ * For both initiator and responder role, the handshake rate, the latency from
+ * the first message to the establishment of the IKE_SA and the peak number of
+ * half-open IKE_SAs gets recorded. For each exchange type, the CPU time spent
+ * by the responder from receiving a request until sending the response is
+ * accumulated.
+ */
+struct load_tester_stats_t {
+
+	/**
+	 * Implements listener interface.
+	 */
+	listener_t listener;
+
+	/**
+	 * Log the statistics collected so far.
+	 */
+	void (*report)(load_tester_stats_t *this);
+
+	/**
+	 * Destroy a load_tester_stats_t.
+	 */
+	void (*destroy)(load_tester_stats_t *this);
+};
+
+/**
+ * Create a listener collecting load test statistics.
+ *
+ * @param interval		log statistics every interval seconds, 0 to disable
+ * @return				listener
+ */
+load_tester_stats_t *load_tester_stats_create(u_int interval);
+
+#endif /** LOAD_TESTER_STATS_H_ @}*/
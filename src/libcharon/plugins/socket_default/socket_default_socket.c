@@ -44,10 +44,19 @@
 #include <hydra.h>
 #include <daemon.h>
 #include <threading/thread.h>
+#include <threading/thread_value.h>
+#include <threading/mutex.h>
+#include <utils/linked_list.h>
 
 /* Maximum size of a packet */
 #define MAX_PACKET 10000
 
+/* Maximum number of packets read with a single recvmmsg() call */
+#define RECV_BATCH 16
+
+/* Maximum number of packets written with a single sendmmsg() call */
+#define SEND_BATCH 16
+
 /* these are not defined on some platforms */
 #ifndef SOL_IP
 #define SOL_IP IPPROTO_IP
@@ -71,6 +80,48 @@ static const struct in6_addr in6addr_any = IN6ADDR_ANY_INIT;
 #endif
 
 typedef struct private_socket_default_socket_t private_socket_default_socket_t;
+typedef struct socket_set_t socket_set_t;
+
+/**
+ * Set of sockets, drained by one receiver thread
+ */
+struct socket_set_t {
+
+	/**
+	 * IPv4 socket (500 or port)
+	 */
+	int ipv4;
+
+	/**
+	 * IPv4 socket for NAT-T (4500 or natt)
+	 */
+	int ipv4_natt;
+
+	/**
+	 * IPv6 socket (500 or port)
+	 */
+	int ipv6;
+
+	/**
+	 * IPv6 socket for NAT-T (4500 or natt)
+	 */
+	int ipv6_natt;
+
+	/**
+	 * Packets received but not yet returned, packet_t
+	 */
+	linked_list_t *pending;
+
+	/**
+	 * Receive buffer for RECV_BATCH packets
+	 */
+	char *buffer;
+
+	/**
+	 * Lock for receiving, in case more threads than sets receive
+	 */
+	mutex_t *mutex;
+};
 
 /**
  * Private data of an socket_t object
@@ -93,24 +144,29 @@ struct private_socket_default_socket_t {
 	u_int16_t natt;
 
 	/**
-	 * IPv4 socket (500 or port)
+	 * Socket sets bound with SO_REUSEPORT, the first is used for sending
 	 */
-	int ipv4;
+	socket_set_t *sets;
 
 	/**
-	 * IPv4 socket for NAT-T (4500 or natt)
+	 * Number of socket sets
 	 */
-	int ipv4_natt;
+	int count;
 
 	/**
-	 * IPv6 socket (500 or port)
+	 * Socket set assigned to the current receiver thread
 	 */
-	int ipv6;
+	thread_value_t *set;
 
 	/**
-	 * IPv6 socket for NAT-T (4500 or natt)
+	 * Socket set to assign to the next receiver thread
 	 */
-	int ipv6_natt;
+	int next;
+
+	/**
+	 * Lock to assign socket sets
+	 */
+	mutex_t *mutex;
 
 	/**
 	 * Maximum packet size to receive
@@ -123,193 +179,289 @@ struct private_socket_default_socket_t {
 	bool set_source;
 };
 
-METHOD(socket_t, receiver, status_t,
-	private_socket_default_socket_t *this, packet_t **packet)
+/**
+ * Create a packet from a received message, NULL on error
+ */
+static packet_t *create_packet(private_socket_default_socket_t *this,
+							   struct msghdr *msg, int bytes_read,
+							   u_int16_t port)
 {
-	char buffer[this->max_packet];
+	struct cmsghdr *cmsgptr;
+	host_t *source, *dest = NULL;
+	packet_t *pkt;
 	chunk_t data;
+
+	if (msg->msg_flags & MSG_TRUNC)
+	{
+		DBG1(DBG_NET, "receive buffer too small, packet discarded");
+		return NULL;
+	}
+	data = chunk_create(msg->msg_iov->iov_base, bytes_read);
+	DBG3(DBG_NET, "received packet %B", &data);
+
+	/* read ancillary data to get destination address */
+	for (cmsgptr = CMSG_FIRSTHDR(msg); cmsgptr != NULL;
+		 cmsgptr = CMSG_NXTHDR(msg, cmsgptr))
+	{
+		if (cmsgptr->cmsg_len == 0)
+		{
+			DBG1(DBG_NET, "error reading ancillary data");
+			return NULL;
+		}
+
+#ifdef HAVE_IN6_PKTINFO
+		if (cmsgptr->cmsg_level == SOL_IPV6 &&
+			cmsgptr->cmsg_type == IPV6_PKTINFO)
+		{
+			struct in6_pktinfo *pktinfo;
+			pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsgptr);
+			struct sockaddr_in6 dst;
+
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst.sin6_addr, &pktinfo->ipi6_addr, sizeof(dst.sin6_addr));
+			dst.sin6_family = AF_INET6;
+			dst.sin6_port = htons(port);
+			dest = host_create_from_sockaddr((sockaddr_t*)&dst);
+		}
+#endif /* HAVE_IN6_PKTINFO */
+		if (cmsgptr->cmsg_level == SOL_IP &&
+#ifdef IP_PKTINFO
+			cmsgptr->cmsg_type == IP_PKTINFO
+#elif defined(IP_RECVDSTADDR)
+			cmsgptr->cmsg_type == IP_RECVDSTADDR
+#else
+			FALSE
+#endif
+			)
+		{
+			struct in_addr *addr;
+			struct sockaddr_in dst;
+
+#ifdef IP_PKTINFO
+			struct in_pktinfo *pktinfo;
+			pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsgptr);
+			addr = &pktinfo->ipi_addr;
+#elif defined(IP_RECVDSTADDR)
+			addr = (struct in_addr*)CMSG_DATA(cmsgptr);
+#endif
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst.sin_addr, addr, sizeof(dst.sin_addr));
+
+			dst.sin_family = AF_INET;
+			dst.sin_port = htons(port);
+			dest = host_create_from_sockaddr((sockaddr_t*)&dst);
+		}
+		if (dest)
+		{
+			break;
+		}
+	}
+	if (dest == NULL)
+	{
+		DBG1(DBG_NET, "error reading IP header");
+		return NULL;
+	}
+	source = host_create_from_sockaddr((sockaddr_t*)msg->msg_name);
+
+	pkt = packet_create();
+	pkt->set_source(pkt, source);
+	pkt->set_destination(pkt, dest);
+	DBG2(DBG_NET, "received packet: from %#H to %#H", source, dest);
+	pkt->set_data(pkt, chunk_clone(data));
+	return pkt;
+}
+
+/**
+ * Read all pending packets (up to RECV_BATCH) from a socket into a set
+ */
+static void read_packets(private_socket_default_socket_t *this,
+						 socket_set_t *set, int skt, u_int16_t port)
+{
+	union {
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+	} src[RECV_BATCH];
+	char ancillary[RECV_BATCH][64];
+	struct iovec iov[RECV_BATCH];
+	struct msghdr *msg;
 	packet_t *pkt;
-	host_t *source = NULL, *dest = NULL;
-	int bytes_read = 0;
-	bool oldstate;
+	int i, count = 1;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[RECV_BATCH];
+
+	memset(msgs, 0, sizeof(msgs));
+	count = RECV_BATCH;
+#else
+	struct msghdr msgs[1];
+	ssize_t bytes;
 
+	memset(msgs, 0, sizeof(msgs));
+#endif
+
+	for (i = 0; i < count; i++)
+	{
+#ifdef HAVE_RECVMMSG
+		msg = &msgs[i].msg_hdr;
+#else
+		msg = &msgs[i];
+#endif
+		msg->msg_name = &src[i];
+		msg->msg_namelen = sizeof(src[i]);
+		iov[i].iov_base = set->buffer + i * this->max_packet;
+		iov[i].iov_len = this->max_packet;
+		msg->msg_iov = &iov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = ancillary[i];
+		msg->msg_controllen = sizeof(ancillary[i]);
+	}
+
+#ifdef HAVE_RECVMMSG
+	count = recvmmsg(skt, msgs, count, MSG_DONTWAIT, NULL);
+#else
+	bytes = recvmsg(skt, &msgs[0], MSG_DONTWAIT);
+	count = bytes < 0 ? -1 : 1;
+#endif
+	if (count < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
+		}
+		return;
+	}
+	for (i = 0; i < count; i++)
+	{
+#ifdef HAVE_RECVMMSG
+		pkt = create_packet(this, &msgs[i].msg_hdr, msgs[i].msg_len, port);
+#else
+		pkt = create_packet(this, &msgs[i], bytes, port);
+#endif
+		if (pkt)
+		{
+			set->pending->insert_last(set->pending, pkt);
+		}
+	}
+}
+
+/**
+ * Get the socket set assigned to the current thread
+ */
+static socket_set_t *get_set(private_socket_default_socket_t *this)
+{
+	socket_set_t *set;
+
+	set = this->set->get(this->set);
+	if (!set)
+	{
+		this->mutex->lock(this->mutex);
+		set = &this->sets[this->next++ % this->count];
+		this->mutex->unlock(this->mutex);
+		this->set->set(this->set, set);
+	}
+	return set;
+}
+
+/**
+ * Wait for packets on the sockets of a set and read them
+ */
+static void receive_packets(private_socket_default_socket_t *this,
+							socket_set_t *set)
+{
 	fd_set rfds;
-	int max_fd = 0, selected = 0;
-	u_int16_t port = 0;
+	int max_fd;
+	bool oldstate;
 
 	FD_ZERO(&rfds);
 
-	if (this->ipv4)
+	if (set->ipv4)
 	{
-		FD_SET(this->ipv4, &rfds);
+		FD_SET(set->ipv4, &rfds);
 	}
-	if (this->ipv4_natt)
+	if (set->ipv4_natt)
 	{
-		FD_SET(this->ipv4_natt, &rfds);
+		FD_SET(set->ipv4_natt, &rfds);
 	}
-	if (this->ipv6)
+	if (set->ipv6)
 	{
-		FD_SET(this->ipv6, &rfds);
+		FD_SET(set->ipv6, &rfds);
 	}
-	if (this->ipv6_natt)
+	if (set->ipv6_natt)
 	{
-		FD_SET(this->ipv6_natt, &rfds);
+		FD_SET(set->ipv6_natt, &rfds);
 	}
-	max_fd = max(max(this->ipv4, this->ipv4_natt), max(this->ipv6, this->ipv6_natt));
+	max_fd = max(max(set->ipv4, set->ipv4_natt), max(set->ipv6, set->ipv6_natt));
 
 	DBG2(DBG_NET, "waiting for data on sockets");
 	oldstate = thread_cancelability(TRUE);
 	if (select(max_fd + 1, &rfds, NULL, NULL, NULL) <= 0)
 	{
 		thread_cancelability(oldstate);
-		return FAILED;
+		return;
 	}
 	thread_cancelability(oldstate);
 
-	if (FD_ISSET(this->ipv4, &rfds))
+	if (set->ipv4 && FD_ISSET(set->ipv4, &rfds))
 	{
-		port = this->port;
-		selected = this->ipv4;
+		read_packets(this, set, set->ipv4, this->port);
 	}
-	if (FD_ISSET(this->ipv4_natt, &rfds))
+	if (set->ipv4_natt && FD_ISSET(set->ipv4_natt, &rfds))
 	{
-		port = this->natt;
-		selected = this->ipv4_natt;
+		read_packets(this, set, set->ipv4_natt, this->natt);
 	}
-	if (FD_ISSET(this->ipv6, &rfds))
+	if (set->ipv6 && FD_ISSET(set->ipv6, &rfds))
 	{
-		port = this->port;
-		selected = this->ipv6;
+		read_packets(this, set, set->ipv6, this->port);
 	}
-	if (FD_ISSET(this->ipv6_natt, &rfds))
+	if (set->ipv6_natt && FD_ISSET(set->ipv6_natt, &rfds))
 	{
-		port = this->natt;
-		selected = this->ipv6_natt;
+		read_packets(this, set, set->ipv6_natt, this->natt);
 	}
-	if (selected)
-	{
-		struct msghdr msg;
-		struct cmsghdr *cmsgptr;
-		struct iovec iov;
-		char ancillary[64];
-		union {
-			struct sockaddr_in in4;
-			struct sockaddr_in6 in6;
-		} src;
+}
 
-		msg.msg_name = &src;
-		msg.msg_namelen = sizeof(src);
-		iov.iov_base = buffer;
-		iov.iov_len = this->max_packet;
-		msg.msg_iov = &iov;
-		msg.msg_iovlen = 1;
-		msg.msg_control = ancillary;
-		msg.msg_controllen = sizeof(ancillary);
-		msg.msg_flags = 0;
-		bytes_read = recvmsg(selected, &msg, 0);
-		if (bytes_read < 0)
-		{
-			DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
-			return FAILED;
-		}
-		if (msg.msg_flags & MSG_TRUNC)
-		{
-			DBG1(DBG_NET, "receive buffer too small, packet discarded");
-			return FAILED;
-		}
-		DBG3(DBG_NET, "received packet %b", buffer, bytes_read);
+METHOD(socket_t, receiver, status_t,
+	private_socket_default_socket_t *this, packet_t **packet)
+{
+	socket_set_t *set;
+	status_t status;
 
-		/* read ancillary data to get destination address */
-		for (cmsgptr = CMSG_FIRSTHDR(&msg); cmsgptr != NULL;
-			 cmsgptr = CMSG_NXTHDR(&msg, cmsgptr))
-		{
-			if (cmsgptr->cmsg_len == 0)
-			{
-				DBG1(DBG_NET, "error reading ancillary data");
-				return FAILED;
-			}
+	set = get_set(this);
+	set->mutex->lock(set->mutex);
+	thread_cleanup_push((thread_cleanup_t)set->mutex->unlock, set->mutex);
+	if (set->pending->get_count(set->pending) == 0)
+	{
+		receive_packets(this, set);
+	}
+	status = set->pending->remove_first(set->pending, (void**)packet);
+	thread_cleanup_pop(TRUE);
+	return status == SUCCESS ? SUCCESS : FAILED;
+}
 
-#ifdef HAVE_IN6_PKTINFO
-			if (cmsgptr->cmsg_level == SOL_IPV6 &&
-				cmsgptr->cmsg_type == IPV6_PKTINFO)
-			{
-				struct in6_pktinfo *pktinfo;
-				pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsgptr);
-				struct sockaddr_in6 dst;
-
-				memset(&dst, 0, sizeof(dst));
-				memcpy(&dst.sin6_addr, &pktinfo->ipi6_addr, sizeof(dst.sin6_addr));
-				dst.sin6_family = AF_INET6;
-				dst.sin6_port = htons(port);
-				dest = host_create_from_sockaddr((sockaddr_t*)&dst);
-			}
-#endif /* HAVE_IN6_PKTINFO */
-			if (cmsgptr->cmsg_level == SOL_IP &&
+/**
+ * Ancillary data to set the source address of an outbound packet
+ */
+typedef union {
 #ifdef IP_PKTINFO
-				cmsgptr->cmsg_type == IP_PKTINFO
-#elif defined(IP_RECVDSTADDR)
-				cmsgptr->cmsg_type == IP_RECVDSTADDR
-#else
-				FALSE
+	char in4[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#elif defined(IP_SENDSRCADDR)
+	char in4[CMSG_SPACE(sizeof(struct in_addr))];
 #endif
-				)
-			{
-				struct in_addr *addr;
-				struct sockaddr_in dst;
-
-#ifdef IP_PKTINFO
-				struct in_pktinfo *pktinfo;
-				pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsgptr);
-				addr = &pktinfo->ipi_addr;
-#elif defined(IP_RECVDSTADDR)
-				addr = (struct in_addr*)CMSG_DATA(cmsgptr);
+#ifdef HAVE_IN6_PKTINFO
+	char in6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
 #endif
-				memset(&dst, 0, sizeof(dst));
-				memcpy(&dst.sin_addr, addr, sizeof(dst.sin_addr));
-
-				dst.sin_family = AF_INET;
-				dst.sin_port = htons(port);
-				dest = host_create_from_sockaddr((sockaddr_t*)&dst);
-			}
-			if (dest)
-			{
-				break;
-			}
-		}
-		if (dest == NULL)
-		{
-			DBG1(DBG_NET, "error reading IP header");
-			return FAILED;
-		}
-		source = host_create_from_sockaddr((sockaddr_t*)&src);
-
-		pkt = packet_create();
-		pkt->set_source(pkt, source);
-		pkt->set_destination(pkt, dest);
-		DBG2(DBG_NET, "received packet: from %#H to %#H", source, dest);
-		data = chunk_create(buffer, bytes_read);
-		pkt->set_data(pkt, chunk_clone(data));
-	}
-	else
-	{
-		/* oops, shouldn't happen */
-		return FAILED;
-	}
-	/* return packet */
-	*packet = pkt;
-	return SUCCESS;
-}
+	struct cmsghdr align;
+} control_t;
 
-METHOD(socket_t, sender, status_t,
-	private_socket_default_socket_t *this, packet_t *packet)
+/**
+ * Prepare the message to send a packet, returns the socket to use or 0
+ */
+static int prepare_send(private_socket_default_socket_t *this,
+						packet_t *packet, struct msghdr *msg,
+						struct iovec *iov, control_t *control)
 {
 	int sport, skt, family;
-	ssize_t bytes_sent;
 	chunk_t data;
 	host_t *src, *dst;
-	struct msghdr msg;
 	struct cmsghdr *cmsg;
-	struct iovec iov;
 
 	src = packet->get_source(packet);
 	dst = packet->get_destination(packet);
@@ -324,38 +476,38 @@ METHOD(socket_t, sender, status_t,
 	{
 		if (family == AF_INET)
 		{
-			skt = this->ipv4;
+			skt = this->sets[0].ipv4;
 		}
 		else
 		{
-			skt = this->ipv6;
+			skt = this->sets[0].ipv6;
 		}
 	}
 	else if (sport == this->natt)
 	{
 		if (family == AF_INET)
 		{
-			skt = this->ipv4_natt;
+			skt = this->sets[0].ipv4_natt;
 		}
 		else
 		{
-			skt = this->ipv6_natt;
+			skt = this->sets[0].ipv6_natt;
 		}
 	}
 	else
 	{
 		DBG1(DBG_NET, "unable to locate a send socket for port %d", sport);
-		return FAILED;
+		return 0;
 	}
 
-	memset(&msg, 0, sizeof(struct msghdr));
-	msg.msg_name = dst->get_sockaddr(dst);;
-	msg.msg_namelen = *dst->get_sockaddr_len(dst);
-	iov.iov_base = data.ptr;
-	iov.iov_len = data.len;
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_flags = 0;
+	memset(msg, 0, sizeof(struct msghdr));
+	msg->msg_name = dst->get_sockaddr(dst);
+	msg->msg_namelen = *dst->get_sockaddr_len(dst);
+	iov->iov_base = data.ptr;
+	iov->iov_len = data.len;
+	msg->msg_iov = iov;
+	msg->msg_iovlen = 1;
+	msg->msg_flags = 0;
 
 	if (this->set_source && !src->is_anyaddr(src))
 	{
@@ -365,14 +517,11 @@ METHOD(socket_t, sender, status_t,
 			struct in_addr *addr;
 			struct sockaddr_in *sin;
 #ifdef IP_PKTINFO
-			char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
 			struct in_pktinfo *pktinfo;
-#elif defined(IP_SENDSRCADDR)
-			char buf[CMSG_SPACE(sizeof(struct in_addr))];
 #endif
-			msg.msg_control = buf;
-			msg.msg_controllen = sizeof(buf);
-			cmsg = CMSG_FIRSTHDR(&msg);
+			msg->msg_control = control->in4;
+			msg->msg_controllen = sizeof(control->in4);
+			cmsg = CMSG_FIRSTHDR(msg);
 			cmsg->cmsg_level = SOL_IP;
 #ifdef IP_PKTINFO
 			cmsg->cmsg_type = IP_PKTINFO;
@@ -392,13 +541,12 @@ METHOD(socket_t, sender, status_t,
 #ifdef HAVE_IN6_PKTINFO
 		else
 		{
-			char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
 			struct in6_pktinfo *pktinfo;
 			struct sockaddr_in6 *sin;
 
-			msg.msg_control = buf;
-			msg.msg_controllen = sizeof(buf);
-			cmsg = CMSG_FIRSTHDR(&msg);
+			msg->msg_control = control->in6;
+			msg->msg_controllen = sizeof(control->in6);
+			cmsg = CMSG_FIRSTHDR(msg);
 			cmsg->cmsg_level = SOL_IPV6;
 			cmsg->cmsg_type = IPV6_PKTINFO;
 			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
@@ -409,10 +557,27 @@ METHOD(socket_t, sender, status_t,
 		}
 #endif /* HAVE_IN6_PKTINFO */
 	}
+	return skt;
+}
+
+METHOD(socket_t, sender, status_t,
+	private_socket_default_socket_t *this, packet_t *packet)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	control_t control;
+	ssize_t bytes_sent;
+	int skt;
+
+	skt = prepare_send(this, packet, &msg, &iov, &control);
+	if (!skt)
+	{
+		return FAILED;
+	}
 
 	bytes_sent = sendmsg(skt, &msg, 0);
 
-	if (bytes_sent != data.len)
+	if (bytes_sent != iov.iov_len)
 	{
 		DBG1(DBG_NET, "error writing to socket: %s", strerror(errno));
 		return FAILED;
@@ -420,6 +585,68 @@ METHOD(socket_t, sender, status_t,
 	return SUCCESS;
 }
 
+METHOD(socket_t, send_batch, status_t,
+	private_socket_default_socket_t *this, packet_t *packets[], int count)
+{
+	status_t status = SUCCESS;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[SEND_BATCH];
+	struct iovec iov[SEND_BATCH];
+	control_t control[SEND_BATCH];
+	int skts[SEND_BATCH];
+	int i, j, n, sent;
+
+	while (count > 0)
+	{
+		n = min(count, SEND_BATCH);
+		for (i = 0; i < n; i++)
+		{
+			skts[i] = prepare_send(this, packets[i], &msgs[i].msg_hdr, &iov[i],
+								   &control[i]);
+			msgs[i].msg_len = 0;
+		}
+		/* send consecutive packets using the same socket at once */
+		for (i = 0; i < n; i = j)
+		{
+			for (j = i + 1; j < n && skts[j] == skts[i]; j++)
+			{
+				/* find end of run */
+			}
+			if (!skts[i])
+			{
+				status = FAILED;
+				continue;
+			}
+			while (i < j)
+			{
+				sent = sendmmsg(skts[i], &msgs[i], j - i, 0);
+				if (sent <= 0)
+				{	/* skip the packet failing to send */
+					DBG1(DBG_NET, "error writing to socket: %s",
+						 strerror(errno));
+					status = FAILED;
+					sent = 1;
+				}
+				i += sent;
+			}
+		}
+		packets += n;
+		count -= n;
+	}
+#else /* HAVE_SENDMMSG */
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (sender(this, packets[i]) != SUCCESS)
+		{
+			status = FAILED;
+		}
+	}
+#endif /* HAVE_SENDMMSG */
+	return status;
+}
+
 METHOD(socket_t, get_port, u_int16_t,
 	private_socket_default_socket_t *this, bool nat_t)
 {
@@ -483,6 +710,15 @@ static int open_socket(private_socket_default_socket_t *this,
 		close(skt);
 		return 0;
 	}
+#ifdef SO_REUSEPORT
+	/* let multiple socket sets share the port, the kernel distributes
+	 * packets among them by hashing addresses and ports */
+	if (this->count > 1 &&
+		setsockopt(skt, SOL_SOCKET, SO_REUSEPORT, (void*)&on, sizeof(on)) < 0)
+	{
+		DBG1(DBG_NET, "unable to set SO_REUSEPORT on socket: %s", strerror(errno));
+	}
+#endif
 
 	/* bind the socket */
 	if (bind(skt, (struct sockaddr *)&addr, addrlen) < 0)
@@ -547,25 +783,100 @@ static int open_socket(private_socket_default_socket_t *this,
 	return skt;
 }
 
-METHOD(socket_t, destroy, void,
-	private_socket_default_socket_t *this)
+/**
+ * Close the sockets of a set and free its resources
+ */
+static void destroy_set(socket_set_t *set)
 {
-	if (this->ipv4)
+	if (set->ipv4)
 	{
-		close(this->ipv4);
+		close(set->ipv4);
 	}
-	if (this->ipv4_natt)
+	if (set->ipv4_natt)
 	{
-		close(this->ipv4_natt);
+		close(set->ipv4_natt);
 	}
-	if (this->ipv6)
+	if (set->ipv6)
 	{
-		close(this->ipv6);
+		close(set->ipv6);
 	}
-	if (this->ipv6_natt)
+	if (set->ipv6_natt)
 	{
-		close(this->ipv6_natt);
+		close(set->ipv6_natt);
+	}
+	DESTROY_OFFSET_IF(set->pending, offsetof(packet_t, destroy));
+	DESTROY_IF(set->mutex);
+	free(set->buffer);
+}
+
+/**
+ * Open an additional set of sockets on the ports of the first set
+ */
+static bool open_set(private_socket_default_socket_t *this, socket_set_t *set)
+{
+	socket_set_t *first = &this->sets[0];
+
+	if (first->ipv6)
+	{
+		set->ipv6 = open_socket(this, AF_INET6, &this->port);
+		if (!set->ipv6)
+		{
+			return FALSE;
+		}
+	}
+	if (first->ipv6_natt)
+	{
+		set->ipv6_natt = open_socket(this, AF_INET6, &this->natt);
+		if (!set->ipv6_natt)
+		{
+			return FALSE;
+		}
 	}
+	if (first->ipv4)
+	{
+		set->ipv4 = open_socket(this, AF_INET, &this->port);
+		if (!set->ipv4)
+		{
+			return FALSE;
+		}
+	}
+	if (first->ipv4_natt)
+	{
+		set->ipv4_natt = open_socket(this, AF_INET, &this->natt);
+		if (!set->ipv4_natt)
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Allocate the receive resources of a set
+ */
+static void init_set(private_socket_default_socket_t *this, socket_set_t *set)
+{
+	set->pending = linked_list_create();
+	set->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+#ifdef HAVE_RECVMMSG
+	set->buffer = malloc(RECV_BATCH * this->max_packet);
+#else
+	set->buffer = malloc(this->max_packet);
+#endif
+}
+
+METHOD(socket_t, destroy, void,
+	private_socket_default_socket_t *this)
+{
+	int i;
+
+	for (i = 0; i < this->count; i++)
+	{
+		destroy_set(&this->sets[i]);
+	}
+	free(this->sets);
+	DESTROY_IF(this->set);
+	DESTROY_IF(this->mutex);
 	free(this);
 }
 
@@ -575,11 +886,14 @@ METHOD(socket_t, destroy, void,
 socket_default_socket_t *socket_default_socket_create()
 {
 	private_socket_default_socket_t *this;
+	socket_set_t *first;
+	int i;
 
 	INIT(this,
 		.public = {
 			.socket = {
 				.send = _sender,
+				.send_batch = _send_batch,
 				.receive = _receiver,
 				.get_port = _get_port,
 				.destroy = _destroy,
@@ -594,6 +908,8 @@ socket_default_socket_t *socket_default_socket_create()
 		.set_source = lib->settings->get_bool(lib->settings,
 							"%s.plugins.socket-default.set_source", TRUE,
 							charon->name),
+		.count = max(1, lib->settings->get_int(lib->settings,
+							"%s.receiver_threads", 1, charon->name)),
 	);
 
 	if (this->port && this->port == this->natt)
@@ -602,44 +918,68 @@ socket_default_socket_t *socket_default_socket_create()
 			 "port randomly");
 		this->natt = 0;
 	}
+#ifndef SO_REUSEPORT
+	if (this->count > 1)
+	{
+		DBG1(DBG_NET, "SO_REUSEPORT not supported, using a single socket set");
+		this->count = 1;
+	}
+#endif
+	this->sets = calloc(this->count, sizeof(socket_set_t));
+	first = &this->sets[0];
 
 	/* we allocate IPv6 sockets first as that will reserve randomly allocated
 	 * ports also for IPv4 */
-	this->ipv6 = open_socket(this, AF_INET6, &this->port);
-	if (this->ipv6 == 0)
+	first->ipv6 = open_socket(this, AF_INET6, &this->port);
+	if (first->ipv6 == 0)
 	{
 		DBG1(DBG_NET, "could not open IPv6 socket, IPv6 disabled");
 	}
 	else
 	{
-		this->ipv6_natt = open_socket(this, AF_INET6, &this->natt);
-		if (this->ipv6_natt == 0)
+		first->ipv6_natt = open_socket(this, AF_INET6, &this->natt);
+		if (first->ipv6_natt == 0)
 		{
 			DBG1(DBG_NET, "could not open IPv6 NAT-T socket");
 		}
 	}
 
-	this->ipv4 = open_socket(this, AF_INET, &this->port);
-	if (this->ipv4 == 0)
+	first->ipv4 = open_socket(this, AF_INET, &this->port);
+	if (first->ipv4 == 0)
 	{
 		DBG1(DBG_NET, "could not open IPv4 socket, IPv4 disabled");
 	}
 	else
 	{
-		this->ipv4_natt = open_socket(this, AF_INET, &this->natt);
-		if (this->ipv4_natt == 0)
+		first->ipv4_natt = open_socket(this, AF_INET, &this->natt);
+		if (first->ipv4_natt == 0)
 		{
 			DBG1(DBG_NET, "could not open IPv4 NAT-T socket");
 		}
 	}
 
-	if (!this->ipv4 && !this->ipv6)
+	if (!first->ipv4 && !first->ipv6)
 	{
 		DBG1(DBG_NET, "could not create any sockets");
 		destroy(this);
 		return NULL;
 	}
+	init_set(this, first);
+
+	for (i = 1; i < this->count; i++)
+	{
+		if (!open_set(this, &this->sets[i]))
+		{
+			DBG1(DBG_NET, "could not open socket set %d, using %d sets",
+				 i + 1, i);
+			destroy_set(&this->sets[i]);
+			this->count = i;
+			break;
+		}
+		init_set(this, &this->sets[i]);
+	}
+	this->set = thread_value_create(NULL);
+	this->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
 
 	return &this->public;
 }
-
@@ -1056,6 +1056,7 @@ METHOD(stroke_config_t, add, void,
 		this->mutex->lock(this->mutex);
 		this->list->insert_last(this->list, peer_cfg);
 		this->mutex->unlock(this->mutex);
+		charon->backends->changed(charon->backends, &this->public.backend);
 	}
 }
 
@@ -1103,6 +1104,7 @@ METHOD(stroke_config_t, del, void,
 
 	if (deleted)
 	{
+		charon->backends->changed(charon->backends, &this->public.backend);
 		DBG1(DBG_CFG, "deleted connection '%s'", msg->del_conn.name);
 	}
 	else
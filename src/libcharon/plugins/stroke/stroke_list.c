@@ -458,7 +458,7 @@ METHOD(stroke_list_t, status, void,
 		host_t *host;
 		u_int32_t dpd;
 		time_t since, now;
-		u_int size, online, offline, i;
+		u_int size, online, offline, i, j;
 		struct utsname utsname;
 
 		now = time_monotonic(NULL);
@@ -496,6 +496,70 @@ METHOD(stroke_list_t, status, void,
 		}
 		fprintf(out, ", scheduled: %d\n",
 				lib->scheduler->get_job_load(lib->scheduler));
+		for (j = 0; j < lib->processor->get_queue_count(lib->processor); j++)
+		{
+			u_int steals;
+
+			fprintf(out, "  job queue %d: ", j);
+			for (i = 0; i < JOB_PRIO_MAX; i++)
+			{
+				fprintf(out, "%s%d", i == 0 ? "" : "/",
+						lib->processor->get_queue_load(lib->processor, j, i,
+													   &steals));
+			}
+			fprintf(out, ", %u stolen\n", steals);
+		}
+		{
+			u_int queued, peak, batches, packets;
+
+			charon->sender->get_stats(charon->sender, &queued, &peak,
+									  &batches, &packets);
+			fprintf(out, "  send queue: %u, peak %u, %u packets in %u "
+					"batches\n", queued, peak, packets, batches);
+		}
+		{
+			file_logger_t *logger;
+			u_int dropped = 0;
+
+			enumerator = charon->file_loggers->create_enumerator(
+														charon->file_loggers);
+			while (enumerator->enumerate(enumerator, &logger))
+			{
+				dropped += logger->get_dropped(logger);
+			}
+			enumerator->destroy(enumerator);
+			if (dropped)
+			{
+				fprintf(out, "  dropped log messages: %u\n", dropped);
+			}
+		}
+		{
+			listener_t *listener;
+			u_int calls, max_usec;
+			u_int64_t usec;
+
+			enumerator = charon->bus->create_listener_enumerator(charon->bus);
+			while (enumerator->enumerate(enumerator, &listener, &calls,
+										 &usec, &max_usec))
+			{
+				if (calls)
+				{
+					fprintf(out, "  listener %p: %u calls, %ums, max %uus\n",
+							listener, calls, (u_int)(usec / 1000), max_usec);
+				}
+			}
+			enumerator->destroy(enumerator);
+		}
+		{
+			u_int hits, misses, evictions;
+
+			if (lib->credmgr->get_cache_stats(lib->credmgr, &hits, &misses,
+											  &evictions))
+			{
+				fprintf(out, "  certificate cache: %u hits, %u misses, "
+						"%u evictions\n", hits, misses, evictions);
+			}
+		}
 		fprintf(out, "  loaded plugins: %s\n",
 				lib->plugins->loaded_plugins(lib->plugins));
 
@@ -1239,6 +1303,9 @@ static void list_algs(FILE *out)
 	diffie_hellman_group_t group;
 	rng_quality_t quality;
 	const char *plugin_name;
+	u_int depth, hits, misses;
+	char stats[64];
+	bool first;
 	int len;
 
 	fprintf(out, "\n");
@@ -1291,6 +1358,25 @@ static void list_algs(FILE *out)
 		print_alg(out, &len, diffie_hellman_group_names, group, plugin_name);
 	}
 	enumerator->destroy(enumerator);
+	first = TRUE;
+	enumerator = lib->crypto->create_dh_enumerator(lib->crypto);
+	while (enumerator->enumerate(enumerator, &group, &plugin_name))
+	{
+		if (lib->crypto->get_dh_pool_stats(lib->crypto, group, &depth,
+										   &hits, &misses))
+		{
+			if (first)
+			{
+				fprintf(out, "\n  dh-pool:   ");
+				len = 13;
+				first = FALSE;
+			}
+			snprintf(stats, sizeof(stats), "%u pooled, %u hits, %u misses",
+					 depth, hits, misses);
+			print_alg(out, &len, diffie_hellman_group_names, group, stats);
+		}
+	}
+	enumerator->destroy(enumerator);
 	fprintf(out, "\n  random-gen:");
 	len = 13;
 	enumerator = lib->crypto->create_rng_enumerator(lib->crypto);
@@ -193,6 +193,47 @@ bool test_id_equals()
 	return TRUE;
 }
 
+/*******************************************************************************
+ * identification hash test
+ ******************************************************************************/
+
+static bool test_id_hash_one(char *a_str, char *b_str)
+{
+	identification_t *a, *b;
+	bool good;
+
+	a = identification_create_from_string(a_str);
+	b = identification_create_from_string(b_str);
+	good = a->get_type(a) == b->get_type(b) && a->equals(a, b) &&
+		   a->hash(a, 0) == b->hash(b, 0) && a->hash(a, 42) == b->hash(b, 42);
+	a->destroy(a);
+	b->destroy(b);
+	return good;
+}
+
+bool test_id_hash()
+{
+	if (!test_id_hash_one("moon.strongswan.org", "MOON.strongSwan.org"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("martin@strongswan.org", "Martin@StrongSwan.ORG"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("C=CH, E=martin@strongswan.org, CN=martin",
+						  "C=ch, E=martin@STRONGSWAN.ORG, CN=Martin"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("C=CH, O=strongSwan, CN=moon.strongswan.org",
+						  "C=CH, O=STRONGSWAN, CN=Moon.StrongSwan.Org"))
+	{
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /*******************************************************************************
  * identification matches test
  ******************************************************************************/
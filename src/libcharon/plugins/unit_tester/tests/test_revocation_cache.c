@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <daemon.h>
+#include <credentials/certificates/x509.h>
+#include <plugins/revocation/revocation_cache.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#define CACHEDIR "/tmp/strongswan-test-revocation"
+
+/* layout of the index file, see revocation_cache.c */
+#define INDEX_FILE CACHEDIR "/index"
+#define HEADER_COUNT 8
+#define HEADER_LEN 16
+#define RECORD_TYPE 16
+#define RECORD_SERIAL_LEN 18
+#define RECORD_LEN 88
+
+/**
+ * Remove all files in the cache directory, returns the number of CRL files
+ */
+static int clean_dir(bool remove)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	int crls = 0;
+	DIR *dir;
+
+	dir = opendir(CACHEDIR);
+	if (!dir)
+	{
+		return 0;
+	}
+	while ((entry = readdir(dir)))
+	{
+		if (strstr(entry->d_name, ".crl"))
+		{
+			crls++;
+		}
+		if (remove && entry->d_name[0] != '.')
+		{
+			snprintf(path, sizeof(path), "%s/%s", CACHEDIR, entry->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dir);
+	if (remove)
+	{
+		rmdir(CACHEDIR);
+	}
+	return crls;
+}
+
+/**
+ * Read or write a u_int8_t/u_int32_t field in the index file
+ */
+static bool access_index(off_t offset, void *value, size_t len, bool write)
+{
+	bool ok;
+	int fd;
+
+	fd = open(INDEX_FILE, O_RDWR);
+	if (fd == -1)
+	{
+		return FALSE;
+	}
+	if (write)
+	{
+		ok = pwrite(fd, value, len, offset) == len;
+	}
+	else
+	{
+		ok = pread(fd, value, len, offset) == len;
+	}
+	close(fd);
+	return ok;
+}
+
+/**
+ * Get the number of records in the index header
+ */
+static u_int32_t get_count()
+{
+	u_int32_t count = 0;
+
+	access_index(HEADER_COUNT, &count, sizeof(count), FALSE);
+	return count;
+}
+
+/**
+ * Create a CRL of a CA with the given DN
+ */
+static certificate_t *create_crl(private_key_t *key, char *dn,
+								 time_t this_update, time_t next_update)
+{
+	public_key_t *public;
+	identification_t *id;
+	certificate_t *ca, *crl = NULL;
+
+	public = key->get_public_key(key);
+	id = identification_create_from_string(dn);
+	ca = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+					BUILD_SIGNING_KEY, key, BUILD_PUBLIC_KEY, public,
+					BUILD_SUBJECT, id, BUILD_SERIAL, chunk_from_chars(0x01),
+					BUILD_X509_FLAG, X509_CA, BUILD_END);
+	if (ca)
+	{
+		crl = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509_CRL,
+					BUILD_SIGNING_KEY, key, BUILD_SIGNING_CERT, ca,
+					BUILD_NOT_BEFORE_TIME, this_update,
+					BUILD_NOT_AFTER_TIME, next_update,
+					BUILD_SERIAL, chunk_from_chars(0x01), BUILD_END);
+		ca->destroy(ca);
+	}
+	id->destroy(id);
+	DESTROY_IF(public);
+	return crl;
+}
+
+/**
+ * Count the valid CRLs a cache provides for an issuer, or all if NULL
+ */
+static int count_crls(revocation_cache_t *cache, char *dn)
+{
+	enumerator_t *enumerator;
+	identification_t *id = NULL;
+	certificate_t *cert;
+	int count = 0;
+
+	if (dn)
+	{
+		id = identification_create_from_string(dn);
+	}
+	enumerator = cache->set.create_cert_enumerator(&cache->set,
+										CERT_X509_CRL, KEY_ANY, id, FALSE);
+	while (enumerator && enumerator->enumerate(enumerator, &cert))
+	{
+		count++;
+	}
+	DESTROY_IF(enumerator);
+	DESTROY_IF(id);
+	return count;
+}
+
+/**
+ * Check cache sharing and pruning with two instances on the same directory
+ */
+static bool test_shared(certificate_t *a, certificate_t *b, certificate_t *c)
+{
+	revocation_cache_t *first, *second;
+	bool good = TRUE;
+
+	first = revocation_cache_create(CACHEDIR);
+	if (!first)
+	{
+		return FALSE;
+	}
+	first->set.cache_cert(&first->set, a);
+	first->set.cache_cert(&first->set, b);
+	if (clean_dir(FALSE) != 2 || get_count() != 2 ||
+		count_crls(first, "C=CH, CN=A") != 1 ||
+		count_crls(first, "C=CH, CN=B") != 0)
+	{
+		good = FALSE;
+	}
+	/* opening the index again prunes the expired CRL and its file */
+	second = revocation_cache_create(CACHEDIR);
+	if (!second)
+	{
+		first->destroy(first);
+		return FALSE;
+	}
+	if (clean_dir(FALSE) != 1 || get_count() != 1 ||
+		count_crls(second, "C=CH, CN=A") != 1 ||
+		count_crls(first, "C=CH, CN=A") != 1)
+	{
+		good = FALSE;
+	}
+	/* records appended by one instance are seen by the other */
+	first->set.cache_cert(&first->set, c);
+	if (count_crls(second, "C=CH, CN=C") != 1 ||
+		count_crls(second, NULL) != 2)
+	{
+		good = FALSE;
+	}
+	second->destroy(second);
+	first->destroy(first);
+	return good;
+}
+
+/**
+ * Check that invalid records are skipped and an invalid header resets
+ */
+static bool test_corrupted(certificate_t *a)
+{
+	revocation_cache_t *cache;
+	u_int32_t count = 100000;
+	u_int8_t value;
+
+	/* two records left by test_shared() */
+	value = 7;
+	if (get_count() != 2 ||
+		!access_index(HEADER_LEN + RECORD_TYPE, &value, 1, TRUE))
+	{
+		return FALSE;
+	}
+	value = 3;
+	if (!access_index(HEADER_LEN + RECORD_LEN + RECORD_TYPE, &value, 1, TRUE))
+	{
+		return FALSE;
+	}
+	value = 200;
+	if (!access_index(HEADER_LEN + RECORD_LEN + RECORD_SERIAL_LEN,
+					  &value, 1, TRUE))
+	{
+		return FALSE;
+	}
+	cache = revocation_cache_create(CACHEDIR);
+	if (!cache)
+	{
+		return FALSE;
+	}
+	if (count_crls(cache, NULL) != 0 || get_count() != 0)
+	{
+		cache->destroy(cache);
+		return FALSE;
+	}
+	cache->set.cache_cert(&cache->set, a);
+	cache->destroy(cache);
+
+	/* a count not covered by the file resets the index */
+	if (get_count() != 1 ||
+		!access_index(HEADER_COUNT, &count, sizeof(count), TRUE))
+	{
+		return FALSE;
+	}
+	cache = revocation_cache_create(CACHEDIR);
+	if (!cache)
+	{
+		return FALSE;
+	}
+	if (get_count() != 0 || count_crls(cache, NULL) != 0)
+	{
+		cache->destroy(cache);
+		return FALSE;
+	}
+	cache->set.cache_cert(&cache->set, a);
+	if (count_crls(cache, "C=CH, CN=A") != 1)
+	{
+		cache->destroy(cache);
+		return FALSE;
+	}
+	cache->destroy(cache);
+	return TRUE;
+}
+
+/*******************************************************************************
+ * persistent revocation cache test
+ ******************************************************************************/
+bool test_revocation_cache()
+{
+	certificate_t *a, *b, *c;
+	private_key_t *key;
+	time_t now;
+	bool good;
+
+	key = lib->creds->create(lib->creds, CRED_PRIVATE_KEY, KEY_RSA,
+							 BUILD_KEY_SIZE, 1024, BUILD_END);
+	if (!key)
+	{
+		return FALSE;
+	}
+	now = time(NULL);
+	a = create_crl(key, "C=CH, CN=A", now, now + 3600);
+	b = create_crl(key, "C=CH, CN=B", now - 7200, now - 3600);
+	c = create_crl(key, "C=CH, CN=C", now, now + 3600);
+	key->destroy(key);
+
+	clean_dir(TRUE);
+	good = a && b && c && test_shared(a, b, c) && test_corrupted(a);
+	clean_dir(TRUE);
+
+	DESTROY_IF(a);
+	DESTROY_IF(b);
+	DESTROY_IF(c);
+	return good;
+}
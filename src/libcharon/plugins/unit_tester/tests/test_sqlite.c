@@ -16,6 +16,7 @@
 #include <library.h>
 #include <daemon.h>
 #include <utils/enumerator.h>
+#include <threading/thread.h>
 
 #include <unistd.h>
 
@@ -91,3 +92,228 @@ bool test_sqlite()
 	return TRUE;
 }
 
+
+/**
+ * Count the rows of a query returning a single integer column, -1 on error
+ */
+static int count_rows(database_t *db, char *sql, int *sum)
+{
+	enumerator_t *enumerator;
+	int value, rows = 0;
+
+	enumerator = db->query(db, sql, DB_INT);
+	if (!enumerator)
+	{
+		return -1;
+	}
+	*sum = 0;
+	while (enumerator->enumerate(enumerator, &value))
+	{
+		*sum += value;
+		rows++;
+	}
+	enumerator->destroy(enumerator);
+	return rows;
+}
+
+/*******************************************************************************
+ * sqlite statement cache test
+ ******************************************************************************/
+bool test_sqlite_stmt_cache()
+{
+	database_t *db;
+	enumerator_t *outer, *inner;
+	int i, value, rows = 0, nested, sum;
+	bool good = TRUE;
+
+	/* fewer cache slots than statements used */
+	lib->settings->set_int(lib->settings,
+						   "libstrongswan.plugins.sqlite.statement_cache", 3);
+	db = lib->db->create(lib->db, "sqlite://" DBFILE);
+	lib->settings->set_int(lib->settings,
+						   "libstrongswan.plugins.sqlite.statement_cache", 32);
+	if (!db)
+	{
+		return FALSE;
+	}
+	if (db->execute(db, NULL, "CREATE TABLE test (value INTEGER)") < 0)
+	{
+		good = FALSE;
+	}
+	/* reuse cached statements with different bindings */
+	for (i = 1; good && i <= 10; i++)
+	{
+		if (db->execute(db, NULL, "INSERT INTO test (value) VALUES (?)",
+						DB_INT, i) != 1 ||
+			count_rows(db, "SELECT value FROM test", &sum) != i ||
+			sum != i * (i + 1) / 2)
+		{
+			good = FALSE;
+		}
+	}
+	/* a cached statement in use by an active query gets prepared again */
+	outer = good ? db->query(db, "SELECT value FROM test", DB_INT) : NULL;
+	if (!outer)
+	{
+		good = FALSE;
+	}
+	while (good && outer->enumerate(outer, &value))
+	{
+		rows++;
+		inner = db->query(db, "SELECT value FROM test", DB_INT);
+		if (!inner)
+		{
+			good = FALSE;
+			break;
+		}
+		nested = 0;
+		while (inner->enumerate(inner, &sum))
+		{
+			nested++;
+		}
+		inner->destroy(inner);
+		if (nested != 10)
+		{
+			good = FALSE;
+		}
+	}
+	DESTROY_IF(outer);
+	if (rows != 10)
+	{
+		good = FALSE;
+	}
+	/* cached statements stay usable after schema changes */
+	if (good &&
+		(db->execute(db, NULL, "DROP TABLE test") < 0 ||
+		 db->execute(db, NULL, "CREATE TABLE test (other TEXT, "
+						"value INTEGER)") < 0 ||
+		 db->execute(db, NULL, "INSERT INTO test (value) VALUES (?)",
+					 DB_INT, 42) != 1 ||
+		 count_rows(db, "SELECT value FROM test", &sum) != 1 || sum != 42))
+	{
+		good = FALSE;
+	}
+	db->destroy(db);
+	unlink(DBFILE);
+	return good;
+}
+
+/**
+ * Query data passed to a thread
+ */
+typedef struct {
+	database_t *db;
+	char *sql;
+	int result;
+} query_data_t;
+
+/**
+ * Execute a statement in a separate thread
+ */
+static void *execute_thread(query_data_t *data)
+{
+	data->result = data->db->execute(data->db, NULL, data->sql);
+	return NULL;
+}
+
+/**
+ * Start a query in a separate thread, keeping its connection busy
+ */
+static void *query_thread(query_data_t *data)
+{
+	return data->db->query(data->db, data->sql, DB_INT);
+}
+
+/**
+ * Run a thread function for a statement, return its result
+ */
+static void *run_thread(database_t *db, void *(*function)(query_data_t*),
+						char *sql, int *result)
+{
+	query_data_t data = {
+		.db = db,
+		.sql = sql,
+		.result = -1,
+	};
+	thread_t *thread;
+	void *ret;
+
+	thread = thread_create((thread_main_t)function, &data);
+	ret = thread->join(thread);
+	if (result)
+	{
+		*result = data.result;
+	}
+	return ret;
+}
+
+/*******************************************************************************
+ * sqlite connection pool test
+ ******************************************************************************/
+bool test_sqlite_pool()
+{
+	database_t *db;
+	enumerator_t *busy1, *busy2;
+	int result, sum;
+	bool good = TRUE;
+
+	lib->settings->set_int(lib->settings,
+						   "libstrongswan.plugins.sqlite.pool_size", 2);
+	db = lib->db->create(lib->db, "sqlite://" DBFILE);
+	lib->settings->set_int(lib->settings,
+						   "libstrongswan.plugins.sqlite.pool_size", 1);
+	if (!db)
+	{
+		return FALSE;
+	}
+	/* TEMP tables are visible to the connection creating them only, which
+	 * tells which connection a thread uses */
+	if (db->execute(db, NULL, "CREATE TABLE test (value INTEGER)") < 0 ||
+		db->execute(db, NULL, "INSERT INTO test (value) VALUES (1)") != 1 ||
+		db->execute(db, NULL, "BEGIN") < 0 ||
+		db->execute(db, NULL, "CREATE TEMP TABLE own (value INTEGER)") < 0)
+	{
+		good = FALSE;
+	}
+	/* the open transaction pins the first connection to this thread, so
+	 * another thread gets the second one */
+	if (good)
+	{
+		run_thread(db, execute_thread, "DELETE FROM own WHERE 0", &result);
+		if (result >= 0 ||
+			run_thread(db, execute_thread,
+					   "CREATE TEMP TABLE other (value INTEGER)", &result) ||
+			result < 0)
+		{
+			good = FALSE;
+		}
+	}
+	if (good &&
+		(db->execute(db, NULL, "INSERT INTO own (value) VALUES (2)") != 1 ||
+		 db->execute(db, NULL, "COMMIT") < 0 ||
+		 count_rows(db, "SELECT value FROM own", &sum) != 1 || sum != 2))
+	{
+		good = FALSE;
+	}
+	/* with both connections busy, another thread shares one of them
+	 * instead of opening a third one without the TEMP tables */
+	if (good)
+	{
+		busy1 = db->query(db, "SELECT value FROM test", DB_INT);
+		busy2 = run_thread(db, query_thread, "SELECT value FROM test", NULL);
+		run_thread(db, execute_thread, "DELETE FROM own WHERE 0", &result);
+		if (result < 0)
+		{
+			run_thread(db, execute_thread, "DELETE FROM other WHERE 0", &result);
+		}
+		if (!busy1 || !busy2 || result < 0)
+		{
+			good = FALSE;
+		}
+		DESTROY_IF(busy1);
+		DESTROY_IF(busy2);
+	}
+	db->destroy(db);
+	unlink(DBFILE);
+	return good;
+}
@@ -54,6 +54,26 @@ ENUM(ike_sa_state_names, IKE_CREATED, IKE_DESTROYING,
 typedef struct private_ike_sa_t private_ike_sa_t;
 typedef struct attribute_entry_t attribute_entry_t;
 
+/**
+ * Jobs an IKE_SA schedules for itself
+ */
+typedef enum {
+	/** send a NAT keepalive */
+	IKE_SA_JOB_KEEPALIVE,
+	/** check liveness of peer */
+	IKE_SA_JOB_DPD,
+	/** rekey the IKE_SA */
+	IKE_SA_JOB_REKEY,
+	/** reauthenticate the IKE_SA */
+	IKE_SA_JOB_REAUTH,
+	/** delete the IKE_SA after its maximum lifetime */
+	IKE_SA_JOB_DELETE,
+	/** retry a deferred initiation */
+	IKE_SA_JOB_RETRY_INITIATE,
+	/** number of job kinds */
+	IKE_SA_JOB_MAX,
+} ike_sa_job_t;
+
 /**
  * Private data of an ike_sa_t object.
  */
@@ -251,6 +271,11 @@ struct private_ike_sa_t {
 	 * Flush auth configs once established?
 	 */
 	bool flush_auth_cfg;
+
+	/**
+	 * Scheduled jobs, by ike_sa_job_t
+	 */
+	scheduler_id_t jobs[IKE_SA_JOB_MAX];
 };
 
 /**
@@ -455,10 +480,48 @@ METHOD(ike_sa_t, set_message_id, void,
 	}
 }
 
+/**
+ * Schedule a job of this IKE_SA, replacing a pending job of the same kind
+ */
+static void schedule_job(private_ike_sa_t *this, ike_sa_job_t kind,
+						 u_int32_t s)
+{
+	job_t *job;
+
+	if (this->jobs[kind] &&
+		lib->scheduler->reschedule(lib->scheduler, this->jobs[kind], s))
+	{
+		return;
+	}
+	switch (kind)
+	{
+		case IKE_SA_JOB_KEEPALIVE:
+			job = (job_t*)send_keepalive_job_create(this->ike_sa_id);
+			break;
+		case IKE_SA_JOB_DPD:
+			job = (job_t*)send_dpd_job_create(this->ike_sa_id);
+			break;
+		case IKE_SA_JOB_REKEY:
+			job = (job_t*)rekey_ike_sa_job_create(this->ike_sa_id, FALSE);
+			break;
+		case IKE_SA_JOB_REAUTH:
+			job = (job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE);
+			break;
+		case IKE_SA_JOB_DELETE:
+			job = (job_t*)delete_ike_sa_job_create(this->ike_sa_id, TRUE);
+			break;
+		case IKE_SA_JOB_RETRY_INITIATE:
+			job = (job_t*)retry_initiate_job_create(this->ike_sa_id);
+			break;
+		default:
+			return;
+	}
+	this->jobs[kind] = lib->scheduler->schedule_job(lib->scheduler, job, s);
+}
+
 METHOD(ike_sa_t, send_keepalive, void,
 	private_ike_sa_t *this)
 {
-	send_keepalive_job_t *job;
 	time_t last_out, now, diff;
 
 	if (!(this->conditions & COND_NAT_HERE) || this->keepalive_interval == 0)
@@ -487,9 +550,7 @@ METHOD(ike_sa_t, send_keepalive, void,
 		charon->sender->send_no_marker(charon->sender, packet);
 		diff = 0;
 	}
-	job = send_keepalive_job_create(this->ike_sa_id);
-	lib->scheduler->schedule_job(lib->scheduler, (job_t*)job,
-								 this->keepalive_interval - diff);
+	schedule_job(this, IKE_SA_JOB_KEEPALIVE, this->keepalive_interval - diff);
 }
 
 METHOD(ike_sa_t, get_ike_cfg, ike_cfg_t*,
@@ -573,7 +634,6 @@ METHOD(ike_sa_t, set_condition, void,
 METHOD(ike_sa_t, send_dpd, status_t,
 	private_ike_sa_t *this)
 {
-	job_t *job;
 	time_t diff, delay;
 	bool task_queued = FALSE;
 
@@ -606,8 +666,7 @@ METHOD(ike_sa_t, send_dpd, status_t,
 	/* recheck in "interval" seconds */
 	if (delay)
 	{
-		job = (job_t*)send_dpd_job_create(this->ike_sa_id);
-		lib->scheduler->schedule_job(lib->scheduler, job, delay - diff);
+		schedule_job(this, IKE_SA_JOB_DPD, delay - diff);
 	}
 	if (task_queued)
 	{
@@ -639,7 +698,6 @@ METHOD(ike_sa_t, set_state, void,
 			if (this->state == IKE_CONNECTING ||
 				this->state == IKE_PASSIVE)
 			{
-				job_t *job;
 				u_int32_t t;
 
 				/* calculate rekey, reauth and lifetime */
@@ -652,8 +710,7 @@ METHOD(ike_sa_t, set_state, void,
 					(this->stats[STAT_REKEY] > t + this->stats[STAT_ESTABLISHED])))
 				{
 					this->stats[STAT_REKEY] = t + this->stats[STAT_ESTABLISHED];
-					job = (job_t*)rekey_ike_sa_job_create(this->ike_sa_id, FALSE);
-					lib->scheduler->schedule_job(lib->scheduler, job, t);
+					schedule_job(this, IKE_SA_JOB_REKEY, t);
 					DBG1(DBG_IKE, "scheduling rekeying in %ds", t);
 				}
 				t = this->peer_cfg->get_reauth_time(this->peer_cfg, TRUE);
@@ -661,8 +718,7 @@ METHOD(ike_sa_t, set_state, void,
 					(this->stats[STAT_REAUTH] > t + this->stats[STAT_ESTABLISHED])))
 				{
 					this->stats[STAT_REAUTH] = t + this->stats[STAT_ESTABLISHED];
-					job = (job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE);
-					lib->scheduler->schedule_job(lib->scheduler, job, t);
+					schedule_job(this, IKE_SA_JOB_REAUTH, t);
 					DBG1(DBG_IKE, "scheduling reauthentication in %ds", t);
 				}
 				t = this->peer_cfg->get_over_time(this->peer_cfg);
@@ -683,8 +739,7 @@ METHOD(ike_sa_t, set_state, void,
 					}
 					this->stats[STAT_DELETE] += t;
 					t = this->stats[STAT_DELETE] - this->stats[STAT_ESTABLISHED];
-					job = (job_t*)delete_ike_sa_job_create(this->ike_sa_id, TRUE);
-					lib->scheduler->schedule_job(lib->scheduler, job, t);
+					schedule_job(this, IKE_SA_JOB_DELETE, t);
 					DBG1(DBG_IKE, "maximum IKE_SA lifetime %ds", t);
 				}
 				trigger_dpd = this->peer_cfg->get_dpd(this->peer_cfg);
@@ -1182,9 +1237,8 @@ METHOD(ike_sa_t, initiate, status_t,
 	{
 		if (!this->retry_initiate_queued)
 		{
-			job_t *job = (job_t*)retry_initiate_job_create(this->ike_sa_id);
-			lib->scheduler->schedule_job(lib->scheduler, (job_t*)job,
-										 this->retry_initiate_interval);
+			schedule_job(this, IKE_SA_JOB_RETRY_INITIATE,
+						 this->retry_initiate_interval);
 			this->retry_initiate_queued = TRUE;
 		}
 		return SUCCESS;
@@ -1766,9 +1820,7 @@ METHOD(ike_sa_t, set_auth_lifetime, status_t,
 		{
 			DBG1(DBG_IKE, "received AUTH_LIFETIME of %ds, scheduling "
 				 "reauthentication in %ds", lifetime, lifetime - diff);
-			lib->scheduler->schedule_job(lib->scheduler,
-						(job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE),
-						lifetime - diff);
+			schedule_job(this, IKE_SA_JOB_REAUTH, lifetime - diff);
 		}
 	}
 	else
@@ -2036,10 +2088,8 @@ METHOD(ike_sa_t, inherit, void,
 		this->stats[STAT_DELETE] = this->stats[STAT_REAUTH] + delete;
 		DBG1(DBG_IKE, "rescheduling reauthentication in %ds after rekeying, "
 			 "lifetime reduced to %ds", reauth, delete);
-		lib->scheduler->schedule_job(lib->scheduler,
-				(job_t*)rekey_ike_sa_job_create(this->ike_sa_id, TRUE), reauth);
-		lib->scheduler->schedule_job(lib->scheduler,
-				(job_t*)delete_ike_sa_job_create(this->ike_sa_id, TRUE), delete);
+		schedule_job(this, IKE_SA_JOB_REAUTH, reauth);
+		schedule_job(this, IKE_SA_JOB_DELETE, delete);
 	}
 }
 
@@ -2048,9 +2098,18 @@ METHOD(ike_sa_t, destroy, void,
 {
 	attribute_entry_t *entry;
 	host_t *vip;
+	int i;
 
 	charon->bus->set_sa(charon->bus, &this->public);
 
+	for (i = 0; i < IKE_SA_JOB_MAX; i++)
+	{
+		if (this->jobs[i])
+		{
+			lib->scheduler->cancel(lib->scheduler, this->jobs[i]);
+		}
+	}
+
 	set_state(this, IKE_DESTROYING);
 	DESTROY_IF(this->task_manager);
 
@@ -27,6 +27,7 @@
 #include <threading/mutex.h>
 #include <threading/rwlock.h>
 #include <utils/linked_list.h>
+#include <utils/hashtable.h>
 #include <crypto/hashers/hasher.h>
 
 /* the default size of the hash table (MUST be a power of 2) */
@@ -38,6 +39,9 @@
 /* the default number of segments (MUST be a power of 2) */
 #define DEFAULT_SEGMENT_COUNT 1
 
+/* the number of IDs initially copied from the secondary index per lookup */
+#define INDEX_BATCH 4
+
 typedef struct entry_t entry_t;
 
 /**
@@ -111,8 +115,81 @@ struct entry_t {
 	 * message ID currently processing, if any
 	 */
 	u_int32_t message_id;
+
+	/**
+	 * keys this SA is currently registered with in the index, as index_key_t
+	 */
+	linked_list_t *index_keys;
+};
+
+typedef enum index_type_t index_type_t;
+
+/**
+ * Type of the secondary index keys to look up IKE_SAs
+ */
+enum index_type_t {
+	/** name of the IKE_SA, i.e. the name of its peer_cfg */
+	INDEX_IKE_NAME,
+	/** remote address and port of the ike_cfg used by the IKE_SA */
+	INDEX_IKE_CFG,
+	/** unique ID of the IKE_SA */
+	INDEX_UNIQUE_ID,
+	/** name of a CHILD_SA of the IKE_SA */
+	INDEX_CHILD_NAME,
+	/** reqid of a CHILD_SA of the IKE_SA */
+	INDEX_REQID,
+};
+
+typedef struct index_key_t index_key_t;
+
+/**
+ * Key of the secondary index
+ */
+struct index_key_t {
+	/** type of this key */
+	index_type_t type;
+
+	/** name or address, for name based key types */
+	char *name;
+
+	/** unique ID, reqid or port */
+	u_int32_t id;
 };
 
+/**
+ * Destroy an index key
+ */
+static void index_key_destroy(index_key_t *this)
+{
+	free(this->name);
+	free(this);
+}
+
+/**
+ * Hash function for index keys
+ */
+static u_int index_key_hash(index_key_t *key)
+{
+	u_int hash;
+
+	hash = chunk_hash(chunk_from_thing(key->type));
+	if (key->name)
+	{
+		hash = chunk_hash_inc(chunk_create(key->name, strlen(key->name)), hash);
+	}
+	return chunk_hash_inc(chunk_from_thing(key->id), hash);
+}
+
+/**
+ * Function that matches index_key_t objects
+ */
+static bool index_key_equals(index_key_t *a, index_key_t *b)
+{
+	return a->type == b->type && a->id == b->id &&
+		   (a->name == b->name ||
+			(a->name && b->name && streq(a->name, b->name)));
+}
+
 /**
  * Implementation of entry_t.destroy.
  */
@@ -125,6 +202,7 @@ static status_t entry_destroy(entry_t *this)
 	DESTROY_IF(this->other);
 	DESTROY_IF(this->my_id);
 	DESTROY_IF(this->other_id);
+	DESTROY_FUNCTION_IF(this->index_keys, (void*)index_key_destroy);
 	this->condvar->destroy(this->condvar);
 	free(this);
 	return SUCCESS;
@@ -150,6 +228,7 @@ static entry_t *entry_create()
 	this->half_open = FALSE;
 	this->my_id = NULL;
 	this->other_id = NULL;
+	this->index_keys = NULL;
 	this->ike_sa_id = NULL;
 	this->ike_sa = NULL;
 
@@ -271,6 +350,81 @@ struct init_hash_t {
 	u_int64_t our_spi;
 };
 
+/**
+ * Hash function for ike_sa_id_t objects in the secondary index, the
+ * responder SPI might have been set after registration and is not hashed
+ */
+static u_int index_id_hash(ike_sa_id_t *id)
+{
+	u_int64_t spi = id->get_initiator_spi(id);
+
+	return chunk_hash(chunk_from_thing(spi));
+}
+
+/**
+ * Equals function for ike_sa_id_t objects in the secondary index, matches
+ * like entry_match_by_id()
+ */
+static bool index_id_equals(ike_sa_id_t *a, ike_sa_id_t *b)
+{
+	if (a->equals(a, b))
+	{
+		return TRUE;
+	}
+	return (a->get_responder_spi(a) == 0 || b->get_responder_spi(b) == 0) &&
+			a->get_initiator_spi(a) == b->get_initiator_spi(b);
+}
+
+/**
+ * Create a hashtable for ike_sa_id_t objects in the secondary index
+ */
+static hashtable_t *index_ids_create()
+{
+	return hashtable_create((hashtable_hash_t)index_id_hash,
+							(hashtable_equals_t)index_id_equals, 8);
+}
+
+/**
+ * Destroy a hashtable created with index_ids_create() and the IDs in it
+ */
+static void index_ids_destroy(hashtable_t *ids)
+{
+	enumerator_t *enumerator;
+	ike_sa_id_t *id;
+
+	enumerator = ids->create_enumerator(ids);
+	while (enumerator->enumerate(enumerator, &id, NULL))
+	{
+		id->destroy(id);
+	}
+	enumerator->destroy(enumerator);
+	ids->destroy(ids);
+}
+
+typedef struct sa_index_t sa_index_t;
+
+/**
+ * Struct to look up IKE_SAs by a secondary index key.
+ */
+struct sa_index_t {
+	/** key of this index entry */
+	index_key_t key;
+
+	/** ike_sa_id_t objects of IKE_SAs registered with that key, as key and
+	 * value */
+	hashtable_t *sas;
+};
+
+/**
+ * Destroys an sa_index_t object.
+ */
+static void sa_index_destroy(sa_index_t *this)
+{
+	free(this->key.name);
+	index_ids_destroy(this->sas);
+	free(this);
+}
+
 typedef struct segment_t segment_t;
 
 /**
@@ -383,6 +537,16 @@ struct private_ike_sa_manager_t {
 	 */
 	segment_t *init_hashes_segments;
 
+	/**
+	 * Hash table with sa_index_t objects.
+	 */
+	table_item_t **index_table;
+
+	/**
+	 * Segments of the "index" hash table.
+	 */
+	shareable_segment_t *index_segments;
+
 	/**
 	 * RNG to get random SPIs for our side
 	 */
@@ -939,6 +1103,350 @@ static void remove_connected_peers(private_ike_sa_manager_t *this, entry_t *entr
 	lock->unlock(lock);
 }
 
+/**
+ * Register an SA with a key in the secondary index.
+ */
+static void put_index(private_ike_sa_manager_t *this, entry_t *entry,
+					  index_key_t *key)
+{
+	table_item_t *item;
+	u_int row, segment;
+	rwlock_t *lock;
+	sa_index_t *index;
+	ike_sa_id_t *id;
+
+	row = index_key_hash(key) & this->table_mask;
+	segment = row & this->segment_mask;
+	lock = this->index_segments[segment].lock;
+	lock->write_lock(lock);
+	item = this->index_table[row];
+	while (item)
+	{
+		index = item->value;
+
+		if (index_key_equals(&index->key, key))
+		{
+			break;
+		}
+		item = item->next;
+	}
+
+	if (!item)
+	{
+		INIT(index,
+			.key = {
+				.type = key->type,
+				.name = strdupnull(key->name),
+				.id = key->id,
+			},
+			.sas = index_ids_create(),
+		);
+		INIT(item,
+			.value = index,
+			.next = this->index_table[row],
+		);
+		this->index_table[row] = item;
+	}
+	if (!index->sas->get(index->sas, entry->ike_sa_id))
+	{
+		id = entry->ike_sa_id->clone(entry->ike_sa_id);
+		index->sas->put(index->sas, id, id);
+		this->index_segments[segment].count++;
+	}
+	lock->unlock(lock);
+}
+
+/**
+ * Remove the registration of an SA with a key from the secondary index.
+ */
+static void remove_index(private_ike_sa_manager_t *this, entry_t *entry,
+						 index_key_t *key)
+{
+	table_item_t *item, *prev = NULL;
+	u_int row, segment;
+	rwlock_t *lock;
+
+	row = index_key_hash(key) & this->table_mask;
+	segment = row & this->segment_mask;
+	lock = this->index_segments[segment].lock;
+	lock->write_lock(lock);
+	item = this->index_table[row];
+	while (item)
+	{
+		sa_index_t *current = item->value;
+
+		if (index_key_equals(&current->key, key))
+		{
+			ike_sa_id_t *ike_sa_id;
+
+			ike_sa_id = current->sas->remove(current->sas, entry->ike_sa_id);
+			if (ike_sa_id)
+			{
+				ike_sa_id->destroy(ike_sa_id);
+				this->index_segments[segment].count--;
+			}
+			if (current->sas->get_count(current->sas) == 0)
+			{
+				if (prev)
+				{
+					prev->next = item->next;
+				}
+				else
+				{
+					this->index_table[row] = item->next;
+				}
+				sa_index_destroy(current);
+				free(item);
+			}
+			break;
+		}
+		prev = item;
+		item = item->next;
+	}
+	lock->unlock(lock);
+}
+
+/**
+ * Check if a list of index keys contains a specific key
+ */
+static bool has_index_key(linked_list_t *keys, index_key_t *key)
+{
+	return keys->find_first(keys, (linked_list_match_t)index_key_equals,
+							NULL, key) == SUCCESS;
+}
+
+/**
+ * Add a key to a list of index keys, if it is not already contained
+ */
+static void add_index_key(linked_list_t *keys, index_type_t type, char *name,
+						  u_int32_t id)
+{
+	index_key_t *key, lookup = {
+		.type = type,
+		.name = name,
+		.id = id,
+	};
+
+	if (!has_index_key(keys, &lookup))
+	{
+		INIT(key,
+			.type = type,
+			.name = strdupnull(name),
+			.id = id,
+		);
+		keys->insert_last(keys, key);
+	}
+}
+
+/**
+ * Update the secondary index keys an SA is registered with.
+ * The IKE_SA of the entry must not be used by any other thread.
+ */
+static void update_index(private_ike_sa_manager_t *this, entry_t *entry)
+{
+	ike_sa_t *ike_sa = entry->ike_sa;
+	enumerator_t *enumerator;
+	child_sa_t *child_sa;
+	peer_cfg_t *peer_cfg;
+	linked_list_t *keys;
+	index_key_t *key;
+
+	keys = linked_list_create();
+	add_index_key(keys, INDEX_IKE_NAME, ike_sa->get_name(ike_sa), 0);
+	add_index_key(keys, INDEX_UNIQUE_ID, NULL, ike_sa->get_unique_id(ike_sa));
+	peer_cfg = ike_sa->get_peer_cfg(ike_sa);
+	if (peer_cfg)
+	{
+		ike_cfg_t *ike_cfg = peer_cfg->get_ike_cfg(peer_cfg);
+
+		add_index_key(keys, INDEX_IKE_CFG, ike_cfg->get_other_addr(ike_cfg, NULL),
+					  ike_cfg->get_other_port(ike_cfg));
+	}
+	enumerator = ike_sa->create_child_sa_enumerator(ike_sa);
+	while (enumerator->enumerate(enumerator, &child_sa))
+	{
+		add_index_key(keys, INDEX_CHILD_NAME, child_sa->get_name(child_sa), 0);
+		add_index_key(keys, INDEX_REQID, NULL, child_sa->get_reqid(child_sa));
+	}
+	enumerator->destroy(enumerator);
+
+	if (entry->index_keys)
+	{
+		enumerator = entry->index_keys->create_enumerator(entry->index_keys);
+		while (enumerator->enumerate(enumerator, &key))
+		{
+			if (!has_index_key(keys, key))
+			{
+				remove_index(this, entry, key);
+			}
+		}
+		enumerator->destroy(enumerator);
+	}
+	enumerator = keys->create_enumerator(keys);
+	while (enumerator->enumerate(enumerator, &key))
+	{
+		if (!entry->index_keys || !has_index_key(entry->index_keys, key))
+		{
+			put_index(this, entry, key);
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	DESTROY_FUNCTION_IF(entry->index_keys, (void*)index_key_destroy);
+	entry->index_keys = keys;
+}
+
+/**
+ * Remove an SA from the secondary index.
+ */
+static void remove_all_index(private_ike_sa_manager_t *this, entry_t *entry)
+{
+	index_key_t *key;
+
+	if (entry->index_keys)
+	{
+		while (entry->index_keys->remove_first(entry->index_keys,
+											   (void**)&key) == SUCCESS)
+		{
+			remove_index(this, entry, key);
+			index_key_destroy(key);
+		}
+	}
+}
+
+/**
+ * Get the IDs of up to max SAs registered with a key in the secondary index,
+ * skipping SAs already contained in tried. The IDs get added to tried.
+ */
+static linked_list_t *get_index(private_ike_sa_manager_t *this,
+								index_key_t *key, hashtable_t *tried,
+								u_int max)
+{
+	enumerator_t *enumerator;
+	table_item_t *item;
+	u_int row, segment;
+	rwlock_t *lock;
+	linked_list_t *ids = NULL;
+	ike_sa_id_t *id;
+
+	row = index_key_hash(key) & this->table_mask;
+	segment = row & this->segment_mask;
+	lock = this->index_segments[segment].lock;
+	lock->read_lock(lock);
+	item = this->index_table[row];
+	while (item)
+	{
+		sa_index_t *current = item->value;
+
+		if (index_key_equals(&current->key, key))
+		{
+			enumerator = current->sas->create_enumerator(current->sas);
+			while (max && enumerator->enumerate(enumerator, &id, NULL))
+			{
+				if (tried->get(tried, id))
+				{
+					continue;
+				}
+				if (!ids)
+				{
+					ids = linked_list_create();
+				}
+				id = id->clone(id);
+				ids->insert_last(ids, id);
+				tried->put(tried, id, id);
+				max--;
+			}
+			enumerator->destroy(enumerator);
+			break;
+		}
+		item = item->next;
+	}
+	lock->unlock(lock);
+	return ids;
+}
+
+/**
+ * Check if an SA (still) has a specific CHILD_SA name or reqid
+ */
+static bool has_child(ike_sa_t *ike_sa, index_key_t *key)
+{
+	enumerator_t *enumerator;
+	child_sa_t *child_sa;
+	bool found = FALSE;
+
+	enumerator = ike_sa->create_child_sa_enumerator(ike_sa);
+	while (enumerator->enumerate(enumerator, &child_sa))
+	{
+		if (key->type == INDEX_REQID ?
+				child_sa->get_reqid(child_sa) == key->id :
+				streq(child_sa->get_name(child_sa), key->name))
+		{
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Function to match a checked out IKE_SA against an index key and additional
+ * data, the index might be outdated.
+ */
+typedef bool (*index_match_t)(ike_sa_t *ike_sa, index_key_t *key, void *data);
+
+/**
+ * Checkout the first SA registered in the secondary index with the given key
+ * that is accepted by the match function.
+ */
+static ike_sa_t *checkout_by_index(private_ike_sa_manager_t *this,
+								   index_key_t *key, index_match_t match,
+								   void *data)
+{
+	ike_sa_t *ike_sa = NULL;
+	linked_list_t *ids;
+	hashtable_t *tried;
+	ike_sa_id_t *id;
+	entry_t *entry;
+	u_int segment, batch = INDEX_BATCH;
+
+	/* we can't wait for SAs while holding the index lock, as checkin() updates
+	 * the index with the segment locked. To avoid copying all IDs registered
+	 * with a key, we copy them in growing batches until one matches */
+	tried = index_ids_create();
+	while (!ike_sa)
+	{
+		ids = get_index(this, key, tried, batch);
+		if (!ids)
+		{
+			break;
+		}
+		while (!ike_sa && ids->remove_first(ids, (void**)&id) == SUCCESS)
+		{
+			if (get_entry_by_id(this, id, &entry, &segment) == SUCCESS)
+			{
+				if (wait_for_entry(this, entry, segment))
+				{
+					if (match(entry->ike_sa, key, data))
+					{
+						entry->checked_out = TRUE;
+						ike_sa = entry->ike_sa;
+					}
+					else
+					{
+						entry->condvar->signal(entry->condvar);
+					}
+				}
+				unlock_single_segment(this, segment);
+			}
+		}
+		ids->destroy(ids);
+		batch *= 2;
+	}
+	index_ids_destroy(tried);
+	return ike_sa;
+}
+
 /**
  * Get a random SPI for new IKE_SAs
  */
@@ -1279,15 +1787,34 @@ METHOD(ike_sa_manager_t, checkout_by_message, ike_sa_t*,
 	return ike_sa;
 }
 
+/**
+ * Match an IKE_SA that is usable for the given peer_cfg
+ */
+static bool match_config(ike_sa_t *ike_sa, index_key_t *key,
+						 peer_cfg_t *peer_cfg)
+{
+	peer_cfg_t *current_peer;
+	ike_cfg_t *current_ike;
+
+	if (ike_sa->get_state(ike_sa) == IKE_DELETING)
+	{	/* skip IKE_SAs which are not usable */
+		return FALSE;
+	}
+	current_peer = ike_sa->get_peer_cfg(ike_sa);
+	if (current_peer && current_peer->equals(current_peer, peer_cfg))
+	{
+		current_ike = current_peer->get_ike_cfg(current_peer);
+		return current_ike->equals(current_ike, peer_cfg->get_ike_cfg(peer_cfg));
+	}
+	return FALSE;
+}
+
 METHOD(ike_sa_manager_t, checkout_by_config, ike_sa_t*,
 	private_ike_sa_manager_t *this, peer_cfg_t *peer_cfg)
 {
-	enumerator_t *enumerator;
-	entry_t *entry;
 	ike_sa_t *ike_sa = NULL;
-	peer_cfg_t *current_peer;
-	ike_cfg_t *current_ike;
-	u_int segment;
+	ike_cfg_t *ike_cfg;
+	index_key_t key;
 
 	DBG2(DBG_MGR, "checkout IKE_SA by config");
 
@@ -1298,36 +1825,21 @@ METHOD(ike_sa_manager_t, checkout_by_config, ike_sa_t*,
 		return ike_sa;
 	}
 
-	enumerator = create_table_enumerator(this);
-	while (enumerator->enumerate(enumerator, &entry, &segment))
+	/* equal configs always share the remote address/port of the ike_cfg */
+	ike_cfg = peer_cfg->get_ike_cfg(peer_cfg);
+	key = (index_key_t){
+		.type = INDEX_IKE_CFG,
+		.name = ike_cfg->get_other_addr(ike_cfg, NULL),
+		.id = ike_cfg->get_other_port(ike_cfg),
+	};
+	ike_sa = checkout_by_index(this, &key, (index_match_t)match_config,
+							   peer_cfg);
+	if (ike_sa)
 	{
-		if (!wait_for_entry(this, entry, segment))
-		{
-			continue;
-		}
-		if (entry->ike_sa->get_state(entry->ike_sa) == IKE_DELETING)
-		{	/* skip IKE_SAs which are not usable */
-			continue;
-		}
-
-		current_peer = entry->ike_sa->get_peer_cfg(entry->ike_sa);
-		if (current_peer && current_peer->equals(current_peer, peer_cfg))
-		{
-			current_ike = current_peer->get_ike_cfg(current_peer);
-			if (current_ike->equals(current_ike, peer_cfg->get_ike_cfg(peer_cfg)))
-			{
-				entry->checked_out = TRUE;
-				ike_sa = entry->ike_sa;
-				DBG2(DBG_MGR, "found existing IKE_SA %u with a '%s' config",
-						ike_sa->get_unique_id(ike_sa),
-						current_peer->get_name(current_peer));
-				break;
-			}
-		}
+		DBG2(DBG_MGR, "found existing IKE_SA %u with a '%s' config",
+			 ike_sa->get_unique_id(ike_sa), ike_sa->get_name(ike_sa));
 	}
-	enumerator->destroy(enumerator);
-
-	if (!ike_sa)
+	else
 	{	/* no IKE_SA using such a config, hand out a new */
 		ike_sa = checkout_new(this, peer_cfg->get_ike_version(peer_cfg), TRUE);
 	}
@@ -1335,55 +1847,44 @@ METHOD(ike_sa_manager_t, checkout_by_config, ike_sa_t*,
 	return ike_sa;
 }
 
+/**
+ * Match an IKE_SA by unique ID, IKE_SA name or a CHILD_SA name/reqid
+ */
+static bool match_key(ike_sa_t *ike_sa, index_key_t *key, void *data)
+{
+	switch (key->type)
+	{
+		case INDEX_UNIQUE_ID:
+			return ike_sa->get_unique_id(ike_sa) == key->id;
+		case INDEX_IKE_NAME:
+			return streq(ike_sa->get_name(ike_sa), key->name);
+		case INDEX_CHILD_NAME:
+		case INDEX_REQID:
+			return has_child(ike_sa, key);
+		default:
+			return FALSE;
+	}
+}
+
 METHOD(ike_sa_manager_t, checkout_by_id, ike_sa_t*,
 	private_ike_sa_manager_t *this, u_int32_t id, bool child)
 {
-	enumerator_t *enumerator, *children;
-	entry_t *entry;
-	ike_sa_t *ike_sa = NULL;
-	child_sa_t *child_sa;
-	u_int segment;
+	ike_sa_t *ike_sa;
+	index_key_t key = {
+		/* look for a child with such a reqid or for an IKE_SA with such
+		 * a unique id */
+		.type = child ? INDEX_REQID : INDEX_UNIQUE_ID,
+		.id = id,
+	};
 
 	DBG2(DBG_MGR, "checkout IKE_SA by ID");
 
-	enumerator = create_table_enumerator(this);
-	while (enumerator->enumerate(enumerator, &entry, &segment))
+	ike_sa = checkout_by_index(this, &key, match_key, NULL);
+	if (ike_sa)
 	{
-		if (wait_for_entry(this, entry, segment))
-		{
-			/* look for a child with such a reqid ... */
-			if (child)
-			{
-				children = entry->ike_sa->create_child_sa_enumerator(entry->ike_sa);
-				while (children->enumerate(children, (void**)&child_sa))
-				{
-					if (child_sa->get_reqid(child_sa) == id)
-					{
-						ike_sa = entry->ike_sa;
-						break;
-					}
-				}
-				children->destroy(children);
-			}
-			else /* ... or for a IKE_SA with such a unique id */
-			{
-				if (entry->ike_sa->get_unique_id(entry->ike_sa) == id)
-				{
-					ike_sa = entry->ike_sa;
-				}
-			}
-			/* got one, return */
-			if (ike_sa)
-			{
-				entry->checked_out = TRUE;
-				DBG2(DBG_MGR, "IKE_SA %s[%u] successfully checked out",
-						ike_sa->get_name(ike_sa), ike_sa->get_unique_id(ike_sa));
-				break;
-			}
-		}
+		DBG2(DBG_MGR, "IKE_SA %s[%u] successfully checked out",
+			 ike_sa->get_name(ike_sa), ike_sa->get_unique_id(ike_sa));
 	}
-	enumerator->destroy(enumerator);
-
 	charon->bus->set_sa(charon->bus, ike_sa);
 	return ike_sa;
 }
@@ -1391,50 +1892,20 @@ METHOD(ike_sa_manager_t, checkout_by_id, ike_sa_t*,
 METHOD(ike_sa_manager_t, checkout_by_name, ike_sa_t*,
 	private_ike_sa_manager_t *this, char *name, bool child)
 {
-	enumerator_t *enumerator, *children;
-	entry_t *entry;
-	ike_sa_t *ike_sa = NULL;
-	child_sa_t *child_sa;
-	u_int segment;
-
-	enumerator = create_table_enumerator(this);
-	while (enumerator->enumerate(enumerator, &entry, &segment))
+	ike_sa_t *ike_sa;
+	index_key_t key = {
+		/* look for a child with such a policy name or for an IKE_SA with
+		 * such a connection name */
+		.type = child ? INDEX_CHILD_NAME : INDEX_IKE_NAME,
+		.name = name,
+	};
+
+	ike_sa = checkout_by_index(this, &key, match_key, NULL);
+	if (ike_sa)
 	{
-		if (wait_for_entry(this, entry, segment))
-		{
-			/* look for a child with such a policy name ... */
-			if (child)
-			{
-				children = entry->ike_sa->create_child_sa_enumerator(entry->ike_sa);
-				while (children->enumerate(children, (void**)&child_sa))
-				{
-					if (streq(child_sa->get_name(child_sa), name))
-					{
-						ike_sa = entry->ike_sa;
-						break;
-					}
-				}
-				children->destroy(children);
-			}
-			else /* ... or for a IKE_SA with such a connection name */
-			{
-				if (streq(entry->ike_sa->get_name(entry->ike_sa), name))
-				{
-					ike_sa = entry->ike_sa;
-				}
-			}
-			/* got one, return */
-			if (ike_sa)
-			{
-				entry->checked_out = TRUE;
-				DBG2(DBG_MGR, "IKE_SA %s[%u] successfully checked out",
-						ike_sa->get_name(ike_sa), ike_sa->get_unique_id(ike_sa));
-				break;
-			}
-		}
+		DBG2(DBG_MGR, "IKE_SA %s[%u] successfully checked out",
+			 ike_sa->get_name(ike_sa), ike_sa->get_unique_id(ike_sa));
 	}
-	enumerator->destroy(enumerator);
-
 	charon->bus->set_sa(charon->bus, ike_sa);
 	return ike_sa;
 }
@@ -1578,6 +2049,7 @@ METHOD(ike_sa_manager_t, checkin, void,
 		put_connected_peers(this, entry);
 	}
 
+	update_index(this, entry);
 	unlock_single_segment(this, segment);
 
 	charon->bus->set_sa(charon->bus, NULL);
@@ -1639,6 +2111,7 @@ METHOD(ike_sa_manager_t, checkin_and_destroy, void,
 		{
 			remove_init_hash(this, entry->init_hash);
 		}
+		remove_all_index(this, entry);
 
 		entry_destroy(entry);
 
@@ -1944,6 +2417,7 @@ METHOD(ike_sa_manager_t, flush, void,
 		{
 			remove_init_hash(this, entry->init_hash);
 		}
+		remove_all_index(this, entry);
 		remove_entry_at((private_enumerator_t*)enumerator);
 		entry_destroy(entry);
 	}
@@ -1967,17 +2441,20 @@ METHOD(ike_sa_manager_t, destroy, void,
 	free(this->half_open_table);
 	free(this->connected_peers_table);
 	free(this->init_hashes_table);
+	free(this->index_table);
 	for (i = 0; i < this->segment_count; i++)
 	{
 		this->segments[i].mutex->destroy(this->segments[i].mutex);
 		this->half_open_segments[i].lock->destroy(this->half_open_segments[i].lock);
 		this->connected_peers_segments[i].lock->destroy(this->connected_peers_segments[i].lock);
 		this->init_hashes_segments[i].mutex->destroy(this->init_hashes_segments[i].mutex);
+		this->index_segments[i].lock->destroy(this->index_segments[i].lock);
 	}
 	free(this->segments);
 	free(this->half_open_segments);
 	free(this->connected_peers_segments);
 	free(this->init_hashes_segments);
+	free(this->index_segments);
 
 	free(this);
 }
@@ -2092,6 +2569,15 @@ ike_sa_manager_t *ike_sa_manager_create()
 		this->init_hashes_segments[i].count = 0;
 	}
 
+	/* and for the secondary index to look up SAs by name, ID or config */
+	this->index_table = calloc(this->table_size, sizeof(table_item_t*));
+	this->index_segments = calloc(this->segment_count, sizeof(shareable_segment_t));
+	for (i = 0; i < this->segment_count; i++)
+	{
+		this->index_segments[i].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		this->index_segments[i].count = 0;
+	}
+
 	this->reuse_ikesa = lib->settings->get_bool(lib->settings,
 										"%s.reuse_ikesa", TRUE, charon->name);
 	return &this->public;
@@ -123,6 +123,11 @@ struct private_task_manager_t {
 		 */
 		u_int retransmitted;
 
+		/**
+		 * scheduled retransmit job
+		 */
+		scheduler_id_t job;
+
 	} responding;
 
 	/**
@@ -164,6 +169,11 @@ struct private_task_manager_t {
 		 */
 		exchange_type_t type;
 
+		/**
+		 * scheduled retransmit job
+		 */
+		scheduler_id_t job;
+
 	} initiating;
 
 	/**
@@ -212,6 +222,18 @@ struct private_task_manager_t {
 	u_int32_t dpd_recv;
 };
 
+/**
+ * Cancel a scheduled retransmission, either as initiator or as responder
+ */
+static void cancel_retransmit(scheduler_id_t *job)
+{
+	if (*job)
+	{
+		lib->scheduler->cancel(lib->scheduler, *job);
+		*job = 0;
+	}
+}
+
 METHOD(task_manager_t, flush_queue, void,
 	private_task_manager_t *this, task_queue_t queue)
 {
@@ -231,6 +253,7 @@ METHOD(task_manager_t, flush_queue, void,
 			this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 			DESTROY_IF(this->initiating.packet);
 			this->initiating.packet = NULL;
+			cancel_retransmit(&this->initiating.job);
 			break;
 		case TASK_QUEUE_PASSIVE:
 			list = this->passive_tasks;
@@ -286,7 +309,8 @@ static bool activate_task(private_task_manager_t *this, task_type_t type)
  * Retransmit a packet, either as initiator or as responder
  */
 static status_t retransmit_packet(private_task_manager_t *this, u_int32_t seqnr,
-							u_int mid, u_int retransmitted, packet_t *packet)
+							u_int mid, u_int retransmitted, packet_t *packet,
+							scheduler_id_t *job)
 {
 	u_int32_t t;
 
@@ -304,7 +328,7 @@ static status_t retransmit_packet(private_task_manager_t *this, u_int32_t seqnr,
 			 mid, seqnr < RESPONDING_SEQ ? seqnr : seqnr - RESPONDING_SEQ);
 	}
 	charon->sender->send(charon->sender, packet->clone(packet));
-	lib->scheduler->schedule_job_ms(lib->scheduler, (job_t*)
+	*job = lib->scheduler->schedule_job_ms(lib->scheduler, (job_t*)
 			retransmit_job_create(seqnr, this->ike_sa->get_id(this->ike_sa)), t);
 	return NEED_MORE;
 }
@@ -317,7 +341,8 @@ METHOD(task_manager_t, retransmit, status_t,
 	if (seqnr == this->initiating.seqnr && this->initiating.packet)
 	{
 		status = retransmit_packet(this, seqnr, this->initiating.mid,
-					this->initiating.retransmitted, this->initiating.packet);
+					this->initiating.retransmitted, this->initiating.packet,
+					&this->initiating.job);
 		if (status == NEED_MORE)
 		{
 			this->initiating.retransmitted++;
@@ -327,7 +352,8 @@ METHOD(task_manager_t, retransmit, status_t,
 	if (seqnr == this->responding.seqnr && this->responding.packet)
 	{
 		status = retransmit_packet(this, seqnr, this->responding.mid,
-					this->responding.retransmitted, this->responding.packet);
+					this->responding.retransmitted, this->responding.packet,
+					&this->responding.job);
 		if (status == NEED_MORE)
 		{
 			this->responding.retransmitted++;
@@ -582,6 +608,7 @@ METHOD(task_manager_t, initiate, status_t,
 	}
 
 	DESTROY_IF(this->initiating.packet);
+	cancel_retransmit(&this->initiating.job);
 	status = this->ike_sa->generate_message(this->ike_sa, message,
 											&this->initiating.packet);
 	if (status != SUCCESS)
@@ -693,6 +720,7 @@ static status_t build_response(private_task_manager_t *this, message_t *request)
 
 	DESTROY_IF(this->responding.packet);
 	this->responding.packet = NULL;
+	cancel_retransmit(&this->responding.job);
 	if (cancelled)
 	{
 		message->destroy(message);
@@ -955,6 +983,7 @@ static status_t process_request(private_task_manager_t *this,
 		 * the same message again. */
 		DESTROY_IF(this->responding.packet);
 		this->responding.packet = NULL;
+		cancel_retransmit(&this->responding.job);
 	}
 	if (this->passive_tasks->get_count(this->passive_tasks) == 0 &&
 		this->queued_tasks->get_count(this->queued_tasks) > 0)
@@ -1019,6 +1048,7 @@ static status_t process_response(private_task_manager_t *this,
 	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 	DESTROY_IF(this->initiating.packet);
 	this->initiating.packet = NULL;
+	cancel_retransmit(&this->initiating.job);
 
 	if (this->queued && this->active_tasks->get_count(this->active_tasks) == 0)
 	{
@@ -1577,6 +1607,8 @@ METHOD(task_manager_t, reset, void,
 	/* reset message counters and retransmit packets */
 	DESTROY_IF(this->responding.packet);
 	DESTROY_IF(this->initiating.packet);
+	cancel_retransmit(&this->responding.job);
+	cancel_retransmit(&this->initiating.job);
 	this->responding.packet = NULL;
 	this->responding.seqnr = RESPONDING_SEQ;
 	this->responding.retransmitted = 0;
@@ -1639,6 +1671,8 @@ METHOD(task_manager_t, destroy, void,
 	DESTROY_IF(this->queued);
 	DESTROY_IF(this->responding.packet);
 	DESTROY_IF(this->initiating.packet);
+	cancel_retransmit(&this->responding.job);
+	cancel_retransmit(&this->initiating.job);
 	DESTROY_IF(this->rng);
 	free(this);
 }
@@ -119,6 +119,11 @@ struct private_task_manager_t {
 		 */
 		exchange_type_t type;
 
+		/**
+		 * scheduled retransmit job
+		 */
+		scheduler_id_t job;
+
 	} initiating;
 
 	/**
@@ -218,6 +223,18 @@ static bool activate_task(private_task_manager_t *this, task_type_t type)
 	return found;
 }
 
+/**
+ * Cancel the scheduled retransmission of the initiated exchange
+ */
+static void cancel_retransmit(private_task_manager_t *this)
+{
+	if (this->initiating.job)
+	{
+		lib->scheduler->cancel(lib->scheduler, this->initiating.job);
+		this->initiating.job = 0;
+	}
+}
+
 METHOD(task_manager_t, retransmit, status_t,
 	private_task_manager_t *this, u_int32_t message_id)
 {
@@ -292,7 +309,8 @@ METHOD(task_manager_t, retransmit, status_t,
 		this->initiating.retransmitted++;
 		job = (job_t*)retransmit_job_create(this->initiating.mid,
 											this->ike_sa->get_id(this->ike_sa));
-		lib->scheduler->schedule_job_ms(lib->scheduler, job, timeout);
+		this->initiating.job = lib->scheduler->schedule_job_ms(lib->scheduler,
+															   job, timeout);
 	}
 	return SUCCESS;
 }
@@ -562,6 +580,7 @@ static status_t process_response(private_task_manager_t *this,
 	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 	this->initiating.packet->destroy(this->initiating.packet);
 	this->initiating.packet = NULL;
+	cancel_retransmit(this);
 
 	return initiate(this);
 }
@@ -1394,6 +1413,7 @@ METHOD(task_manager_t, reset, void,
 	DESTROY_IF(this->initiating.packet);
 	this->responding.packet = NULL;
 	this->initiating.packet = NULL;
+	cancel_retransmit(this);
 	if (initiate != UINT_MAX)
 	{
 		this->initiating.mid = initiate;
@@ -1450,6 +1470,7 @@ METHOD(task_manager_t, destroy, void,
 
 	DESTROY_IF(this->responding.packet);
 	DESTROY_IF(this->initiating.packet);
+	cancel_retransmit(this);
 	free(this);
 }
 
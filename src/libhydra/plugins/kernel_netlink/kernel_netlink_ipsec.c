@@ -1144,29 +1144,39 @@ METHOD(kernel_ipsec_t, get_cpi, status_t,
 	return SUCCESS;
 }
 
-METHOD(kernel_ipsec_t, add_sa, status_t,
-	private_kernel_netlink_ipsec_t *this, host_t *src, host_t *dst,
-	u_int32_t spi, u_int8_t protocol, u_int32_t reqid, mark_t mark,
-	u_int32_t tfc, lifetime_cfg_t *lifetime, u_int16_t enc_alg, chunk_t enc_key,
-	u_int16_t int_alg, chunk_t int_key, ipsec_mode_t mode, u_int16_t ipcomp,
-	u_int16_t cpi, bool encap, bool esn, bool inbound,
-	traffic_selector_t* src_ts, traffic_selector_t* dst_ts)
+/**
+ * Install an SA.  If a buffer is passed in build, the request is not sent but
+ * just written to that buffer.
+ */
+static status_t add_sa_internal(private_kernel_netlink_ipsec_t *this,
+	host_t *src, host_t *dst, u_int32_t spi, u_int8_t protocol,
+	u_int32_t reqid, mark_t mark, u_int32_t tfc, lifetime_cfg_t *lifetime,
+	u_int16_t enc_alg, chunk_t enc_key, u_int16_t int_alg, chunk_t int_key,
+	ipsec_mode_t mode, u_int16_t ipcomp, u_int16_t cpi, bool encap, bool esn,
+	bool inbound, traffic_selector_t* src_ts, traffic_selector_t* dst_ts,
+	u_char *build)
 {
-	netlink_buf_t request;
+	netlink_buf_t request, comp_request;
 	char *alg_name;
-	struct nlmsghdr *hdr;
+	struct nlmsghdr *hdr, *hdrs[2];
 	struct xfrm_usersa_info *sa;
 	u_int16_t icv_size = 64;
-	status_t status = FAILED;
+	status_t status = FAILED, results[2];
+	u_int count = 0;
 
 	/* if IPComp is used, we install an additional IPComp SA. if the cpi is 0
-	 * we are in the recursive call below */
+	 * we are in the recursive call below. Both SAs are sent to the kernel
+	 * in a single message batch. */
 	if (ipcomp != IPCOMP_NONE && cpi != 0)
 	{
 		lifetime_cfg_t lft = {{0,0,0},{0,0,0},{0,0,0}};
-		add_sa(this, src, dst, htonl(ntohs(cpi)), IPPROTO_COMP, reqid, mark,
-			   tfc, &lft, ENCR_UNDEFINED, chunk_empty, AUTH_UNDEFINED,
-			   chunk_empty, mode, ipcomp, 0, FALSE, FALSE, inbound, NULL, NULL);
+		if (add_sa_internal(this, src, dst, htonl(ntohs(cpi)), IPPROTO_COMP,
+				reqid, mark, tfc, &lft, ENCR_UNDEFINED, chunk_empty,
+				AUTH_UNDEFINED, chunk_empty, mode, ipcomp, 0, FALSE, FALSE,
+				inbound, NULL, NULL, comp_request) == SUCCESS)
+		{
+			hdrs[count++] = (struct nlmsghdr*)comp_request;
+		}
 		ipcomp = IPCOMP_NONE;
 		/* use transport mode ESP SA, IPComp uses tunnel mode */
 		mode = MODE_TRANSPORT;
@@ -1510,7 +1520,17 @@ METHOD(kernel_ipsec_t, add_sa, status_t,
 		}
 	}
 
-	if (this->socket_xfrm->send_ack(this->socket_xfrm, hdr) != SUCCESS)
+	if (build)
+	{	/* the caller sends the request along with its own */
+		memcpy(build, request, sizeof(request));
+		status = SUCCESS;
+		goto failed;
+	}
+
+	hdrs[count++] = hdr;
+	if (this->socket_xfrm->send_ack_batch(this->socket_xfrm, hdrs, count,
+										  results) != SUCCESS ||
+		results[count - 1] != SUCCESS)
 	{
 		if (mark.value)
 		{
@@ -1523,6 +1543,11 @@ METHOD(kernel_ipsec_t, add_sa, status_t,
 		}
 		goto failed;
 	}
+	if (count > 1 && results[0] != SUCCESS)
+	{
+		DBG1(DBG_KNL, "unable to add IPComp SAD entry with CPI %.4x",
+			 ntohs(cpi));
+	}
 
 	status = SUCCESS;
 
@@ -1531,6 +1556,20 @@ failed:
 	return status;
 }
 
+METHOD(kernel_ipsec_t, add_sa, status_t,
+	private_kernel_netlink_ipsec_t *this, host_t *src, host_t *dst,
+	u_int32_t spi, u_int8_t protocol, u_int32_t reqid, mark_t mark,
+	u_int32_t tfc, lifetime_cfg_t *lifetime, u_int16_t enc_alg, chunk_t enc_key,
+	u_int16_t int_alg, chunk_t int_key, ipsec_mode_t mode, u_int16_t ipcomp,
+	u_int16_t cpi, bool encap, bool esn, bool inbound,
+	traffic_selector_t* src_ts, traffic_selector_t* dst_ts)
+{
+	return add_sa_internal(this, src, dst, spi, protocol, reqid, mark, tfc,
+						   lifetime, enc_alg, enc_key, int_alg, int_key, mode,
+						   ipcomp, cpi, encap, esn, inbound, src_ts, dst_ts,
+						   NULL);
+}
+
 /**
  * Get the ESN replay state (i.e. sequence numbers) of an SA.
  *
@@ -14,6 +14,7 @@
  */
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <errno.h>
@@ -22,7 +23,15 @@
 #include "kernel_netlink_shared.h"
 
 #include <debug.h>
+#include <threading/thread.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <utils/hashtable.h>
+
+/**
+ * Maximum number of messages we send in a single batch
+ */
+#define MAX_BATCH 16
 
 typedef struct private_netlink_socket_t private_netlink_socket_t;
 
@@ -36,14 +45,29 @@ struct private_netlink_socket_t {
 	netlink_socket_t public;
 
 	/**
-	 * mutex to lock access to netlink socket
+	 * mutex to lock access to entries and sequence numbers
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * the kernel supports a single dump per socket only, serializes them
+	 */
+	mutex_t *dump_mutex;
+
+	/**
+	 * requests waiting for a reply, entry_t indexed by sequence number
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * TRUE if a thread currently reads from the socket
+	 */
+	bool reading;
+
 	/**
 	 * current sequence number for netlink request
 	 */
-	int seq;
+	u_int32_t seq;
 
 	/**
 	 * netlink socket protocol
@@ -57,140 +81,330 @@ struct private_netlink_socket_t {
 };
 
 /**
- * Imported from kernel_netlink_ipsec.c
+ * A request waiting for its reply
  */
-extern enum_name_t *xfrm_msg_names;
+typedef struct {
 
-METHOD(netlink_socket_t, netlink_send, status_t,
-	private_netlink_socket_t *this, struct nlmsghdr *in, struct nlmsghdr **out,
-	size_t *out_len)
+	/**
+	 * sequence number of the request
+	 */
+	u_int32_t seq;
+
+	/**
+	 * TRUE if the request asked for an acknowledge
+	 */
+	bool ack;
+
+	/**
+	 * TRUE once the reply has been received completely
+	 */
+	bool complete;
+
+	/**
+	 * received reply messages
+	 */
+	chunk_t reply;
+
+	/**
+	 * condvar the requesting thread waits on, shared by entries of a batch
+	 */
+	condvar_t *condvar;
+
+} entry_t;
+
+/**
+ * Hashtable hash function for entries
+ */
+static u_int entry_hash(u_int32_t *seq)
 {
-	int len, addr_len;
-	struct sockaddr_nl addr;
-	chunk_t result = chunk_empty, tmp;
-	struct nlmsghdr *msg, peek;
+	return *seq;
+}
 
-	this->mutex->lock(this->mutex);
+/**
+ * Hashtable equals function for entries
+ */
+static bool entry_equals(u_int32_t *a, u_int32_t *b)
+{
+	return *a == *b;
+}
 
-	in->nlmsg_seq = ++this->seq;
-	in->nlmsg_pid = getpid();
+/**
+ * Imported from kernel_netlink_ipsec.c
+ */
+extern enum_name_t *xfrm_msg_names;
 
-	memset(&addr, 0, sizeof(addr));
-	addr.nl_family = AF_NETLINK;
-	addr.nl_pid = 0;
-	addr.nl_groups = 0;
+/**
+ * Queue a received netlink message to the request it belongs to, mutex must
+ * be held
+ */
+static void queue_reply(private_netlink_socket_t *this, struct nlmsghdr *hdr)
+{
+	entry_t *entry;
 
-	if (this->protocol == NETLINK_XFRM)
+	entry = this->entries->get(this->entries, &hdr->nlmsg_seq);
+	if (!entry || entry->complete)
 	{
-		chunk_t in_chunk = { (u_char*)in, in->nlmsg_len };
+		DBG2(DBG_KNL, "received netlink message with unexpected sequence "
+			 "number %u, ignored", hdr->nlmsg_seq);
+		return;
+	}
+	entry->reply.ptr = realloc(entry->reply.ptr,
+							   entry->reply.len + NLMSG_ALIGN(hdr->nlmsg_len));
+	memcpy(entry->reply.ptr + entry->reply.len, hdr, hdr->nlmsg_len);
+	entry->reply.len += NLMSG_ALIGN(hdr->nlmsg_len);
 
-		DBG3(DBG_KNL, "sending %N: %B", xfrm_msg_names, in->nlmsg_type, &in_chunk);
+	switch (hdr->nlmsg_type)
+	{
+		case NLMSG_DONE:
+		case NLMSG_ERROR:
+			break;
+		default:
+			if (entry->ack || hdr->nlmsg_flags & NLM_F_MULTI)
+			{	/* wait for more messages, or the acknowledge */
+				return;
+			}
+			break;
 	}
+	entry->complete = TRUE;
+	entry->condvar->signal(entry->condvar);
+}
+
+/**
+ * Read a datagram from the socket and queue all contained messages, mutex
+ * must not be held
+ */
+static bool read_and_queue(private_netlink_socket_t *this)
+{
+	char buf[4096] __attribute__((aligned(RTA_ALIGNTO)));
+	struct nlmsghdr *hdr = (struct nlmsghdr*)buf;
+	struct sockaddr_nl addr;
+	socklen_t addr_len;
+	int len;
 
 	while (TRUE)
 	{
-		len = sendto(this->socket, in, in->nlmsg_len, 0,
-					 (struct sockaddr*)&addr, sizeof(addr));
+		memset(&addr, 0, sizeof(addr));
+		addr_len = sizeof(addr);
 
-		if (len != in->nlmsg_len)
+		len = recvfrom(this->socket, buf, sizeof(buf), MSG_TRUNC,
+					   (struct sockaddr*)&addr, &addr_len);
+		if (len < 0)
 		{
 			if (errno == EINTR)
 			{
+				DBG1(DBG_KNL, "got interrupted");
 				/* interrupted, try again */
 				continue;
 			}
-			this->mutex->unlock(this->mutex);
-			DBG1(DBG_KNL, "error sending to netlink socket: %s", strerror(errno));
-			return FAILED;
+			DBG1(DBG_KNL, "error reading from netlink socket: %s",
+				 strerror(errno));
+			return FALSE;
 		}
 		break;
 	}
+	if (len > sizeof(buf))
+	{
+		DBG1(DBG_KNL, "received netlink message too large (%d bytes)", len);
+		return FALSE;
+	}
+	if (addr.nl_pid != 0)
+	{	/* not from the kernel */
+		return TRUE;
+	}
+	if (!NLMSG_OK(hdr, len))
+	{
+		DBG1(DBG_KNL, "received corrupted netlink message");
+		return FALSE;
+	}
 
-	while (TRUE)
+	this->mutex->lock(this->mutex);
+	while (NLMSG_OK(hdr, len))
 	{
-		char buf[4096];
-		tmp.len = sizeof(buf);
-		tmp.ptr = buf;
-		msg = (struct nlmsghdr*)tmp.ptr;
+		queue_reply(this, hdr);
+		hdr = NLMSG_NEXT(hdr, len);
+	}
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
 
-		memset(&addr, 0, sizeof(addr));
-		addr.nl_family = AF_NETLINK;
-		addr.nl_pid = getpid();
-		addr.nl_groups = 0;
-		addr_len = sizeof(addr);
+/**
+ * Let the thread of a pending request take over reading, mutex must be held
+ */
+static void wake_reader(private_netlink_socket_t *this)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
 
-		len = recvfrom(this->socket, tmp.ptr, tmp.len, 0,
-					   (struct sockaddr*)&addr, &addr_len);
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		if (!entry->complete)
+		{
+			entry->condvar->signal(entry->condvar);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
 
-		if (len < 0)
+/**
+ * Send a batch of netlink messages in a single datagram and wait for all
+ * replies.  Replies of other threads are dispatched while reading.
+ */
+static status_t send_batch(private_netlink_socket_t *this,
+						   struct nlmsghdr *in[], u_int count,
+						   chunk_t replies[])
+{
+	struct iovec iov[count];
+	struct msghdr msg;
+	struct sockaddr_nl addr;
+	entry_t entries[count];
+	condvar_t *condvar;
+	status_t status = SUCCESS;
+	bool old, dump = FALSE;
+	int i, len = 0;
+
+	/* we must not leave stale entries behind, which could be cancelled
+	 * while blocking in recvfrom() or waiting for the condvar */
+	old = thread_cancelability(FALSE);
+	condvar = condvar_create(CONDVAR_TYPE_DEFAULT);
+
+	for (i = 0; i < count; i++)
+	{
+		if (in[i]->nlmsg_flags & NLM_F_DUMP)
+		{
+			dump = TRUE;
+		}
+	}
+	if (dump)
+	{
+		this->dump_mutex->lock(this->dump_mutex);
+	}
+
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < count; i++)
+	{
+		in[i]->nlmsg_seq = ++this->seq;
+		in[i]->nlmsg_pid = getpid();
+
+		entries[i] = (entry_t){
+			.seq = in[i]->nlmsg_seq,
+			.ack = (in[i]->nlmsg_flags & NLM_F_ACK) != 0,
+			.condvar = condvar,
+		};
+		this->entries->put(this->entries, &entries[i].seq, &entries[i]);
+
+		iov[i].iov_base = in[i];
+		iov[i].iov_len = NLMSG_ALIGN(in[i]->nlmsg_len);
+		len += iov[i].iov_len;
+
+		if (this->protocol == NETLINK_XFRM)
+		{
+			chunk_t in_chunk = { (u_char*)in[i], in[i]->nlmsg_len };
+
+			DBG3(DBG_KNL, "sending %N: %B", xfrm_msg_names, in[i]->nlmsg_type,
+				 &in_chunk);
+		}
+	}
+	this->mutex->unlock(this->mutex);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	while (TRUE)
+	{
+		if (sendmsg(this->socket, &msg, 0) != len)
 		{
 			if (errno == EINTR)
 			{
-				DBG1(DBG_KNL, "got interrupted");
 				/* interrupted, try again */
 				continue;
 			}
-			DBG1(DBG_KNL, "error reading from netlink socket: %s", strerror(errno));
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
-		}
-		if (!NLMSG_OK(msg, len))
-		{
-			DBG1(DBG_KNL, "received corrupted netlink message");
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			DBG1(DBG_KNL, "error sending to netlink socket: %s",
+				 strerror(errno));
+			status = FAILED;
 		}
-		if (msg->nlmsg_seq != this->seq)
+		break;
+	}
+
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < count && status == SUCCESS; i++)
+	{
+		while (!entries[i].complete)
 		{
-			DBG1(DBG_KNL, "received invalid netlink sequence number");
-			if (msg->nlmsg_seq < this->seq)
-			{
+			if (this->reading)
+			{	/* another thread reads, and wakes us for our reply */
+				condvar->wait(condvar, this->mutex);
 				continue;
 			}
+			this->reading = TRUE;
 			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			if (!read_and_queue(this))
+			{
+				status = FAILED;
+			}
+			this->mutex->lock(this->mutex);
+			this->reading = FALSE;
+			if (status != SUCCESS)
+			{
+				break;
+			}
 		}
-
-		tmp.len = len;
-		result.ptr = realloc(result.ptr, result.len + tmp.len);
-		memcpy(result.ptr + result.len, tmp.ptr, tmp.len);
-		result.len += tmp.len;
-
-		/* NLM_F_MULTI flag does not seem to be set correctly, we use sequence
-		 * numbers to detect multi header messages */
-		len = recvfrom(this->socket, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT,
-					   (struct sockaddr*)&addr, &addr_len);
-
-		if (len == sizeof(peek) && peek.nlmsg_seq == this->seq)
+	}
+	for (i = 0; i < count; i++)
+	{
+		this->entries->remove(this->entries, &entries[i].seq);
+		if (status == SUCCESS)
 		{
-			/* seems to be multipart */
-			continue;
+			replies[i] = entries[i].reply;
+		}
+		else
+		{
+			free(entries[i].reply.ptr);
 		}
-		break;
 	}
-
-	*out_len = result.len;
-	*out = (struct nlmsghdr*)result.ptr;
-
+	wake_reader(this);
 	this->mutex->unlock(this->mutex);
 
-	return SUCCESS;
+	if (dump)
+	{
+		this->dump_mutex->unlock(this->dump_mutex);
+	}
+	condvar->destroy(condvar);
+	thread_cancelability(old);
+	return status;
 }
 
-METHOD(netlink_socket_t, netlink_send_ack, status_t,
-	private_netlink_socket_t *this, struct nlmsghdr *in)
+METHOD(netlink_socket_t, netlink_send, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr *in, struct nlmsghdr **out,
+	size_t *out_len)
 {
-	struct nlmsghdr *out, *hdr;
-	size_t len;
+	chunk_t reply;
 
-	if (netlink_send(this, in, &out, &len) != SUCCESS)
+	if (send_batch(this, &in, 1, &reply) != SUCCESS)
 	{
 		return FAILED;
 	}
-	hdr = out;
+	*out_len = reply.len;
+	*out = (struct nlmsghdr*)reply.ptr;
+	return SUCCESS;
+}
+
+/**
+ * Check the acknowledge in a reply
+ */
+static status_t check_ack(struct nlmsghdr *out, size_t len)
+{
+	struct nlmsghdr *hdr = out;
+
 	while (NLMSG_OK(hdr, len))
 	{
 		switch (hdr->nlmsg_type)
@@ -203,20 +417,16 @@ METHOD(netlink_socket_t, netlink_send_ack, status_t,
 				{
 					if (-err->error == EEXIST)
 					{	/* do not report existing routes */
-						free(out);
 						return ALREADY_DONE;
 					}
 					if (-err->error == ESRCH)
 					{	/* do not report missing entries */
-						free(out);
 						return NOT_FOUND;
 					}
 					DBG1(DBG_KNL, "received netlink error: %s (%d)",
 						 strerror(-err->error), -err->error);
-					free(out);
 					return FAILED;
 				}
-				free(out);
 				return SUCCESS;
 			}
 			default:
@@ -228,10 +438,49 @@ METHOD(netlink_socket_t, netlink_send_ack, status_t,
 		break;
 	}
 	DBG1(DBG_KNL, "netlink request not acknowledged");
-	free(out);
 	return FAILED;
 }
 
+METHOD(netlink_socket_t, netlink_send_ack, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr *in)
+{
+	struct nlmsghdr *out;
+	size_t len;
+	status_t status;
+
+	if (netlink_send(this, in, &out, &len) != SUCCESS)
+	{
+		return FAILED;
+	}
+	status = check_ack(out, len);
+	free(out);
+	return status;
+}
+
+METHOD(netlink_socket_t, netlink_send_ack_batch, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr *in[], u_int count,
+	status_t status[])
+{
+	chunk_t replies[count];
+	int i;
+
+	if (count > MAX_BATCH)
+	{
+		DBG1(DBG_KNL, "netlink batch of %u messages too large", count);
+		return FAILED;
+	}
+	if (send_batch(this, in, count, replies) != SUCCESS)
+	{
+		return FAILED;
+	}
+	for (i = 0; i < count; i++)
+	{
+		status[i] = check_ack((struct nlmsghdr*)replies[i].ptr, replies[i].len);
+		free(replies[i].ptr);
+	}
+	return SUCCESS;
+}
+
 METHOD(netlink_socket_t, destroy, void,
 	private_netlink_socket_t *this)
 {
@@ -239,6 +488,8 @@ METHOD(netlink_socket_t, destroy, void,
 	{
 		close(this->socket);
 	}
+	this->entries->destroy(this->entries);
+	this->dump_mutex->destroy(this->dump_mutex);
 	this->mutex->destroy(this->mutex);
 	free(this);
 }
@@ -255,10 +506,14 @@ netlink_socket_t *netlink_socket_create(int protocol)
 		.public = {
 			.send = _netlink_send,
 			.send_ack = _netlink_send_ack,
+			.send_ack_batch = _netlink_send_ack_batch,
 			.destroy = _destroy,
 		},
 		.seq = 200,
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.dump_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.entries = hashtable_create((hashtable_hash_t)entry_hash,
+									(hashtable_equals_t)entry_equals, 8),
 		.protocol = protocol,
 	);
 
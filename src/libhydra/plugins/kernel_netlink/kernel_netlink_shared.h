@@ -38,6 +38,9 @@ struct netlink_socket_t {
 	/**
 	 * Send a netlink message and wait for a reply.
 	 *
+	 * Multiple threads may have requests outstanding at the same time,
+	 * replies are matched to requests by their sequence number.
+	 *
 	 * @param	in		netlink message to send
 	 * @param	out 	received netlink message
 	 * @param	out_len	length of the received message
@@ -51,6 +54,21 @@ struct netlink_socket_t {
 	 */
 	status_t (*send_ack)(netlink_socket_t *this, struct nlmsghdr *in);
 
+	/**
+	 * Send multiple netlink messages at once and wait for their acknowledges.
+	 *
+	 * The messages get sent in a single datagram and are processed by the
+	 * kernel in the given order.  Message buffers must be padded to
+	 * NLMSG_ALIGN(nlmsg_len), which netlink_buf_t always is.
+	 *
+	 * @param	in		array of netlink messages to send
+	 * @param	count	number of messages in array, at most 16
+	 * @param	status	array receiving the send_ack() result of each message
+	 * @return			SUCCESS if all acknowledges received, FAILED otherwise
+	 */
+	status_t (*send_ack_batch)(netlink_socket_t *this, struct nlmsghdr *in[],
+							   u_int count, status_t status[]);
+
 	/**
 	 * Destroy the socket.
 	 */
@@ -25,6 +25,11 @@
 #include <crypto/crypters/crypter.h>
 #include <crypto/signers/signer.h>
 
+/**
+ * Length of the salt appended to the key of AEAD algorithms
+ */
+#define AEAD_SALT_SIZE 4
+
 /**
  * Should be a multiple of 8
  */
@@ -43,14 +48,19 @@ struct private_esp_context_t {
 	esp_context_t public;
 
 	/**
-	 * Crypter used to encrypt/decrypt ESP packets
+	 * AEAD transform used to encrypt/decrypt and authenticate ESP packets
+	 */
+	aead_t *aead;
+
+	/**
+	 * TRUE if the AEAD transform is a combined mode algorithm
 	 */
-	crypter_t *crypter;
+	bool combined;
 
 	/**
-	 * Signer to authenticate ESP packets
+	 * RNG used to generate IVs, created on demand
 	 */
-	signer_t *signer;
+	rng_t *rng;
 
 	/**
 	 * The highest sequence number that was successfully verified
@@ -197,97 +207,174 @@ METHOD(esp_context_t, next_seqno, bool,
 	return TRUE;
 }
 
-METHOD(esp_context_t, get_signer, signer_t *,
+METHOD(esp_context_t, get_aead, aead_t*,
 		private_esp_context_t *this)
 {
-	return this->signer;
+	return this->aead;
 }
 
-METHOD(esp_context_t, get_crypter, crypter_t *,
-		private_esp_context_t *this)
+METHOD(esp_context_t, generate_iv, bool,
+		private_esp_context_t *this, u_int32_t seqno, chunk_t iv)
 {
-	return this->crypter;
+	if (this->combined && iv.len >= sizeof(seqno))
+	{	/* combined mode algorithms only require a unique IV, as sequence
+		 * numbers never cycle we use them (RFC 4106, section 3.1) */
+		memset(iv.ptr, 0, iv.len);
+		htoun32(iv.ptr + iv.len - sizeof(seqno), seqno);
+		return TRUE;
+	}
+	if (!this->rng)
+	{
+		this->rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+		if (!this->rng)
+		{
+			DBG1(DBG_ESP, "failed to generate IV: could not find RNG");
+			return FALSE;
+		}
+	}
+	return this->rng->get_bytes(this->rng, iv.len, iv.ptr);
 }
 
 METHOD(esp_context_t, destroy, void,
 		private_esp_context_t *this)
 {
 	chunk_free(&this->window);
-	DESTROY_IF(this->crypter);
-	DESTROY_IF(this->signer);
+	DESTROY_IF(this->aead);
+	DESTROY_IF(this->rng);
 	free(this);
 }
 
 /**
- * Described in header.
+ * Create an AEAD transform for a combined mode algorithm
  */
-esp_context_t *esp_context_create(int enc_alg, chunk_t enc_key,
-								  int int_alg, chunk_t int_key, bool inbound)
+static bool create_aead(private_esp_context_t *this, int alg, chunk_t key)
 {
-	private_esp_context_t *this;
+	if (key.len <= AEAD_SALT_SIZE)
+	{
+		DBG1(DBG_ESP, "failed to create ESP context: invalid key length");
+		return FALSE;
+	}
+	this->aead = lib->crypto->create_aead(lib->crypto, alg,
+										  key.len - AEAD_SALT_SIZE);
+	if (!this->aead)
+	{
+		DBG1(DBG_ESP, "failed to create ESP context: unsupported AEAD "
+			 "algorithm");
+		return FALSE;
+	}
+	if (!this->aead->set_key(this->aead, key))
+	{
+		DBG1(DBG_ESP, "failed to create ESP context: setting AEAD key "
+			 "failed");
+		return FALSE;
+	}
+	this->combined = TRUE;
+	return TRUE;
+}
 
-	INIT(this,
-		.public = {
-			.get_crypter = _get_crypter,
-			.get_signer = _get_signer,
-			.get_seqno = _get_seqno,
-			.next_seqno = _next_seqno,
-			.verify_seqno = _verify_seqno,
-			.set_authenticated_seqno = _set_authenticated_seqno,
-			.destroy = _destroy,
-		},
-		.inbound = inbound,
-		.window_size = ESP_DEFAULT_WINDOW_SIZE,
-	);
+/**
+ * Create an AEAD transform wrapping a crypter and a signer
+ */
+static bool create_traditional(private_esp_context_t *this, int enc_alg,
+							   chunk_t enc_key, int int_alg, chunk_t int_key)
+{
+	crypter_t *crypter = NULL;
+	signer_t *signer = NULL;
 
-	switch(enc_alg)
+	switch (enc_alg)
 	{
 		case ENCR_AES_CBC:
-			this->crypter = lib->crypto->create_crypter(lib->crypto, enc_alg,
-														enc_key.len);
+			crypter = lib->crypto->create_crypter(lib->crypto, enc_alg,
+												  enc_key.len);
 			break;
 		default:
 			break;
 	}
-	if (!this->crypter)
+	if (!crypter)
 	{
 		DBG1(DBG_ESP, "failed to create ESP context: unsupported encryption "
 			 "algorithm");
-		destroy(this);
-		return NULL;
+		goto failed;
 	}
-	if (!this->crypter->set_key(this->crypter, enc_key))
+	if (!crypter->set_key(crypter, enc_key))
 	{
 		DBG1(DBG_ESP, "failed to create ESP context: setting encryption key "
 			 "failed");
-		destroy(this);
-		return NULL;
+		goto failed;
 	}
 
-	switch(int_alg)
+	switch (int_alg)
 	{
 		case AUTH_HMAC_SHA1_96:
 		case AUTH_HMAC_SHA2_256_128:
 		case AUTH_HMAC_SHA2_384_192:
 		case AUTH_HMAC_SHA2_512_256:
-			this->signer = lib->crypto->create_signer(lib->crypto, int_alg);
+			signer = lib->crypto->create_signer(lib->crypto, int_alg);
 			break;
 		default:
 			break;
 	}
-	if (!this->signer)
+	if (!signer)
 	{
 		DBG1(DBG_ESP, "failed to create ESP context: unsupported integrity "
 			 "algorithm");
-		destroy(this);
-		return NULL;
+		goto failed;
 	}
-	if (!this->signer->set_key(this->signer, int_key))
+	if (!signer->set_key(signer, int_key))
 	{
 		DBG1(DBG_ESP, "failed to create ESP context: setting signature key "
 			 "failed");
-		destroy(this);
-		return NULL;
+		goto failed;
+	}
+	this->aead = aead_create(crypter, signer);
+	return TRUE;
+
+failed:
+	DESTROY_IF(crypter);
+	DESTROY_IF(signer);
+	return FALSE;
+}
+
+/**
+ * Described in header.
+ */
+esp_context_t *esp_context_create(int enc_alg, chunk_t enc_key,
+								  int int_alg, chunk_t int_key, bool inbound)
+{
+	private_esp_context_t *this;
+
+	INIT(this,
+		.public = {
+			.get_aead = _get_aead,
+			.generate_iv = _generate_iv,
+			.get_seqno = _get_seqno,
+			.next_seqno = _next_seqno,
+			.verify_seqno = _verify_seqno,
+			.set_authenticated_seqno = _set_authenticated_seqno,
+			.destroy = _destroy,
+		},
+		.inbound = inbound,
+		.window_size = ESP_DEFAULT_WINDOW_SIZE,
+	);
+
+	switch (enc_alg)
+	{
+		case ENCR_AES_GCM_ICV8:
+		case ENCR_AES_GCM_ICV12:
+		case ENCR_AES_GCM_ICV16:
+			if (!create_aead(this, enc_alg, enc_key))
+			{
+				destroy(this);
+				return NULL;
+			}
+			break;
+		default:
+			if (!create_traditional(this, enc_alg, enc_key, int_alg, int_key))
+			{
+				destroy(this);
+				return NULL;
+			}
+			break;
 	}
 
 	if (inbound)
@@ -24,8 +24,7 @@
 #define ESP_CONTEXT_H_
 
 #include <library.h>
-#include <crypto/crypters/crypter.h>
-#include <crypto/signers/signer.h>
+#include <crypto/aead.h>
 
 typedef struct esp_context_t esp_context_t;
 
@@ -35,18 +34,21 @@ typedef struct esp_context_t esp_context_t;
 struct esp_context_t {
 
 	/**
-	 * Get the crypter.
+	 * Get the AEAD transform used to encrypt/decrypt and authenticate ESP
+	 * packets.  For traditional algorithms this wraps a crypter and a signer.
 	 *
-	 * @return				crypter
+	 * @return				AEAD transform
 	 */
-	crypter_t *(*get_crypter)(esp_context_t *this);
+	aead_t *(*get_aead)(esp_context_t *this);
 
 	/**
-	 * Get the signer.
+	 * Generate the IV for an outbound ESP packet.
 	 *
-	 * @return				signer
+	 * @param seqno			sequence number of the packet
+	 * @param iv			buffer to write the IV to, get_iv_size() bytes
+	 * @return				TRUE if IV generated successfully
 	 */
-	signer_t *(*get_signer)(esp_context_t *this);
+	bool (*generate_iv)(esp_context_t *this, u_int32_t seqno, chunk_t iv);
 
 	/**
 	 * Get the current outbound ESP sequence number or the highest authenticated
@@ -97,9 +99,9 @@ struct esp_context_t {
  * Create an esp_context_t instance
  *
  * @param enc_alg		encryption algorithm
- * @param enc_key		encryption key
- * @param int_alg		integrity protection algorithm
- * @param int_key		integrity protection key
+ * @param enc_key		encryption key, including salt for AEAD algorithms
+ * @param int_alg		integrity protection algorithm, ignored for AEAD
+ * @param int_key		integrity protection key, ignored for AEAD
  * @param inbound		TRUE to create an inbound ESP context
  * @return				ESP context instance, or NULL if creation fails
  */
@@ -20,10 +20,8 @@
 
 #include <library.h>
 #include <debug.h>
-#include <crypto/crypters/crypter.h>
-#include <crypto/signers/signer.h>
+#include <crypto/aead.h>
 #include <bio/bio_reader.h>
-#include <bio/bio_writer.h>
 
 #include <netinet/in.h>
 
@@ -174,7 +172,8 @@ static bool remove_padding(private_esp_packet_t *this, chunk_t plaintext)
 		DBG1(DBG_ESP, "parsing ESP payload failed: invalid padding");
 		goto failed;
 	}
-	this->payload = ip_packet_create(reader->peek(reader));
+	/* the payload outlives the ESP packet, so it requires a copy */
+	this->payload = ip_packet_create(chunk_clone(reader->peek(reader)));
 	reader->destroy(reader);
 	if (!this->payload)
 	{
@@ -191,7 +190,6 @@ static bool remove_padding(private_esp_packet_t *this, chunk_t plaintext)
 
 failed:
 	reader->destroy(reader);
-	chunk_free(&plaintext);
 	return FALSE;
 }
 
@@ -201,24 +199,25 @@ METHOD(esp_packet_t, decrypt, status_t,
 	bio_reader_t *reader;
 	u_int32_t spi, seq;
 	chunk_t data, iv, icv, ciphertext, plaintext;
-	crypter_t *crypter;
-	signer_t *signer;
+	size_t bs;
+	aead_t *aead;
 
 	DESTROY_IF(this->payload);
 	this->payload = NULL;
 
 	data = this->packet->get_data(this->packet);
-	crypter = esp_context->get_crypter(esp_context);
-	signer = esp_context->get_signer(esp_context);
+	aead = esp_context->get_aead(esp_context);
+	bs = aead->get_block_size(aead);
 
 	reader = bio_reader_create(data);
 	if (!reader->read_uint32(reader, &spi) ||
 		!reader->read_uint32(reader, &seq) ||
-		!reader->read_data(reader, crypter->get_iv_size(crypter), &iv) ||
-		!reader->read_data_end(reader, signer->get_block_size(signer), &icv) ||
-		reader->remaining(reader) % crypter->get_block_size(crypter))
+		!reader->read_data(reader, aead->get_iv_size(aead), &iv) ||
+		!reader->read_data_end(reader, aead->get_icv_size(aead), &icv) ||
+		reader->remaining(reader) % bs)
 	{
 		DBG1(DBG_ESP, "ESP decryption failed: invalid length");
+		reader->destroy(reader);
 		return PARSE_ERROR;
 	}
 	ciphertext = reader->peek(reader);
@@ -234,21 +233,17 @@ METHOD(esp_packet_t, decrypt, status_t,
 	DBG3(DBG_ESP, "ESP decryption:\n  SPI %.8x [seq %u]\n  IV %B\n  "
 		 "encrypted %B\n  ICV %B", spi, seq, &iv, &ciphertext, &icv);
 
-	if (!signer->get_signature(signer, chunk_create(data.ptr, 8), NULL) ||
-		!signer->get_signature(signer, iv, NULL) ||
-		!signer->verify_signature(signer, ciphertext, icv))
+	/* verify and decrypt inline, the ICV directly follows the ciphertext */
+	plaintext = ciphertext;
+	if (!aead->decrypt(aead, chunk_create(ciphertext.ptr,
+										  ciphertext.len + icv.len),
+					   chunk_create(data.ptr, 8), iv, NULL))
 	{
 		DBG1(DBG_ESP, "ICV verification failed!");
 		return FAILED;
 	}
 	esp_context->set_authenticated_seqno(esp_context, seq);
 
-	if (!crypter->decrypt(crypter, ciphertext, iv, &plaintext))
-	{
-		DBG1(DBG_ESP, "ESP decryption failed");
-		return FAILED;
-	}
-
 	if (!remove_padding(this, plaintext))
 	{
 		return PARSE_ERROR;
@@ -272,13 +267,10 @@ static void generate_padding(chunk_t padding)
 METHOD(esp_packet_t, encrypt, status_t,
 	private_esp_packet_t *this, esp_context_t *esp_context, u_int32_t spi)
 {
-	chunk_t iv, icv, padding, payload, ciphertext, auth_data;
-	bio_writer_t *writer;
+	chunk_t data, iv, icv, padding, payload, plaintext;
 	u_int32_t next_seqno;
 	size_t blocksize, plainlen;
-	crypter_t *crypter;
-	signer_t *signer;
-	rng_t *rng;
+	aead_t *aead;
 
 	this->packet->set_data(this->packet, chunk_empty);
 
@@ -288,18 +280,11 @@ METHOD(esp_packet_t, encrypt, status_t,
 		return FAILED;
 	}
 
-	rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
-	if (!rng)
-	{
-		DBG1(DBG_ESP, "ESP encryption failed: could not find RNG");
-		return NOT_FOUND;
-	}
-	crypter = esp_context->get_crypter(esp_context);
-	signer = esp_context->get_signer(esp_context);
-
-	blocksize = crypter->get_block_size(crypter);
-	iv.len = crypter->get_iv_size(crypter);
-	icv.len = signer->get_block_size(signer);
+	aead = esp_context->get_aead(esp_context);
+	/* the trailer has to be aligned to 4 bytes (RFC 4303, section 2.4) */
+	blocksize = max(aead->get_block_size(aead), 4);
+	iv.len = aead->get_iv_size(aead);
+	icv.len = aead->get_icv_size(aead);
 
 	/* plaintext = payload, padding, pad_length, next_header */
 	payload = this->payload ? this->payload->get_encoding(this->payload)
@@ -308,63 +293,44 @@ METHOD(esp_packet_t, encrypt, status_t,
 	padding.len = blocksize - (plainlen % blocksize);
 	plainlen += padding.len;
 
-	/* len = spi, seq, IV, plaintext, ICV */
-	writer = bio_writer_create(2 * sizeof(u_int32_t) + iv.len + plainlen +
-							   icv.len);
-	writer->write_uint32(writer, ntohl(spi));
-	writer->write_uint32(writer, next_seqno);
+	/* len = spi, seq, IV, plaintext, ICV, everything is processed inline */
+	data = chunk_alloc(2 * sizeof(u_int32_t) + iv.len + plainlen + icv.len);
+	memcpy(data.ptr, &spi, sizeof(spi));
+	htoun32(data.ptr + sizeof(spi), next_seqno);
 
-	iv = writer->skip(writer, iv.len);
-	if (!rng->get_bytes(rng, iv.len, iv.ptr))
+	iv.ptr = data.ptr + 2 * sizeof(u_int32_t);
+	if (!esp_context->generate_iv(esp_context, next_seqno, iv))
 	{
 		DBG1(DBG_ESP, "ESP encryption failed: could not generate IV");
-		writer->destroy(writer);
-		rng->destroy(rng);
+		chunk_free(&data);
 		return FAILED;
 	}
-	rng->destroy(rng);
 
-	/* plain-/ciphertext will start here */
-	ciphertext = writer->get_buf(writer);
-	ciphertext.ptr += ciphertext.len;
-	ciphertext.len = plainlen;
-
-	writer->write_data(writer, payload);
-
-	padding = writer->skip(writer, padding.len);
+	plaintext = chunk_create(iv.ptr + iv.len, plainlen);
+	memcpy(plaintext.ptr, payload.ptr, payload.len);
+	padding.ptr = plaintext.ptr + payload.len;
 	generate_padding(padding);
-
-	writer->write_uint8(writer, padding.len);
-	writer->write_uint8(writer, this->next_header);
+	plaintext.ptr[plainlen - 2] = padding.len;
+	plaintext.ptr[plainlen - 1] = this->next_header;
 
 	DBG3(DBG_ESP, "ESP before encryption:\n  payload = %B\n  padding = %B\n  "
 		 "padding length = %hhu, next header = %hhu", &payload, &padding,
 		 (u_int8_t)padding.len, this->next_header);
 
-	/* encrypt the content inline */
-	if (!crypter->encrypt(crypter, ciphertext, iv, NULL))
+	/* encrypt the content and append the ICV inline */
+	if (!aead->encrypt(aead, plaintext, chunk_create(data.ptr, 8), iv, NULL))
 	{
 		DBG1(DBG_ESP, "ESP encryption failed");
-		writer->destroy(writer);
-		return FAILED;
-	}
-
-	/* calculate signature */
-	auth_data = writer->get_buf(writer);
-	icv = writer->skip(writer, icv.len);
-	if (!signer->get_signature(signer, auth_data, icv.ptr))
-	{
-		DBG1(DBG_ESP, "ESP encryption failed: signature generation failed");
-		writer->destroy(writer);
+		chunk_free(&data);
 		return FAILED;
 	}
+	icv.ptr = plaintext.ptr + plaintext.len;
 
 	DBG3(DBG_ESP, "ESP packet:\n  SPI %.8x [seq %u]\n  IV %B\n  "
 		 "encrypted %B\n  ICV %B", ntohl(spi), next_seqno, &iv,
-		 &ciphertext, &icv);
+		 &plaintext, &icv);
 
-	this->packet->set_data(this->packet, writer->extract_buf(writer));
-	writer->destroy(writer);
+	this->packet->set_data(this->packet, data);
 	return SUCCESS;
 }
 
@@ -89,9 +89,9 @@ struct esp_packet_t {
 	 * @param esp_context		ESP context of corresponding outbound IPsec SA
 	 * @param spi				SPI value to use, in network byte order
 	 * @return					- SUCCESS if encrypted
-	 *							- FAILED if sequence number cycled or any of the
-	 *							  cryptographic functions failed
-	 *							- NOT_FOUND if no suitable RNG could be found
+	 *							- FAILED if sequence number cycled, no IV could
+	 *							  be generated or any of the cryptographic
+	 *							  functions failed
 	 */
 	status_t (*encrypt)(esp_packet_t *this, esp_context_t *esp_context,
 						u_int32_t spi);
@@ -18,13 +18,16 @@
 #include "ipsec_policy_mgr.h"
 
 #include <debug.h>
-#include <threading/rwlock.h>
+#include <threading/mutex.h>
+#include <threading/spinlock.h>
+#include <utils/hashtable.h>
 #include <utils/linked_list.h>
 
 /** Base priority for installed policies */
 #define PRIO_BASE 512
 
 typedef struct private_ipsec_policy_mgr_t private_ipsec_policy_mgr_t;
+typedef struct policy_table_t policy_table_t;
 
 /**
  * Private additions to ipsec_policy_mgr_t.
@@ -42,9 +45,19 @@ struct private_ipsec_policy_mgr_t {
 	linked_list_t *policies;
 
 	/**
-	 * Lock to safely access the list of policies
+	 * Mutex to serialize changes to the list of policies
 	 */
-	rwlock_t *lock;
+	mutex_t *mutex;
+
+	/**
+	 * Lookup table built from the installed policies, immutable
+	 */
+	policy_table_t *table;
+
+	/**
+	 * Spinlock to safely acquire a reference to the current lookup table
+	 */
+	spinlock_t *table_lock;
 
 };
 
@@ -64,8 +77,149 @@ typedef struct {
 	 */
 	ipsec_policy_t *policy;
 
+	/**
+	 * References held by the list of policies and lookup tables
+	 */
+	refcount_t refs;
+
 } ipsec_policy_entry_t;
 
+typedef struct policy_item_t policy_item_t;
+
+/**
+ * A policy in a lookup table
+ */
+struct policy_item_t {
+
+	/**
+	 * Position of the policy in the sorted list, lower ranks match first
+	 */
+	u_int rank;
+
+	/**
+	 * The policy entry
+	 */
+	ipsec_policy_entry_t *entry;
+
+	/**
+	 * Next policy with a higher rank in the same bucket
+	 */
+	policy_item_t *next;
+};
+
+/**
+ * Masked source and destination addresses of policies/packets
+ */
+typedef struct {
+
+	/**
+	 * Length of the addresses
+	 */
+	u_int8_t len;
+
+	/**
+	 * Masked source address
+	 */
+	u_char src[16];
+
+	/**
+	 * Masked destination address
+	 */
+	u_char dst[16];
+
+} policy_key_t;
+
+/**
+ * Policies of a tuple sharing the same masked addresses
+ */
+typedef struct {
+
+	/**
+	 * Masked addresses of the policies
+	 */
+	policy_key_t key;
+
+	/**
+	 * Policies sorted by rank
+	 */
+	policy_item_t *first;
+
+	/**
+	 * Policy with the highest rank, to append others
+	 */
+	policy_item_t *last;
+
+} policy_bucket_t;
+
+/**
+ * Policies with the same direction, address family and prefix lengths
+ */
+typedef struct {
+
+	/**
+	 * TRUE for inbound policies
+	 */
+	bool inbound;
+
+	/**
+	 * Length of the addresses
+	 */
+	u_int8_t len;
+
+	/**
+	 * Prefix length of the source selector
+	 */
+	u_int8_t src_bits;
+
+	/**
+	 * Prefix length of the destination selector
+	 */
+	u_int8_t dst_bits;
+
+	/**
+	 * Lowest rank of all policies in this tuple
+	 */
+	u_int rank;
+
+	/**
+	 * Buckets of policies, policy_key_t => policy_bucket_t
+	 */
+	hashtable_t *buckets;
+
+} policy_tuple_t;
+
+/**
+ * Lookup table to classify packets using a tuple space search.  A table is
+ * never modified once built, it gets replaced if the policies change.
+ */
+struct policy_table_t {
+
+	/**
+	 * Tuples, sorted by lowest rank
+	 */
+	policy_tuple_t *tuples;
+
+	/**
+	 * Number of tuples
+	 */
+	u_int tuple_count;
+
+	/**
+	 * All policy items of this table
+	 */
+	policy_item_t *items;
+
+	/**
+	 * Number of policy items
+	 */
+	u_int count;
+
+	/**
+	 * References held by the manager and readers
+	 */
+	refcount_t refs;
+};
+
 /**
  * Calculate the pseudo-priority to sort policies.  This is the same algorithm
  * used by the NETLINK kernel interface (i.e. high priority -> low value).
@@ -118,6 +272,7 @@ static ipsec_policy_entry_t *policy_entry_create(ipsec_policy_t *policy)
 
 	INIT(this,
 		.policy = policy,
+		.refs = 1,
 		.priority = calculate_priority(policy->get_priority(policy),
 									   policy->get_source_ts(policy),
 									   policy->get_destination_ts(policy)),
@@ -126,14 +281,324 @@ static ipsec_policy_entry_t *policy_entry_create(ipsec_policy_t *policy)
 }
 
 /**
- * Destroy a policy entry
+ * Release a reference to a policy entry, destroys it if it was the last one
  */
 static void policy_entry_destroy(ipsec_policy_entry_t *this)
 {
-	this->policy->destroy(this->policy);
+	if (ref_put(&this->refs))
+	{
+		this->policy->destroy(this->policy);
+		free(this);
+	}
+}
+
+/**
+ * Hash function for masked addresses
+ */
+static u_int policy_key_hash(policy_key_t *key)
+{
+	return chunk_hash_inc(chunk_create(key->dst, key->len),
+						  chunk_hash(chunk_create(key->src, key->len)));
+}
+
+/**
+ * Equality function for masked addresses
+ */
+static bool policy_key_equals(policy_key_t *key, policy_key_t *other)
+{
+	return key->len == other->len &&
+		   memeq(key->src, other->src, key->len) &&
+		   memeq(key->dst, other->dst, key->len);
+}
+
+/**
+ * Copy an address masked to the given number of prefix bits
+ */
+static void mask_address(u_char *dst, chunk_t address, u_int8_t bits)
+{
+	int i;
+
+	for (i = 0; i < address.len; i++)
+	{
+		if (bits >= 8)
+		{
+			dst[i] = address.ptr[i];
+			bits -= 8;
+		}
+		else
+		{
+			dst[i] = address.ptr[i] & (0xff << (8 - bits));
+			bits = 0;
+		}
+	}
+}
+
+/**
+ * Get the length of the smallest prefix covering a traffic selector.  For
+ * address ranges that are not a subnet this covers more addresses, which is
+ * fine as candidates are always verified using match_packet().
+ */
+static u_int8_t get_prefix(traffic_selector_t *ts)
+{
+	chunk_t from, to;
+	u_int8_t bits = 0;
+	u_char diff;
+	int i;
+
+	from = ts->get_from_address(ts);
+	to = ts->get_to_address(ts);
+	for (i = 0; i < from.len && i < to.len; i++)
+	{
+		diff = from.ptr[i] ^ to.ptr[i];
+		if (diff)
+		{
+			while (!(diff & 0x80))
+			{
+				diff <<= 1;
+				bits++;
+			}
+			break;
+		}
+		bits += 8;
+	}
+	return bits;
+}
+
+/**
+ * Destroy a lookup table, releasing the policy entries
+ */
+static void policy_table_destroy(policy_table_t *this)
+{
+	policy_bucket_t *bucket;
+	enumerator_t *enumerator;
+	int i;
+
+	for (i = 0; i < this->tuple_count; i++)
+	{
+		enumerator = this->tuples[i].buckets->create_enumerator(
+													this->tuples[i].buckets);
+		while (enumerator->enumerate(enumerator, NULL, (void**)&bucket))
+		{
+			free(bucket);
+		}
+		enumerator->destroy(enumerator);
+		this->tuples[i].buckets->destroy(this->tuples[i].buckets);
+	}
+	for (i = 0; i < this->count; i++)
+	{
+		policy_entry_destroy(this->items[i].entry);
+	}
+	free(this->tuples);
+	free(this->items);
 	free(this);
 }
 
+/**
+ * Release a reference to a lookup table
+ */
+static void policy_table_put(policy_table_t *this)
+{
+	if (ref_put(&this->refs))
+	{
+		policy_table_destroy(this);
+	}
+}
+
+/**
+ * Find or create the tuple for the given parameters
+ */
+static policy_tuple_t *get_tuple(policy_table_t *this, u_int *size,
+								 bool inbound, u_int8_t len, u_int8_t src_bits,
+								 u_int8_t dst_bits, u_int rank)
+{
+	policy_tuple_t *tuple;
+	int i;
+
+	for (i = 0; i < this->tuple_count; i++)
+	{
+		tuple = &this->tuples[i];
+		if (tuple->inbound == inbound && tuple->len == len &&
+			tuple->src_bits == src_bits && tuple->dst_bits == dst_bits)
+		{
+			return tuple;
+		}
+	}
+	if (this->tuple_count == *size)
+	{
+		*size = max(8, *size * 2);
+		this->tuples = realloc(this->tuples, *size * sizeof(policy_tuple_t));
+	}
+	/* policies are added by rank, so tuples are sorted by their lowest rank */
+	tuple = &this->tuples[this->tuple_count++];
+	*tuple = (policy_tuple_t){
+		.inbound = inbound,
+		.len = len,
+		.src_bits = src_bits,
+		.dst_bits = dst_bits,
+		.rank = rank,
+		.buckets = hashtable_create((hashtable_hash_t)policy_key_hash,
+									(hashtable_equals_t)policy_key_equals, 8),
+	};
+	return tuple;
+}
+
+/**
+ * Add a policy to a lookup table
+ */
+static void add_item(policy_table_t *this, u_int *size, policy_item_t *item)
+{
+	ipsec_policy_t *policy = item->entry->policy;
+	traffic_selector_t *src_ts, *dst_ts;
+	policy_bucket_t *bucket;
+	policy_tuple_t *tuple;
+	policy_key_t key;
+	u_int8_t src_bits, dst_bits;
+	chunk_t src, dst;
+
+	src_ts = policy->get_source_ts(policy);
+	dst_ts = policy->get_destination_ts(policy);
+	src = src_ts->get_from_address(src_ts);
+	dst = dst_ts->get_from_address(dst_ts);
+	if (src.len != dst.len || src.len > sizeof(key.src))
+	{	/* mixed address families never match a packet */
+		return;
+	}
+	src_bits = get_prefix(src_ts);
+	dst_bits = get_prefix(dst_ts);
+
+	tuple = get_tuple(this, size, policy->get_direction(policy) == POLICY_IN,
+					  src.len, src_bits, dst_bits, item->rank);
+	memset(&key, 0, sizeof(key));
+	key.len = src.len;
+	mask_address(key.src, src, src_bits);
+	mask_address(key.dst, dst, dst_bits);
+
+	bucket = tuple->buckets->get(tuple->buckets, &key);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.key = key,
+		);
+		tuple->buckets->put(tuple->buckets, &bucket->key, bucket);
+	}
+	if (bucket->last)
+	{
+		bucket->last->next = item;
+	}
+	else
+	{
+		bucket->first = item;
+	}
+	bucket->last = item;
+}
+
+/**
+ * Build a lookup table from the sorted list of policies
+ */
+static policy_table_t *policy_table_create(linked_list_t *policies)
+{
+	policy_table_t *this;
+	ipsec_policy_entry_t *entry;
+	enumerator_t *enumerator;
+	u_int size = 0;
+
+	INIT(this,
+		.refs = 1,
+	);
+	this->items = calloc(max(policies->get_count(policies), 1),
+						 sizeof(policy_item_t));
+
+	enumerator = policies->create_enumerator(policies);
+	while (enumerator->enumerate(enumerator, (void**)&entry))
+	{
+		policy_item_t *item = &this->items[this->count];
+
+		ref_get(&entry->refs);
+		item->entry = entry;
+		item->rank = this->count++;
+		add_item(this, &size, item);
+	}
+	enumerator->destroy(enumerator);
+	return this;
+}
+
+/**
+ * Replace the lookup table after the list of policies changed, requires
+ * the mutex
+ */
+static void update_table(private_ipsec_policy_mgr_t *this)
+{
+	policy_table_t *table, *old;
+
+	table = policy_table_create(this->policies);
+
+	this->table_lock->lock(this->table_lock);
+	old = this->table;
+	this->table = table;
+	this->table_lock->unlock(this->table_lock);
+
+	policy_table_put(old);
+}
+
+/**
+ * Find the policy with the lowest rank matching a packet
+ */
+static ipsec_policy_t *lookup_packet(policy_table_t *this, ip_packet_t *packet,
+									 bool inbound)
+{
+	policy_item_t *item, *found = NULL;
+	policy_key_t key;
+	chunk_t src, dst;
+	int i;
+
+	src = packet->get_source(packet)->get_address(packet->get_source(packet));
+	dst = packet->get_destination(packet)->get_address(
+											packet->get_destination(packet));
+	if (src.len != dst.len || src.len > sizeof(key.src))
+	{
+		return NULL;
+	}
+	memset(&key, 0, sizeof(key));
+	key.len = src.len;
+
+	for (i = 0; i < this->tuple_count; i++)
+	{
+		policy_tuple_t *tuple = &this->tuples[i];
+		policy_bucket_t *bucket;
+
+		if (found && found->rank < tuple->rank)
+		{	/* tuples are sorted, no better match possible */
+			break;
+		}
+		if (tuple->inbound != inbound || tuple->len != key.len)
+		{
+			continue;
+		}
+		mask_address(key.src, src, tuple->src_bits);
+		mask_address(key.dst, dst, tuple->dst_bits);
+		bucket = tuple->buckets->get(tuple->buckets, &key);
+		if (!bucket)
+		{
+			continue;
+		}
+		for (item = bucket->first; item; item = item->next)
+		{
+			ipsec_policy_t *policy = item->entry->policy;
+
+			if (found && found->rank < item->rank)
+			{
+				break;
+			}
+			if (policy->match_packet(policy, packet))
+			{
+				found = item;
+				break;
+			}
+		}
+	}
+	return found ? found->entry->policy : NULL;
+}
+
 METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 	private_ipsec_policy_mgr_t *this, host_t *src, host_t *dst,
 	traffic_selector_t *src_ts, traffic_selector_t *dst_ts,
@@ -156,7 +621,7 @@ METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 								 mark, priority);
 	entry = policy_entry_create(policy);
 
-	this->lock->write_lock(this->lock);
+	this->mutex->lock(this->mutex);
 	enumerator = this->policies->create_enumerator(this->policies);
 	while (enumerator->enumerate(enumerator, (void**)&current))
 	{
@@ -167,7 +632,8 @@ METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 	}
 	this->policies->insert_before(this->policies, enumerator, entry);
 	enumerator->destroy(enumerator);
-	this->lock->unlock(this->lock);
+	update_table(this);
+	this->mutex->unlock(this->mutex);
 	return SUCCESS;
 }
 
@@ -189,7 +655,7 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 
 	priority = calculate_priority(policy_priority, src_ts, dst_ts);
 
-	this->lock->write_lock(this->lock);
+	this->mutex->lock(this->mutex);
 	enumerator = this->policies->create_enumerator(this->policies);
 	while (enumerator->enumerate(enumerator, (void**)&current))
 	{
@@ -203,7 +669,11 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 		}
 	}
 	enumerator->destroy(enumerator);
-	this->lock->unlock(this->lock);
+	if (found)
+	{
+		update_table(this);
+	}
+	this->mutex->unlock(this->mutex);
 	if (found)
 	{
 		policy_entry_destroy(found);
@@ -219,38 +689,35 @@ METHOD(ipsec_policy_mgr_t, flush_policies, status_t,
 
 	DBG2(DBG_ESP, "flushing policies");
 
-	this->lock->write_lock(this->lock);
+	this->mutex->lock(this->mutex);
 	while (this->policies->remove_last(this->policies,
 									  (void**)&entry) == SUCCESS)
 	{
 		policy_entry_destroy(entry);
 	}
-	this->lock->unlock(this->lock);
+	update_table(this);
+	this->mutex->unlock(this->mutex);
 	return SUCCESS;
 }
 
 METHOD(ipsec_policy_mgr_t, find_by_packet, ipsec_policy_t*,
 	private_ipsec_policy_mgr_t *this, ip_packet_t *packet, bool inbound)
 {
-	enumerator_t *enumerator;
-	ipsec_policy_entry_t *current;
-	ipsec_policy_t *found = NULL;
+	policy_table_t *table;
+	ipsec_policy_t *found;
 
-	this->lock->read_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
-	while (enumerator->enumerate(enumerator, (void**)&current))
-	{
-		ipsec_policy_t *policy = current->policy;
+	/* the table is never modified, so we just need a reference to it */
+	this->table_lock->lock(this->table_lock);
+	table = this->table;
+	ref_get(&table->refs);
+	this->table_lock->unlock(this->table_lock);
 
-		if ((inbound == (policy->get_direction(policy) == POLICY_IN)) &&
-			 policy->match_packet(policy, packet))
-		{
-			found = policy->get_ref(policy);
-			break;
-		}
+	found = lookup_packet(table, packet, inbound);
+	if (found)
+	{
+		found = found->get_ref(found);
 	}
-	enumerator->destroy(enumerator);
-	this->lock->unlock(this->lock);
+	policy_table_put(table);
 	return found;
 }
 
@@ -258,8 +725,10 @@ METHOD(ipsec_policy_mgr_t, destroy, void,
 	private_ipsec_policy_mgr_t *this)
 {
 	flush_policies(this);
+	policy_table_put(this->table);
 	this->policies->destroy(this->policies);
-	this->lock->destroy(this->lock);
+	this->mutex->destroy(this->mutex);
+	this->table_lock->destroy(this->table_lock);
 	free(this);
 }
 
@@ -279,8 +748,10 @@ ipsec_policy_mgr_t *ipsec_policy_mgr_create()
 			.destroy = _destroy,
 		},
 		.policies = linked_list_create(),
-		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.table_lock = spinlock_create(),
 	);
+	this->table = policy_table_create(this->policies);
 
 	return &this->public;
 }
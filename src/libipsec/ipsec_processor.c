@@ -18,12 +18,92 @@
 
 #include <debug.h>
 #include <library.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
 #include <threading/rwlock.h>
-#include <utils/blocking_queue.h>
 #include <processing/jobs/callback_job.h>
 
+/** Default number of packet workers */
+#define DEFAULT_WORKERS 2
+
+/** Maximum number of packets a worker processes in one go */
+#define BURST_SIZE 32
+
+/** Initial number of packets a worker queue can hold, grows if necessary */
+#define INITIAL_QUEUE_SIZE 64
+
 typedef struct private_ipsec_processor_t private_ipsec_processor_t;
 
+/**
+ * A queued inbound or outbound packet
+ */
+typedef struct {
+
+	/**
+	 * TRUE for an inbound ESP packet, FALSE for an outbound IP packet
+	 */
+	bool inbound;
+
+	/**
+	 * The packet, esp_packet_t* or ip_packet_t*
+	 */
+	void *packet;
+
+	/**
+	 * SPI of an inbound packet
+	 */
+	u_int32_t spi;
+
+	/**
+	 * Matching policy of an outbound packet
+	 */
+	ipsec_policy_t *policy;
+
+} queued_packet_t;
+
+/**
+ * A packet worker, processes the packets of a subset of the IPsec SAs
+ */
+typedef struct {
+
+	/**
+	 * IPsec processor
+	 */
+	private_ipsec_processor_t *processor;
+
+	/**
+	 * Queued packets, a ring buffer
+	 */
+	queued_packet_t *packets;
+
+	/**
+	 * Size of the ring buffer
+	 */
+	u_int size;
+
+	/**
+	 * Index of the oldest packet
+	 */
+	u_int head;
+
+	/**
+	 * Number of queued packets
+	 */
+	u_int count;
+
+	/**
+	 * Mutex to access the queue
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Condvar to signal queued packets
+	 */
+	condvar_t *condvar;
+
+} packet_worker_t;
+
 /**
  * Private additions to ipsec_processor_t.
  */
@@ -35,14 +115,14 @@ struct private_ipsec_processor_t {
 	ipsec_processor_t public;
 
 	/**
-	 * Queue for inbound packets (esp_packet_t*)
+	 * Packet workers
 	 */
-	blocking_queue_t *inbound_queue;
+	packet_worker_t *workers;
 
 	/**
-	 * Queue for outbound packets (ip_packet_t*)
+	 * Number of packet workers
 	 */
-	blocking_queue_t *outbound_queue;
+	u_int worker_count;
 
 	/**
 	 * Registered inbound callback
@@ -86,47 +166,55 @@ static void deliver_inbound(private_ipsec_processor_t *this,
 }
 
 /**
- * Processes inbound packets
+ * Check in a cached IPsec SA, if any
  */
-static job_requeue_t process_inbound(private_ipsec_processor_t *this)
+static void release_sa(ipsec_sa_t **sa)
 {
-	esp_packet_t *packet;
-	ipsec_sa_t *sa;
-	u_int8_t next_header;
-	u_int32_t spi;
-
-	packet = (esp_packet_t*)this->inbound_queue->dequeue(this->inbound_queue);
-
-	if (!packet->parse_header(packet, &spi))
+	if (*sa)
 	{
-		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
+		ipsec->sas->checkin(ipsec->sas, *sa);
+		*sa = NULL;
 	}
+}
 
-	sa = ipsec->sas->checkout_by_spi(ipsec->sas, spi,
-									 packet->get_destination(packet));
-	if (!sa)
-	{
-		DBG2(DBG_ESP, "inbound ESP packet does not belong to an installed SA");
-		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
-	}
+/**
+ * Processes an inbound packet, the checked out SA is cached for the next
+ * packet in the same burst
+ */
+static void process_inbound(private_ipsec_processor_t *this,
+							esp_packet_t *packet, u_int32_t spi,
+							ipsec_sa_t **cached)
+{
+	ipsec_sa_t *sa = *cached;
+	u_int8_t next_header;
 
-	if (!sa->is_inbound(sa))
+	if (!sa || !sa->is_inbound(sa) ||
+		!sa->match_by_spi_dst(sa, spi, packet->get_destination(packet)))
 	{
-		DBG1(DBG_ESP, "error: IPsec SA is not inbound");
-		packet->destroy(packet);
-		ipsec->sas->checkin(ipsec->sas, sa);
-		return JOB_REQUEUE_DIRECT;
+		release_sa(cached);
+		sa = ipsec->sas->checkout_by_spi(ipsec->sas, spi,
+										 packet->get_destination(packet));
+		if (!sa)
+		{
+			DBG2(DBG_ESP, "inbound ESP packet does not belong to an "
+				 "installed SA");
+			packet->destroy(packet);
+			return;
+		}
+		*cached = sa;
+		if (!sa->is_inbound(sa))
+		{
+			DBG1(DBG_ESP, "error: IPsec SA is not inbound");
+			packet->destroy(packet);
+			return;
+		}
 	}
 
 	if (packet->decrypt(packet, sa->get_esp_context(sa)) != SUCCESS)
 	{
-		ipsec->sas->checkin(ipsec->sas, sa);
 		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
+		return;
 	}
-	ipsec->sas->checkin(ipsec->sas, sa);
 
 	next_header = packet->get_next_header(packet);
 	switch (next_header)
@@ -156,7 +244,6 @@ static job_requeue_t process_inbound(private_ipsec_processor_t *this)
 			packet->destroy(packet);
 			break;
 	}
-	return JOB_REQUEUE_DIRECT;
 }
 
 /**
@@ -179,36 +266,32 @@ static void send_outbound(private_ipsec_processor_t *this,
 }
 
 /**
- * Processes outbound packets
+ * Processes an outbound packet, the checked out SA is cached for the next
+ * packet in the same burst
  */
-static job_requeue_t process_outbound(private_ipsec_processor_t *this)
+static void process_outbound(private_ipsec_processor_t *this,
+							 ip_packet_t *packet, ipsec_policy_t *policy,
+							 ipsec_sa_t **cached)
 {
-	ipsec_policy_t *policy;
+	ipsec_sa_t *sa = *cached;
 	esp_packet_t *esp_packet;
-	ip_packet_t *packet;
-	ipsec_sa_t *sa;
 	host_t *src, *dst;
 
-	packet = (ip_packet_t*)this->outbound_queue->dequeue(this->outbound_queue);
-
-	policy = ipsec->policies->find_by_packet(ipsec->policies, packet, FALSE);
-	if (!policy)
+	if (!sa || sa->is_inbound(sa) ||
+		sa->get_reqid(sa) != policy->get_reqid(policy))
 	{
-		DBG1(DBG_ESP, "no matching outbound IPsec policy for %H == %H",
-			 packet->get_source(packet), packet->get_destination(packet));
-		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
-	}
-
-	sa = ipsec->sas->checkout_by_reqid(ipsec->sas, policy->get_reqid(policy),
-									   FALSE);
-	if (!sa)
-	{	/* TODO-IPSEC: send an acquire to uppper layer */
-		DBG1(DBG_ESP, "could not find an outbound IPsec SA for reqid {%u}, "
-			 "dropping packet", policy->get_reqid(policy));
-		packet->destroy(packet);
-		policy->destroy(policy);
-		return JOB_REQUEUE_DIRECT;
+		release_sa(cached);
+		sa = ipsec->sas->checkout_by_reqid(ipsec->sas,
+										   policy->get_reqid(policy), FALSE);
+		if (!sa)
+		{	/* TODO-IPSEC: send an acquire to uppper layer */
+			DBG1(DBG_ESP, "could not find an outbound IPsec SA for reqid "
+				 "{%u}, dropping packet", policy->get_reqid(policy));
+			packet->destroy(packet);
+			policy->destroy(policy);
+			return;
+		}
+		*cached = sa;
 	}
 	src = sa->get_source(sa);
 	dst = sa->get_destination(sa);
@@ -217,28 +300,165 @@ static job_requeue_t process_outbound(private_ipsec_processor_t *this)
 	if (esp_packet->encrypt(esp_packet, sa->get_esp_context(sa),
 							sa->get_spi(sa)) != SUCCESS)
 	{
-		ipsec->sas->checkin(ipsec->sas, sa);
 		esp_packet->destroy(esp_packet);
 		policy->destroy(policy);
-		return JOB_REQUEUE_DIRECT;
+		return;
 	}
 	/* TODO-IPSEC: update policy/sa counters? */
-	ipsec->sas->checkin(ipsec->sas, sa);
 	policy->destroy(policy);
 	send_outbound(this, esp_packet);
+}
+
+/**
+ * Destroy a queued packet that was not processed
+ */
+static void queued_packet_destroy(queued_packet_t *queued)
+{
+	if (queued->inbound)
+	{
+		esp_packet_t *packet = queued->packet;
+
+		packet->destroy(packet);
+	}
+	else
+	{
+		ip_packet_t *packet = queued->packet;
+
+		packet->destroy(packet);
+		queued->policy->destroy(queued->policy);
+	}
+}
+
+/**
+ * Queue a packet to a worker
+ */
+static void enqueue_packet(packet_worker_t *worker, queued_packet_t *queued)
+{
+	worker->mutex->lock(worker->mutex);
+	if (worker->count == worker->size)
+	{	/* grow the ring buffer, moving the packets to the beginning */
+		queued_packet_t *packets;
+		u_int i;
+
+		packets = malloc(sizeof(queued_packet_t) * worker->size * 2);
+		for (i = 0; i < worker->count; i++)
+		{
+			packets[i] = worker->packets[(worker->head + i) % worker->size];
+		}
+		free(worker->packets);
+		worker->packets = packets;
+		worker->size *= 2;
+		worker->head = 0;
+	}
+	worker->packets[(worker->head + worker->count) % worker->size] = *queued;
+	worker->count++;
+	worker->condvar->signal(worker->condvar);
+	worker->mutex->unlock(worker->mutex);
+}
+
+/**
+ * Wait for queued packets and dequeue up to BURST_SIZE of them
+ */
+static u_int dequeue_burst(packet_worker_t *worker, queued_packet_t *burst)
+{
+	bool oldstate;
+	u_int count;
+
+	worker->mutex->lock(worker->mutex);
+	thread_cleanup_push((thread_cleanup_t)worker->mutex->unlock,
+						worker->mutex);
+	/* ensure that a canceled thread does not dequeue any packets */
+	thread_cancellation_point();
+	while (!worker->count)
+	{
+		oldstate = thread_cancelability(TRUE);
+		worker->condvar->wait(worker->condvar, worker->mutex);
+		thread_cancelability(oldstate);
+	}
+	for (count = 0; count < BURST_SIZE && worker->count; count++)
+	{
+		burst[count] = worker->packets[worker->head];
+		worker->head = (worker->head + 1) % worker->size;
+		worker->count--;
+	}
+	thread_cleanup_pop(TRUE);
+	return count;
+}
+
+/**
+ * Processes bursts of queued packets
+ */
+static job_requeue_t process_packets(packet_worker_t *worker)
+{
+	queued_packet_t burst[BURST_SIZE];
+	ipsec_sa_t *sa = NULL;
+	u_int count, i;
+
+	count = dequeue_burst(worker, burst);
+	for (i = 0; i < count; i++)
+	{
+		if (burst[i].inbound)
+		{
+			process_inbound(worker->processor, burst[i].packet, burst[i].spi,
+							&sa);
+		}
+		else
+		{
+			process_outbound(worker->processor, burst[i].packet,
+							 burst[i].policy, &sa);
+		}
+	}
+	release_sa(&sa);
 	return JOB_REQUEUE_DIRECT;
 }
 
+/**
+ * Get the worker responsible for a specific SPI or reqid
+ */
+static packet_worker_t *get_worker(private_ipsec_processor_t *this,
+								   u_int32_t value)
+{
+	return &this->workers[chunk_hash(chunk_from_thing(value)) %
+						  this->worker_count];
+}
+
 METHOD(ipsec_processor_t, queue_inbound, void,
 	private_ipsec_processor_t *this, esp_packet_t *packet)
 {
-	this->inbound_queue->enqueue(this->inbound_queue, packet);
+	queued_packet_t queued = {
+		.inbound = TRUE,
+		.packet = packet,
+	};
+
+	/* packets of the same SA are processed by the same worker, in order */
+	if (!packet->parse_header(packet, &queued.spi))
+	{
+		packet->destroy(packet);
+		return;
+	}
+	enqueue_packet(get_worker(this, queued.spi), &queued);
 }
 
 METHOD(ipsec_processor_t, queue_outbound, void,
 	private_ipsec_processor_t *this, ip_packet_t *packet)
 {
-	this->outbound_queue->enqueue(this->outbound_queue, packet);
+	queued_packet_t queued = {
+		.packet = packet,
+	};
+
+	/* packets of the same policy, and thus SA, are processed by the same
+	 * worker, in order */
+	queued.policy = ipsec->policies->find_by_packet(ipsec->policies, packet,
+													FALSE);
+	if (!queued.policy)
+	{
+		DBG1(DBG_ESP, "no matching outbound IPsec policy for %H == %H",
+			 packet->get_source(packet), packet->get_destination(packet));
+		packet->destroy(packet);
+		return;
+	}
+	enqueue_packet(get_worker(this, queued.policy->get_reqid(queued.policy)),
+				   &queued);
 }
 
 METHOD(ipsec_processor_t, register_inbound, void,
@@ -284,10 +504,23 @@ METHOD(ipsec_processor_t, unregister_outbound, void,
 METHOD(ipsec_processor_t, destroy, void,
 	private_ipsec_processor_t *this)
 {
-	this->inbound_queue->destroy_offset(this->inbound_queue,
-										offsetof(esp_packet_t, destroy));
-	this->outbound_queue->destroy_offset(this->outbound_queue,
-										 offsetof(ip_packet_t, destroy));
+	packet_worker_t *worker;
+	u_int i;
+
+	for (i = 0; i < this->worker_count; i++)
+	{
+		worker = &this->workers[i];
+		while (worker->count)
+		{
+			queued_packet_destroy(&worker->packets[worker->head]);
+			worker->head = (worker->head + 1) % worker->size;
+			worker->count--;
+		}
+		free(worker->packets);
+		worker->condvar->destroy(worker->condvar);
+		worker->mutex->destroy(worker->mutex);
+	}
+	free(this->workers);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -298,6 +531,7 @@ METHOD(ipsec_processor_t, destroy, void,
 ipsec_processor_t *ipsec_processor_create()
 {
 	private_ipsec_processor_t *this;
+	u_int i;
 
 	INIT(this,
 		.public = {
@@ -309,16 +543,28 @@ ipsec_processor_t *ipsec_processor_create()
 			.unregister_outbound = _unregister_outbound,
 			.destroy = _destroy,
 		},
-		.inbound_queue = blocking_queue_create(),
-		.outbound_queue = blocking_queue_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.worker_count = max(1, lib->settings->get_int(lib->settings,
+								"libipsec.processor.workers", DEFAULT_WORKERS)),
 	);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create((callback_job_cb_t)process_inbound, this,
-									NULL, (callback_job_cancel_t)return_false));
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create((callback_job_cb_t)process_outbound, this,
-									NULL, (callback_job_cancel_t)return_false));
+	this->workers = calloc(this->worker_count, sizeof(packet_worker_t));
+	for (i = 0; i < this->worker_count; i++)
+	{
+		this->workers[i] = (packet_worker_t){
+			.processor = this,
+			.packets = malloc(sizeof(queued_packet_t) * INITIAL_QUEUE_SIZE),
+			.size = INITIAL_QUEUE_SIZE,
+			.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+			.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+		};
+	}
+	for (i = 0; i < this->worker_count; i++)
+	{
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)process_packets,
+									&this->workers[i], NULL,
+									(callback_job_cancel_t)return_false));
+	}
 	return &this->public;
 }
@@ -23,6 +23,7 @@
 #include <processing/jobs/callback_job.h>
 #include <threading/condvar.h>
 #include <threading/mutex.h>
+#include <threading/rwlock.h>
 #include <utils/hashtable.h>
 #include <utils/linked_list.h>
 
@@ -39,9 +40,19 @@ struct private_ipsec_sa_mgr_t {
 	ipsec_sa_mgr_t public;
 
 	/**
-	 * Installed SAs
+	 * Installed SAs, as ipsec_sa_entry_t, hashed by SPI
 	 */
-	linked_list_t *sas;
+	hashtable_t *sas;
+
+	/**
+	 * Installed SAs, as reqid_entries_t, hashed by reqid and direction
+	 */
+	hashtable_t *reqids;
+
+	/**
+	 * All entries, including those being deleted, hashed by ipsec_sa_t
+	 */
+	hashtable_t *entries;
 
 	/**
 	 * SPIs allocated using get_spi()
@@ -49,9 +60,9 @@ struct private_ipsec_sa_mgr_t {
 	hashtable_t *allocated_spis;
 
 	/**
-	 * Mutex used to synchronize access to the SA manager
+	 * Lock for the hash tables, entries have their own lock
 	 */
-	mutex_t *mutex;
+	rwlock_t *lock;
 
 	/**
 	 * RNG used to generate SPIs
@@ -69,11 +80,31 @@ typedef struct {
 	 */
 	ipsec_sa_t *sa;
 
+	/**
+	 * SPI of the SA, cached for lookups
+	 */
+	u_int32_t spi;
+
+	/**
+	 * Source address of the SA, cached for lookups
+	 */
+	host_t *src;
+
+	/**
+	 * Destination address of the SA, cached for lookups
+	 */
+	host_t *dst;
+
 	/**
 	 * Set if this SA is currently in use by a thread
 	 */
 	bool locked;
 
+	/**
+	 * Mutex protecting the state of this entry
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * Condvar used by threads to wait for this entry
 	 */
@@ -85,12 +116,35 @@ typedef struct {
 	u_int waiting_threads;
 
 	/**
-	 * Set if this entry is awaiting deletion
+	 * Set if this entry is awaiting deletion, protected by the manager's lock
+	 * and the entry's mutex
 	 */
 	bool awaits_deletion;
 
 }  ipsec_sa_entry_t;
 
+/**
+ * SAs with the same reqid and direction, in the order they were installed
+ */
+typedef struct {
+
+	/**
+	 * Reqid of the SAs
+	 */
+	u_int32_t reqid;
+
+	/**
+	 * Direction of the SAs
+	 */
+	bool inbound;
+
+	/**
+	 * SAs with this reqid, as ipsec_sa_entry_t
+	 */
+	linked_list_t *entries;
+
+} reqid_entries_t;
+
 /**
  * Helper struct for expiration events
  */
@@ -102,9 +156,9 @@ typedef struct {
 	private_ipsec_sa_mgr_t *manager;
 
 	/**
-	 * Entry that expired
+	 * SA that expired, used to find the entry
 	 */
-	ipsec_sa_entry_t *entry;
+	ipsec_sa_t *sa;
 
 	/**
 	 * 0 if this is a hard expire, otherwise the offset in s (soft->hard)
@@ -126,6 +180,47 @@ static u_int spi_hash(u_int32_t *spi)
 	return chunk_hash(chunk_from_thing(*spi));
 }
 
+/*
+ * Used for the hash table of installed SAs, hashed by SPI only, as we lookup
+ * inbound SAs without destination address
+ */
+static bool entry_equals(ipsec_sa_entry_t *entry, ipsec_sa_entry_t *other)
+{
+	return entry == other;
+}
+
+static u_int entry_hash(ipsec_sa_entry_t *entry)
+{
+	return spi_hash(&entry->spi);
+}
+
+/*
+ * Used for the hash table of reqids
+ */
+static bool reqid_equals(reqid_entries_t *reqid, reqid_entries_t *other)
+{
+	return reqid->reqid == other->reqid && reqid->inbound == other->inbound;
+}
+
+static u_int reqid_hash(reqid_entries_t *reqid)
+{
+	return chunk_hash_inc(chunk_from_thing(reqid->reqid),
+						  chunk_hash(chunk_from_thing(reqid->inbound)));
+}
+
+/*
+ * Used for the hash table of all entries, hashed by ipsec_sa_t pointer
+ */
+static bool sa_equals(ipsec_sa_t *sa, ipsec_sa_t *other)
+{
+	return sa == other;
+}
+
+static u_int sa_hash(ipsec_sa_t *sa)
+{
+	return chunk_hash(chunk_from_thing(sa));
+}
+
 /**
  * Create an SA entry
  */
@@ -134,8 +229,12 @@ static ipsec_sa_entry_t *create_entry(ipsec_sa_t *sa)
 	ipsec_sa_entry_t *this;
 
 	INIT(this,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.sa = sa,
+		.spi = sa->get_spi(sa),
+		.src = sa->get_source(sa),
+		.dst = sa->get_destination(sa),
 	);
 	return this;
 }
@@ -146,146 +245,184 @@ static ipsec_sa_entry_t *create_entry(ipsec_sa_t *sa)
 static void destroy_entry(ipsec_sa_entry_t *entry)
 {
 	entry->condvar->destroy(entry->condvar);
+	entry->mutex->destroy(entry->mutex);
 	entry->sa->destroy(entry->sa);
 	free(entry);
 }
 
+/*
+ * Different match functions to find SAs in the hash tables
+ */
+static bool match_entry_by_spi_inbound(ipsec_sa_entry_t *lookup,
+									   ipsec_sa_entry_t *item)
+{
+	return item->spi == lookup->spi && item->sa->is_inbound(item->sa);
+}
+
+static bool match_entry_by_spi_src_dst(ipsec_sa_entry_t *lookup,
+									   ipsec_sa_entry_t *item)
+{
+	return item->sa->match_by_spi_src_dst(item->sa, lookup->spi, lookup->src,
+										  lookup->dst);
+}
+
+static bool match_entry_by_spi_dst(ipsec_sa_entry_t *lookup,
+								   ipsec_sa_entry_t *item)
+{
+	return item->sa->match_by_spi_dst(item->sa, lookup->spi, lookup->dst);
+}
+
 /**
- * Makes sure an entry is safe to remove
- * Must be called with this->mutex held.
- *
- * @return			TRUE if entry can be removed, FALSE if entry is already
-*					being removed by another thread
+ * Register an entry in the lookup tables, requires the write lock
  */
-static bool wait_remove_entry(private_ipsec_sa_mgr_t *this,
-							  ipsec_sa_entry_t *entry)
+static void register_entry(private_ipsec_sa_mgr_t *this,
+						   ipsec_sa_entry_t *entry)
 {
-	if (entry->awaits_deletion)
+	reqid_entries_t *reqid, lookup = {
+		.reqid = entry->sa->get_reqid(entry->sa),
+		.inbound = entry->sa->is_inbound(entry->sa),
+	};
+
+	reqid = this->reqids->get(this->reqids, &lookup);
+	if (!reqid)
 	{
-		/* this will be deleted by another thread already */
-		return FALSE;
+		INIT(reqid,
+			.reqid = lookup.reqid,
+			.inbound = lookup.inbound,
+			.entries = linked_list_create(),
+		);
+		this->reqids->put(this->reqids, reqid, reqid);
 	}
-	entry->awaits_deletion = TRUE;
-	while (entry->locked)
+	reqid->entries->insert_last(reqid->entries, entry);
+	this->sas->put(this->sas, entry, entry);
+	this->entries->put(this->entries, entry->sa, entry);
+}
+
+/**
+ * Remove an entry from the tables used to look up SAs, requires the write lock.
+ * The entry is still registered in this->entries until it is destroyed.
+ */
+static void unregister_entry(private_ipsec_sa_mgr_t *this,
+							 ipsec_sa_entry_t *entry)
+{
+	reqid_entries_t *reqid, lookup = {
+		.reqid = entry->sa->get_reqid(entry->sa),
+		.inbound = entry->sa->is_inbound(entry->sa),
+	};
+
+	reqid = this->reqids->get(this->reqids, &lookup);
+	if (reqid)
 	{
-		entry->condvar->wait(entry->condvar, this->mutex);
+		reqid->entries->remove(reqid->entries, entry, NULL);
+		if (reqid->entries->get_count(reqid->entries) == 0)
+		{
+			this->reqids->remove(this->reqids, reqid);
+			reqid->entries->destroy(reqid->entries);
+			free(reqid);
+		}
 	}
-	while (entry->waiting_threads > 0)
+	this->sas->remove(this->sas, entry);
+}
+
+/**
+ * Mark an entry for deletion, requires the write lock.
+ *
+ * @return			TRUE if entry can be removed, FALSE if entry is already
+ *					being removed by another thread
+ */
+static bool mark_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	bool marked = FALSE;
+
+	entry->mutex->lock(entry->mutex);
+	if (!entry->awaits_deletion)
+	{
+		entry->awaits_deletion = TRUE;
+		unregister_entry(this, entry);
+		marked = TRUE;
+	}
+	entry->mutex->unlock(entry->mutex);
+	return marked;
+}
+
+/**
+ * Wait until a marked entry is not used anymore and remove it completely.
+ * Must be called without holding the lock.
+ */
+static void remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	entry->mutex->lock(entry->mutex);
+	while (entry->locked || entry->waiting_threads > 0)
 	{
 		entry->condvar->broadcast(entry->condvar);
-		entry->condvar->wait(entry->condvar, this->mutex);
+		entry->condvar->wait(entry->condvar, entry->mutex);
 	}
-	return TRUE;
+	entry->mutex->unlock(entry->mutex);
+
+	this->lock->write_lock(this->lock);
+	this->entries->remove(this->entries, entry->sa);
+	this->lock->unlock(this->lock);
 }
 
 /**
- * Waits until an is available and then locks it.
- * Must only be called with this->mutex held
+ * Waits until an entry is available and then locks it.
+ * Must be called with at least the read lock held, which is released.
  */
 static bool wait_for_entry(private_ipsec_sa_mgr_t *this,
 						   ipsec_sa_entry_t *entry)
 {
+	entry->mutex->lock(entry->mutex);
+	/* once we registered as waiting thread the entry won't get destroyed */
+	entry->waiting_threads++;
+	this->lock->unlock(this->lock);
+
 	while (entry->locked && !entry->awaits_deletion)
 	{
-		entry->waiting_threads++;
-		entry->condvar->wait(entry->condvar, this->mutex);
-		entry->waiting_threads--;
+		entry->condvar->wait(entry->condvar, entry->mutex);
 	}
+	entry->waiting_threads--;
 	if (entry->awaits_deletion)
 	{
 		/* others may still be waiting, */
 		entry->condvar->signal(entry->condvar);
+		entry->mutex->unlock(entry->mutex);
 		return FALSE;
 	}
 	entry->locked = TRUE;
+	entry->mutex->unlock(entry->mutex);
 	return TRUE;
 }
 
 /**
  * Flushes all entries
- * Must be called with this->mutex held.
  */
 static void flush_entries(private_ipsec_sa_mgr_t *this)
 {
 	ipsec_sa_entry_t *current;
 	enumerator_t *enumerator;
+	linked_list_t *marked;
 
 	DBG2(DBG_ESP, "flushing SAD");
 
-	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	marked = linked_list_create();
+	this->lock->write_lock(this->lock);
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, (void**)&current))
 	{
-		if (wait_remove_entry(this, current))
+		if (mark_entry(this, current))
 		{
-			this->sas->remove_at(this->sas, enumerator);
-			destroy_entry(current);
+			marked->insert_last(marked, current);
 		}
 	}
 	enumerator->destroy(enumerator);
-}
-
-/*
- * Different match functions to find SAs in the linked list
- */
-static bool match_entry_by_ptr(ipsec_sa_entry_t *item, ipsec_sa_entry_t *entry)
-{
-	return item == entry;
-}
-
-static bool match_entry_by_sa_ptr(ipsec_sa_entry_t *item, ipsec_sa_t *sa)
-{
-	return item->sa == sa;
-}
-
-static bool match_entry_by_spi_inbound(ipsec_sa_entry_t *item, u_int32_t spi,
-									   bool inbound)
-{
-	return item->sa->get_spi(item->sa) == spi &&
-		   item->sa->is_inbound(item->sa) == inbound;
-}
+	this->lock->unlock(this->lock);
 
-static bool match_entry_by_spi_src_dst(ipsec_sa_entry_t *item, u_int32_t spi,
-									   host_t *src, host_t *dst)
-{
-	return item->sa->match_by_spi_src_dst(item->sa, spi, src, dst);
-}
-
-static bool match_entry_by_reqid_inbound(ipsec_sa_entry_t *item,
-										 u_int32_t reqid, bool inbound)
-{
-	return item->sa->match_by_reqid(item->sa, reqid, inbound);
-}
-
-static bool match_entry_by_spi_dst(ipsec_sa_entry_t *item, u_int32_t spi,
-								   host_t *dst)
-{
-	return item->sa->match_by_spi_dst(item->sa, spi, dst);
-}
-
-/**
- * Remove an entry
- */
-static bool remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
-{
-	ipsec_sa_entry_t *current;
-	enumerator_t *enumerator;
-	bool removed = FALSE;
-
-	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	while (marked->remove_first(marked, (void**)&current) == SUCCESS)
 	{
-		if (current == entry)
-		{
-			if (wait_remove_entry(this, current))
-			{
-				this->sas->remove_at(this->sas, enumerator);
-				removed = TRUE;
-			}
-			break;
-		}
+		remove_entry(this, current);
+		destroy_entry(current);
 	}
-	enumerator->destroy(enumerator);
-	return removed;
+	marked->destroy(marked);
 }
 
 /**
@@ -294,13 +431,15 @@ static bool remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
 static job_requeue_t sa_expired(ipsec_sa_expired_t *expired)
 {
 	private_ipsec_sa_mgr_t *this = expired->manager;
+	ipsec_sa_entry_t *entry;
+	bool remove = FALSE;
 
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_ptr,
-							  NULL, expired->entry) == SUCCESS)
+	this->lock->write_lock(this->lock);
+	entry = this->entries->get(this->entries, expired->sa);
+	if (entry && !entry->awaits_deletion)
 	{
 		u_int32_t hard_offset = expired->hard_offset;
-		ipsec_sa_t *sa = expired->entry->sa;
+		ipsec_sa_t *sa = entry->sa;
 
 		ipsec->events->expire(ipsec->events, sa->get_reqid(sa),
 							  sa->get_protocol(sa), sa->get_spi(sa),
@@ -308,16 +447,19 @@ static job_requeue_t sa_expired(ipsec_sa_expired_t *expired)
 		if (hard_offset)
 		{	/* soft limit reached, schedule hard expire */
 			expired->hard_offset = 0;
-			this->mutex->unlock(this->mutex);
+			this->lock->unlock(this->lock);
 			return JOB_RESCHEDULE(hard_offset);
 		}
 		/* hard limit reached */
-		if (remove_entry(this, expired->entry))
-		{
-			destroy_entry(expired->entry);
-		}
+		remove = mark_entry(this, entry);
+	}
+	this->lock->unlock(this->lock);
+
+	if (remove)
+	{
+		remove_entry(this, entry);
+		destroy_entry(entry);
 	}
-	this->mutex->unlock(this->mutex);
 	return JOB_REQUEUE_NONE;
 }
 
@@ -334,7 +476,7 @@ static void schedule_expiration(private_ipsec_sa_mgr_t *this,
 
 	INIT(expired,
 		.manager = this,
-		.entry = entry,
+		.sa = entry->sa,
 	);
 
 	/* schedule a rekey first, a hard timeout will be scheduled then, if any */
@@ -377,11 +519,14 @@ static void flush_allocated_spis(private_ipsec_sa_mgr_t *this)
  */
 static bool allocate_spi(private_ipsec_sa_mgr_t *this, u_int32_t spi)
 {
+	ipsec_sa_entry_t lookup = {
+		.spi = spi,
+	};
 	u_int32_t *spi_alloc;
 
 	if (this->allocated_spis->get(this->allocated_spis, &spi) ||
-		this->sas->find_first(this->sas, (void*)match_entry_by_spi_inbound,
-							  NULL, spi, TRUE) == SUCCESS)
+		this->sas->get_match(this->sas, &lookup,
+							 (void*)match_entry_by_spi_inbound))
 	{
 		return FALSE;
 	}
@@ -399,13 +544,13 @@ METHOD(ipsec_sa_mgr_t, get_spi, status_t,
 
 	DBG2(DBG_ESP, "allocating SPI for reqid {%u}", reqid);
 
-	this->mutex->lock(this->mutex);
+	this->lock->write_lock(this->lock);
 	if (!this->rng)
 	{
 		this->rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
 		if (!this->rng)
 		{
-			this->mutex->unlock(this->mutex);
+			this->lock->unlock(this->lock);
 			DBG1(DBG_ESP, "failed to create RNG for SPI generation");
 			return FAILED;
 		}
@@ -416,7 +561,7 @@ METHOD(ipsec_sa_mgr_t, get_spi, status_t,
 		if (!this->rng->get_bytes(this->rng, sizeof(spi_new),
 								 (u_int8_t*)&spi_new))
 		{
-			this->mutex->unlock(this->mutex);
+			this->lock->unlock(this->lock);
 			DBG1(DBG_ESP, "failed to allocate SPI for reqid {%u}", reqid);
 			return FAILED;
 		}
@@ -425,7 +570,7 @@ METHOD(ipsec_sa_mgr_t, get_spi, status_t,
 		spi_new = htonl(spi_new);
 	}
 	while (!allocate_spi(this, spi_new));
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 
 	*spi = spi_new;
 
@@ -459,8 +604,9 @@ METHOD(ipsec_sa_mgr_t, add_sa, status_t,
 		DBG1(DBG_ESP, "failed to create SAD entry");
 		return FAILED;
 	}
+	entry = create_entry(sa_new);
 
-	this->mutex->lock(this->mutex);
+	this->lock->write_lock(this->lock);
 
 	if (inbound)
 	{	/* remove any pre-allocated SPIs */
@@ -470,20 +616,19 @@ METHOD(ipsec_sa_mgr_t, add_sa, status_t,
 		free(spi_alloc);
 	}
 
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_src_dst,
-							  NULL, spi, src, dst) == SUCCESS)
+	if (this->sas->get_match(this->sas, entry,
+							 (void*)match_entry_by_spi_src_dst))
 	{
-		this->mutex->unlock(this->mutex);
+		this->lock->unlock(this->lock);
 		DBG1(DBG_ESP, "failed to install SAD entry: already installed");
-		sa_new->destroy(sa_new);
+		destroy_entry(entry);
 		return FAILED;
 	}
 
-	entry = create_entry(sa_new);
 	schedule_expiration(this, entry);
-	this->sas->insert_last(this->sas, entry);
+	register_entry(this, entry);
 
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 	return SUCCESS;
 }
 
@@ -491,28 +636,24 @@ METHOD(ipsec_sa_mgr_t, del_sa, status_t,
 	private_ipsec_sa_mgr_t *this, host_t *src, host_t *dst, u_int32_t spi,
 	u_int8_t protocol, u_int16_t cpi, mark_t mark)
 {
-	ipsec_sa_entry_t *current, *found = NULL;
-	enumerator_t *enumerator;
-
-	this->mutex->lock(this->mutex);
-	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	ipsec_sa_entry_t *current, *found = NULL, lookup = {
+		.spi = spi,
+		.src = src,
+		.dst = dst,
+	};
+
+	this->lock->write_lock(this->lock);
+	current = this->sas->get_match(this->sas, &lookup,
+								   (void*)match_entry_by_spi_src_dst);
+	if (current && mark_entry(this, current))
 	{
-		if (match_entry_by_spi_src_dst(current, spi, src, dst))
-		{
-			if (wait_remove_entry(this, current))
-			{
-				this->sas->remove_at(this->sas, enumerator);
-				found = current;
-			}
-			break;
-		}
+		found = current;
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 
 	if (found)
 	{
+		remove_entry(this, found);
 		DBG2(DBG_ESP, "deleted %sbound SAD entry with SPI %.8x",
 			 found->sa->is_inbound(found->sa) ? "in" : "out", ntohl(spi));
 		destroy_entry(found);
@@ -525,34 +666,47 @@ METHOD(ipsec_sa_mgr_t, checkout_by_reqid, ipsec_sa_t*,
 	private_ipsec_sa_mgr_t *this, u_int32_t reqid, bool inbound)
 {
 	ipsec_sa_entry_t *entry;
-	ipsec_sa_t *sa = NULL;
-
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_reqid_inbound,
-							 (void**)&entry, reqid, inbound) == SUCCESS &&
-		wait_for_entry(this, entry))
+	reqid_entries_t *found, lookup = {
+		.reqid = reqid,
+		.inbound = inbound,
+	};
+
+	this->lock->read_lock(this->lock);
+	found = this->reqids->get(this->reqids, &lookup);
+	if (!found || found->entries->get_first(found->entries,
+											(void**)&entry) != SUCCESS)
 	{
-		sa = entry->sa;
+		this->lock->unlock(this->lock);
+		return NULL;
 	}
-	this->mutex->unlock(this->mutex);
-	return sa;
+	if (wait_for_entry(this, entry))
+	{
+		return entry->sa;
+	}
+	return NULL;
 }
 
 METHOD(ipsec_sa_mgr_t, checkout_by_spi, ipsec_sa_t*,
 	private_ipsec_sa_mgr_t *this, u_int32_t spi, host_t *dst)
 {
-	ipsec_sa_entry_t *entry;
-	ipsec_sa_t *sa = NULL;
-
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_dst,
-							 (void**)&entry, spi, dst) == SUCCESS &&
-		wait_for_entry(this, entry))
+	ipsec_sa_entry_t *entry, lookup = {
+		.spi = spi,
+		.dst = dst,
+	};
+
+	this->lock->read_lock(this->lock);
+	entry = this->sas->get_match(this->sas, &lookup,
+								 (void*)match_entry_by_spi_dst);
+	if (!entry)
+	{
+		this->lock->unlock(this->lock);
+		return NULL;
+	}
+	if (wait_for_entry(this, entry))
 	{
-		sa = entry->sa;
+		return entry->sa;
 	}
-	this->mutex->unlock(this->mutex);
-	return sa;
+	return NULL;
 }
 
 METHOD(ipsec_sa_mgr_t, checkin, void,
@@ -560,40 +714,40 @@ METHOD(ipsec_sa_mgr_t, checkin, void,
 {
 	ipsec_sa_entry_t *entry;
 
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_sa_ptr,
-							 (void**)&entry, sa) == SUCCESS)
+	this->lock->read_lock(this->lock);
+	entry = this->entries->get(this->entries, sa);
+	if (entry)
 	{
+		entry->mutex->lock(entry->mutex);
 		if (entry->locked)
 		{
 			entry->locked = FALSE;
 			entry->condvar->signal(entry->condvar);
 		}
+		entry->mutex->unlock(entry->mutex);
 	}
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 }
 
 METHOD(ipsec_sa_mgr_t, flush_sas, status_t,
 	private_ipsec_sa_mgr_t *this)
 {
-	this->mutex->lock(this->mutex);
 	flush_entries(this);
-	this->mutex->unlock(this->mutex);
 	return SUCCESS;
 }
 
 METHOD(ipsec_sa_mgr_t, destroy, void,
 	private_ipsec_sa_mgr_t *this)
 {
-	this->mutex->lock(this->mutex);
 	flush_entries(this);
 	flush_allocated_spis(this);
-	this->mutex->unlock(this->mutex);
 
 	this->allocated_spis->destroy(this->allocated_spis);
 	this->sas->destroy(this->sas);
+	this->reqids->destroy(this->reqids);
+	this->entries->destroy(this->entries);
 
-	this->mutex->destroy(this->mutex);
+	this->lock->destroy(this->lock);
 	DESTROY_IF(this->rng);
 	free(this);
 }
@@ -616,8 +770,13 @@ ipsec_sa_mgr_t *ipsec_sa_mgr_create()
 			.flush_sas = _flush_sas,
 			.destroy = _destroy,
 		},
-		.sas = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.sas = hashtable_create((hashtable_hash_t)entry_hash,
+								(hashtable_equals_t)entry_equals, 32),
+		.reqids = hashtable_create((hashtable_hash_t)reqid_hash,
+								   (hashtable_equals_t)reqid_equals, 32),
+		.entries = hashtable_create((hashtable_hash_t)sa_hash,
+									(hashtable_equals_t)sa_equals, 32),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.allocated_spis = hashtable_create((hashtable_hash_t)spi_hash,
 										   (hashtable_equals_t)spi_equals, 16),
 	);
@@ -17,6 +17,7 @@
 
 #include <debug.h>
 #include <credentials/certificates/x509.h>
+#include <credentials/certificates/crl.h>
 
 ENUM(certificate_type_names, CERT_ANY, CERT_PLUTO_CRL,
 	"ANY",
@@ -63,3 +64,114 @@ bool certificate_is_newer(certificate_t *this, certificate_t *other)
 		 type, &that_update, FALSE, newer ? "replaced" : "retained");
 	return newer;
 }
+
+/**
+ * Add the fingerprints of a public key to a list of identities
+ */
+static void add_fingerprints(linked_list_t *ids, public_key_t *public)
+{
+	cred_encoding_type_t type;
+	chunk_t fp;
+
+	for (type = 0; type < KEYID_MAX; type++)
+	{
+		if (public->get_fingerprint(public, type, &fp))
+		{
+			ids->insert_last(ids,
+							 identification_create_from_encoding(ID_KEY_ID, fp));
+		}
+	}
+}
+
+/**
+ * Create the lookup identities of an X.509 certificate
+ */
+static linked_list_t *create_x509_ids(certificate_t *cert)
+{
+	identification_t *id;
+	enumerator_t *enumerator;
+	public_key_t *public;
+	linked_list_t *ids;
+	hasher_t *hasher;
+	chunk_t encoding, hash;
+	x509_t *x509 = (x509_t*)cert;
+	bool success;
+
+	hasher = lib->crypto->create_hasher(lib->crypto, HASH_SHA1);
+	if (!hasher)
+	{
+		return NULL;
+	}
+	if (!cert->get_encoding(cert, CERT_ASN1_DER, &encoding))
+	{
+		hasher->destroy(hasher);
+		return NULL;
+	}
+	success = hasher->allocate_hash(hasher, encoding, &hash);
+	hasher->destroy(hasher);
+	chunk_free(&encoding);
+	if (!success)
+	{
+		return NULL;
+	}
+	ids = linked_list_create();
+	ids->insert_last(ids, identification_create_from_encoding(ID_KEY_ID, hash));
+	chunk_free(&hash);
+
+	id = cert->get_subject(cert);
+	ids->insert_last(ids, id->clone(id));
+	enumerator = x509->create_subjectAltName_enumerator(x509);
+	while (enumerator->enumerate(enumerator, &id))
+	{
+		ids->insert_last(ids, id->clone(id));
+	}
+	enumerator->destroy(enumerator);
+	if (x509->get_subjectKeyIdentifier(x509).len)
+	{
+		ids->insert_last(ids, identification_create_from_encoding(ID_KEY_ID,
+									x509->get_subjectKeyIdentifier(x509)));
+	}
+	public = cert->get_public_key(cert);
+	if (public)
+	{
+		add_fingerprints(ids, public);
+		public->destroy(public);
+	}
+	return ids;
+}
+
+/**
+ * Create the lookup identities of an X.509 CRL
+ */
+static linked_list_t *create_crl_ids(certificate_t *cert)
+{
+	identification_t *id;
+	linked_list_t *ids;
+	crl_t *crl = (crl_t*)cert;
+
+	ids = linked_list_create();
+	id = cert->get_issuer(cert);
+	ids->insert_last(ids, id->clone(id));
+	if (crl->get_authKeyIdentifier(crl).len)
+	{
+		ids->insert_last(ids, identification_create_from_encoding(ID_KEY_ID,
+									crl->get_authKeyIdentifier(crl)));
+	}
+	return ids;
+}
+
+/**
+ * See header
+ */
+linked_list_t *certificate_create_lookup_ids(certificate_t *cert)
+{
+	switch (cert->get_type(cert))
+	{
+		case CERT_X509:
+			return create_x509_ids(cert);
+		case CERT_X509_CRL:
+			return create_crl_ids(cert);
+		default:
+			return NULL;
+	}
+}
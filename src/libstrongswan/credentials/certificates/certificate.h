@@ -29,6 +29,7 @@ typedef enum cert_validation_t cert_validation_t;
 #include <utils/identification.h>
 #include <credentials/keys/public_key.h>
 #include <credentials/cred_encoding.h>
+#include <utils/linked_list.h>
 
 /**
  * Kind of a certificate_t
@@ -207,4 +208,18 @@ struct certificate_t {
  */
 bool certificate_is_newer(certificate_t *cert, certificate_t *other);
 
+/**
+ * Create a list of identities to index a certificate by.
+ *
+ * For X.509 certificates, the list contains all identities has_subject()
+ * matches if they contain no wildcards: the SHA-1 hash of the encoding
+ * (always the first item), subject, subjectAltNames, subjectKeyIdentifier
+ * and public key fingerprints. For X.509 CRLs, it contains the issuer and
+ * authorityKeyIdentifier has_issuer() matches.
+ *
+ * @param cert			certificate
+ * @return				list of identification_t, NULL if not supported
+ */
+linked_list_t *certificate_create_lookup_ids(certificate_t *cert);
+
 #endif /** CERTIFICATE_H_ @}*/
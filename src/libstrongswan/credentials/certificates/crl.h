@@ -95,6 +95,19 @@ struct crl_t {
 	 * @return			enumerator over revoked certificates.
 	 */
 	enumerator_t* (*create_enumerator)(crl_t *this);
+
+	/**
+	 * Check if a certificate is listed as revoked in this CRL.
+	 *
+	 * Unlike create_enumerator(), this lookup does not scan all entries.
+	 *
+	 * @param serial	serial of the certificate to look up
+	 * @param date		receives revocation date, if found and not NULL
+	 * @param reason	receives revocation reason, if found and not NULL
+	 * @return			TRUE if certificate is listed as revoked
+	 */
+	bool (*is_revoked)(crl_t *this, chunk_t serial, time_t *date,
+					   crl_reason_t *reason);
 };
 
 /**
@@ -77,6 +77,20 @@ struct ocsp_response_t {
 	 * @return					enumerator over certificate_t*
 	 */
 	enumerator_t* (*create_cert_enumerator)(ocsp_response_t *this);
+
+	/**
+	 * Create an enumerator over the contained single responses.
+	 *
+	 * The enumerator takes 5 pointer arguments:
+	 * chunk_t serial, chunk_t issuer_keyid, cert_validation_t status,
+	 * time_t this_update, time_t next_update
+	 *
+	 * The issuer_keyid is the SHA1 hash over the issuer's public key, or
+	 * chunk_empty if the response identifies the issuer differently.
+	 *
+	 * @return					enumerator over single responses
+	 */
+	enumerator_t* (*create_response_enumerator)(ocsp_response_t *this);
 };
 
 #endif /** OCSP_RESPONSE_H_ @}*/
@@ -1124,12 +1124,26 @@ METHOD(credential_manager_t, get_private, private_key_t*,
 METHOD(credential_manager_t, flush_cache, void,
 	private_credential_manager_t *this, certificate_type_t type)
 {
+	/* cache queued certificates first, so they get flushed, too */
+	cache_queue(this);
 	if (this->cache)
 	{
 		this->cache->flush(this->cache, type);
 	}
 }
 
+METHOD(credential_manager_t, get_cache_stats, bool,
+	private_credential_manager_t *this, u_int *hits, u_int *misses,
+	u_int *evictions)
+{
+	if (this->cache)
+	{
+		this->cache->get_stats(this->cache, hits, misses, evictions);
+		return TRUE;
+	}
+	return FALSE;
+}
+
 METHOD(credential_manager_t, add_set, void,
 	private_credential_manager_t *this, credential_set_t *set)
 {
@@ -1199,6 +1213,7 @@ credential_manager_t *credential_manager_create()
 			.create_trusted_enumerator = _create_trusted_enumerator,
 			.create_public_enumerator = _create_public_enumerator,
 			.flush_cache = _flush_cache,
+			.get_cache_stats = _get_cache_stats,
 			.cache_cert = _cache_cert,
 			.issued_by = _issued_by,
 			.add_set = _add_set,
@@ -196,6 +196,17 @@ struct credential_manager_t {
 	 */
 	void (*flush_cache)(credential_manager_t *this, certificate_type_t type);
 
+	/**
+	 * Get statistics about the usage of the managers local cache.
+	 *
+	 * @param hits		receives the number of cached issued_by() results
+	 * @param misses	receives the number of signature verifications done
+	 * @param evictions	receives the number of relations evicted
+	 * @return			TRUE if the cache is enabled
+	 */
+	bool (*get_cache_stats)(credential_manager_t *this, u_int *hits,
+							u_int *misses, u_int *evictions);
+
 	/**
 	 * Check if a given subject certificate is issued by an issuer certificate.
 	 *
@@ -15,24 +15,25 @@
 
 #include "cert_cache.h"
 
-#include <time.h>
-#include <sched.h>
-
 #include <library.h>
 #include <threading/rwlock.h>
 #include <utils/linked_list.h>
+#include <utils/hashtable.h>
+
+/** default number of cached relations */
+#define CACHE_SIZE 1024
 
-/** cache size, a power of 2 for fast modulo */
-#define CACHE_SIZE 32
+/** number of shards, a power of 2 for fast modulo */
+#define CACHE_SHARDS 16
 
-/** attempts to acquire a cache lock */
-#define REPLACE_TRIES 5
+/** number of failed verifications cached per shard */
+#define FAILED_SLOTS 8
 
 typedef struct private_cert_cache_t private_cert_cache_t;
 typedef struct relation_t relation_t;
 
 /**
- * A trusted relation between subject and issuer
+ * A verified relation between subject and issuer, or a failed verification
  */
 struct relation_t {
 
@@ -52,16 +53,95 @@ struct relation_t {
 	signature_scheme_t scheme;
 
 	/**
-	 * Cache hits
+	 * Set on each cache hit, cleared by the CLOCK hand
 	 */
-	u_int hits;
+	bool referenced;
 
 	/**
-	 * Lock for this relation
+	 * Hash of subject and issuer
 	 */
-	rwlock_t *lock;
+	u_int hash;
+
+	/**
+	 * Identities the subject of a valid relation is indexed by, NULL for any
+	 */
+	linked_list_t *ids;
 };
 
+/**
+ * A shard of the cache, holding a part of the relations
+ */
+typedef struct {
+
+	/**
+	 * Lock for this shard
+	 */
+	rwlock_t *lock;
+
+	/**
+	 * Valid relations in this shard, relation_t => relation_t
+	 */
+	hashtable_t *relations;
+
+	/**
+	 * Slots the CLOCK hand iterates over, entries may be NULL
+	 */
+	relation_t **slots;
+
+	/**
+	 * Position of the CLOCK hand
+	 */
+	u_int hand;
+
+	/**
+	 * Failed verifications in this shard, relation_t => relation_t
+	 */
+	hashtable_t *failed;
+
+	/**
+	 * Slots for failed verifications, replaced in FIFO order
+	 */
+	relation_t *failed_slots[FAILED_SLOTS];
+
+	/**
+	 * Next slot to replace in failed_slots
+	 */
+	u_int failed_hand;
+
+	/**
+	 * Cache hits, incremented atomically under the read lock
+	 */
+	refcount_t hits;
+
+	/**
+	 * Cache misses, incremented atomically under the read lock
+	 */
+	refcount_t misses;
+
+	/**
+	 * Relations evicted to make room for others
+	 */
+	u_int evictions;
+
+} shard_t;
+
+/**
+ * Relations of valid subjects having the same lookup identity
+ */
+typedef struct {
+
+	/**
+	 * Lookup identity
+	 */
+	identification_t *id;
+
+	/**
+	 * Relations, as relation_t
+	 */
+	linked_list_t *relations;
+
+} bucket_t;
+
 /**
  * private data of cert_cache
  */
@@ -73,298 +153,566 @@ struct private_cert_cache_t {
 	cert_cache_t public;
 
 	/**
-	 * array of trusted subject-issuer relations
+	 * Shards of the cache
+	 */
+	shard_t shards[CACHE_SHARDS];
+
+	/**
+	 * Number of slots per shard
+	 */
+	u_int slots;
+
+	/**
+	 * Lock for the subject index
+	 */
+	rwlock_t *lock;
+
+	/**
+	 * Valid relations by lookup identity, identification_t => bucket_t
+	 */
+	hashtable_t *index;
+
+	/**
+	 * Valid relations with subjects not indexed by identity, as relation_t
 	 */
-	relation_t relations[CACHE_SIZE];
+	linked_list_t *any;
 };
 
 /**
- * Cache relation in a free slot/replace an other
+ * Hashtable hash function for relations
  */
-static void cache(private_cert_cache_t *this,
-				  certificate_t *subject, certificate_t *issuer,
-				  signature_scheme_t scheme)
+static u_int relation_hash(relation_t *rel)
 {
-	relation_t *rel;
-	int i, offset, try;
-	u_int total_hits = 0;
+	return rel->hash;
+}
+
+/**
+ * Hashtable equals function for relations
+ */
+static bool relation_equals(relation_t *a, relation_t *b)
+{
+	return a->subject->equals(a->subject, b->subject) &&
+		   a->issuer->equals(a->issuer, b->issuer);
+}
 
-	/* check for a unused relation slot first */
-	for (i = 0; i < CACHE_SIZE; i++)
+/**
+ * Hashtable hash function for lookup identities
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Hashtable equals function for lookup identities
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Hash the encodings of subject and issuer
+ */
+static u_int hash_certs(certificate_t *subject, certificate_t *issuer)
+{
+	chunk_t encoding;
+	u_int hash = 0;
+
+	if (subject->get_encoding(subject, CERT_ASN1_DER, &encoding))
 	{
-		rel = &this->relations[i];
+		hash = chunk_hash_inc(encoding, hash);
+		chunk_free(&encoding);
+	}
+	if (issuer->get_encoding(issuer, CERT_ASN1_DER, &encoding))
+	{
+		hash = chunk_hash_inc(encoding, hash);
+		chunk_free(&encoding);
+	}
+	return hash;
+}
+
+/**
+ * Get the shard responsible for a hash, using the bits the hashtable does not
+ */
+static shard_t *get_shard(private_cert_cache_t *this, u_int hash)
+{
+	return &this->shards[(hash >> 24) % CACHE_SHARDS];
+}
 
-		if (!rel->subject && rel->lock->try_write_lock(rel->lock))
+/**
+ * Add the subject of a valid relation to the index, requires the index lock
+ */
+static void index_add(private_cert_cache_t *this, relation_t *rel)
+{
+	enumerator_t *enumerator;
+	identification_t *id;
+	bucket_t *bucket;
+
+	rel->ids = certificate_create_lookup_ids(rel->subject);
+	if (!rel->ids)
+	{
+		this->any->insert_last(this->any, rel);
+		return;
+	}
+	enumerator = rel->ids->create_enumerator(rel->ids);
+	while (enumerator->enumerate(enumerator, &id))
+	{
+		bucket = this->index->get(this->index, id);
+		if (!bucket)
 		{
-			/* double-check having lock */
-			if (!rel->subject)
-			{
-				rel->subject = subject->get_ref(subject);
-				rel->issuer = issuer->get_ref(issuer);
-				rel->scheme = scheme;
-				return rel->lock->unlock(rel->lock);
-			}
-			rel->lock->unlock(rel->lock);
+			INIT(bucket,
+				.id = id->clone(id),
+				.relations = linked_list_create(),
+			);
+			this->index->put(this->index, bucket->id, bucket);
+		}
+		if (bucket->relations->find_first(bucket->relations, NULL,
+										  (void**)&rel) != SUCCESS)
+		{	/* subjects might list the same identity twice */
+			bucket->relations->insert_last(bucket->relations, rel);
 		}
-		total_hits += rel->hits;
 	}
-	/* run several attempts to replace a random slot, never block. */
-	for (try = 0; try < REPLACE_TRIES; try++)
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Remove the subject of a valid relation from the index, requires the lock
+ */
+static void index_remove(private_cert_cache_t *this, relation_t *rel)
+{
+	enumerator_t *enumerator;
+	identification_t *id;
+	bucket_t *bucket;
+
+	if (!rel->ids)
+	{
+		this->any->remove(this->any, rel, NULL);
+		return;
+	}
+	enumerator = rel->ids->create_enumerator(rel->ids);
+	while (enumerator->enumerate(enumerator, &id))
 	{
-		/* replace a random relation */
-		offset = random();
-		for (i = 0; i < CACHE_SIZE; i++)
+		bucket = this->index->get(this->index, id);
+		if (bucket)
 		{
-			rel = &this->relations[(i + offset) % CACHE_SIZE];
-
-			if (rel->hits > total_hits / CACHE_SIZE)
-			{	/* skip often used slots */
-				continue;
-			}
-			if (rel->lock->try_write_lock(rel->lock))
+			bucket->relations->remove(bucket->relations, rel, NULL);
+			if (bucket->relations->get_count(bucket->relations) == 0)
 			{
-				if (rel->subject)
-				{
-					rel->subject->destroy(rel->subject);
-					rel->issuer->destroy(rel->issuer);
-				}
-				rel->subject = subject->get_ref(subject);
-				rel->issuer = issuer->get_ref(issuer);
-				rel->scheme = scheme;
-				rel->hits = 0;
-				return rel->lock->unlock(rel->lock);
+				this->index->remove(this->index, id);
+				bucket->relations->destroy(bucket->relations);
+				bucket->id->destroy(bucket->id);
+				free(bucket);
 			}
 		}
-		/* give other threads a chance to release locks */
-		sched_yield();
 	}
+	enumerator->destroy(enumerator);
+	rel->ids->destroy_offset(rel->ids, offsetof(identification_t, destroy));
+	rel->ids = NULL;
 }
 
-METHOD(cert_cache_t, issued_by, bool,
-	private_cert_cache_t *this, certificate_t *subject, certificate_t *issuer,
-	signature_scheme_t *schemep)
+/**
+ * Destroy a relation
+ */
+static void relation_destroy(relation_t *rel)
 {
-	relation_t *found = NULL, *current;
-	signature_scheme_t scheme;
-	int i;
+	rel->subject->destroy(rel->subject);
+	rel->issuer->destroy(rel->issuer);
+	free(rel);
+}
 
-	for (i = 0; i < CACHE_SIZE; i++)
-	{
-		current = &this->relations[i];
+/**
+ * Remove a valid relation from its shard and the index, requires the lock
+ */
+static void relation_remove(private_cert_cache_t *this, shard_t *shard,
+							u_int slot)
+{
+	relation_t *rel = shard->slots[slot];
+
+	shard->relations->remove(shard->relations, rel);
+	shard->slots[slot] = NULL;
+	this->lock->write_lock(this->lock);
+	index_remove(this, rel);
+	this->lock->unlock(this->lock);
+	relation_destroy(rel);
+}
+
+/**
+ * Remove a failed verification from its shard, requires the shard lock
+ */
+static void failed_remove(shard_t *shard, u_int slot)
+{
+	relation_t *rel = shard->failed_slots[slot];
+
+	shard->failed->remove(shard->failed, rel);
+	shard->failed_slots[slot] = NULL;
+	relation_destroy(rel);
+}
 
-		current->lock->read_lock(current->lock);
-		if (current->subject)
+/**
+ * Find a free slot in a shard, or free one using CLOCK eviction
+ */
+static u_int get_slot(private_cert_cache_t *this, shard_t *shard)
+{
+	relation_t *rel;
+	u_int i, slot;
+
+	if (shard->relations->get_count(shard->relations) < this->slots)
+	{
+		for (i = 0; i < this->slots; i++)
 		{
-			/* check for equal issuer */
-			if (issuer->equals(issuer, current->issuer))
+			slot = (shard->hand + i) % this->slots;
+			if (!shard->slots[slot])
 			{
-				/* reuse issuer instance in cache() */
-				issuer = current->issuer;
-				if (subject->equals(subject, current->subject))
-				{
-					/* write hit counter is not locked, but not critical */
-					current->hits++;
-					found = current;;
-					if (schemep)
-					{
-						*schemep = current->scheme;
-					}
-				}
+				shard->hand = (slot + 1) % this->slots;
+				return slot;
 			}
 		}
-		current->lock->unlock(current->lock);
-		if (found)
+	}
+	while (TRUE)
+	{
+		slot = shard->hand;
+		shard->hand = (slot + 1) % this->slots;
+		rel = shard->slots[slot];
+		if (!rel->referenced)
 		{
-			return TRUE;
+			relation_remove(this, shard, slot);
+			shard->evictions++;
+			return slot;
 		}
+		/* give recently used relations a second chance */
+		rel->referenced = FALSE;
 	}
-	/* no cache hit, check and cache signature */
-	if (subject->issued_by(subject, issuer, &scheme))
+}
+
+/**
+ * Cache the result of a verification
+ *
+ * Failed verifications are kept in a few separate slots per shard, so
+ * repeatedly trying wrong issuers can't evict valid relations.
+ */
+static void cache(private_cert_cache_t *this, shard_t *shard, relation_t *key,
+				  bool valid, signature_scheme_t scheme)
+{
+	relation_t *rel;
+	u_int slot;
+
+	shard->lock->write_lock(shard->lock);
+	if (!shard->relations->get(shard->relations, key) &&
+		!shard->failed->get(shard->failed, key))
+	{	/* not cached by a concurrent verification */
+		INIT(rel,
+			.subject = key->subject->get_ref(key->subject),
+			.issuer = key->issuer->get_ref(key->issuer),
+			.scheme = scheme,
+			.hash = key->hash,
+		);
+		if (valid)
+		{
+			shard->slots[get_slot(this, shard)] = rel;
+			shard->relations->put(shard->relations, rel, rel);
+			this->lock->write_lock(this->lock);
+			index_add(this, rel);
+			this->lock->unlock(this->lock);
+		}
+		else
+		{
+			slot = shard->failed_hand;
+			shard->failed_hand = (slot + 1) % FAILED_SLOTS;
+			if (shard->failed_slots[slot])
+			{
+				failed_remove(shard, slot);
+			}
+			shard->failed_slots[slot] = rel;
+			shard->failed->put(shard->failed, rel, rel);
+		}
+	}
+	shard->lock->unlock(shard->lock);
+}
+
+METHOD(cert_cache_t, issued_by, bool,
+	private_cert_cache_t *this, certificate_t *subject, certificate_t *issuer,
+	signature_scheme_t *schemep)
+{
+	relation_t *found, key = {
+		.subject = subject,
+		.issuer = issuer,
+		.hash = hash_certs(subject, issuer),
+	};
+	signature_scheme_t scheme = SIGN_UNKNOWN;
+	shard_t *shard;
+	bool valid;
+
+	shard = get_shard(this, key.hash);
+	shard->lock->read_lock(shard->lock);
+	found = shard->relations->get(shard->relations, &key);
+	if (found)
 	{
-		cache(this, subject, issuer, scheme);
+		ref_get(&shard->hits);
+		/* reference bit is written without write lock, but not critical */
+		found->referenced = TRUE;
 		if (schemep)
 		{
-			*schemep = scheme;
+			*schemep = found->scheme;
 		}
+		shard->lock->unlock(shard->lock);
 		return TRUE;
 	}
-	return FALSE;
+	if (shard->failed->get(shard->failed, &key))
+	{
+		ref_get(&shard->hits);
+		shard->lock->unlock(shard->lock);
+		return FALSE;
+	}
+	ref_get(&shard->misses);
+	shard->lock->unlock(shard->lock);
+
+	/* no cache hit, check signature without holding a lock and cache the
+	 * result, failed verifications as well */
+	valid = subject->issued_by(subject, issuer, &scheme);
+	cache(this, shard, &key, valid, scheme);
+	if (valid && schemep)
+	{
+		*schemep = scheme;
+	}
+	return valid;
 }
 
 /**
- * certificate enumerator implemenation
+ * Data for the certificate enumerator
  */
 typedef struct {
-	/** implements enumerator_t interface */
-	enumerator_t public;
 	/** type of requested certificate */
 	certificate_type_t cert;
 	/** type of requested key */
 	key_type_t key;
 	/** ID to get a cert for */
 	identification_t *id;
-	/** cache */
-	relation_t *relations;
-	/** current position in array cache */
-	int index;
-	/** currently locked relation */
-	int locked;
-} cert_enumerator_t;
+	/** references to candidate subjects, as certificate_t */
+	linked_list_t *candidates;
+} cert_data_t;
 
 /**
- * filter function for certs enumerator
+ * Add a reference to a subject to the candidates, if not already there
  */
-static bool cert_enumerate(cert_enumerator_t *this, certificate_t **out)
+static void add_candidate(linked_list_t *candidates, relation_t *rel)
 {
-	public_key_t *public;
-	relation_t *rel;
+	certificate_t *cert = rel->subject;
 
-	if (this->locked >= 0)
+	if (candidates->find_first(candidates, NULL, (void**)&cert) != SUCCESS)
 	{
-		rel = &this->relations[this->locked];
-		rel->lock->unlock(rel->lock);
-		this->locked = -1;
+		candidates->insert_last(candidates, cert->get_ref(cert));
 	}
+}
 
-	while (++this->index < CACHE_SIZE)
+/**
+ * Collect all subjects of valid relations as candidates
+ */
+static void collect_all(private_cert_cache_t *this, linked_list_t *candidates)
+{
+	shard_t *shard;
+	u_int i, j;
+
+	for (i = 0; i < CACHE_SHARDS; i++)
 	{
-		rel = &this->relations[this->index];
-		rel->lock->read_lock(rel->lock);
-		this->locked = this->index;
-		if (rel->subject)
+		shard = &this->shards[i];
+		shard->lock->read_lock(shard->lock);
+		for (j = 0; j < this->slots; j++)
 		{
-			/* CRL lookup is done using issuer/authkeyidentifier */
-			if (this->key == KEY_ANY && this->id &&
-				(this->cert == CERT_ANY || this->cert == CERT_X509_CRL) &&
-				rel->subject->get_type(rel->subject) == CERT_X509_CRL &&
-				rel->subject->has_issuer(rel->subject, this->id))
+			if (shard->slots[j])
 			{
-				*out = rel->subject;
-				return TRUE;
+				add_candidate(candidates, shard->slots[j]);
 			}
-			if ((this->cert == CERT_ANY ||
-				 rel->subject->get_type(rel->subject) == this->cert) &&
-				(!this->id || rel->subject->has_subject(rel->subject, this->id)))
+		}
+		shard->lock->unlock(shard->lock);
+	}
+}
+
+/**
+ * Collect subjects of valid relations indexed by the given identities
+ */
+static void collect_ids(private_cert_cache_t *this, linked_list_t *candidates,
+						identification_t **ids, int count)
+{
+	enumerator_t *enumerator;
+	relation_t *rel;
+	bucket_t *bucket;
+	int i;
+
+	this->lock->read_lock(this->lock);
+	for (i = 0; i < count; i++)
+	{
+		bucket = this->index->get(this->index, ids[i]);
+		if (bucket)
+		{
+			enumerator = bucket->relations->create_enumerator(
+														bucket->relations);
+			while (enumerator->enumerate(enumerator, &rel))
 			{
-				if (this->key == KEY_ANY)
-				{
-					*out = rel->subject;
-					return TRUE;
-				}
-				public = rel->subject->get_public_key(rel->subject);
-				if (public)
-				{
-					if (public->get_type(public) == this->key)
-					{
-						public->destroy(public);
-						*out = rel->subject;
-						return TRUE;
-					}
-					public->destroy(public);
-				}
+				add_candidate(candidates, rel);
 			}
+			enumerator->destroy(enumerator);
 		}
-		this->locked = -1;
-		rel->lock->unlock(rel->lock);
 	}
-	return FALSE;
+	enumerator = this->any->create_enumerator(this->any);
+	while (enumerator->enumerate(enumerator, &rel))
+	{
+		add_candidate(candidates, rel);
+	}
+	enumerator->destroy(enumerator);
+	this->lock->unlock(this->lock);
 }
 
 /**
- * clean up enumeration data
+ * destroy cert_data
  */
-static void cert_enumerator_destroy(cert_enumerator_t *this)
+static void cert_data_destroy(cert_data_t *data)
 {
-	relation_t *rel;
+	data->candidates->destroy_offset(data->candidates,
+									 offsetof(certificate_t, destroy));
+	free(data);
+}
+
+/**
+ * filter function for certs enumerator
+ */
+static bool certs_filter(cert_data_t *data, certificate_t **in,
+						 certificate_t **out)
+{
+	public_key_t *public;
+	certificate_t *cert = *in;
 
-	if (this->locked >= 0)
+	/* CRL lookup is done using issuer/authkeyidentifier */
+	if (data->key == KEY_ANY && data->id &&
+		(data->cert == CERT_ANY || data->cert == CERT_X509_CRL) &&
+		cert->get_type(cert) == CERT_X509_CRL &&
+		cert->has_issuer(cert, data->id))
 	{
-		rel = &this->relations[this->locked];
-		rel->lock->unlock(rel->lock);
+		*out = cert;
+		return TRUE;
 	}
-	free(this);
+	if ((data->cert == CERT_ANY || cert->get_type(cert) == data->cert) &&
+		(!data->id || cert->has_subject(cert, data->id)))
+	{
+		if (data->key == KEY_ANY)
+		{
+			*out = cert;
+			return TRUE;
+		}
+		public = cert->get_public_key(cert);
+		if (public)
+		{
+			if (public->get_type(public) == data->key)
+			{
+				public->destroy(public);
+				*out = cert;
+				return TRUE;
+			}
+			public->destroy(public);
+		}
+	}
+	return FALSE;
 }
 
 METHOD(credential_set_t, create_enumerator, enumerator_t*,
 	private_cert_cache_t *this, certificate_type_t cert, key_type_t key,
 	identification_t *id, bool trusted)
 {
-	cert_enumerator_t *enumerator;
+	identification_t *ids[2];
+	cert_data_t *data;
 
 	if (trusted)
 	{
 		return NULL;
 	}
-	enumerator = malloc_thing(cert_enumerator_t);
-	enumerator->public.enumerate = (void*)cert_enumerate;
-	enumerator->public.destroy = (void*)cert_enumerator_destroy;
-	enumerator->cert = cert;
-	enumerator->key = key;
-	enumerator->id = id;
-	enumerator->relations = this->relations;
-	enumerator->index = -1;
-	enumerator->locked = -1;
-
-	return &enumerator->public;
+	INIT(data,
+		.cert = cert,
+		.key = key,
+		.id = id,
+		.candidates = linked_list_create(),
+	);
+	if (!id || id->contains_wildcards(id))
+	{	/* wildcard subjects might match any certificate */
+		collect_all(this, data->candidates);
+	}
+	else
+	{	/* the ID might be a subject or a keyid/fingerprint of any type */
+		ids[0] = id;
+		ids[1] = identification_create_from_encoding(ID_KEY_ID,
+													 id->get_encoding(id));
+		collect_ids(this, data->candidates, ids, countof(ids));
+		ids[1]->destroy(ids[1]);
+	}
+	return enumerator_create_filter(
+						data->candidates->create_enumerator(data->candidates),
+						(void*)certs_filter, data, (void*)cert_data_destroy);
 }
 
 METHOD(cert_cache_t, flush, void,
 	private_cert_cache_t *this, certificate_type_t type)
 {
+	shard_t *shard;
 	relation_t *rel;
-	int i;
+	u_int i, j;
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	for (i = 0; i < CACHE_SHARDS; i++)
 	{
-		rel = &this->relations[i];
-		if (!rel->subject)
+		shard = &this->shards[i];
+		shard->lock->write_lock(shard->lock);
+		for (j = 0; j < this->slots; j++)
 		{
-			continue;
-		}
-		/* check with cheap read lock first */
-		if (type != CERT_ANY)
-		{
-			rel->lock->read_lock(rel->lock);
-			if (!rel->subject || type != rel->subject->get_type(rel->subject))
+			rel = shard->slots[j];
+			if (rel && (type == CERT_ANY ||
+						type == rel->subject->get_type(rel->subject)))
 			{
-				rel->lock->unlock(rel->lock);
-				continue;
+				relation_remove(this, shard, j);
 			}
-			rel->lock->unlock(rel->lock);
 		}
-		/* double check in write lock */
-		rel->lock->write_lock(rel->lock);
-		if (rel->subject)
+		for (j = 0; j < FAILED_SLOTS; j++)
 		{
-			if (type == CERT_ANY || type == rel->subject->get_type(rel->subject))
+			rel = shard->failed_slots[j];
+			if (rel && (type == CERT_ANY ||
+						type == rel->subject->get_type(rel->subject)))
 			{
-				rel->subject->destroy(rel->subject);
-				rel->issuer->destroy(rel->issuer);
-				rel->subject = NULL;
-				rel->issuer = NULL;
-				rel->hits = 0;
+				failed_remove(shard, j);
 			}
 		}
-		rel->lock->unlock(rel->lock);
+		shard->lock->unlock(shard->lock);
+	}
+}
+
+METHOD(cert_cache_t, get_stats, void,
+	private_cert_cache_t *this, u_int *hits, u_int *misses, u_int *evictions)
+{
+	u_int i;
+
+	*hits = *misses = *evictions = 0;
+	for (i = 0; i < CACHE_SHARDS; i++)
+	{
+		*hits += this->shards[i].hits;
+		*misses += this->shards[i].misses;
+		*evictions += this->shards[i].evictions;
 	}
 }
 
 METHOD(cert_cache_t, destroy, void,
 	private_cert_cache_t *this)
 {
-	relation_t *rel;
-	int i;
+	shard_t *shard;
+	u_int i;
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	flush(this, CERT_ANY);
+	for (i = 0; i < CACHE_SHARDS; i++)
 	{
-		rel = &this->relations[i];
-		if (rel->subject)
-		{
-			rel->subject->destroy(rel->subject);
-			rel->issuer->destroy(rel->issuer);
-		}
-		rel->lock->destroy(rel->lock);
+		shard = &this->shards[i];
+		shard->relations->destroy(shard->relations);
+		shard->failed->destroy(shard->failed);
+		shard->lock->destroy(shard->lock);
+		free(shard->slots);
 	}
+	this->index->destroy(this->index);
+	this->any->destroy(this->any);
+	this->lock->destroy(this->lock);
 	free(this);
 }
 
@@ -374,7 +722,7 @@ METHOD(cert_cache_t, destroy, void,
 cert_cache_t *cert_cache_create()
 {
 	private_cert_cache_t *this;
-	int i;
+	int i, size;
 
 	INIT(this,
 		.public = {
@@ -387,16 +735,29 @@ cert_cache_t *cert_cache_create()
 			},
 			.issued_by = _issued_by,
 			.flush = _flush,
+			.get_stats = _get_stats,
 			.destroy = _destroy,
 		},
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.index = hashtable_create((hashtable_hash_t)id_hash,
+								  (hashtable_equals_t)id_equals, 32),
+		.any = linked_list_create(),
 	);
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	size = lib->settings->get_int(lib->settings,
+								  "libstrongswan.cert_cache_size", CACHE_SIZE);
+	this->slots = max(1, (size + CACHE_SHARDS - 1) / CACHE_SHARDS);
+
+	for (i = 0; i < CACHE_SHARDS; i++)
 	{
-		this->relations[i].subject = NULL;
-		this->relations[i].issuer = NULL;
-		this->relations[i].hits = 0;
-		this->relations[i].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		this->shards[i].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		this->shards[i].relations = hashtable_create(
+									(hashtable_hash_t)relation_hash,
+									(hashtable_equals_t)relation_equals, 8);
+		this->shards[i].failed = hashtable_create(
+									(hashtable_hash_t)relation_hash,
+									(hashtable_equals_t)relation_equals, 4);
+		this->shards[i].slots = calloc(this->slots, sizeof(relation_t*));
 	}
 
 	return &this->public;
@@ -30,8 +30,9 @@ typedef struct cert_cache_t cert_cache_t;
  *
  * This cache serves all certificates seen in its issued_by method
  * and serves them as untrusted through the credential set interface. Further,
- * it caches valid subject-issuer relationships to speed up the issued_by
- * method.
+ * it caches the results of subject-issuer verifications to speed up the
+ * issued_by method. The number of cached relations is configured with
+ * libstrongswan.cert_cache_size, rarely used relations get evicted.
  */
 struct cert_cache_t {
 
@@ -59,6 +60,16 @@ struct cert_cache_t {
 	 */
 	void (*flush)(cert_cache_t *this, certificate_type_t type);
 
+	/**
+	 * Get statistics about the cache usage.
+	 *
+	 * @param hits			receives the number of cached issued_by() results
+	 * @param misses		receives the number of verifications done
+	 * @param evictions		receives the number of relations evicted
+	 */
+	void (*get_stats)(cert_cache_t *this, u_int *hits, u_int *misses,
+					  u_int *evictions);
+
 	/**
 	 * Destroy a cert_cache instance.
 	 */
@@ -19,9 +19,51 @@
 
 #include <threading/rwlock.h>
 #include <utils/linked_list.h>
+#include <utils/hashtable.h>
 
 typedef struct private_mem_cred_t private_mem_cred_t;
 
+/**
+ * Indexed list of credentials.
+ *
+ * Each credential is stored in an entry, which gets indexed by identities
+ * the credential is looked up with. Credentials that can't be indexed, for
+ * instance because their lookup keys contain wildcards, are kept in a list of
+ * entries returned for any key.
+ */
+typedef struct {
+	/** all entries, newest first, as entry_t */
+	linked_list_t *all;
+	/** entries not indexed, newest first, as entry_t */
+	linked_list_t *any;
+	/** indexed entries, identification_t => bucket_t */
+	hashtable_t *ids;
+	/** sequence number of the next entry */
+	u_int seq;
+} cred_list_t;
+
+/**
+ * Entry of a cred_list_t
+ */
+typedef struct {
+	/** certificate_t, private_key_t or shared_entry_t */
+	void *item;
+	/** keys the entry is indexed by, identification_t */
+	linked_list_t *keys;
+	/** insertion sequence number */
+	u_int seq;
+} entry_t;
+
+/**
+ * Entries indexed by the same key
+ */
+typedef struct {
+	/** key of the bucket */
+	identification_t *key;
+	/** entries, newest first, as entry_t */
+	linked_list_t *entries;
+} bucket_t;
+
 /**
  * Private data of an mem_cred_t object.
  */
@@ -40,22 +82,22 @@ struct private_mem_cred_t {
 	/**
 	 * List of trusted certificates, certificate_t
 	 */
-	linked_list_t *trusted;
+	cred_list_t *trusted;
 
 	/**
 	 * List of trusted and untrusted certificates, certificate_t
 	 */
-	linked_list_t *untrusted;
+	cred_list_t *untrusted;
 
 	/**
 	 * List of private keys, private_key_t
 	 */
-	linked_list_t *keys;
+	cred_list_t *keys;
 
 	/**
 	 * List of shared keys, as shared_entry_t
 	 */
-	linked_list_t *shared;
+	cred_list_t *shared;
 
 	/**
 	 * List of CDPs, as cdp_t
@@ -63,6 +105,269 @@ struct private_mem_cred_t {
 	linked_list_t *cdps;
 };
 
+/**
+ * Hash an identity used as key
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Compare two identities used as keys
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->equals(a, b);
+}
+
+/**
+ * Create an empty credential list
+ */
+static cred_list_t *cred_list_create()
+{
+	cred_list_t *list;
+
+	INIT(list,
+		.all = linked_list_create(),
+		.any = linked_list_create(),
+		.ids = hashtable_create((hashtable_hash_t)id_hash,
+								(hashtable_equals_t)id_equals, 32),
+	);
+	return list;
+}
+
+/**
+ * Add a credential to a list, keys get cloned, NULL to index it as any
+ */
+static void cred_list_add(cred_list_t *list, void *item, linked_list_t *keys)
+{
+	enumerator_t *enumerator;
+	identification_t *key;
+	bucket_t *bucket;
+	entry_t *entry;
+
+	INIT(entry,
+		.item = item,
+		.keys = linked_list_create(),
+		.seq = list->seq++,
+	);
+	list->all->insert_first(list->all, entry);
+	if (!keys)
+	{
+		list->any->insert_first(list->any, entry);
+		return;
+	}
+	enumerator = keys->create_enumerator(keys);
+	while (enumerator->enumerate(enumerator, &key))
+	{
+		if (entry->keys->find_first(entry->keys, (void*)id_equals,
+									NULL, key) == SUCCESS)
+		{	/* e.g. subjectAltName equal to subject */
+			continue;
+		}
+		entry->keys->insert_last(entry->keys, key->clone(key));
+		bucket = list->ids->get(list->ids, key);
+		if (!bucket)
+		{
+			INIT(bucket,
+				.key = key->clone(key),
+				.entries = linked_list_create(),
+			);
+			list->ids->put(list->ids, bucket->key, bucket);
+		}
+		bucket->entries->insert_first(bucket->entries, entry);
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Remove an entry from a list, returns the credential
+ */
+static void *cred_list_remove(cred_list_t *list, entry_t *entry)
+{
+	identification_t *key;
+	bucket_t *bucket;
+	void *item;
+
+	while (entry->keys->remove_last(entry->keys, (void**)&key) == SUCCESS)
+	{
+		bucket = list->ids->get(list->ids, key);
+		if (bucket)
+		{
+			bucket->entries->remove(bucket->entries, entry, NULL);
+			if (bucket->entries->get_count(bucket->entries) == 0)
+			{
+				list->ids->remove(list->ids, key);
+				bucket->entries->destroy(bucket->entries);
+				bucket->key->destroy(bucket->key);
+				free(bucket);
+			}
+		}
+		key->destroy(key);
+	}
+	list->all->remove(list->all, entry, NULL);
+	list->any->remove(list->any, entry, NULL);
+	entry->keys->destroy(entry->keys);
+	item = entry->item;
+	free(entry);
+	return item;
+}
+
+/**
+ * Destroy a list and all its credentials
+ */
+static void cred_list_destroy(cred_list_t *list, void (*destroy)(void*))
+{
+	enumerator_t *enumerator;
+	identification_t *key;
+	bucket_t *bucket;
+	entry_t *entry;
+
+	enumerator = list->ids->create_enumerator(list->ids);
+	while (enumerator->enumerate(enumerator, &key, &bucket))
+	{
+		bucket->entries->destroy(bucket->entries);
+		bucket->key->destroy(bucket->key);
+		free(bucket);
+	}
+	enumerator->destroy(enumerator);
+	list->ids->destroy(list->ids);
+	while (list->all->remove_last(list->all, (void**)&entry) == SUCCESS)
+	{
+		entry->keys->destroy_offset(entry->keys,
+									offsetof(identification_t, destroy));
+		destroy(entry->item);
+		free(entry);
+	}
+	list->all->destroy(list->all);
+	list->any->destroy(list->any);
+	free(list);
+}
+
+/**
+ * Get the entries indexed by a key, NULL if none
+ */
+static linked_list_t *cred_list_get(cred_list_t *list, identification_t *key)
+{
+	bucket_t *bucket;
+
+	bucket = list->ids->get(list->ids, key);
+	return bucket ? bucket->entries : NULL;
+}
+
+/**
+ * Sort entries newest first
+ */
+static int entry_cmp(const void *a, const void *b)
+{
+	const entry_t *ea = *(const entry_t**)a, *eb = *(const entry_t**)b;
+
+	return ea->seq < eb->seq ? 1 : (ea->seq > eb->seq ? -1 : 0);
+}
+
+/**
+ * Create an enumerator over the entries of a list, NULL for all entries.
+ * Otherwise the entries indexed by the given keys and those not indexed are
+ * enumerated, in the order they have been added.
+ */
+static enumerator_t *cred_list_create_enumerator(cred_list_t *list,
+												 identification_t **keys,
+												 int count)
+{
+	linked_list_t *candidates, *current;
+	enumerator_t *enumerator;
+	entry_t **entries, *entry;
+	int i, n = 0, total;
+
+	if (!keys)
+	{
+		return list->all->create_enumerator(list->all);
+	}
+	total = list->any->get_count(list->any);
+	for (i = 0; i < count; i++)
+	{
+		current = cred_list_get(list, keys[i]);
+		total += current ? current->get_count(current) : 0;
+	}
+	entries = malloc(sizeof(entry_t*) * max(total, 1));
+	for (i = 0; i <= count; i++)
+	{
+		current = i < count ? cred_list_get(list, keys[i]) : list->any;
+		if (current)
+		{
+			enumerator = current->create_enumerator(current);
+			while (enumerator->enumerate(enumerator, &entry))
+			{
+				entries[n++] = entry;
+			}
+			enumerator->destroy(enumerator);
+		}
+	}
+	qsort(entries, n, sizeof(entry_t*), entry_cmp);
+	candidates = linked_list_create();
+	for (i = 0; i < n; i++)
+	{
+		if (i == 0 || entries[i] != entries[i - 1])
+		{
+			candidates->insert_last(candidates, entries[i]);
+		}
+	}
+	free(entries);
+	return enumerator_create_cleaner(candidates->create_enumerator(candidates),
+									 (void*)candidates->destroy, candidates);
+}
+
+/**
+ * Create a key for lookups by keyid or fingerprint
+ */
+static identification_t *keyid_create(chunk_t keyid)
+{
+	return identification_create_from_encoding(ID_KEY_ID, keyid);
+}
+
+/**
+ * Add the fingerprints of a private key to a list of keys
+ */
+static void add_fingerprints(linked_list_t *keys, private_key_t *private)
+{
+	cred_encoding_type_t type;
+	chunk_t fp;
+
+	for (type = 0; type < KEYID_MAX; type++)
+	{
+		if (private->get_fingerprint(private, type, &fp))
+		{
+			keys->insert_last(keys, keyid_create(fp));
+		}
+	}
+}
+
+/**
+ * Get the keys to index a certificate by, NULL to index it as any.
+ *
+ * CRLs are not indexed, as add_crl() looks them up by issuer.
+ */
+static linked_list_t *get_cert_keys(certificate_t *cert)
+{
+	if (cert->get_type(cert) != CERT_X509)
+	{
+		return NULL;
+	}
+	return certificate_create_lookup_ids(cert);
+}
+
+/**
+ * Destroy a list of keys
+ */
+static void keys_destroy(linked_list_t *keys)
+{
+	if (keys)
+	{
+		keys->destroy_offset(keys, offsetof(identification_t, destroy));
+	}
+}
+
 /**
  * Data for the certificate enumerator
  */
@@ -85,10 +390,10 @@ static void cert_data_destroy(cert_data_t *data)
 /**
  * filter function for certs enumerator
  */
-static bool certs_filter(cert_data_t *data, certificate_t **in, certificate_t **out)
+static bool certs_filter(cert_data_t *data, entry_t **in, certificate_t **out)
 {
 	public_key_t *public;
-	certificate_t *cert = *in;
+	certificate_t *cert = (*in)->item;
 
 	if (data->cert == CERT_ANY || data->cert == cert->get_type(cert))
 	{
@@ -101,7 +406,7 @@ static bool certs_filter(cert_data_t *data, certificate_t **in, certificate_t **
 											data->id->get_encoding(data->id)))
 				{
 					public->destroy(public);
-					*out = *in;
+					*out = cert;
 					return TRUE;
 				}
 			}
@@ -113,7 +418,7 @@ static bool certs_filter(cert_data_t *data, certificate_t **in, certificate_t **
 		}
 		if (data->id == NULL || cert->has_subject(cert, data->id))
 		{
-			*out = *in;
+			*out = cert;
 			return TRUE;
 		}
 	}
@@ -124,8 +429,10 @@ METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
 	private_mem_cred_t *this, certificate_type_t cert, key_type_t key,
 	identification_t *id, bool trusted)
 {
+	identification_t *keys[2];
 	cert_data_t *data;
 	enumerator_t *enumerator;
+	cred_list_t *list;
 
 	INIT(data,
 		.lock = this->lock,
@@ -134,23 +441,22 @@ METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
 		.id = id,
 	);
 	this->lock->read_lock(this->lock);
-	if (trusted)
-	{
-		enumerator = this->trusted->create_enumerator(this->trusted);
+	list = trusted ? this->trusted : this->untrusted;
+	if (!id || id->contains_wildcards(id))
+	{	/* wildcard subjects might match any certificate */
+		enumerator = cred_list_create_enumerator(list, NULL, 0);
 	}
 	else
-	{
-		enumerator = this->untrusted->create_enumerator(this->untrusted);
+	{	/* the ID might be a subject or a keyid/fingerprint of any type */
+		keys[0] = id;
+		keys[1] = keyid_create(id->get_encoding(id));
+		enumerator = cred_list_create_enumerator(list, keys, countof(keys));
+		keys[1]->destroy(keys[1]);
 	}
 	return enumerator_create_filter(enumerator, (void*)certs_filter, data,
 									(void*)cert_data_destroy);
 }
 
-static bool certificate_equals(certificate_t *item, certificate_t *cert)
-{
-	return item->equals(item, cert);
-}
-
 /**
  * Add a certificate the the cache. Returns a reference to "cert" or a
  * previously cached certificate that equals "cert".
@@ -159,23 +465,47 @@ static certificate_t *add_cert_internal(private_mem_cred_t *this, bool trusted,
 										certificate_t *cert)
 {
 	certificate_t *cached;
+	enumerator_t *enumerator;
+	identification_t *hash;
+	linked_list_t *keys;
+	entry_t *entry;
+	bool found = FALSE;
+
+	/* get keys before locking, as calculating them might be expensive */
+	keys = get_cert_keys(cert);
 	this->lock->write_lock(this->lock);
-	if (this->untrusted->find_first(this->untrusted,
-									(linked_list_match_t)certificate_equals,
-									(void**)&cached, cert) == SUCCESS)
+	/* equal certificates share the hash of their encoding, the first key */
+	if (keys && keys->get_first(keys, (void**)&hash) == SUCCESS)
 	{
-		cert->destroy(cert);
-		cert = cached->get_ref(cached);
+		enumerator = cred_list_create_enumerator(this->untrusted, &hash, 1);
 	}
 	else
+	{
+		enumerator = this->untrusted->any->create_enumerator(
+														this->untrusted->any);
+	}
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		cached = entry->item;
+		if (cached->equals(cached, cert))
+		{
+			cert->destroy(cert);
+			cert = cached->get_ref(cached);
+			found = TRUE;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (!found)
 	{
 		if (trusted)
 		{
-			this->trusted->insert_first(this->trusted, cert->get_ref(cert));
+			cred_list_add(this->trusted, cert->get_ref(cert), keys);
 		}
-		this->untrusted->insert_first(this->untrusted, cert->get_ref(cert));
+		cred_list_add(this->untrusted, cert->get_ref(cert), keys);
 	}
 	this->lock->unlock(this->lock);
+	keys_destroy(keys);
 	return cert;
 }
 
@@ -197,12 +527,15 @@ METHOD(mem_cred_t, add_crl, bool,
 {
 	certificate_t *current, *cert = &crl->certificate;
 	enumerator_t *enumerator;
+	entry_t *entry;
 	bool new = TRUE;
 
 	this->lock->write_lock(this->lock);
-	enumerator = this->untrusted->create_enumerator(this->untrusted);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	/* CRLs are not indexed */
+	enumerator = this->untrusted->any->create_enumerator(this->untrusted->any);
+	while (enumerator->enumerate(enumerator, &entry))
 	{
+		current = entry->item;
 		if (current->get_type(current) == CERT_X509_CRL)
 		{
 			bool found = FALSE;
@@ -231,7 +564,8 @@ METHOD(mem_cred_t, add_crl, bool,
 				new = crl_is_newer(crl, crl_c);
 				if (new)
 				{
-					this->untrusted->remove_at(this->untrusted, enumerator);
+					cred_list_remove(this->untrusted, entry);
+					current->destroy(current);
 				}
 				else
 				{
@@ -245,7 +579,7 @@ METHOD(mem_cred_t, add_crl, bool,
 
 	if (new)
 	{
-		this->untrusted->insert_first(this->untrusted, cert);
+		cred_list_add(this->untrusted, cert, NULL);
 	}
 	this->lock->unlock(this->lock);
 	return new;
@@ -272,11 +606,11 @@ static void key_data_destroy(key_data_t *data)
 /**
  * filter function for private key enumerator
  */
-static bool key_filter(key_data_t *data, private_key_t **in, private_key_t **out)
+static bool key_filter(key_data_t *data, entry_t **in, private_key_t **out)
 {
 	private_key_t *key;
 
-	key = *in;
+	key = (*in)->item;
 	if (data->type == KEY_ANY || data->type == key->get_type(key))
 	{
 		if (data->id == NULL ||
@@ -292,6 +626,8 @@ static bool key_filter(key_data_t *data, private_key_t **in, private_key_t **out
 METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
 	private_mem_cred_t *this, key_type_t type, identification_t *id)
 {
+	identification_t *keyid = NULL;
+	enumerator_t *enumerator;
 	key_data_t *data;
 
 	INIT(data,
@@ -299,17 +635,34 @@ METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
 		.type = type,
 		.id = id,
 	);
+	if (id)
+	{	/* the ID is a fingerprint of any type */
+		keyid = keyid_create(id->get_encoding(id));
+	}
 	this->lock->read_lock(this->lock);
-	return enumerator_create_filter(this->keys->create_enumerator(this->keys),
-							(void*)key_filter, data, (void*)key_data_destroy);
+	enumerator = cred_list_create_enumerator(this->keys,
+											 keyid ? &keyid : NULL, 1);
+	DESTROY_IF(keyid);
+	return enumerator_create_filter(enumerator, (void*)key_filter, data,
+									(void*)key_data_destroy);
 }
 
 METHOD(mem_cred_t, add_key, void,
 	private_mem_cred_t *this, private_key_t *key)
 {
+	linked_list_t *keys;
+
+	keys = linked_list_create();
+	add_fingerprints(keys, key);
+	if (keys->get_count(keys) == 0)
+	{
+		keys_destroy(keys);
+		keys = NULL;
+	}
 	this->lock->write_lock(this->lock);
-	this->keys->insert_first(this->keys, key);
+	cred_list_add(this->keys, key, keys);
 	this->lock->unlock(this->lock);
+	keys_destroy(keys);
 }
 
 /**
@@ -378,12 +731,12 @@ static id_match_t has_owner(shared_entry_t *entry, identification_t *owner)
  * enumerator filter function for shared entries
  */
 static bool shared_filter(shared_data_t *data,
-						  shared_entry_t **in, shared_key_t **out,
+						  entry_t **in, shared_key_t **out,
 						  void **unused1, id_match_t *me,
 						  void **unused2, id_match_t *other)
 {
 	id_match_t my_match = ID_MATCH_NONE, other_match = ID_MATCH_NONE;
-	shared_entry_t *entry = *in;
+	shared_entry_t *entry = (*in)->item;
 
 	if (data->type != SHARED_ANY &&
 		entry->shared->get_type(entry->shared) != data->type)
@@ -418,7 +771,10 @@ METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
 	private_mem_cred_t *this, shared_key_type_t type,
 	identification_t *me, identification_t *other)
 {
+	identification_t *keys[2];
+	enumerator_t *enumerator;
 	shared_data_t *data;
+	int count = 0;
 
 	INIT(data,
 		.lock = this->lock,
@@ -426,24 +782,50 @@ METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
 		.other = other,
 		.type = type,
 	);
+	/* entries match if they have an owner equal to either ID, see has_owner */
+	if (me)
+	{
+		keys[count++] = me;
+	}
+	if (other)
+	{
+		keys[count++] = other;
+	}
 	data->lock->read_lock(data->lock);
-	return enumerator_create_filter(
-						this->shared->create_enumerator(this->shared),
-						(void*)shared_filter, data, (void*)shared_data_destroy);
+	enumerator = cred_list_create_enumerator(this->shared,
+											 count ? keys : NULL, count);
+	return enumerator_create_filter(enumerator, (void*)shared_filter, data,
+									(void*)shared_data_destroy);
 }
 
 METHOD(mem_cred_t, add_shared_list, void,
 	private_mem_cred_t *this, shared_key_t *shared, linked_list_t* owners)
 {
 	shared_entry_t *entry;
+	enumerator_t *enumerator;
+	identification_t *owner;
+	linked_list_t *keys;
 
 	INIT(entry,
 		.shared = shared,
 		.owners = owners,
 	);
 
+	/* owners with wildcards might match any ID */
+	keys = owners;
+	enumerator = owners->create_enumerator(owners);
+	while (enumerator->enumerate(enumerator, &owner))
+	{
+		if (owner->contains_wildcards(owner))
+		{
+			keys = NULL;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+
 	this->lock->write_lock(this->lock);
-	this->shared->insert_first(this->shared, entry);
+	cred_list_add(this->shared, entry, keys);
 	this->lock->unlock(this->lock);
 }
 
@@ -555,14 +937,30 @@ METHOD(credential_set_t, create_cdp_enumerator, enumerator_t*,
 
 }
 
+/**
+ * Destroy a certificate of a list
+ */
+static void destroy_cert(certificate_t *cert)
+{
+	cert->destroy(cert);
+}
+
+/**
+ * Destroy a private key of a list
+ */
+static void destroy_key(private_key_t *key)
+{
+	key->destroy(key);
+}
+
 METHOD(mem_cred_t, clear_secrets, void,
 	private_mem_cred_t *this)
 {
 	this->lock->write_lock(this->lock);
-	this->keys->destroy_offset(this->keys, offsetof(private_key_t, destroy));
-	this->shared->destroy_function(this->shared, (void*)shared_entry_destroy);
-	this->keys = linked_list_create();
-	this->shared = linked_list_create();
+	cred_list_destroy(this->keys, (void*)destroy_key);
+	cred_list_destroy(this->shared, (void*)shared_entry_destroy);
+	this->keys = cred_list_create();
+	this->shared = cred_list_create();
 	this->lock->unlock(this->lock);
 }
 
@@ -570,13 +968,11 @@ METHOD(mem_cred_t, clear_, void,
 	private_mem_cred_t *this)
 {
 	this->lock->write_lock(this->lock);
-	this->trusted->destroy_offset(this->trusted,
-								  offsetof(certificate_t, destroy));
-	this->untrusted->destroy_offset(this->untrusted,
-									offsetof(certificate_t, destroy));
+	cred_list_destroy(this->trusted, (void*)destroy_cert);
+	cred_list_destroy(this->untrusted, (void*)destroy_cert);
 	this->cdps->destroy_function(this->cdps, (void*)cdp_destroy);
-	this->trusted = linked_list_create();
-	this->untrusted = linked_list_create();
+	this->trusted = cred_list_create();
+	this->untrusted = cred_list_create();
 	this->cdps = linked_list_create();
 	this->lock->unlock(this->lock);
 
@@ -587,10 +983,10 @@ METHOD(mem_cred_t, destroy, void,
 	private_mem_cred_t *this)
 {
 	clear_(this);
-	this->trusted->destroy(this->trusted);
-	this->untrusted->destroy(this->untrusted);
-	this->keys->destroy(this->keys);
-	this->shared->destroy(this->shared);
+	cred_list_destroy(this->trusted, (void*)destroy_cert);
+	cred_list_destroy(this->untrusted, (void*)destroy_cert);
+	cred_list_destroy(this->keys, (void*)destroy_key);
+	cred_list_destroy(this->shared, (void*)shared_entry_destroy);
 	this->cdps->destroy(this->cdps);
 	this->lock->destroy(this->lock);
 	free(this);
@@ -623,10 +1019,10 @@ mem_cred_t *mem_cred_create()
 			.clear_secrets = _clear_secrets,
 			.destroy = _destroy,
 		},
-		.trusted = linked_list_create(),
-		.untrusted = linked_list_create(),
-		.keys = linked_list_create(),
-		.shared = linked_list_create(),
+		.trusted = cred_list_create(),
+		.untrusted = cred_list_create(),
+		.keys = cred_list_create(),
+		.shared = cred_list_create(),
 		.cdps = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
@@ -16,9 +16,11 @@
 #include "crypto_factory.h"
 
 #include <debug.h>
+#include <threading/mutex.h>
 #include <threading/rwlock.h>
 #include <utils/linked_list.h>
 #include <crypto/crypto_tester.h>
+#include <processing/jobs/callback_job.h>
 
 const char *default_plugin_name = "default";
 
@@ -57,6 +59,70 @@ struct entry_t {
 };
 
 typedef struct private_crypto_factory_t private_crypto_factory_t;
+typedef struct dh_pool_t dh_pool_t;
+typedef struct dh_pool_entry_t dh_pool_entry_t;
+
+/**
+ * Precomputed DH key pair
+ */
+struct dh_pool_entry_t {
+
+	/**
+	 * DH object holding the precomputed key pair
+	 */
+	diffie_hellman_t *dh;
+
+	/**
+	 * constructor that created the DH object
+	 */
+	dh_constructor_t create;
+};
+
+/**
+ * Pool of precomputed DH key pairs for a DH group
+ */
+struct dh_pool_t {
+
+	/**
+	 * DH group of this pool
+	 */
+	diffie_hellman_group_t group;
+
+	/**
+	 * number of key pairs to keep, 0 if pooling is disabled
+	 */
+	u_int depth;
+
+	/**
+	 * start refilling if fewer key pairs are pooled
+	 */
+	u_int refill;
+
+	/**
+	 * pooled key pairs, as dh_pool_entry_t
+	 */
+	linked_list_t *entries;
+
+	/**
+	 * whether a refill job is queued
+	 */
+	bool refilling;
+
+	/**
+	 * number of DH objects served from the pool
+	 */
+	u_int hits;
+
+	/**
+	 * number of DH objects created while the pool was empty
+	 */
+	u_int misses;
+
+	/**
+	 * factory owning this pool
+	 */
+	private_crypto_factory_t *factory;
+};
 
 /**
  * private data of crypto_factory
@@ -132,6 +198,21 @@ struct private_crypto_factory_t {
 	 * rwlock to lock access to modules
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * pools of precomputed DH key pairs, as dh_pool_t
+	 */
+	linked_list_t *dh_pools;
+
+	/**
+	 * mutex to lock access to DH pools
+	 */
+	mutex_t *dh_pool_mutex;
+
+	/**
+	 * TRUE if a pool depth is configured for any DH group
+	 */
+	bool dh_pooling;
 };
 
 METHOD(crypto_factory_t, create_crypter, crypter_t*,
@@ -354,41 +435,226 @@ METHOD(crypto_factory_t, create_nonce_gen, nonce_gen_t*,
 	return nonce_gen;
 }
 
-METHOD(crypto_factory_t, create_dh, diffie_hellman_t*,
-	private_crypto_factory_t *this, diffie_hellman_group_t group, ...)
+/**
+ * Create a DH object from the registered constructors, read lock required
+ */
+static diffie_hellman_t *create_dh_locked(private_crypto_factory_t *this,
+							diffie_hellman_group_t group, chunk_t g, chunk_t p,
+							dh_constructor_t *create)
 {
 	enumerator_t *enumerator;
 	entry_t *entry;
-	va_list args;
-	chunk_t g = chunk_empty, p = chunk_empty;
 	diffie_hellman_t *diffie_hellman = NULL;
 
-	if (group == MODP_CUSTOM)
-	{
-		va_start(args, group);
-		g = va_arg(args, chunk_t);
-		p = va_arg(args, chunk_t);
-		va_end(args);
-	}
-
-	this->lock->read_lock(this->lock);
 	enumerator = this->dhs->create_enumerator(this->dhs);
 	while (enumerator->enumerate(enumerator, &entry))
 	{
 		if (entry->algo == group)
 		{
+			if (this->test_on_create &&
+				!this->tester->test_dh(this->tester, group, entry->create_dh,
+									   NULL, default_plugin_name))
+			{
+				continue;
+			}
 			diffie_hellman = entry->create_dh(group, g, p);
 			if (diffie_hellman)
 			{
+				*create = entry->create_dh;
 				break;
 			}
 		}
 	}
 	enumerator->destroy(enumerator);
+	return diffie_hellman;
+}
+
+/**
+ * Destroy a pooled key pair
+ */
+static void dh_pool_entry_destroy(dh_pool_entry_t *entry)
+{
+	entry->dh->destroy(entry->dh);
+	free(entry);
+}
+
+/**
+ * Destroy a DH pool and all pooled key pairs
+ */
+static void dh_pool_destroy(dh_pool_t *pool)
+{
+	pool->entries->destroy_function(pool->entries,
+									(void*)dh_pool_entry_destroy);
+	free(pool);
+}
+
+/**
+ * Get the pool of a DH group, creating it on first use, mutex required
+ */
+static dh_pool_t *get_dh_pool(private_crypto_factory_t *this,
+							  diffie_hellman_group_t group)
+{
+	enumerator_t *enumerator;
+	dh_pool_t *pool, *found = NULL;
+	u_int depth, refill;
+
+	enumerator = this->dh_pools->create_enumerator(this->dh_pools);
+	while (enumerator->enumerate(enumerator, &pool))
+	{
+		if (pool->group == group)
+		{
+			found = pool;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	if (!found)
+	{
+		depth = lib->settings->get_int(lib->settings,
+								"libstrongswan.dh_pool.depth", 0);
+		depth = lib->settings->get_int(lib->settings,
+								"libstrongswan.dh_pool.%N.depth", depth,
+								diffie_hellman_group_names, group);
+		refill = lib->settings->get_int(lib->settings,
+								"libstrongswan.dh_pool.refill", depth / 2);
+		refill = lib->settings->get_int(lib->settings,
+								"libstrongswan.dh_pool.%N.refill", refill,
+								diffie_hellman_group_names, group);
+		INIT(found,
+			.group = group,
+			.depth = depth,
+			.refill = min(refill, depth),
+			.entries = linked_list_create(),
+			.factory = this,
+		);
+		this->dh_pools->insert_last(this->dh_pools, found);
+	}
+	return found;
+}
+
+/**
+ * Job adding a precomputed key pair to a pool, requeued until it is full
+ */
+static job_requeue_t refill_dh_pool(dh_pool_t *pool)
+{
+	private_crypto_factory_t *this = pool->factory;
+	dh_pool_entry_t *entry;
+	diffie_hellman_t *dh;
+	dh_constructor_t create;
+	bool full = TRUE;
+
+	/* hold the read lock until the key pair is pooled, so it gets flushed
+	 * if the constructor is removed */
+	this->lock->read_lock(this->lock);
+	dh = create_dh_locked(this, pool->group, chunk_empty, chunk_empty, &create);
+	this->dh_pool_mutex->lock(this->dh_pool_mutex);
+	if (dh)
+	{
+		INIT(entry,
+			.dh = dh,
+			.create = create,
+		);
+		pool->entries->insert_last(pool->entries, entry);
+		full = pool->entries->get_count(pool->entries) >= pool->depth;
+	}
+	pool->refilling = !full;
+	this->dh_pool_mutex->unlock(this->dh_pool_mutex);
+	this->lock->unlock(this->lock);
+
+	return full ? JOB_REQUEUE_NONE : JOB_REQUEUE_FAIR;
+}
+
+/**
+ * Get a precomputed key pair from the pool of a group, if any
+ */
+static diffie_hellman_t *get_pooled_dh(private_crypto_factory_t *this,
+									   diffie_hellman_group_t group)
+{
+	dh_pool_entry_t *entry;
+	diffie_hellman_t *dh = NULL;
+	dh_pool_t *pool;
+
+	if (!this->dh_pooling)
+	{
+		return NULL;
+	}
+	this->dh_pool_mutex->lock(this->dh_pool_mutex);
+	pool = get_dh_pool(this, group);
+	if (pool->depth)
+	{
+		if (pool->entries->remove_first(pool->entries,
+										(void**)&entry) == SUCCESS)
+		{
+			dh = entry->dh;
+			free(entry);
+			pool->hits++;
+		}
+		else
+		{
+			pool->misses++;
+		}
+		if (!pool->refilling && lib->processor &&
+			pool->entries->get_count(pool->entries) < max(pool->refill, 1))
+		{
+			pool->refilling = TRUE;
+			lib->processor->queue_job(lib->processor,
+					(job_t*)callback_job_create_with_prio(
+						(callback_job_cb_t)refill_dh_pool, pool, NULL, NULL,
+						JOB_PRIO_LOW));
+		}
+	}
+	this->dh_pool_mutex->unlock(this->dh_pool_mutex);
+	return dh;
+}
+
+METHOD(crypto_factory_t, create_dh, diffie_hellman_t*,
+	private_crypto_factory_t *this, diffie_hellman_group_t group, ...)
+{
+	va_list args;
+	chunk_t g = chunk_empty, p = chunk_empty;
+	diffie_hellman_t *diffie_hellman;
+	dh_constructor_t create;
+
+	if (group == MODP_CUSTOM)
+	{
+		va_start(args, group);
+		g = va_arg(args, chunk_t);
+		p = va_arg(args, chunk_t);
+		va_end(args);
+	}
+	else if (group != MODP_NULL)
+	{
+		diffie_hellman = get_pooled_dh(this, group);
+		if (diffie_hellman)
+		{
+			return diffie_hellman;
+		}
+	}
+
+	this->lock->read_lock(this->lock);
+	diffie_hellman = create_dh_locked(this, group, g, p, &create);
 	this->lock->unlock(this->lock);
 	return diffie_hellman;
 }
 
+METHOD(crypto_factory_t, get_dh_pool_stats, bool,
+	private_crypto_factory_t *this, diffie_hellman_group_t group,
+	u_int *depth, u_int *hits, u_int *misses)
+{
+	dh_pool_t *pool;
+	bool enabled;
+
+	this->dh_pool_mutex->lock(this->dh_pool_mutex);
+	pool = get_dh_pool(this, group);
+	enabled = pool->depth != 0;
+	*depth = pool->entries->get_count(pool->entries);
+	*hits = pool->hits;
+	*misses = pool->misses;
+	this->dh_pool_mutex->unlock(this->dh_pool_mutex);
+	return enabled;
+}
+
 /**
  * Insert an algorithm entry to a list
  */
@@ -670,7 +936,43 @@ METHOD(crypto_factory_t, add_dh, void,
 	private_crypto_factory_t *this,	diffie_hellman_group_t group,
 	 const char *plugin_name, dh_constructor_t create)
 {
-	add_entry(this, this->dhs, group, plugin_name, 0, create);
+	u_int speed = 0;
+
+	if (!this->test_on_add ||
+		this->tester->test_dh(this->tester, group, create,
+							  this->bench ? &speed : NULL, plugin_name))
+	{
+		add_entry(this, this->dhs, group, plugin_name, speed, create);
+	}
+}
+
+/**
+ * Destroy the pooled key pairs created by a constructor
+ */
+static void flush_dh_pools(private_crypto_factory_t *this,
+						   dh_constructor_t create)
+{
+	enumerator_t *pools, *entries;
+	dh_pool_entry_t *entry;
+	dh_pool_t *pool;
+
+	this->dh_pool_mutex->lock(this->dh_pool_mutex);
+	pools = this->dh_pools->create_enumerator(this->dh_pools);
+	while (pools->enumerate(pools, &pool))
+	{
+		entries = pool->entries->create_enumerator(pool->entries);
+		while (entries->enumerate(entries, &entry))
+		{
+			if (entry->create == create)
+			{
+				pool->entries->remove_at(pool->entries, entries);
+				dh_pool_entry_destroy(entry);
+			}
+		}
+		entries->destroy(entries);
+	}
+	pools->destroy(pools);
+	this->dh_pool_mutex->unlock(this->dh_pool_mutex);
 }
 
 METHOD(crypto_factory_t, remove_dh, void,
@@ -690,6 +992,7 @@ METHOD(crypto_factory_t, remove_dh, void,
 		}
 	}
 	enumerator->destroy(enumerator);
+	flush_dh_pools(this, create);
 	this->lock->unlock(this->lock);
 }
 
@@ -886,11 +1189,35 @@ METHOD(crypto_factory_t, destroy, void,
 	this->rngs->destroy(this->rngs);
 	this->nonce_gens->destroy(this->nonce_gens);
 	this->dhs->destroy(this->dhs);
+	this->dh_pools->destroy_function(this->dh_pools, (void*)dh_pool_destroy);
+	this->dh_pool_mutex->destroy(this->dh_pool_mutex);
 	this->tester->destroy(this->tester);
 	this->lock->destroy(this->lock);
 	free(this);
 }
 
+/**
+ * Check if a DH pool depth is configured globally or for any group
+ */
+static bool dh_pooling_configured()
+{
+	enumerator_t *enumerator;
+	char *group;
+	bool configured;
+
+	configured = lib->settings->get_int(lib->settings,
+								"libstrongswan.dh_pool.depth", 0) > 0;
+	enumerator = lib->settings->create_section_enumerator(lib->settings,
+								"libstrongswan.dh_pool");
+	while (!configured && enumerator->enumerate(enumerator, &group))
+	{
+		configured = lib->settings->get_int(lib->settings,
+								"libstrongswan.dh_pool.%s.depth", 0, group) > 0;
+	}
+	enumerator->destroy(enumerator);
+	return configured;
+}
+
 /*
  * see header file
  */
@@ -908,6 +1235,7 @@ crypto_factory_t *crypto_factory_create()
 			.create_rng = _create_rng,
 			.create_nonce_gen = _create_nonce_gen,
 			.create_dh = _create_dh,
+			.get_dh_pool_stats = _get_dh_pool_stats,
 			.add_crypter = _add_crypter,
 			.remove_crypter = _remove_crypter,
 			.add_aead = _add_aead,
@@ -943,6 +1271,9 @@ crypto_factory_t *crypto_factory_create()
 		.rngs = linked_list_create(),
 		.nonce_gens = linked_list_create(),
 		.dhs = linked_list_create(),
+		.dh_pools = linked_list_create(),
+		.dh_pool_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.dh_pooling = dh_pooling_configured(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.tester = crypto_tester_create(),
 		.test_on_add = lib->settings->get_bool(lib->settings,
@@ -155,6 +155,22 @@ struct crypto_factory_t {
 	diffie_hellman_t* (*create_dh)(crypto_factory_t *this,
 								   diffie_hellman_group_t group, ...);
 
+	/**
+	 * Get statistics of the pool of precomputed DH key pairs of a group.
+	 *
+	 * If enabled with libstrongswan.dh_pool.depth, create_dh() hands out
+	 * key pairs precomputed by low priority jobs.
+	 *
+	 * @param group			diffie hellman group
+	 * @param depth			number of currently pooled key pairs
+	 * @param hits			number of DH objects served from the pool
+	 * @param misses		number of DH objects created with an empty pool
+	 * @return				TRUE if pooling is enabled for this group
+	 */
+	bool (*get_dh_pool_stats)(crypto_factory_t *this,
+							  diffie_hellman_group_t group, u_int *depth,
+							  u_int *hits, u_int *misses);
+
 	/**
 	 * Register a crypter constructor.
 	 *
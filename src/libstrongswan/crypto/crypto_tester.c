@@ -1122,6 +1122,120 @@ failure:
 	return !failed;
 }
 
+/**
+ * Run a key exchange between two DH instances, optionally with a fixed
+ * public value of the peer
+ */
+static bool run_dh(diffie_hellman_group_t group, dh_constructor_t create,
+				   diffie_hellman_t *peer)
+{
+	diffie_hellman_t *local, *remote;
+	chunk_t local_pub = chunk_empty, remote_pub = chunk_empty;
+	chunk_t local_secret = chunk_empty, remote_secret = chunk_empty;
+	bool success = FALSE;
+
+	local = create(group);
+	remote = peer;
+	if (!remote)
+	{
+		remote = create(group);
+	}
+	if (!local || !remote)
+	{
+		goto failure;
+	}
+	remote->get_my_public_value(remote, &remote_pub);
+	local->set_other_public_value(local, remote_pub);
+	if (local->get_shared_secret(local, &local_secret) != SUCCESS)
+	{
+		goto failure;
+	}
+	if (peer)
+	{	/* benchmark only, skip the work of the peer */
+		success = TRUE;
+		goto failure;
+	}
+	local->get_my_public_value(local, &local_pub);
+	remote->set_other_public_value(remote, local_pub);
+	if (remote->get_shared_secret(remote, &remote_secret) != SUCCESS)
+	{
+		goto failure;
+	}
+	success = chunk_equals(local_secret, remote_secret);
+
+failure:
+	DESTROY_IF(local);
+	if (!peer)
+	{
+		DESTROY_IF(remote);
+	}
+	chunk_free(&local_pub);
+	chunk_free(&remote_pub);
+	chunk_clear(&local_secret);
+	chunk_clear(&remote_secret);
+	return success;
+}
+
+/**
+ * Benchmark a DH backend, each run creates a key pair and derives a secret
+ */
+static u_int bench_dh(private_crypto_tester_t *this,
+					  diffie_hellman_group_t group, dh_constructor_t create)
+{
+	diffie_hellman_t *peer;
+
+	peer = create(group);
+	if (peer)
+	{
+		struct timespec start;
+		u_int runs;
+
+		runs = 0;
+		start_timing(&start);
+		while (end_timing(&start) < this->bench_time)
+		{
+			if (!run_dh(group, create, peer))
+			{
+				runs = 0;
+				break;
+			}
+			runs++;
+		}
+		peer->destroy(peer);
+
+		return runs;
+	}
+	return 0;
+}
+
+METHOD(crypto_tester_t, test_dh, bool,
+	private_crypto_tester_t *this, diffie_hellman_group_t group,
+	dh_constructor_t create, u_int *speed, const char *plugin_name)
+{
+	if (group == MODP_CUSTOM)
+	{	/* requires explicit parameters, nothing to test */
+		return TRUE;
+	}
+	if (!run_dh(group, create, NULL))
+	{
+		DBG1(DBG_LIB, "disabled %N[%s]: key exchange failed",
+			 diffie_hellman_group_names, group, plugin_name);
+		return FALSE;
+	}
+	if (speed)
+	{
+		*speed = bench_dh(this, group, create);
+		DBG1(DBG_LIB, "enabled  %N[%s]: passed key exchange, %d points",
+			 diffie_hellman_group_names, group, plugin_name, *speed);
+	}
+	else
+	{
+		DBG1(DBG_LIB, "enabled  %N[%s]: passed key exchange",
+			 diffie_hellman_group_names, group, plugin_name);
+	}
+	return TRUE;
+}
+
 METHOD(crypto_tester_t, add_crypter_vector, void,
 	private_crypto_tester_t *this, crypter_test_vector_t *vector)
 {
@@ -1185,6 +1299,7 @@ crypto_tester_t *crypto_tester_create()
 			.test_hasher = _test_hasher,
 			.test_prf = _test_prf,
 			.test_rng = _test_rng,
+			.test_dh = _test_dh,
 			.add_crypter_vector = _add_crypter_vector,
 			.add_aead_vector = _add_aead_vector,
 			.add_signer_vector = _add_signer_vector,
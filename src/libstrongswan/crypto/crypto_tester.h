@@ -201,6 +201,21 @@ struct crypto_tester_t {
 	bool (*test_rng)(crypto_tester_t *this, rng_quality_t quality,
 					 rng_constructor_t create,
 					 u_int *speed, const char *plugin_name);
+	/**
+	 * Test a Diffie-Hellman group by running a key exchange.
+	 *
+	 * As there are no test vectors for DH, two instances exchange their
+	 * public values and are expected to derive the same shared secret.
+	 *
+	 * @param group			DH group to test
+	 * @param create		constructor function for the DH backend
+	 * @param speed			speed test result, NULL to omit
+	 * @param plugin_name	name of the plugin providing the DH backend
+	 * @return				TRUE if test passed
+	 */
+	bool (*test_dh)(crypto_tester_t *this, diffie_hellman_group_t group,
+					dh_constructor_t create,
+					u_int *speed, const char *plugin_name);
 	/**
 	 * Add a test vector to test a crypter.
 	 *
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "aesni_cbc.h"
+#include "aesni_key.h"
+
+/**
+ * Pipeline parallelism we use for CBC decryption
+ */
+#define CBC_DECRYPT_PARALLELISM 4
+
+typedef struct private_aesni_cbc_t private_aesni_cbc_t;
+
+/**
+ * CBC en/decryption method type
+ */
+typedef void (*aesni_cbc_fn_t)(aesni_key_t*, u_int, u_char*, u_char*, u_char*);
+
+/**
+ * Private data of an aesni_cbc_t object.
+ */
+struct private_aesni_cbc_t {
+
+	/**
+	 * Public aesni_cbc_t interface.
+	 */
+	aesni_cbc_t public;
+
+	/**
+	 * Key size
+	 */
+	u_int key_size;
+
+	/**
+	 * Encryption key schedule
+	 */
+	aesni_key_t *ekey;
+
+	/**
+	 * Decryption key schedule
+	 */
+	aesni_key_t *dkey;
+};
+
+/**
+ * Encrypt blocks in CBC mode, which is inherently sequential
+ */
+static void encrypt_cbc(aesni_key_t *key, u_int blocks, u_char *in,
+						u_char *iv, u_char *out)
+{
+	__m128i *ks, *bi, *bo, t, fb;
+	u_int i;
+	int round;
+
+	ks = key->schedule;
+	bi = (__m128i*)in;
+	bo = (__m128i*)out;
+
+	fb = _mm_loadu_si128((__m128i*)iv);
+	for (i = 0; i < blocks; i++)
+	{
+		t = _mm_loadu_si128(bi + i);
+		fb = _mm_xor_si128(t, fb);
+		fb = _mm_xor_si128(fb, ks[0]);
+		for (round = 1; round < key->rounds; round++)
+		{
+			fb = _mm_aesenc_si128(fb, ks[round]);
+		}
+		fb = _mm_aesenclast_si128(fb, ks[key->rounds]);
+		_mm_storeu_si128(bo + i, fb);
+	}
+}
+
+/**
+ * Decrypt blocks in CBC mode, interleaving multiple independent blocks to
+ * keep the AES unit pipeline busy
+ */
+static void decrypt_cbc(aesni_key_t *key, u_int blocks, u_char *in,
+						u_char *iv, u_char *out)
+{
+	__m128i *ks, *bi, *bo, last, t1, t2, t3, t4, f1, f2, f3, f4;
+	u_int i, pblocks;
+	int round;
+
+	ks = key->schedule;
+	bi = (__m128i*)in;
+	bo = (__m128i*)out;
+	pblocks = blocks - (blocks % CBC_DECRYPT_PARALLELISM);
+
+	f1 = _mm_loadu_si128((__m128i*)iv);
+
+	for (i = 0; i < pblocks; i += CBC_DECRYPT_PARALLELISM)
+	{
+		t1 = _mm_loadu_si128(bi + i + 0);
+		t2 = _mm_loadu_si128(bi + i + 1);
+		t3 = _mm_loadu_si128(bi + i + 2);
+		t4 = _mm_loadu_si128(bi + i + 3);
+
+		f2 = t1;
+		f3 = t2;
+		f4 = t3;
+		last = t4;
+
+		t1 = _mm_xor_si128(t1, ks[0]);
+		t2 = _mm_xor_si128(t2, ks[0]);
+		t3 = _mm_xor_si128(t3, ks[0]);
+		t4 = _mm_xor_si128(t4, ks[0]);
+
+		for (round = 1; round < key->rounds; round++)
+		{
+			t1 = _mm_aesdec_si128(t1, ks[round]);
+			t2 = _mm_aesdec_si128(t2, ks[round]);
+			t3 = _mm_aesdec_si128(t3, ks[round]);
+			t4 = _mm_aesdec_si128(t4, ks[round]);
+		}
+
+		t1 = _mm_aesdeclast_si128(t1, ks[key->rounds]);
+		t2 = _mm_aesdeclast_si128(t2, ks[key->rounds]);
+		t3 = _mm_aesdeclast_si128(t3, ks[key->rounds]);
+		t4 = _mm_aesdeclast_si128(t4, ks[key->rounds]);
+
+		t1 = _mm_xor_si128(t1, f1);
+		t2 = _mm_xor_si128(t2, f2);
+		t3 = _mm_xor_si128(t3, f3);
+		t4 = _mm_xor_si128(t4, f4);
+
+		_mm_storeu_si128(bo + i + 0, t1);
+		_mm_storeu_si128(bo + i + 1, t2);
+		_mm_storeu_si128(bo + i + 2, t3);
+		_mm_storeu_si128(bo + i + 3, t4);
+
+		f1 = last;
+	}
+
+	for (i = pblocks; i < blocks; i++)
+	{
+		last = _mm_loadu_si128(bi + i);
+		t1 = _mm_xor_si128(last, ks[0]);
+		for (round = 1; round < key->rounds; round++)
+		{
+			t1 = _mm_aesdec_si128(t1, ks[round]);
+		}
+		t1 = _mm_aesdeclast_si128(t1, ks[key->rounds]);
+		t1 = _mm_xor_si128(t1, f1);
+		_mm_storeu_si128(bo + i, t1);
+		f1 = last;
+	}
+}
+
+/**
+ * Do inline or allocated de/encryption using key schedule
+ */
+static bool crypt_cbc(aesni_cbc_fn_t fn, aesni_key_t *key,
+					  chunk_t data, chunk_t iv, chunk_t *out)
+{
+	u_char *buf;
+
+	if (!key || data.len % AES_BLOCK_SIZE)
+	{
+		return FALSE;
+	}
+	if (out)
+	{
+		*out = chunk_alloc(data.len);
+		buf = out->ptr;
+	}
+	else
+	{
+		buf = data.ptr;
+	}
+	fn(key, data.len / AES_BLOCK_SIZE, data.ptr, iv.ptr, buf);
+	return TRUE;
+}
+
+METHOD(crypter_t, encrypt, bool,
+	private_aesni_cbc_t *this, chunk_t data, chunk_t iv, chunk_t *encrypted)
+{
+	return crypt_cbc(encrypt_cbc, this->ekey, data, iv, encrypted);
+}
+
+METHOD(crypter_t, decrypt, bool,
+	private_aesni_cbc_t *this, chunk_t data, chunk_t iv, chunk_t *decrypted)
+{
+	return crypt_cbc(decrypt_cbc, this->dkey, data, iv, decrypted);
+}
+
+METHOD(crypter_t, get_block_size, size_t,
+	private_aesni_cbc_t *this)
+{
+	return AES_BLOCK_SIZE;
+}
+
+METHOD(crypter_t, get_iv_size, size_t,
+	private_aesni_cbc_t *this)
+{
+	return AES_BLOCK_SIZE;
+}
+
+METHOD(crypter_t, get_key_size, size_t,
+	private_aesni_cbc_t *this)
+{
+	return this->key_size;
+}
+
+METHOD(crypter_t, set_key, bool,
+	private_aesni_cbc_t *this, chunk_t key)
+{
+	if (key.len != this->key_size)
+	{
+		return FALSE;
+	}
+
+	DESTROY_IF(this->ekey);
+	DESTROY_IF(this->dkey);
+
+	this->ekey = aesni_key_create(TRUE, key);
+	this->dkey = aesni_key_create(FALSE, key);
+
+	return this->ekey && this->dkey;
+}
+
+METHOD(crypter_t, destroy, void,
+	private_aesni_cbc_t *this)
+{
+	DESTROY_IF(this->ekey);
+	DESTROY_IF(this->dkey);
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_cbc_t *aesni_cbc_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_cbc_t *this;
+
+	if (algo != ENCR_AES_CBC)
+	{
+		return NULL;
+	}
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.crypter = {
+				.encrypt = _encrypt,
+				.decrypt = _decrypt,
+				.get_block_size = _get_block_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+	);
+
+	return &this->public;
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "aesni_ctr.h"
+#include "aesni_key.h"
+
+/**
+ * Pipeline parallelism we use for CTR en/decryption
+ */
+#define CTR_CRYPT_PARALLELISM 4
+
+typedef struct private_aesni_ctr_t private_aesni_ctr_t;
+
+/**
+ * Private data of an aesni_ctr_t object.
+ */
+struct private_aesni_ctr_t {
+
+	/**
+	 * Public aesni_ctr_t interface.
+	 */
+	aesni_ctr_t public;
+
+	/**
+	 * Key size
+	 */
+	u_int key_size;
+
+	/**
+	 * Key schedule
+	 */
+	aesni_key_t *key;
+
+	/**
+	 * Counter block state, without the counter
+	 */
+	struct {
+		char nonce[4];
+		char iv[8];
+	} __attribute__((packed)) state;
+};
+
+/**
+ * Get the counter block for a given block counter value
+ */
+static inline __m128i counter_block(u_int32_t words[3], u_int32_t counter)
+{
+	return _mm_set_epi32(htonl(counter), words[2], words[1], words[0]);
+}
+
+/**
+ * Encrypt a single counter block
+ */
+static inline __m128i encrypt_block(aesni_key_t *key, __m128i t)
+{
+	int round;
+
+	t = _mm_xor_si128(t, key->schedule[0]);
+	for (round = 1; round < key->rounds; round++)
+	{
+		t = _mm_aesenc_si128(t, key->schedule[round]);
+	}
+	return _mm_aesenclast_si128(t, key->schedule[key->rounds]);
+}
+
+/**
+ * En/decrypt data in CTR mode, processing multiple counter blocks in parallel
+ */
+static void crypt_ctr(private_aesni_ctr_t *this, size_t len,
+					  u_char *in, u_char *out)
+{
+	__m128i *ks, *bi, *bo, t1, t2, t3, t4;
+	u_int32_t words[3], counter = 1;
+	u_int i, blocks, pblocks, rem;
+	int round, rounds;
+
+	ks = this->key->schedule;
+	rounds = this->key->rounds;
+	bi = (__m128i*)in;
+	bo = (__m128i*)out;
+	blocks = len / AES_BLOCK_SIZE;
+	pblocks = blocks - (blocks % CTR_CRYPT_PARALLELISM);
+	rem = len % AES_BLOCK_SIZE;
+
+	memcpy(words, &this->state, sizeof(words));
+
+	for (i = 0; i < pblocks; i += CTR_CRYPT_PARALLELISM)
+	{
+		t1 = _mm_xor_si128(counter_block(words, counter++), ks[0]);
+		t2 = _mm_xor_si128(counter_block(words, counter++), ks[0]);
+		t3 = _mm_xor_si128(counter_block(words, counter++), ks[0]);
+		t4 = _mm_xor_si128(counter_block(words, counter++), ks[0]);
+
+		for (round = 1; round < rounds; round++)
+		{
+			t1 = _mm_aesenc_si128(t1, ks[round]);
+			t2 = _mm_aesenc_si128(t2, ks[round]);
+			t3 = _mm_aesenc_si128(t3, ks[round]);
+			t4 = _mm_aesenc_si128(t4, ks[round]);
+		}
+
+		t1 = _mm_aesenclast_si128(t1, ks[rounds]);
+		t2 = _mm_aesenclast_si128(t2, ks[rounds]);
+		t3 = _mm_aesenclast_si128(t3, ks[rounds]);
+		t4 = _mm_aesenclast_si128(t4, ks[rounds]);
+
+		t1 = _mm_xor_si128(t1, _mm_loadu_si128(bi + i + 0));
+		t2 = _mm_xor_si128(t2, _mm_loadu_si128(bi + i + 1));
+		t3 = _mm_xor_si128(t3, _mm_loadu_si128(bi + i + 2));
+		t4 = _mm_xor_si128(t4, _mm_loadu_si128(bi + i + 3));
+
+		_mm_storeu_si128(bo + i + 0, t1);
+		_mm_storeu_si128(bo + i + 1, t2);
+		_mm_storeu_si128(bo + i + 2, t3);
+		_mm_storeu_si128(bo + i + 3, t4);
+	}
+
+	for (i = pblocks; i < blocks; i++)
+	{
+		t1 = encrypt_block(this->key, counter_block(words, counter++));
+		t1 = _mm_xor_si128(t1, _mm_loadu_si128(bi + i));
+		_mm_storeu_si128(bo + i, t1);
+	}
+
+	if (rem)
+	{
+		u_char block[AES_BLOCK_SIZE];
+
+		memset(block, 0, sizeof(block));
+		memcpy(block, bi + blocks, rem);
+
+		t1 = encrypt_block(this->key, counter_block(words, counter));
+		t1 = _mm_xor_si128(t1, _mm_loadu_si128((__m128i*)block));
+		_mm_storeu_si128((__m128i*)block, t1);
+
+		memcpy(bo + blocks, block, rem);
+	}
+}
+
+METHOD(crypter_t, crypt, bool,
+	private_aesni_ctr_t *this, chunk_t in, chunk_t iv, chunk_t *out)
+{
+	u_char *buf;
+
+	if (!this->key || iv.len != sizeof(this->state.iv))
+	{
+		return FALSE;
+	}
+	memcpy(this->state.iv, iv.ptr, sizeof(this->state.iv));
+
+	if (out)
+	{
+		*out = chunk_alloc(in.len);
+		buf = out->ptr;
+	}
+	else
+	{
+		buf = in.ptr;
+	}
+	crypt_ctr(this, in.len, in.ptr, buf);
+	return TRUE;
+}
+
+METHOD(crypter_t, get_block_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return 1;
+}
+
+METHOD(crypter_t, get_iv_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return sizeof(this->state.iv);
+}
+
+METHOD(crypter_t, get_key_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return this->key_size + sizeof(this->state.nonce);
+}
+
+METHOD(crypter_t, set_key, bool,
+	private_aesni_ctr_t *this, chunk_t key)
+{
+	if (key.len != get_key_size(this))
+	{
+		return FALSE;
+	}
+
+	memcpy(this->state.nonce, key.ptr + key.len - sizeof(this->state.nonce),
+		   sizeof(this->state.nonce));
+	key.len -= sizeof(this->state.nonce);
+
+	DESTROY_IF(this->key);
+	this->key = aesni_key_create(TRUE, key);
+
+	return this->key != NULL;
+}
+
+METHOD(crypter_t, destroy, void,
+	private_aesni_ctr_t *this)
+{
+	DESTROY_IF(this->key);
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_ctr_t *aesni_ctr_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_ctr_t *this;
+
+	if (algo != ENCR_AES_CTR)
+	{
+		return NULL;
+	}
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.crypter = {
+				.encrypt = _crypt,
+				.decrypt = _crypt,
+				.get_block_size = _get_block_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+	);
+
+	return &this->public;
+}
@@ -14,8 +14,7 @@
  */
 
 #include "gcm_aead.h"
-
-#include <limits.h>
+#include "gcm_ghash.h"
 
 #define BLOCK_SIZE 16
 #define NONCE_SIZE 12
@@ -50,102 +49,11 @@ struct private_gcm_aead_t {
 	char salt[SALT_SIZE];
 
 	/**
-	 * GHASH subkey H
+	 * GHASH function, using subkey H
 	 */
-	char h[BLOCK_SIZE];
+	gcm_ghash_t *ghash;
 };
 
-/**
- * Find a suiteable word size and network order conversion functions
- */
-#if ULONG_MAX == 18446744073709551615UL && defined(htobe64)
-#	define htobeword htobe64
-#	define bewordtoh be64toh
-#	define SHIFT_WORD_TYPE u_int64_t
-#else
-#	define htobeword htonl
-#	define bewordtoh ntohl
-#	define SHIFT_WORD_TYPE u_int32_t
-#endif
-
-/**
- * Bitshift a block right by one bit
- */
-static void sr_block(char *block)
-{
-	int i;
-	SHIFT_WORD_TYPE *word = (SHIFT_WORD_TYPE*)block;
-
-	for (i = 0; i < BLOCK_SIZE / sizeof(*word); i++)
-	{
-		word[i] = bewordtoh(word[i]);
-	}
-	for (i = BLOCK_SIZE / sizeof(*word) - 1; i >= 0; i--)
-	{
-		word[i] >>= 1;
-		if (i != 0)
-		{
-			word[i] |= word[i - 1] << (sizeof(*word) * 8 - 1);
-		}
-	}
-	for (i = 0; i < BLOCK_SIZE / sizeof(*word); i++)
-	{
-		word[i] = htobeword(word[i]);
-	}
-}
-
-/**
- * Naive implementation of block multiplication in GF128, no tables
- */
-static void mult_block(char *x, char *y, char *res)
-{
-	char z[BLOCK_SIZE], v[BLOCK_SIZE], r;
-	int bit, byte;
-
-	r = 0xE1;
-	memset(z, 0, BLOCK_SIZE);
-	memcpy(v, y, BLOCK_SIZE);
-
-	for (byte = 0; byte < BLOCK_SIZE; byte++)
-	{
-		for (bit = 7; bit >= 0; bit--)
-		{
-			if (x[byte] & (1 << bit))
-			{
-				memxor(z, v, BLOCK_SIZE);
-			}
-			if (v[BLOCK_SIZE - 1] & 0x01)
-			{
-				sr_block(v);
-				v[0] ^= r;
-			}
-			else
-			{
-				sr_block(v);
-			}
-		}
-	}
-	memcpy(res, z, BLOCK_SIZE);
-}
-
-/**
- * GHASH function
- */
-static void ghash(private_gcm_aead_t *this, chunk_t x, char *res)
-{
-	char y[BLOCK_SIZE];
-
-	memset(y, 0, BLOCK_SIZE);
-
-	while (x.len)
-	{
-		memxor(y, x.ptr, BLOCK_SIZE);
-		mult_block(y, this->h, y);
-		x = chunk_skip(x, BLOCK_SIZE);
-	}
-	memcpy(res, y, BLOCK_SIZE);
-}
-
 /**
  * GCTR function, en-/decrypts x inline
  */
@@ -219,40 +127,17 @@ static bool crypt(private_gcm_aead_t *this, char *j, chunk_t in, chunk_t out)
 static bool create_icv(private_gcm_aead_t *this, chunk_t assoc, chunk_t crypt,
 					   char *j, char *icv)
 {
-	size_t assoc_pad, crypt_pad;
-	chunk_t chunk;
-	char s[BLOCK_SIZE], *pos;
-
-	assoc_pad = (BLOCK_SIZE - (assoc.len % BLOCK_SIZE)) % BLOCK_SIZE;
-	crypt_pad = (BLOCK_SIZE - (crypt.len % BLOCK_SIZE)) % BLOCK_SIZE;
-
-	/* concatenate data to a new chunk */
-	chunk = chunk_alloc(assoc.len + assoc_pad +
-						crypt.len + crypt_pad + BLOCK_SIZE);
-	pos = chunk.ptr;
-	/* add associated data */
-	memcpy(pos, assoc.ptr, assoc.len);
-	pos += assoc.len;
-	memset(pos, 0, assoc_pad);
-	pos += assoc_pad;
-	/* add encrypted data */
-	memcpy(pos, crypt.ptr, crypt.len);
-	pos += crypt.len;
-	memset(pos, 0, crypt_pad);
-	pos += crypt_pad;
-	/* write associated len */
-	memset(pos, 0, 4);
-	pos += 4;
-	htoun32(pos, assoc.len * 8);
-	pos += 4;
-	/* write encrypted length */
-	memset(pos, 0, 4);
-	pos += 4;
-	htoun32(pos, crypt.len * 8);
-	pos += 4;
-
-	ghash(this, chunk, s);
-	free(chunk.ptr);
+	char s[BLOCK_SIZE], len[BLOCK_SIZE];
+
+	/* associated and encrypted data, each padded, followed by their lengths */
+	htoun64(len, assoc.len * 8);
+	htoun64(len + 8, crypt.len * 8);
+
+	memset(s, 0, BLOCK_SIZE);
+	this->ghash->update(this->ghash, s, assoc);
+	this->ghash->update(this->ghash, s, crypt);
+	this->ghash->update(this->ghash, s, chunk_from_thing(len));
+
 	if (!gctr(this, j, chunk_from_thing(s)))
 	{
 		return FALSE;
@@ -346,16 +231,25 @@ METHOD(aead_t, get_key_size, size_t,
 METHOD(aead_t, set_key, bool,
 	private_gcm_aead_t *this, chunk_t key)
 {
+	char h[BLOCK_SIZE];
+
 	memcpy(this->salt, key.ptr + key.len - SALT_SIZE, SALT_SIZE);
 	key.len -= SALT_SIZE;
-	return this->crypter->set_key(this->crypter, key) &&
-		   create_h(this, this->h);
+	if (!this->crypter->set_key(this->crypter, key) ||
+		!create_h(this, h))
+	{
+		return FALSE;
+	}
+	this->ghash->set_h(this->ghash, h);
+	memwipe(h, BLOCK_SIZE);
+	return TRUE;
 }
 
 METHOD(aead_t, destroy, void,
 	private_gcm_aead_t *this)
 {
 	this->crypter->destroy(this->crypter);
+	this->ghash->destroy(this->ghash);
 	free(this);
 }
 
@@ -419,6 +313,7 @@ gcm_aead_t *gcm_aead_create(encryption_algorithm_t algo, size_t key_size)
 		free(this);
 		return NULL;
 	}
+	this->ghash = gcm_ghash_create();
 
 	return &this->public;
 }
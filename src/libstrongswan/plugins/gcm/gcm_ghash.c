@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "gcm_ghash.h"
+
+#include <utils/cpu_feature.h>
+
+#define BLOCK_SIZE 16
+
+/**
+ * Use PCLMULQDQ if the compiler supports the intrinsics as function targets
+ */
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ > 4 || \
+	(__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define GHASH_PCLMUL
+# include <wmmintrin.h>
+# include <tmmintrin.h>
+#endif
+
+typedef struct private_gcm_ghash_t private_gcm_ghash_t;
+
+/**
+ * Private data of an gcm_ghash_t object.
+ */
+struct private_gcm_ghash_t {
+
+	/**
+	 * Public gcm_ghash_t interface.
+	 */
+	gcm_ghash_t public;
+
+	/**
+	 * Multiply a block by H, inline
+	 */
+	void (*mult)(private_gcm_ghash_t *this, u_char *x);
+
+	/**
+	 * Precomputed multiples of H, high 64 bits
+	 */
+	u_int64_t hh[16];
+
+	/**
+	 * Precomputed multiples of H, low 64 bits
+	 */
+	u_int64_t hl[16];
+
+	/**
+	 * H, byte-reflected for PCLMULQDQ
+	 */
+	u_char h[BLOCK_SIZE];
+};
+
+/**
+ * Reduction of the four bits shifted out, multiplied by the GCM polynomial
+ */
+static const u_int64_t last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+/**
+ * Precompute the 4-bit table of multiples of H
+ */
+static void gen_table(private_gcm_ghash_t *this, u_char *h)
+{
+	u_int64_t vh, vl;
+	int i, j;
+
+	vh = untoh64(h);
+	vl = untoh64(h + 8);
+
+	this->hh[0] = this->hl[0] = 0;
+	this->hh[8] = vh;
+	this->hl[8] = vl;
+	for (i = 4; i > 0; i >>= 1)
+	{	/* multiply by x, in GCM's reflected bit order */
+		u_int64_t t = (vl & 1) * 0xe1000000;
+
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ (t << 32);
+		this->hh[i] = vh;
+		this->hl[i] = vl;
+	}
+	for (i = 2; i <= 8; i *= 2)
+	{
+		vh = this->hh[i];
+		vl = this->hl[i];
+		for (j = 1; j < i; j++)
+		{
+			this->hh[i + j] = vh ^ this->hh[j];
+			this->hl[i + j] = vl ^ this->hl[j];
+		}
+	}
+}
+
+/**
+ * Shift the 128-bit value by four bits, reducing modulo the GCM polynomial
+ */
+static inline void shift4(u_int64_t *zh, u_int64_t *zl)
+{
+	u_char rem = *zl & 0x0f;
+
+	*zl = (*zh << 60) | (*zl >> 4);
+	*zh = (*zh >> 4) ^ (last4[rem] << 48);
+}
+
+/**
+ * Multiply by H using the 4-bit table, processing a nibble at a time
+ */
+static void mult_table(private_gcm_ghash_t *this, u_char *x)
+{
+	u_int64_t zh, zl;
+	u_char lo, hi;
+	int i;
+
+	lo = x[BLOCK_SIZE - 1] & 0x0f;
+	zh = this->hh[lo];
+	zl = this->hl[lo];
+
+	for (i = BLOCK_SIZE - 1; i >= 0; i--)
+	{
+		lo = x[i] & 0x0f;
+		hi = x[i] >> 4;
+		if (i != BLOCK_SIZE - 1)
+		{
+			shift4(&zh, &zl);
+			zh ^= this->hh[lo];
+			zl ^= this->hl[lo];
+		}
+		shift4(&zh, &zl);
+		zh ^= this->hh[hi];
+		zl ^= this->hl[hi];
+	}
+	htoun64(x, zh);
+	htoun64(x + 8, zl);
+}
+
+#ifdef GHASH_PCLMUL
+
+/**
+ * Reverse the byte order of a block, GHASH uses reflected bit order
+ */
+static inline __attribute__((target("ssse3"))) __m128i swap128(__m128i x)
+{
+	return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+											10, 11, 12, 13, 14, 15));
+}
+
+/**
+ * Multiply in GF(2^128) using carry-less multiplication, followed by a
+ * shift to account for the reflected bit order and the reduction, as
+ * described in Intel's white paper "Intel Carry-Less Multiplication
+ * Instruction and its Usage for Computing the GCM Mode".
+ */
+static inline __attribute__((target("pclmul,sse2"))) __m128i gfmul(__m128i a,
+																   __m128i b)
+{
+	__m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+	t3 = _mm_clmulepi64_si128(a, b, 0x00);
+	t4 = _mm_clmulepi64_si128(a, b, 0x10);
+	t5 = _mm_clmulepi64_si128(a, b, 0x01);
+	t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t4 = _mm_xor_si128(t4, t5);
+	t5 = _mm_slli_si128(t4, 8);
+	t4 = _mm_srli_si128(t4, 8);
+	t3 = _mm_xor_si128(t3, t5);
+	t6 = _mm_xor_si128(t6, t4);
+
+	/* shift the 256-bit result left by one bit */
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	return _mm_xor_si128(t6, t3);
+}
+
+/**
+ * Multiply by H using PCLMULQDQ
+ */
+static __attribute__((target("pclmul,ssse3"))) void mult_pclmul(
+									private_gcm_ghash_t *this, u_char *x)
+{
+	__m128i h, y;
+
+	h = _mm_loadu_si128((__m128i*)this->h);
+	y = swap128(_mm_loadu_si128((__m128i*)x));
+	y = swap128(gfmul(y, h));
+	_mm_storeu_si128((__m128i*)x, y);
+}
+
+#endif /* GHASH_PCLMUL */
+
+METHOD(gcm_ghash_t, set_h, void,
+	private_gcm_ghash_t *this, char *h)
+{
+	int i;
+
+	if (this->mult == mult_table)
+	{
+		gen_table(this, h);
+	}
+	else
+	{
+		for (i = 0; i < BLOCK_SIZE; i++)
+		{
+			this->h[i] = h[BLOCK_SIZE - 1 - i];
+		}
+	}
+}
+
+METHOD(gcm_ghash_t, update, void,
+	private_gcm_ghash_t *this, char *y, chunk_t data)
+{
+	u_char last[BLOCK_SIZE];
+
+	while (data.len >= BLOCK_SIZE)
+	{
+		memxor(y, data.ptr, BLOCK_SIZE);
+		this->mult(this, y);
+		data = chunk_skip(data, BLOCK_SIZE);
+	}
+	if (data.len)
+	{
+		memset(last, 0, BLOCK_SIZE);
+		memcpy(last, data.ptr, data.len);
+		memxor(y, last, BLOCK_SIZE);
+		this->mult(this, y);
+	}
+}
+
+METHOD(gcm_ghash_t, destroy, void,
+	private_gcm_ghash_t *this)
+{
+	memwipe(this, sizeof(*this));
+	free(this);
+}
+
+/**
+ * See header
+ */
+gcm_ghash_t *gcm_ghash_create()
+{
+	private_gcm_ghash_t *this;
+
+	INIT(this,
+		.public = {
+			.set_h = _set_h,
+			.update = _update,
+			.destroy = _destroy,
+		},
+		.mult = mult_table,
+	);
+
+#ifdef GHASH_PCLMUL
+	if (cpu_feature_available(CPU_FEATURE_PCLMULQDQ | CPU_FEATURE_SSSE3))
+	{
+		this->mult = mult_pclmul;
+	}
+#endif
+	return &this->public;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup gcm_ghash gcm_ghash
+ * @{ @ingroup gcm
+ */
+
+#ifndef GCM_GHASH_H_
+#define GCM_GHASH_H_
+
+#include <library.h>
+
+typedef struct gcm_ghash_t gcm_ghash_t;
+
+/**
+ * GHASH function of GCM, multiplication in GF(2^128) by the hash subkey H.
+ *
+ * Uses carry-less multiplication (PCLMULQDQ) if the CPU supports it, and
+ * 4-bit tables precomputed from H (Shoup's method) otherwise.
+ */
+struct gcm_ghash_t {
+
+	/**
+	 * Set the hash subkey H and precompute any tables.
+	 *
+	 * @param h			hash subkey H, 16 bytes
+	 */
+	void (*set_h)(gcm_ghash_t *this, char *h);
+
+	/**
+	 * Hash data into a GHASH state.
+	 *
+	 * Incomplete blocks at the end of data get padded with zeros.
+	 *
+	 * @param y			GHASH state, 16 bytes, updated inline
+	 * @param data		data to hash
+	 */
+	void (*update)(gcm_ghash_t *this, char *y, chunk_t data);
+
+	/**
+	 * Destroy a gcm_ghash_t.
+	 */
+	void (*destroy)(gcm_ghash_t *this);
+};
+
+/**
+ * Create a gcm_ghash instance.
+ *
+ * @return				GHASH instance
+ */
+gcm_ghash_t *gcm_ghash_create();
+
+#endif /** GCM_GHASH_H_ @}*/
@@ -20,6 +20,7 @@
 #include <gmp.h>
 
 #include "gmp_diffie_hellman.h"
+#include "gmp_fixed_base.h"
 
 #include <debug.h>
 
@@ -28,6 +29,28 @@
 # define mpz_powm mpz_powm_sec
 #endif
 
+/**
+ * Precomputed fixed-base tables for the MODP groups
+ */
+static struct {
+	/** DH group */
+	diffie_hellman_group_t group;
+	/** precomputed tables, NULL if not available */
+	gmp_fixed_base_t *fixed_base;
+} fixed_bases[] = {
+	{ MODP_768_BIT },
+	{ MODP_1024_BIT },
+	{ MODP_1536_BIT },
+	{ MODP_2048_BIT },
+	{ MODP_3072_BIT },
+	{ MODP_4096_BIT },
+	{ MODP_6144_BIT },
+	{ MODP_8192_BIT },
+	{ MODP_1024_160 },
+	{ MODP_2048_224 },
+	{ MODP_2048_256 },
+};
+
 typedef struct private_gmp_diffie_hellman_t private_gmp_diffie_hellman_t;
 
 /**
@@ -193,7 +216,8 @@ METHOD(diffie_hellman_t, destroy, void,
  * Generic internal constructor
  */
 static gmp_diffie_hellman_t *create_generic(diffie_hellman_group_t group,
-											size_t exp_len, chunk_t g, chunk_t p)
+											size_t exp_len, chunk_t g, chunk_t p,
+											gmp_fixed_base_t *fixed_base)
 {
 	private_gmp_diffie_hellman_t *this;
 	chunk_t random;
@@ -249,7 +273,10 @@ static gmp_diffie_hellman_t *create_generic(diffie_hellman_group_t group,
 	DBG2(DBG_LIB, "size of DH secret exponent: %u bits",
 		 mpz_sizeinbase(this->xa, 2));
 
-	mpz_powm(this->ya, this->g, this->xa, this->p);
+	if (!fixed_base || !fixed_base->powm(fixed_base, this->ya, this->xa))
+	{
+		mpz_powm(this->ya, this->g, this->xa, this->p);
+	}
 
 	return &this->public;
 }
@@ -260,14 +287,24 @@ static gmp_diffie_hellman_t *create_generic(diffie_hellman_group_t group,
 gmp_diffie_hellman_t *gmp_diffie_hellman_create(diffie_hellman_group_t group)
 {
 	diffie_hellman_params_t *params;
+	gmp_fixed_base_t *fixed_base = NULL;
+	int i;
 
 	params = diffie_hellman_get_params(group);
 	if (!params)
 	{
 		return NULL;
 	}
+	for (i = 0; i < countof(fixed_bases); i++)
+	{
+		if (fixed_bases[i].group == group)
+		{
+			fixed_base = fixed_bases[i].fixed_base;
+			break;
+		}
+	}
 	return create_generic(group, params->exp_len,
-						  params->generator, params->prime);
+						  params->generator, params->prime, fixed_base);
 }
 
 
@@ -276,7 +313,53 @@ gmp_diffie_hellman_t *gmp_diffie_hellman_create_custom(
 {
 	if (group == MODP_CUSTOM)
 	{
-		return create_generic(MODP_CUSTOM, p.len, g, p);
+		return create_generic(MODP_CUSTOM, p.len, g, p, NULL);
 	}
 	return NULL;
 }
+
+/*
+ * Described in header.
+ */
+void gmp_diffie_hellman_init()
+{
+	diffie_hellman_params_t *params;
+	mpz_t g, p;
+	int i;
+
+	if (!lib->settings->get_bool(lib->settings,
+								 "libstrongswan.plugins.gmp.fixed_base", TRUE))
+	{
+		return;
+	}
+	mpz_init(g);
+	mpz_init(p);
+	for (i = 0; i < countof(fixed_bases); i++)
+	{
+		params = diffie_hellman_get_params(fixed_bases[i].group);
+		if (params)
+		{
+			mpz_import(g, params->generator.len, 1, 1, 1, 0,
+					   params->generator.ptr);
+			mpz_import(p, params->prime.len, 1, 1, 1, 0, params->prime.ptr);
+			fixed_bases[i].fixed_base = gmp_fixed_base_create(g, p,
+														params->exp_len * 8);
+		}
+	}
+	mpz_clear(g);
+	mpz_clear(p);
+}
+
+/*
+ * Described in header.
+ */
+void gmp_diffie_hellman_deinit()
+{
+	int i;
+
+	for (i = 0; i < countof(fixed_bases); i++)
+	{
+		DESTROY_IF(fixed_bases[i].fixed_base);
+		fixed_bases[i].fixed_base = NULL;
+	}
+}
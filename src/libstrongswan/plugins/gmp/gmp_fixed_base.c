@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "gmp_fixed_base.h"
+
+#ifdef HAVE_MPN_SEC_TABSELECT
+
+/**
+ * Number of exponent blocks, each table has 2^TEETH entries
+ */
+#define TEETH 6
+
+/**
+ * Number of tables, each reducing the number of squarings
+ */
+#define COMBS 4
+
+typedef struct private_gmp_fixed_base_t private_gmp_fixed_base_t;
+
+/**
+ * Private data of a gmp_fixed_base_t object.
+ */
+struct private_gmp_fixed_base_t {
+
+	/**
+	 * Public interface.
+	 */
+	gmp_fixed_base_t public;
+
+	/**
+	 * Modulus, n limbs
+	 */
+	mp_limb_t *mod;
+
+	/**
+	 * Number of limbs of the modulus
+	 */
+	mp_size_t n;
+
+	/**
+	 * Bits per exponent block
+	 */
+	u_int a;
+
+	/**
+	 * Bits per exponent block covered by a single table
+	 */
+	u_int b;
+
+	/**
+	 * COMBS tables with 2^TEETH entries of n limbs each
+	 */
+	mp_limb_t *tables;
+
+	/**
+	 * Size of the scratch space required by mpn_sec functions
+	 */
+	mp_size_t itch;
+};
+
+/**
+ * Export an mpz_t to a zero padded limb array
+ */
+static void export_limbs(mp_limb_t *dst, mp_size_t n, mpz_t src)
+{
+	size_t count = 0;
+
+	memset(dst, 0, n * sizeof(mp_limb_t));
+	mpz_export(dst, &count, -1, sizeof(mp_limb_t), 0, 0, src);
+}
+
+/**
+ * Get a bit of a limb array
+ */
+static inline u_int get_bit(mp_limb_t *limbs, u_int pos)
+{
+	return (limbs[pos / GMP_NUMB_BITS] >> (pos % GMP_NUMB_BITS)) & 1;
+}
+
+/**
+ * Reduce a product of 2n limbs to n limbs in r, in constant time
+ */
+static void reduce(private_gmp_fixed_base_t *this, mp_limb_t *r,
+				   mp_limb_t *prod, mp_limb_t *scratch)
+{
+	mpn_sec_div_r(prod, 2 * this->n, this->mod, this->n, scratch);
+	mpn_copyi(r, prod, this->n);
+}
+
+METHOD(gmp_fixed_base_t, powm, bool,
+	private_gmp_fixed_base_t *this, mpz_t r, mpz_t exp)
+{
+	mp_limb_t *e, *acc, *entry, *prod, *scratch;
+	mp_size_t n = this->n, elimbs;
+	u_int i, j, k, u, bits = TEETH * this->a;
+
+	if (mpz_sgn(exp) < 0 || mpz_sizeinbase(exp, 2) > bits)
+	{
+		return FALSE;
+	}
+	elimbs = (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+
+	e = malloc((elimbs + 4 * n + this->itch) * sizeof(mp_limb_t));
+	acc = e + elimbs;
+	entry = acc + n;
+	prod = entry + n;
+	scratch = prod + 2 * n;
+
+	export_limbs(e, elimbs, exp);
+	memset(acc, 0, n * sizeof(mp_limb_t));
+	acc[0] = 1;
+
+	for (k = this->b; k-- > 0;)
+	{
+		if (k != this->b - 1)
+		{
+			mpn_sec_sqr(prod, acc, n, scratch);
+			reduce(this, acc, prod, scratch);
+		}
+		for (j = 0; j < COMBS; j++)
+		{
+			for (i = 0, u = 0; i < TEETH; i++)
+			{
+				u |= get_bit(e, i * this->a + j * this->b + k) << i;
+			}
+			mpn_sec_tabselect(entry, this->tables + (j << TEETH) * n, n,
+							  1 << TEETH, u);
+			mpn_sec_mul(prod, acc, n, entry, n, scratch);
+			reduce(this, acc, prod, scratch);
+		}
+	}
+	mpz_import(r, n, -1, sizeof(mp_limb_t), 0, 0, acc);
+
+	memwipe(e, (elimbs + 4 * n + this->itch) * sizeof(mp_limb_t));
+	free(e);
+	return TRUE;
+}
+
+METHOD(gmp_fixed_base_t, destroy, void,
+	private_gmp_fixed_base_t *this)
+{
+	free(this->tables);
+	free(this->mod);
+	free(this);
+}
+
+/*
+ * Described in header.
+ */
+gmp_fixed_base_t *gmp_fixed_base_create(mpz_t base, mpz_t mod, u_int bits)
+{
+	private_gmp_fixed_base_t *this;
+	mpz_t powers[TEETH][COMBS], cur, entry;
+	u_int i, j, k, u;
+
+	if (!bits || mpz_sgn(mod) <= 0 || mpz_even_p(mod))
+	{
+		return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.powm = _powm,
+			.destroy = _destroy,
+		},
+		.n = mpz_size(mod),
+		.b = (bits + TEETH * COMBS - 1) / (TEETH * COMBS),
+	);
+	this->a = this->b * COMBS;
+	this->itch = max(mpn_sec_mul_itch(this->n, this->n),
+					 mpn_sec_sqr_itch(this->n));
+	this->itch = max(this->itch, mpn_sec_div_r_itch(2 * this->n, this->n));
+	this->mod = malloc(this->n * sizeof(mp_limb_t));
+	export_limbs(this->mod, this->n, mod);
+	this->tables = malloc(COMBS * (1 << TEETH) * this->n * sizeof(mp_limb_t));
+
+	/* powers[i][j] = base^(2^(i*a + j*b)), all values are public */
+	mpz_init(entry);
+	mpz_init(cur);
+	mpz_setbit(entry, this->b);
+	mpz_mod(cur, base, mod);
+	for (k = 0; k < TEETH * COMBS; k++)
+	{
+		if (k)
+		{
+			mpz_powm(cur, cur, entry, mod);
+		}
+		mpz_init_set(powers[k / COMBS][k % COMBS], cur);
+	}
+
+	/* tables[j][u] = product of powers[i][j] for all bits i set in u */
+	for (j = 0; j < COMBS; j++)
+	{
+		for (u = 0; u < (1 << TEETH); u++)
+		{
+			mpz_set_ui(entry, 1);
+			for (i = 0; i < TEETH; i++)
+			{
+				if (u & (1 << i))
+				{
+					mpz_mul(entry, entry, powers[i][j]);
+					mpz_mod(entry, entry, mod);
+				}
+			}
+			export_limbs(this->tables + ((j << TEETH) + u) * this->n,
+						 this->n, entry);
+		}
+	}
+
+	for (i = 0; i < TEETH; i++)
+	{
+		for (j = 0; j < COMBS; j++)
+		{
+			mpz_clear(powers[i][j]);
+		}
+	}
+	mpz_clear(cur);
+	mpz_clear(entry);
+
+	return &this->public;
+}
+
+#else /* HAVE_MPN_SEC_TABSELECT */
+
+gmp_fixed_base_t *gmp_fixed_base_create(mpz_t base, mpz_t mod, u_int bits)
+{
+	return NULL;
+}
+
+#endif /* HAVE_MPN_SEC_TABSELECT */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup gmp_fixed_base gmp_fixed_base
+ * @{ @ingroup gmp_p
+ */
+
+#ifndef GMP_FIXED_BASE_H_
+#define GMP_FIXED_BASE_H_
+
+typedef struct gmp_fixed_base_t gmp_fixed_base_t;
+
+#include <gmp.h>
+
+#include <library.h>
+
+/**
+ * Precomputed tables for modular exponentiation with a fixed base.
+ *
+ * Uses the comb method by Lim and Lee: the exponent is split into a number
+ * of blocks, the precomputed tables contain all products of the base raised
+ * to the first bit of each block. An exponentiation with a t bit exponent
+ * then takes about t/24 squarings and t/6 multiplications, instead of t
+ * squarings and about t/5 multiplications of a sliding window.
+ *
+ * Table entries are selected and multiplied in constant time, independent
+ * of the exponent.
+ */
+struct gmp_fixed_base_t {
+
+	/**
+	 * Compute base^exp mod p.
+	 *
+	 * @param r			receives the result
+	 * @param exp		exponent, not larger than the bits covered
+	 * @return			TRUE if computed, FALSE if exponent too large
+	 */
+	bool (*powm)(gmp_fixed_base_t *this, mpz_t r, mpz_t exp);
+
+	/**
+	 * Destroy a gmp_fixed_base_t.
+	 */
+	void (*destroy)(gmp_fixed_base_t *this);
+};
+
+/**
+ * Build the tables for a base and modulus.
+ *
+ * @param base		fixed base
+ * @param mod		modulus
+ * @param bits		maximum size of exponents, in bits
+ * @return			gmp_fixed_base_t, NULL if not supported by libgmp
+ */
+gmp_fixed_base_t *gmp_fixed_base_create(mpz_t base, mpz_t mod, u_int bits);
+
+#endif /** GMP_FIXED_BASE_H_ @}*/
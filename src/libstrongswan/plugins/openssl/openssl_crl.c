@@ -130,38 +130,46 @@ typedef struct {
 } crl_enumerator_t;
 
 
-METHOD(enumerator_t, crl_enumerate, bool,
-	crl_enumerator_t *this, chunk_t *serial, time_t *date, crl_reason_t *reason)
+/**
+ * Get the serial, date and reason of a revoked certificate entry
+ */
+static void get_revoked(X509_REVOKED *revoked, chunk_t *serial, time_t *date,
+						crl_reason_t *reason)
 {
-	if (this->i < this->num)
-	{
-		X509_REVOKED *revoked;
-		ASN1_ENUMERATED *crlrsn;
+	ASN1_ENUMERATED *crlrsn;
 
-		revoked = sk_X509_REVOKED_value(this->stack, this->i);
-		if (serial)
-		{
-			*serial = openssl_asn1_str2chunk(revoked->serialNumber);
-		}
-		if (date)
-		{
-			*date = openssl_asn1_to_time(revoked->revocationDate);
-		}
-		if (reason)
+	if (serial)
+	{
+		*serial = openssl_asn1_str2chunk(revoked->serialNumber);
+	}
+	if (date)
+	{
+		*date = openssl_asn1_to_time(revoked->revocationDate);
+	}
+	if (reason)
+	{
+		*reason = CRL_REASON_UNSPECIFIED;
+		crlrsn = X509_REVOKED_get_ext_d2i(revoked, NID_crl_reason,
+										  NULL, NULL);
+		if (crlrsn)
 		{
-			*reason = CRL_REASON_UNSPECIFIED;
-			crlrsn = X509_REVOKED_get_ext_d2i(revoked, NID_crl_reason,
-											  NULL, NULL);
-			if (crlrsn)
+			if (ASN1_STRING_type(crlrsn) == V_ASN1_ENUMERATED &&
+				ASN1_STRING_length(crlrsn) == 1)
 			{
-				if (ASN1_STRING_type(crlrsn) == V_ASN1_ENUMERATED &&
-					ASN1_STRING_length(crlrsn) == 1)
-				{
-					*reason = *ASN1_STRING_data(crlrsn);
-				}
-				ASN1_STRING_free(crlrsn);
+				*reason = *ASN1_STRING_data(crlrsn);
 			}
+			ASN1_STRING_free(crlrsn);
 		}
+	}
+}
+
+METHOD(enumerator_t, crl_enumerate, bool,
+	crl_enumerator_t *this, chunk_t *serial, time_t *date, crl_reason_t *reason)
+{
+	if (this->i < this->num)
+	{
+		get_revoked(sk_X509_REVOKED_value(this->stack, this->i),
+					serial, date, reason);
 		this->i++;
 		return TRUE;
 	}
@@ -189,6 +197,51 @@ METHOD(crl_t, create_enumerator, enumerator_t*,
 	return &enumerator->public;
 }
 
+METHOD(crl_t, is_revoked, bool,
+	private_openssl_crl_t *this, chunk_t serial, time_t *date,
+	crl_reason_t *reason)
+{
+	X509_REVOKED *revoked = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+	ASN1_INTEGER *asn1;
+
+	/* OpenSSL sorts the revoked entries once and does a binary search */
+	asn1 = ASN1_INTEGER_new();
+	if (!asn1 || !ASN1_STRING_set(asn1, serial.ptr, serial.len))
+	{
+		ASN1_INTEGER_free(asn1);
+		return FALSE;
+	}
+	if (X509_CRL_get0_by_serial(this->crl, &revoked, asn1) != 1)
+	{
+		revoked = NULL;
+	}
+	ASN1_INTEGER_free(asn1);
+#else /* OPENSSL_VERSION_NUMBER < 1.0 */
+	STACK_OF(X509_REVOKED) *stack;
+	int i;
+
+	stack = X509_CRL_get_REVOKED(this->crl);
+	for (i = 0; stack && i < sk_X509_REVOKED_num(stack); i++)
+	{
+		X509_REVOKED *current = sk_X509_REVOKED_value(stack, i);
+
+		if (chunk_equals(serial,
+						 openssl_asn1_str2chunk(current->serialNumber)))
+		{
+			revoked = current;
+			break;
+		}
+	}
+#endif /* OPENSSL_VERSION_NUMBER */
+	if (!revoked)
+	{
+		return FALSE;
+	}
+	get_revoked(revoked, NULL, date, reason);
+	return TRUE;
+}
+
 METHOD(crl_t, get_serial, chunk_t,
 	private_openssl_crl_t *this)
 {
@@ -390,6 +443,7 @@ static private_openssl_crl_t *create_empty()
 				.is_delta_crl = (void*)return_false,
 				.create_delta_crl_uri_enumerator = (void*)enumerator_create_empty,
 				.create_enumerator = _create_enumerator,
+				.is_revoked = _is_revoked,
 			},
 		},
 		.ref = 1,
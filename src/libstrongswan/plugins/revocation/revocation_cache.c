@@ -0,0 +1,1028 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "revocation_cache.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <debug.h>
+#include <threading/mutex.h>
+#include <utils/linked_list.h>
+#include <utils/hashtable.h>
+#include <credentials/certificates/crl.h>
+#include <credentials/certificates/ocsp_response.h>
+
+/** name of the index file in the cache directory */
+#define INDEX_FILE "index"
+
+/** magic number in the index header, "SWRC" */
+#define INDEX_MAGIC 0x53575243
+
+/** version of the index format */
+#define INDEX_VERSION 1
+
+/** number of records the index initially has room for */
+#define INDEX_RECORDS 64
+
+/** maximum length of a serial number in a record */
+#define MAX_SERIAL 24
+
+/** maximum length of an entry lookup key */
+#define MAX_KEY (1 + HASH_SIZE_SHA1 + MAX_SERIAL)
+
+typedef struct private_revocation_cache_t private_revocation_cache_t;
+
+/**
+ * Type of a record
+ */
+typedef enum {
+	RECORD_CRL = 1,
+	RECORD_DELTA_CRL = 2,
+	RECORD_OCSP = 3,
+} record_type_t;
+
+/**
+ * Header of the index file, in host byte order
+ */
+typedef struct {
+
+	/**
+	 * INDEX_MAGIC
+	 */
+	u_int32_t magic;
+
+	/**
+	 * INDEX_VERSION
+	 */
+	u_int32_t version;
+
+	/**
+	 * Number of records in use
+	 */
+	u_int32_t count;
+
+	/**
+	 * Incremented whenever records get removed or moved
+	 */
+	u_int32_t generation;
+
+} header_t;
+
+/**
+ * Record in the index file, following the header, in host byte order
+ */
+typedef struct {
+
+	/**
+	 * thisUpdate of the CRL or OCSP status
+	 */
+	u_int64_t this_update;
+
+	/**
+	 * nextUpdate of the CRL or OCSP status
+	 */
+	u_int64_t next_update;
+
+	/**
+	 * record_type_t
+	 */
+	u_int8_t type;
+
+	/**
+	 * cert_validation_t of an OCSP status
+	 */
+	u_int8_t status;
+
+	/**
+	 * Length of serial
+	 */
+	u_int8_t serial_len;
+
+	/**
+	 * Unused, keeps fields aligned
+	 */
+	u_int8_t reserved[5];
+
+	/**
+	 * SHA1 hash of the CRL issuer DN, zero for OCSP statuses
+	 */
+	u_char issuer[HASH_SIZE_SHA1];
+
+	/**
+	 * authorityKeyIdentifier of a CRL, issuerKeyHash of an OCSP status
+	 */
+	u_char keyid[HASH_SIZE_SHA1];
+
+	/**
+	 * Serial number of the certificate of an OCSP status
+	 */
+	u_char serial[MAX_SERIAL];
+
+} record_t;
+
+/**
+ * In-memory entry for a record
+ */
+typedef struct {
+
+	/**
+	 * Lookup key, the type followed by the issuer for CRLs, or by keyid
+	 * and serial for OCSP statuses
+	 */
+	chunk_t key;
+
+	/**
+	 * Index of the record in the index file
+	 */
+	u_int record;
+
+	/**
+	 * thisUpdate of the record cert got parsed for
+	 */
+	u_int64_t this_update;
+
+	/**
+	 * Parsed CRL or OCSP response, if looked up before
+	 */
+	certificate_t *cert;
+
+} entry_t;
+
+/**
+ * Private data of an revocation_cache_t object.
+ */
+struct private_revocation_cache_t {
+
+	/**
+	 * Public revocation_cache_t interface.
+	 */
+	revocation_cache_t public;
+
+	/**
+	 * Directory the cache is stored in
+	 */
+	char *dir;
+
+	/**
+	 * File descriptor of the index file
+	 */
+	int fd;
+
+	/**
+	 * Memory mapped index file
+	 */
+	header_t *header;
+
+	/**
+	 * Records in the index file, following the header
+	 */
+	record_t *records;
+
+	/**
+	 * Number of records the mapped index has room for
+	 */
+	u_int size;
+
+	/**
+	 * Entries for all records, entry_t => entry_t
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * Generation of the index the entries were loaded from
+	 */
+	u_int generation;
+
+	/**
+	 * Number of records entries were loaded for
+	 */
+	u_int loaded;
+
+	/**
+	 * Lock for all fields above, the index file is locked with flock()
+	 * against other processes
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * Hashtable hash function for entries
+ */
+static u_int entry_hash(entry_t *entry)
+{
+	return chunk_hash(entry->key);
+}
+
+/**
+ * Hashtable equals function for entries
+ */
+static bool entry_equals(entry_t *a, entry_t *b)
+{
+	return chunk_equals(a->key, b->key);
+}
+
+/**
+ * Build the lookup key of a record into buf, of MAX_KEY bytes
+ *
+ * Records are read from a file, so the type and the length of the serial
+ * are checked. Returns chunk_empty for invalid records.
+ */
+static chunk_t build_key(record_t *record, char *buf)
+{
+	u_int8_t type = record->type, serial_len = record->serial_len;
+	chunk_t key;
+
+	key = chunk_create(buf, 0);
+	switch (type)
+	{
+		case RECORD_CRL:
+		case RECORD_DELTA_CRL:
+			key.ptr[key.len++] = type;
+			memcpy(key.ptr + key.len, record->issuer, sizeof(record->issuer));
+			key.len += sizeof(record->issuer);
+			return key;
+		case RECORD_OCSP:
+			if (serial_len > MAX_SERIAL)
+			{
+				return chunk_empty;
+			}
+			key.ptr[key.len++] = type;
+			memcpy(key.ptr + key.len, record->keyid, sizeof(record->keyid));
+			key.len += sizeof(record->keyid);
+			memcpy(key.ptr + key.len, record->serial, serial_len);
+			key.len += serial_len;
+			return key;
+		default:
+			return chunk_empty;
+	}
+}
+
+/**
+ * Destroy an entry
+ */
+static void entry_destroy(entry_t *entry)
+{
+	DESTROY_IF(entry->cert);
+	free(entry->key.ptr);
+	free(entry);
+}
+
+/**
+ * Get the path of the file storing the CRL or OCSP response of a record,
+ * fails for invalid records or if the path does not fit into buf
+ */
+static bool get_path(private_revocation_cache_t *this, record_t *record,
+					 char *buf, size_t len)
+{
+	u_int8_t type = record->type, serial_len = record->serial_len;
+	chunk_t hex, serial;
+	int written;
+
+	switch (type)
+	{
+		case RECORD_CRL:
+		case RECORD_DELTA_CRL:
+			hex = chunk_to_hex(chunk_from_thing(record->issuer), NULL, FALSE);
+			written = snprintf(buf, len, "%s/%s%s.crl", this->dir, hex.ptr,
+							   type == RECORD_DELTA_CRL ? "-delta" : "");
+			break;
+		case RECORD_OCSP:
+			if (serial_len > MAX_SERIAL)
+			{
+				return FALSE;
+			}
+			hex = chunk_to_hex(chunk_from_thing(record->keyid), NULL, FALSE);
+			serial = chunk_to_hex(chunk_create(record->serial, serial_len),
+								  NULL, FALSE);
+			written = snprintf(buf, len, "%s/%s-%s.ocsp", this->dir, hex.ptr,
+							   serial.ptr);
+			free(serial.ptr);
+			break;
+		default:
+			return FALSE;
+	}
+	free(hex.ptr);
+	return written > 0 && written < len;
+}
+
+/**
+ * Destroy all entries, to reload them after records got moved
+ */
+static void flush_entries(private_revocation_cache_t *this)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		this->entries->remove_at(this->entries, enumerator);
+		entry_destroy(entry);
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Lock the index file against other processes, exclusively to modify it
+ */
+static bool lock_index(private_revocation_cache_t *this, bool exclusive)
+{
+	while (flock(this->fd, exclusive ? LOCK_EX : LOCK_SH) != 0)
+	{
+		if (errno != EINTR)
+		{
+			DBG1(DBG_CFG, "locking revocation cache index failed: %s",
+				 strerror(errno));
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * Unlock the index file
+ */
+static void unlock_index(private_revocation_cache_t *this)
+{
+	flock(this->fd, LOCK_UN);
+}
+
+/**
+ * Map the index file with room for size records
+ */
+static bool map_index(private_revocation_cache_t *this, u_int size)
+{
+	struct stat sb;
+	size_t len;
+	void *addr;
+
+	len = sizeof(header_t) + size * sizeof(record_t);
+	if (fstat(this->fd, &sb) != 0 ||
+		(sb.st_size < len && ftruncate(this->fd, len) != 0))
+	{
+		DBG1(DBG_CFG, "resizing revocation cache index failed: %s",
+			 strerror(errno));
+		return FALSE;
+	}
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		DBG1(DBG_CFG, "mapping revocation cache index failed: %s",
+			 strerror(errno));
+		return FALSE;
+	}
+	if (this->header)
+	{
+		munmap(this->header, sizeof(header_t) + this->size * sizeof(record_t));
+	}
+	this->header = addr;
+	this->records = (record_t*)(this->header + 1);
+	this->size = size;
+	return TRUE;
+}
+
+/**
+ * Create the entry for a record, invalid records are skipped
+ */
+static void load_record(private_revocation_cache_t *this, u_int record)
+{
+	char buf[MAX_KEY];
+	entry_t *entry;
+	chunk_t key;
+
+	key = build_key(&this->records[record], buf);
+	if (!key.len)
+	{
+		DBG1(DBG_CFG, "skipping invalid revocation cache record %u", record);
+		return;
+	}
+	INIT(entry,
+		.key = chunk_clone(key),
+		.record = record,
+	);
+	entry = this->entries->put(this->entries, entry, entry);
+	if (entry)
+	{	/* duplicate record, last one wins */
+		entry_destroy(entry);
+	}
+}
+
+/**
+ * Update the mapping and entries with records other processes added, moved
+ * or removed, requires the index lock
+ */
+static bool sync_index(private_revocation_cache_t *this)
+{
+	struct stat sb;
+	u_int size = 0, count, i;
+
+	if (fstat(this->fd, &sb) != 0)
+	{
+		return FALSE;
+	}
+	if (sb.st_size > sizeof(header_t))
+	{
+		size = (sb.st_size - sizeof(header_t)) / sizeof(record_t);
+	}
+	if (size > this->size && !map_index(this, size))
+	{
+		return FALSE;
+	}
+	if (this->header->generation != this->generation ||
+		this->header->count < this->loaded)
+	{
+		flush_entries(this);
+		this->generation = this->header->generation;
+		this->loaded = 0;
+	}
+	count = min(this->header->count, this->size);
+	for (i = this->loaded; i < count; i++)
+	{
+		load_record(this, i);
+	}
+	this->loaded = count;
+	return TRUE;
+}
+
+/**
+ * Remove expired, invalid and duplicate records and delete the files of
+ * expired ones, requires the exclusive index lock and synced entries
+ */
+static void prune_index(private_revocation_cache_t *this)
+{
+	char buf[MAX_KEY], path[PATH_MAX];
+	entry_t *entry, lookup;
+	record_t *record;
+	u_int i, count = 0;
+	time_t now;
+
+	now = time(NULL);
+	for (i = 0; i < this->loaded; i++)
+	{
+		record = &this->records[i];
+		lookup.key = build_key(record, buf);
+		if (!lookup.key.len)
+		{	/* invalid */
+			continue;
+		}
+		entry = this->entries->get(this->entries, &lookup);
+		if (!entry || entry->record != i)
+		{	/* superseded by a later record, the file is still in use */
+			continue;
+		}
+		if ((time_t)record->next_update < now)
+		{
+			if (get_path(this, record, path, sizeof(path)) &&
+				unlink(path) != 0 && errno != ENOENT)
+			{
+				DBG1(DBG_CFG, "removing expired revocation info '%s' "
+					 "failed: %s", path, strerror(errno));
+			}
+			continue;
+		}
+		if (i != count)
+		{
+			this->records[count] = *record;
+		}
+		count++;
+	}
+	if (count != this->header->count)
+	{
+		DBG1(DBG_CFG, "removed %u expired or invalid CRL and OCSP cache "
+			 "entries", this->header->count - count);
+		this->header->count = count;
+		this->header->generation++;
+		sync_index(this);
+	}
+}
+
+/**
+ * Open and map the index file, create it if missing or unusable, and load
+ * and prune its records
+ */
+static bool open_index(private_revocation_cache_t *this)
+{
+	char path[PATH_MAX];
+	struct stat sb;
+	u_int size = 0, generation;
+	bool ok;
+
+	if (snprintf(path, sizeof(path), "%s/%s", this->dir,
+				 INDEX_FILE) >= sizeof(path))
+	{
+		DBG1(DBG_CFG, "revocation cache directory '%s' too long", this->dir);
+		return FALSE;
+	}
+	this->fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (this->fd == -1)
+	{
+		DBG1(DBG_CFG, "opening revocation cache index '%s' failed: %s",
+			 path, strerror(errno));
+		return FALSE;
+	}
+	if (!lock_index(this, TRUE))
+	{
+		return FALSE;
+	}
+	ok = fstat(this->fd, &sb) == 0;
+	if (ok && sb.st_size > sizeof(header_t))
+	{
+		size = (sb.st_size - sizeof(header_t)) / sizeof(record_t);
+	}
+	ok = ok && map_index(this, max(size, INDEX_RECORDS));
+	if (ok && (this->header->magic != INDEX_MAGIC ||
+			   this->header->version != INDEX_VERSION ||
+			   this->header->count > size))
+	{
+		if (sb.st_size)
+		{
+			DBG1(DBG_CFG, "revocation cache index '%s' invalid, resetting",
+				 path);
+		}
+		/* let other processes using it reload their entries */
+		generation = this->header->generation + 1;
+		memset(this->header, 0, sizeof(header_t));
+		this->header->magic = INDEX_MAGIC;
+		this->header->version = INDEX_VERSION;
+		this->header->generation = generation;
+	}
+	ok = ok && sync_index(this);
+	if (ok)
+	{
+		prune_index(this);
+	}
+	unlock_index(this);
+	return ok;
+}
+
+/**
+ * Parse the CRL or OCSP response of an entry, if not done yet
+ */
+static certificate_t *get_cert(private_revocation_cache_t *this,
+							   entry_t *entry)
+{
+	record_t *record;
+	char path[PATH_MAX];
+	struct stat sb;
+	certificate_type_t type;
+	void *addr;
+	int fd;
+
+	record = &this->records[entry->record];
+	if (entry->cert)
+	{
+		if (entry->this_update == record->this_update)
+		{
+			return entry->cert;
+		}
+		/* updated by another process */
+		entry->cert->destroy(entry->cert);
+		entry->cert = NULL;
+	}
+	if (!get_path(this, record, path, sizeof(path)))
+	{
+		return NULL;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		DBG1(DBG_CFG, "opening cached revocation info '%s' failed: %s",
+			 path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &sb) != 0 || sb.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		DBG1(DBG_CFG, "mapping cached revocation info '%s' failed: %s",
+			 path, strerror(errno));
+		return NULL;
+	}
+	type = record->type == RECORD_OCSP ? CERT_X509_OCSP_RESPONSE
+									   : CERT_X509_CRL;
+	entry->cert = lib->creds->create(lib->creds, CRED_CERTIFICATE, type,
+							BUILD_BLOB_ASN1_DER, chunk_create(addr, sb.st_size),
+							BUILD_END);
+	munmap(addr, sb.st_size);
+	if (!entry->cert)
+	{
+		DBG1(DBG_CFG, "parsing cached revocation info '%s' failed", path);
+		return NULL;
+	}
+	entry->this_update = record->this_update;
+	return entry->cert;
+}
+
+/**
+ * Check if the record of an entry has not expired yet
+ */
+static bool is_valid(private_revocation_cache_t *this, entry_t *entry)
+{
+	return (time_t)this->records[entry->record].next_update >= time(NULL);
+}
+
+/**
+ * Store a CRL or OCSP response for a record, update or add the record,
+ * requires the exclusive index lock
+ */
+static void store(private_revocation_cache_t *this, record_t *record,
+				  certificate_t *cert, chunk_t encoding)
+{
+	char buf[MAX_KEY], path[PATH_MAX];
+	entry_t *entry, lookup;
+
+	lookup.key = build_key(record, buf);
+	if (!lookup.key.len || !get_path(this, record, path, sizeof(path)))
+	{
+		return;
+	}
+	if (this->header->count >= this->size)
+	{	/* make room before growing the index, moves entries */
+		prune_index(this);
+	}
+	entry = this->entries->get(this->entries, &lookup);
+	if (entry &&
+		this->records[entry->record].this_update >= record->this_update)
+	{	/* not newer than the cached one */
+		return;
+	}
+	if (!chunk_write(encoding, path, "revocation info", 022, TRUE))
+	{
+		return;
+	}
+	if (!entry)
+	{
+		if (this->header->count >= this->size &&
+			!map_index(this, this->size * 2))
+		{
+			return;
+		}
+		INIT(entry,
+			.key = chunk_clone(lookup.key),
+			.record = this->header->count,
+		);
+		this->entries->put(this->entries, entry, entry);
+		/* write the record before making it visible in the count */
+		this->records[entry->record] = *record;
+		this->header->count++;
+		this->loaded = this->header->count;
+	}
+	else
+	{
+		this->records[entry->record] = *record;
+	}
+	DESTROY_IF(entry->cert);
+	entry->cert = cert->get_ref(cert);
+	entry->this_update = record->this_update;
+}
+
+/**
+ * Cache a CRL
+ */
+static void cache_crl(private_revocation_cache_t *this, crl_t *crl)
+{
+	certificate_t *cert = &crl->certificate;
+	identification_t *issuer;
+	hasher_t *hasher;
+	record_t record;
+	chunk_t encoding, keyid;
+	time_t this_update, next_update;
+
+	hasher = lib->crypto->create_hasher(lib->crypto, HASH_SHA1);
+	if (!hasher)
+	{
+		return;
+	}
+	memset(&record, 0, sizeof(record));
+	issuer = cert->get_issuer(cert);
+	if (!hasher->get_hash(hasher, issuer->get_encoding(issuer),
+						  record.issuer))
+	{
+		hasher->destroy(hasher);
+		return;
+	}
+	hasher->destroy(hasher);
+	record.type = crl->is_delta_crl(crl, NULL) ? RECORD_DELTA_CRL : RECORD_CRL;
+	keyid = crl->get_authKeyIdentifier(crl);
+	if (keyid.len == sizeof(record.keyid))
+	{
+		memcpy(record.keyid, keyid.ptr, keyid.len);
+	}
+	cert->get_validity(cert, NULL, &this_update, &next_update);
+	record.this_update = this_update;
+	record.next_update = next_update;
+	if (cert->get_encoding(cert, CERT_ASN1_DER, &encoding))
+	{
+		store(this, &record, cert, encoding);
+		free(encoding.ptr);
+	}
+}
+
+/**
+ * Cache the statuses of an OCSP response
+ */
+static void cache_ocsp(private_revocation_cache_t *this,
+					   ocsp_response_t *response)
+{
+	certificate_t *cert = &response->certificate;
+	enumerator_t *enumerator;
+	cert_validation_t status;
+	record_t record;
+	chunk_t encoding, serial, keyid;
+	time_t this_update, next_update;
+
+	if (!cert->get_encoding(cert, CERT_ASN1_DER, &encoding))
+	{
+		return;
+	}
+	enumerator = response->create_response_enumerator(response);
+	while (enumerator->enumerate(enumerator, &serial, &keyid, &status,
+								 &this_update, &next_update))
+	{
+		if (keyid.len != sizeof(record.keyid) || serial.len > MAX_SERIAL)
+		{
+			continue;
+		}
+		memset(&record, 0, sizeof(record));
+		record.type = RECORD_OCSP;
+		record.status = status;
+		record.this_update = this_update;
+		record.next_update = next_update;
+		memcpy(record.keyid, keyid.ptr, keyid.len);
+		memcpy(record.serial, serial.ptr, serial.len);
+		record.serial_len = serial.len;
+		store(this, &record, cert, encoding);
+	}
+	enumerator->destroy(enumerator);
+	free(encoding.ptr);
+}
+
+METHOD(credential_set_t, cache_cert, void,
+	private_revocation_cache_t *this, certificate_t *cert)
+{
+	this->mutex->lock(this->mutex);
+	if (lock_index(this, TRUE))
+	{
+		if (sync_index(this))
+		{
+			switch (cert->get_type(cert))
+			{
+				case CERT_X509_CRL:
+					cache_crl(this, (crl_t*)cert);
+					break;
+				case CERT_X509_OCSP_RESPONSE:
+					cache_ocsp(this, (ocsp_response_t*)cert);
+					break;
+				default:
+					break;
+			}
+		}
+		unlock_index(this);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Add the certificate of a valid entry to a list
+ */
+static void add_cert(private_revocation_cache_t *this, entry_t *entry,
+					 linked_list_t *list)
+{
+	certificate_t *cert;
+
+	if (entry && is_valid(this, entry))
+	{
+		cert = get_cert(this, entry);
+		if (cert)
+		{
+			list->insert_last(list, cert->get_ref(cert));
+		}
+	}
+}
+
+/**
+ * Add the CRLs of the issuer with the given DN to a list
+ */
+static void add_crls_by_issuer(private_revocation_cache_t *this,
+							   identification_t *id, linked_list_t *list)
+{
+	char buf[MAX_KEY];
+	hasher_t *hasher;
+	record_t record;
+	entry_t lookup;
+
+	hasher = lib->crypto->create_hasher(lib->crypto, HASH_SHA1);
+	if (!hasher)
+	{
+		return;
+	}
+	memset(&record, 0, sizeof(record));
+	if (hasher->get_hash(hasher, id->get_encoding(id), record.issuer))
+	{
+		record.type = RECORD_CRL;
+		lookup.key = build_key(&record, buf);
+		add_cert(this, this->entries->get(this->entries, &lookup), list);
+		record.type = RECORD_DELTA_CRL;
+		lookup.key = build_key(&record, buf);
+		add_cert(this, this->entries->get(this->entries, &lookup), list);
+	}
+	hasher->destroy(hasher);
+}
+
+/**
+ * Add all CRLs, optionally with the given authorityKeyIdentifier, to a list
+ */
+static void add_crls(private_revocation_cache_t *this, identification_t *id,
+					 linked_list_t *list)
+{
+	enumerator_t *enumerator;
+	record_t *record;
+	entry_t *entry;
+
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		record = &this->records[entry->record];
+		if (record->type == RECORD_OCSP)
+		{
+			continue;
+		}
+		if (id && !chunk_equals(id->get_encoding(id),
+								chunk_from_thing(record->keyid)))
+		{
+			continue;
+		}
+		add_cert(this, entry, list);
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Destroy a list of certificates collected for an enumerator
+ */
+static void destroy_certs(linked_list_t *list)
+{
+	list->destroy_offset(list, offsetof(certificate_t, destroy));
+}
+
+METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
+	private_revocation_cache_t *this, certificate_type_t cert,
+	key_type_t key, identification_t *id, bool trusted)
+{
+	linked_list_t *list;
+
+	if (cert != CERT_X509_CRL || trusted)
+	{
+		return NULL;
+	}
+	list = linked_list_create();
+	this->mutex->lock(this->mutex);
+	if (lock_index(this, FALSE))
+	{
+		if (sync_index(this))
+		{
+			if (!id)
+			{
+				add_crls(this, NULL, list);
+			}
+			else if (id->get_type(id) == ID_KEY_ID)
+			{
+				add_crls(this, id, list);
+			}
+			else
+			{
+				add_crls_by_issuer(this, id, list);
+			}
+		}
+		unlock_index(this);
+	}
+	this->mutex->unlock(this->mutex);
+	return enumerator_create_cleaner(list->create_enumerator(list),
+									 (void*)destroy_certs, list);
+}
+
+METHOD(revocation_cache_t, get_ocsp, certificate_t*,
+	private_revocation_cache_t *this, chunk_t keyid, chunk_t serial)
+{
+	certificate_t *cert = NULL;
+	char buf[MAX_KEY];
+	record_t record;
+	entry_t *entry, lookup;
+
+	if (keyid.len != sizeof(record.keyid) || serial.len > MAX_SERIAL)
+	{
+		return NULL;
+	}
+	memset(&record, 0, sizeof(record));
+	record.type = RECORD_OCSP;
+	memcpy(record.keyid, keyid.ptr, keyid.len);
+	memcpy(record.serial, serial.ptr, serial.len);
+	record.serial_len = serial.len;
+	lookup.key = build_key(&record, buf);
+
+	this->mutex->lock(this->mutex);
+	if (lock_index(this, FALSE))
+	{
+		if (sync_index(this))
+		{
+			entry = this->entries->get(this->entries, &lookup);
+			if (entry && is_valid(this, entry))
+			{
+				cert = get_cert(this, entry);
+				if (cert)
+				{
+					cert = cert->get_ref(cert);
+				}
+			}
+		}
+		unlock_index(this);
+	}
+	this->mutex->unlock(this->mutex);
+	return cert;
+}
+
+METHOD(revocation_cache_t, destroy, void,
+	private_revocation_cache_t *this)
+{
+	flush_entries(this);
+	this->entries->destroy(this->entries);
+	if (this->header)
+	{
+		munmap(this->header, sizeof(header_t) + this->size * sizeof(record_t));
+	}
+	if (this->fd != -1)
+	{
+		close(this->fd);
+	}
+	this->mutex->destroy(this->mutex);
+	free(this->dir);
+	free(this);
+}
+
+/**
+ * See header
+ */
+revocation_cache_t *revocation_cache_create(char *dir)
+{
+	private_revocation_cache_t *this;
+
+	INIT(this,
+		.public = {
+			.set = {
+				.create_private_enumerator = (void*)return_null,
+				.create_cert_enumerator = _create_cert_enumerator,
+				.create_shared_enumerator = (void*)return_null,
+				.create_cdp_enumerator = (void*)return_null,
+				.cache_cert = _cache_cert,
+			},
+			.get_ocsp = _get_ocsp,
+			.destroy = _destroy,
+		},
+		.dir = strdup(dir),
+		.fd = -1,
+		.entries = hashtable_create((hashtable_hash_t)entry_hash,
+									(hashtable_equals_t)entry_equals, 32),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	if (mkdir(dir, S_IRWXU) != 0 && errno != EEXIST)
+	{
+		DBG1(DBG_CFG, "creating revocation cache directory '%s' failed: %s",
+			 dir, strerror(errno));
+		destroy(this);
+		return NULL;
+	}
+	if (!open_index(this))
+	{
+		destroy(this);
+		return NULL;
+	}
+	DBG1(DBG_CFG, "loaded %u CRL and OCSP cache entries from '%s'",
+		 this->entries->get_count(this->entries), dir);
+
+	return &this->public;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup revocation_cache revocation_cache
+ * @{ @ingroup revocation
+ */
+
+#ifndef REVOCATION_CACHE_H_
+#define REVOCATION_CACHE_H_
+
+#include <credentials/credential_set.h>
+
+typedef struct revocation_cache_t revocation_cache_t;
+
+/**
+ * Persistent cache for CRLs and OCSP responses.
+ *
+ * CRLs and OCSP responses passed to cache_cert() get written to a
+ * directory, one file per CRL issuer and per OCSP status. A memory mapped
+ * index stores the issuer, serial number, status and validity of each file,
+ * which makes the cache available right after startup. Files get parsed
+ * when first looked up. Expired records and their files get removed when
+ * opening the index and before it grows. The index file is locked with
+ * flock(), so processes sharing the directory see each other's records.
+ *
+ * CRLs are provided by the credential set. Cached OCSP responses are looked
+ * up using get_ocsp(), as the credential set interface does not allow
+ * looking them up by issuer and serial number.
+ */
+struct revocation_cache_t {
+
+	/**
+	 * Implements credential_set_t interface.
+	 */
+	credential_set_t set;
+
+	/**
+	 * Get a cached OCSP response for a certificate.
+	 *
+	 * @param keyid		SHA1 hash over the public key of the issuer
+	 * @param serial	serial number of the certificate
+	 * @return			OCSP response, NULL if none valid cached
+	 */
+	certificate_t* (*get_ocsp)(revocation_cache_t *this, chunk_t keyid,
+							   chunk_t serial);
+
+	/**
+	 * Destroy a revocation_cache_t.
+	 */
+	void (*destroy)(revocation_cache_t *this);
+};
+
+/**
+ * Create a revocation_cache instance.
+ *
+ * @param dir		directory to store the cache in, gets created if missing
+ * @return			cache, NULL if the directory or index is not usable
+ */
+revocation_cache_t *revocation_cache_create(char *dir);
+
+#endif /** REVOCATION_CACHE_H_ @}*/
@@ -0,0 +1,556 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "revocation_fetcher.h"
+
+#include <debug.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <utils/linked_list.h>
+#include <utils/hashtable.h>
+#include <credentials/certificates/x509.h>
+
+/** default number of fetcher threads */
+#define DEFAULT_THREADS 4
+
+/** default time in seconds callers wait for a fetch */
+#define DEFAULT_TIMEOUT 10
+
+/** minimum interval in seconds between fetches started by a refresh */
+#define REFRESH_INTERVAL 60
+
+/** interval in seconds to purge expired results */
+#define PURGE_INTERVAL 60
+
+typedef struct private_revocation_fetcher_t private_revocation_fetcher_t;
+
+/**
+ * A CRL or OCSP status to fetch, including the result of the last fetch
+ */
+typedef struct {
+
+	/**
+	 * CERT_X509_CRL or CERT_X509_OCSP_RESPONSE
+	 */
+	certificate_type_t type;
+
+	/**
+	 * URL to fetch from
+	 */
+	char *url;
+
+	/**
+	 * Certificate to request the OCSP status of
+	 */
+	certificate_t *subject;
+
+	/**
+	 * Issuer of subject
+	 */
+	certificate_t *issuer;
+
+	/**
+	 * Hash of the above
+	 */
+	u_int hash;
+
+	/**
+	 * Result of the last successful fetch, if any
+	 */
+	certificate_t *cert;
+
+	/**
+	 * TRUE if queued or being fetched
+	 */
+	bool fetching;
+
+	/**
+	 * Number of completed fetches, lets callers detect completion
+	 */
+	u_int fetches;
+
+	/**
+	 * Monotonic time of the last completed fetch
+	 */
+	time_t fetched;
+
+	/**
+	 * Number of callers waiting for a fetch to complete
+	 */
+	u_int waiting;
+
+} entry_t;
+
+/**
+ * Private data of an revocation_fetcher_t object.
+ */
+struct private_revocation_fetcher_t {
+
+	/**
+	 * Public revocation_fetcher_t interface.
+	 */
+	revocation_fetcher_t public;
+
+	/**
+	 * Lock for all fields below
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Signals fetcher threads that entries got queued
+	 */
+	condvar_t *queued;
+
+	/**
+	 * Signals waiting callers that fetches completed
+	 */
+	condvar_t *done;
+
+	/**
+	 * Known CRLs and OCSP statuses, entry_t => entry_t
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * Entries to fetch, as entry_t
+	 */
+	linked_list_t *queue;
+
+	/**
+	 * Fetcher threads
+	 */
+	thread_t **threads;
+
+	/**
+	 * Number of fetcher threads
+	 */
+	int count;
+
+	/**
+	 * Time in ms callers wait for a fetch
+	 */
+	u_int timeout;
+
+	/**
+	 * Monotonic time expired results were last purged
+	 */
+	time_t purged;
+
+	/**
+	 * Fetcher threads should terminate
+	 */
+	bool terminate;
+};
+
+/**
+ * Hashtable hash function for entries
+ */
+static u_int entry_hash(entry_t *entry)
+{
+	return entry->hash;
+}
+
+/**
+ * Hashtable equals function for entries
+ */
+static bool entry_equals(entry_t *a, entry_t *b)
+{
+	if (a->type != b->type || !streq(a->url, b->url))
+	{
+		return FALSE;
+	}
+	if (a->type == CERT_X509_OCSP_RESPONSE)
+	{
+		return a->subject->equals(a->subject, b->subject) &&
+			   a->issuer->equals(a->issuer, b->issuer);
+	}
+	return TRUE;
+}
+
+/**
+ * Initialize an entry to look up a CRL or OCSP status
+ */
+static void entry_init(entry_t *entry, certificate_type_t type, char *url,
+					   certificate_t *subject, certificate_t *issuer)
+{
+	identification_t *id;
+
+	*entry = (entry_t){
+		.type = type,
+		.url = url,
+		.subject = subject,
+		.issuer = issuer,
+		.hash = chunk_hash(chunk_create(url, strlen(url))),
+	};
+	if (type == CERT_X509_OCSP_RESPONSE)
+	{
+		entry->hash = chunk_hash_inc(((x509_t*)subject)->get_serial(
+											(x509_t*)subject), entry->hash);
+		id = issuer->get_subject(issuer);
+		entry->hash = id->hash(id, entry->hash);
+	}
+}
+
+/**
+ * Create a persistent entry from an entry used for lookups
+ */
+static entry_t *entry_create(entry_t *key)
+{
+	entry_t *entry;
+
+	INIT(entry,
+		.type = key->type,
+		.url = strdup(key->url),
+		.hash = key->hash,
+	);
+	if (key->type == CERT_X509_OCSP_RESPONSE)
+	{
+		entry->subject = key->subject->get_ref(key->subject);
+		entry->issuer = key->issuer->get_ref(key->issuer);
+	}
+	return entry;
+}
+
+/**
+ * Destroy an entry
+ */
+static void entry_destroy(entry_t *entry)
+{
+	DESTROY_IF(entry->subject);
+	DESTROY_IF(entry->issuer);
+	DESTROY_IF(entry->cert);
+	free(entry->url);
+	free(entry);
+}
+
+/**
+ * Fetch a CRL
+ */
+static certificate_t *fetch_crl(entry_t *entry)
+{
+	certificate_t *crl;
+	chunk_t chunk;
+
+	if (lib->fetcher->fetch(lib->fetcher, entry->url, &chunk,
+							FETCH_END) != SUCCESS)
+	{
+		DBG1(DBG_CFG, "crl fetching from '%s' failed", entry->url);
+		return NULL;
+	}
+	crl = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509_CRL,
+							 BUILD_BLOB_ASN1_DER, chunk, BUILD_END);
+	chunk_free(&chunk);
+	if (!crl)
+	{
+		DBG1(DBG_CFG, "crl fetched from '%s' successfully but parsing failed",
+			 entry->url);
+		return NULL;
+	}
+	return crl;
+}
+
+/**
+ * Do an OCSP request
+ */
+static certificate_t *fetch_ocsp(entry_t *entry)
+{
+	certificate_t *request, *response;
+	chunk_t send, receive;
+
+	/* TODO: requestor name, signature */
+	request = lib->creds->create(lib->creds,
+						CRED_CERTIFICATE, CERT_X509_OCSP_REQUEST,
+						BUILD_CA_CERT, entry->issuer,
+						BUILD_CERT, entry->subject, BUILD_END);
+	if (!request)
+	{
+		DBG1(DBG_CFG, "generating ocsp request failed");
+		return NULL;
+	}
+
+	if (!request->get_encoding(request, CERT_ASN1_DER, &send))
+	{
+		DBG1(DBG_CFG, "encoding ocsp request failed");
+		request->destroy(request);
+		return NULL;
+	}
+	request->destroy(request);
+
+	if (lib->fetcher->fetch(lib->fetcher, entry->url, &receive,
+							FETCH_REQUEST_DATA, send,
+							FETCH_REQUEST_TYPE, "application/ocsp-request",
+							FETCH_END) != SUCCESS)
+	{
+		DBG1(DBG_CFG, "ocsp request to %s failed", entry->url);
+		chunk_free(&send);
+		return NULL;
+	}
+	chunk_free(&send);
+
+	response = lib->creds->create(lib->creds,
+								  CRED_CERTIFICATE, CERT_X509_OCSP_RESPONSE,
+								  BUILD_BLOB_ASN1_DER, receive, BUILD_END);
+	chunk_free(&receive);
+	if (!response)
+	{
+		DBG1(DBG_CFG, "parsing ocsp response from %s failed", entry->url);
+		return NULL;
+	}
+	return response;
+}
+
+/**
+ * Queue an entry for fetching, requires the lock
+ */
+static void queue_fetch(private_revocation_fetcher_t *this, entry_t *entry)
+{
+	entry->fetching = TRUE;
+	this->queue->insert_last(this->queue, entry);
+	this->queued->signal(this->queued);
+}
+
+/**
+ * Remove entries without a currently valid result, requires the lock
+ */
+static void purge(private_revocation_fetcher_t *this)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		if (!entry->fetching && !entry->waiting &&
+			(!entry->cert ||
+			 !entry->cert->get_validity(entry->cert, NULL, NULL, NULL)))
+		{
+			this->entries->remove_at(this->entries, enumerator);
+			entry_destroy(entry);
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Main function of fetcher threads
+ */
+static void *fetch_entries(private_revocation_fetcher_t *this)
+{
+	certificate_t *cert;
+	entry_t *entry;
+	time_t now;
+
+	this->mutex->lock(this->mutex);
+	while (!this->terminate)
+	{
+		now = time_monotonic(NULL);
+		if (now - this->purged >= PURGE_INTERVAL)
+		{
+			purge(this);
+			this->purged = now;
+		}
+		if (this->queue->remove_first(this->queue, (void**)&entry) != SUCCESS)
+		{
+			this->queued->timed_wait(this->queued, this->mutex,
+									 PURGE_INTERVAL * 1000);
+			continue;
+		}
+		this->mutex->unlock(this->mutex);
+
+		/* queued entries do not get purged, no need to hold the lock */
+		if (entry->type == CERT_X509_CRL)
+		{
+			cert = fetch_crl(entry);
+		}
+		else
+		{
+			cert = fetch_ocsp(entry);
+		}
+
+		this->mutex->lock(this->mutex);
+		if (cert)
+		{	/* keep the previous result if fetching failed */
+			DESTROY_IF(entry->cert);
+			entry->cert = cert;
+		}
+		entry->fetching = FALSE;
+		entry->fetches++;
+		entry->fetched = time_monotonic(NULL);
+		this->done->broadcast(this->done);
+	}
+	this->mutex->unlock(this->mutex);
+	return NULL;
+}
+
+/**
+ * Get the result of an entry, fetching it if necessary
+ */
+static certificate_t *fetch(private_revocation_fetcher_t *this, entry_t *key,
+							bool wait)
+{
+	certificate_t *cert = NULL;
+	entry_t *entry;
+	timeval_t deadline;
+	u_int fetches;
+	bool timeout = FALSE;
+
+	this->mutex->lock(this->mutex);
+	entry = this->entries->get(this->entries, key);
+	if (!entry)
+	{
+		entry = entry_create(key);
+		this->entries->put(this->entries, entry, entry);
+	}
+	if (!wait)
+	{	/* refresh in the background, but not too often */
+		if (!entry->fetching && (!entry->fetches ||
+			time_monotonic(NULL) - entry->fetched >= REFRESH_INTERVAL))
+		{
+			queue_fetch(this, entry);
+		}
+	}
+	else if (!entry->cert ||
+			 !entry->cert->get_validity(entry->cert, NULL, NULL, NULL))
+	{	/* no result from a previous fetch that is still valid */
+		if (!entry->fetching)
+		{
+			queue_fetch(this, entry);
+		}
+		time_monotonic(&deadline);
+		deadline.tv_sec += this->timeout / 1000;
+		deadline.tv_usec += (this->timeout % 1000) * 1000;
+		if (deadline.tv_usec >= 1000000)
+		{
+			deadline.tv_usec -= 1000000;
+			deadline.tv_sec++;
+		}
+		fetches = entry->fetches;
+		entry->waiting++;
+		while (entry->fetches == fetches && !timeout)
+		{
+			timeout = this->done->timed_wait_abs(this->done, this->mutex,
+												 deadline);
+		}
+		entry->waiting--;
+		if (entry->fetches == fetches)
+		{
+			DBG1(DBG_CFG, "fetching from '%s' timed out after %ums, "
+				 "continuing in background", entry->url, this->timeout);
+		}
+	}
+	if (entry->cert)
+	{
+		cert = entry->cert->get_ref(entry->cert);
+	}
+	this->mutex->unlock(this->mutex);
+	return cert;
+}
+
+METHOD(revocation_fetcher_t, fetch_crl_, certificate_t*,
+	private_revocation_fetcher_t *this, char *url, bool wait)
+{
+	entry_t key;
+
+	entry_init(&key, CERT_X509_CRL, url, NULL, NULL);
+	return fetch(this, &key, wait);
+}
+
+METHOD(revocation_fetcher_t, fetch_ocsp_, certificate_t*,
+	private_revocation_fetcher_t *this, char *url, certificate_t *subject,
+	certificate_t *issuer, bool wait)
+{
+	entry_t key;
+
+	entry_init(&key, CERT_X509_OCSP_RESPONSE, url, subject, issuer);
+	return fetch(this, &key, wait);
+}
+
+METHOD(revocation_fetcher_t, destroy, void,
+	private_revocation_fetcher_t *this)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+	int i;
+
+	this->mutex->lock(this->mutex);
+	this->terminate = TRUE;
+	this->queued->broadcast(this->queued);
+	this->mutex->unlock(this->mutex);
+	for (i = 0; i < this->count; i++)
+	{
+		this->threads[i]->join(this->threads[i]);
+	}
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		entry_destroy(entry);
+	}
+	enumerator->destroy(enumerator);
+	this->entries->destroy(this->entries);
+	this->queue->destroy(this->queue);
+	this->queued->destroy(this->queued);
+	this->done->destroy(this->done);
+	this->mutex->destroy(this->mutex);
+	free(this->threads);
+	free(this);
+}
+
+/**
+ * See header
+ */
+revocation_fetcher_t *revocation_fetcher_create()
+{
+	private_revocation_fetcher_t *this;
+	int i, count;
+
+	INIT(this,
+		.public = {
+			.fetch_crl = _fetch_crl_,
+			.fetch_ocsp = _fetch_ocsp_,
+			.destroy = _destroy,
+		},
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.queued = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.done = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.entries = hashtable_create((hashtable_hash_t)entry_hash,
+									(hashtable_equals_t)entry_equals, 8),
+		.queue = linked_list_create(),
+		.timeout = 1000 * lib->settings->get_time(lib->settings,
+							"libstrongswan.plugins.revocation.timeout",
+							DEFAULT_TIMEOUT),
+		.purged = time_monotonic(NULL),
+	);
+
+	count = max(1, lib->settings->get_int(lib->settings,
+							"libstrongswan.plugins.revocation.threads",
+							DEFAULT_THREADS));
+	this->threads = calloc(count, sizeof(thread_t*));
+	for (i = 0; i < count; i++)
+	{
+		this->threads[i] = thread_create((thread_main_t)fetch_entries, this);
+		if (!this->threads[i])
+		{
+			break;
+		}
+		this->count++;
+	}
+	if (!this->count)
+	{
+		DBG1(DBG_CFG, "creating revocation fetcher threads failed");
+		destroy(this);
+		return NULL;
+	}
+	return &this->public;
+}
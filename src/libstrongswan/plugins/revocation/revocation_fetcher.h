@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup revocation_fetcher revocation_fetcher
+ * @{ @ingroup revocation
+ */
+
+#ifndef REVOCATION_FETCHER_H_
+#define REVOCATION_FETCHER_H_
+
+#include <credentials/certificates/certificate.h>
+
+typedef struct revocation_fetcher_t revocation_fetcher_t;
+
+/**
+ * Asynchronous fetcher for CRLs and OCSP responses.
+ *
+ * Fetches run in threads of the fetcher. Concurrent requests for the same
+ * CRL or OCSP status share a single fetch, and callers wait for it at most
+ * the configured timeout. The fetch continues if that timeout expires, its
+ * result is returned to later requests.
+ */
+struct revocation_fetcher_t {
+
+	/**
+	 * Fetch a CRL.
+	 *
+	 * If wait is FALSE, the call does not block. It returns the result of
+	 * a previous fetch, if any, and starts a new fetch in the background
+	 * if the last one is not too recent. This allows callers to refresh
+	 * CRLs before they expire.
+	 *
+	 * @param url		URL to fetch the CRL from
+	 * @param wait		TRUE to wait for a fetch to complete
+	 * @return			CRL, NULL if not available
+	 */
+	certificate_t* (*fetch_crl)(revocation_fetcher_t *this, char *url,
+								bool wait);
+
+	/**
+	 * Fetch an OCSP response for a certificate.
+	 *
+	 * See fetch_crl() for the semantics of wait.
+	 *
+	 * @param url		URL of the OCSP responder
+	 * @param subject	certificate to request the status of
+	 * @param issuer	issuer of subject
+	 * @param wait		TRUE to wait for a fetch to complete
+	 * @return			OCSP response, NULL if not available
+	 */
+	certificate_t* (*fetch_ocsp)(revocation_fetcher_t *this, char *url,
+								 certificate_t *subject, certificate_t *issuer,
+								 bool wait);
+
+	/**
+	 * Destroy a revocation_fetcher_t, waits for active fetches to complete.
+	 */
+	void (*destroy)(revocation_fetcher_t *this);
+};
+
+/**
+ * Create a revocation_fetcher instance.
+ */
+revocation_fetcher_t *revocation_fetcher_create();
+
+#endif /** REVOCATION_FETCHER_H_ @}*/
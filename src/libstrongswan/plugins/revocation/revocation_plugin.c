@@ -34,6 +34,11 @@ struct private_revocation_plugin_t {
 	 * Validator implementation instance.
 	 */
 	revocation_validator_t *validator;
+
+	/**
+	 * Persistent CRL and OCSP cache, if enabled
+	 */
+	revocation_cache_t *cache;
 };
 
 METHOD(plugin_t, get_name, char*,
@@ -47,6 +52,11 @@ METHOD(plugin_t, destroy, void,
 {
 	lib->credmgr->remove_validator(lib->credmgr, &this->validator->validator);
 	this->validator->destroy(this->validator);
+	if (this->cache)
+	{
+		lib->credmgr->remove_set(lib->credmgr, &this->cache->set);
+		this->cache->destroy(this->cache);
+	}
 	free(this);
 }
 
@@ -56,6 +66,15 @@ METHOD(plugin_t, destroy, void,
 plugin_t *revocation_plugin_create()
 {
 	private_revocation_plugin_t *this;
+	revocation_cache_t *cache = NULL;
+	char *dir;
+
+	dir = lib->settings->get_str(lib->settings,
+							"libstrongswan.plugins.revocation.cache_dir", NULL);
+	if (dir)
+	{
+		cache = revocation_cache_create(dir);
+	}
 
 	INIT(this,
 		.public = {
@@ -65,9 +84,20 @@ plugin_t *revocation_plugin_create()
 				.destroy = _destroy,
 			},
 		},
-		.validator = revocation_validator_create(),
+		.validator = revocation_validator_create(cache),
+		.cache = cache,
 	);
+	if (!this->validator)
+	{
+		DESTROY_IF(this->cache);
+		free(this);
+		return NULL;
+	}
 	lib->credmgr->add_validator(lib->credmgr, &this->validator->validator);
+	if (this->cache)
+	{
+		lib->credmgr->add_set(lib->credmgr, &this->cache->set);
+	}
 
 	return &this->public.plugin;
 }
@@ -16,6 +16,10 @@
  */
 
 #include "revocation_validator.h"
+#include "revocation_fetcher.h"
+#include "revocation_cache.h"
+
+#include <time.h>
 
 #include <debug.h>
 #include <credentials/certificates/x509.h>
@@ -36,58 +40,44 @@ struct private_revocation_validator_t {
 	 * Public revocation_validator_t interface.
 	 */
 	revocation_validator_t public;
+
+	/**
+	 * Fetcher for CRLs and OCSP responses
+	 */
+	revocation_fetcher_t *fetcher;
+
+	/**
+	 * Persistent cache for CRLs and OCSP responses, if any
+	 */
+	revocation_cache_t *cache;
+
+	/**
+	 * Time in seconds before expiration to refresh CRLs and OCSP responses
+	 */
+	u_int32_t refresh;
 };
 
 /**
  * Do an OCSP request
  */
-static certificate_t *fetch_ocsp(char *url, certificate_t *subject,
+static certificate_t *fetch_ocsp(private_revocation_validator_t *this,
+								 char *url, certificate_t *subject,
 								 certificate_t *issuer)
 {
-	certificate_t *request, *response;
-	chunk_t send, receive;
-
-	/* TODO: requestor name, signature */
-	request = lib->creds->create(lib->creds,
-						CRED_CERTIFICATE, CERT_X509_OCSP_REQUEST,
-						BUILD_CA_CERT, issuer,
-						BUILD_CERT, subject, BUILD_END);
-	if (!request)
-	{
-		DBG1(DBG_CFG, "generating ocsp request failed");
-		return NULL;
-	}
-
-	if (!request->get_encoding(request, CERT_ASN1_DER, &send))
-	{
-		DBG1(DBG_CFG, "encoding ocsp request failed");
-		request->destroy(request);
-		return NULL;
-	}
-	request->destroy(request);
-
 	DBG1(DBG_CFG, "  requesting ocsp status from '%s' ...", url);
-	if (lib->fetcher->fetch(lib->fetcher, url, &receive,
-							FETCH_REQUEST_DATA, send,
-							FETCH_REQUEST_TYPE, "application/ocsp-request",
-							FETCH_END) != SUCCESS)
-	{
-		DBG1(DBG_CFG, "ocsp request to %s failed", url);
-		chunk_free(&send);
-		return NULL;
-	}
-	chunk_free(&send);
+	return this->fetcher->fetch_ocsp(this->fetcher, url, subject, issuer, TRUE);
+}
 
-	response = lib->creds->create(lib->creds,
-								  CRED_CERTIFICATE, CERT_X509_OCSP_RESPONSE,
-								  BUILD_BLOB_ASN1_DER, receive, BUILD_END);
-	chunk_free(&receive);
-	if (!response)
-	{
-		DBG1(DBG_CFG, "parsing ocsp response failed");
-		return NULL;
-	}
-	return response;
+/**
+ * Check if a CRL or OCSP response expires soon and should get refreshed
+ */
+static bool expires_soon(private_revocation_validator_t *this,
+						 certificate_t *cert)
+{
+	time_t valid_until;
+
+	return cert->get_validity(cert, NULL, NULL, &valid_until) &&
+		   valid_until < time(NULL) + this->refresh;
 }
 
 /**
@@ -206,10 +196,60 @@ static certificate_t *get_better_ocsp(certificate_t *cand, certificate_t *best,
 	return best;
 }
 
+/**
+ * Refresh an OCSP response about to expire in the background, and use the
+ * result of an earlier refresh if there is one
+ */
+static certificate_t *refresh_ocsp(private_revocation_validator_t *this,
+						certificate_t *best, x509_t *subject, x509_t *issuer,
+						identification_t *keyid, cert_validation_t *valid)
+{
+	cert_validation_t refreshed = VALIDATION_SKIPPED;
+	certificate_t *current = NULL;
+	enumerator_t *enumerator;
+	bool found = FALSE;
+	char *uri;
+
+	if (keyid)
+	{
+		enumerator = lib->credmgr->create_cdp_enumerator(lib->credmgr,
+											CERT_X509_OCSP_RESPONSE, keyid);
+		found = enumerator->enumerate(enumerator, &uri);
+		if (!found)
+		{
+			enumerator->destroy(enumerator);
+		}
+	}
+	if (!found)
+	{
+		enumerator = subject->create_ocsp_uri_enumerator(subject);
+		found = enumerator->enumerate(enumerator, &uri);
+	}
+	if (found)
+	{
+		current = this->fetcher->fetch_ocsp(this->fetcher, uri,
+							&subject->interface, &issuer->interface, FALSE);
+	}
+	enumerator->destroy(enumerator);
+
+	if (current)
+	{	/* caches a newer response, but only a revocation changes the
+		 * result of this validation */
+		best = get_better_ocsp(current, best, subject, issuer, &refreshed,
+							   NULL, TRUE);
+		if (refreshed == VALIDATION_REVOKED)
+		{
+			*valid = refreshed;
+		}
+	}
+	return best;
+}
+
 /**
  * validate a x509 certificate using OCSP
  */
-static cert_validation_t check_ocsp(x509_t *subject, x509_t *issuer,
+static cert_validation_t check_ocsp(private_revocation_validator_t *this,
+									x509_t *subject, x509_t *issuer,
 									auth_cfg_t *auth)
 {
 	enumerator_t *enumerator;
@@ -243,6 +283,27 @@ static cert_validation_t check_ocsp(x509_t *subject, x509_t *issuer,
 	{
 		keyid = identification_create_from_encoding(ID_KEY_ID, chunk);
 	}
+	/** lookup persistently cached OCSP responses */
+	if (this->cache && keyid && valid != VALIDATION_GOOD &&
+		valid != VALIDATION_REVOKED)
+	{
+		current = this->cache->get_ocsp(this->cache,
+							keyid->get_encoding(keyid), subject->get_serial(subject));
+		if (current)
+		{
+			best = get_better_ocsp(current, best, subject, issuer,
+								   &valid, auth, FALSE);
+			if (best && valid != VALIDATION_STALE)
+			{
+				DBG1(DBG_CFG, "  using cached ocsp response");
+			}
+		}
+	}
+	/** refresh a cached OCSP response before it expires */
+	if (best && valid == VALIDATION_GOOD && expires_soon(this, best))
+	{
+		best = refresh_ocsp(this, best, subject, issuer, keyid, &valid);
+	}
 	/** fetch from configured OCSP responder URLs */
 	if (keyid && valid != VALIDATION_GOOD && valid != VALIDATION_REVOKED)
 	{
@@ -250,7 +311,8 @@ static cert_validation_t check_ocsp(x509_t *subject, x509_t *issuer,
 											CERT_X509_OCSP_RESPONSE, keyid);
 		while (enumerator->enumerate(enumerator, &uri))
 		{
-			current = fetch_ocsp(uri, &subject->interface, &issuer->interface);
+			current = fetch_ocsp(this, uri, &subject->interface,
+								 &issuer->interface);
 			if (current)
 			{
 				best = get_better_ocsp(current, best, subject, issuer,
@@ -272,7 +334,8 @@ static cert_validation_t check_ocsp(x509_t *subject, x509_t *issuer,
 		enumerator = subject->create_ocsp_uri_enumerator(subject);
 		while (enumerator->enumerate(enumerator, &uri))
 		{
-			current = fetch_ocsp(uri, &subject->interface, &issuer->interface);
+			current = fetch_ocsp(this, uri, &subject->interface,
+								 &issuer->interface);
 			if (current)
 			{
 				best = get_better_ocsp(current, best, subject, issuer,
@@ -305,26 +368,11 @@ static cert_validation_t check_ocsp(x509_t *subject, x509_t *issuer,
 /**
  * fetch a CRL from an URL
  */
-static certificate_t* fetch_crl(char *url)
+static certificate_t* fetch_crl(private_revocation_validator_t *this,
+								char *url)
 {
-	certificate_t *crl;
-	chunk_t chunk;
-
 	DBG1(DBG_CFG, "  fetching crl from '%s' ...", url);
-	if (lib->fetcher->fetch(lib->fetcher, url, &chunk, FETCH_END) != SUCCESS)
-	{
-		DBG1(DBG_CFG, "crl fetching failed");
-		return NULL;
-	}
-	crl = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509_CRL,
-							 BUILD_BLOB_ASN1_DER, chunk, BUILD_END);
-	chunk_free(&chunk);
-	if (!crl)
-	{
-		DBG1(DBG_CFG, "crl fetched successfully but parsing failed");
-		return NULL;
-	}
-	return crl;
+	return this->fetcher->fetch_crl(this->fetcher, url, TRUE);
 }
 
 /**
@@ -365,7 +413,6 @@ static certificate_t *get_better_crl(certificate_t *cand, certificate_t *best,
 					x509_t *subject, cert_validation_t *valid, auth_cfg_t *auth,
 					bool cache, crl_t *base)
 {
-	enumerator_t *enumerator;
 	time_t revocation, valid_until;
 	crl_reason_t reason;
 	chunk_t serial;
@@ -397,28 +444,23 @@ static certificate_t *get_better_crl(certificate_t *cand, certificate_t *best,
 		return best;
 	}
 
-	enumerator = crl->create_enumerator(crl);
-	while (enumerator->enumerate(enumerator, &serial, &revocation, &reason))
+	if (crl->is_revoked(crl, subject->get_serial(subject), &revocation,
+						&reason))
 	{
-		if (chunk_equals(serial, subject->get_serial(subject)))
+		DBG1(DBG_CFG, "certificate was revoked on %T, reason: %N",
+			 &revocation, TRUE, crl_reason_names, reason);
+		if (reason != CRL_REASON_CERTIFICATE_HOLD)
 		{
-			DBG1(DBG_CFG, "certificate was revoked on %T, reason: %N",
-				 &revocation, TRUE, crl_reason_names, reason);
-			if (reason != CRL_REASON_CERTIFICATE_HOLD)
-			{
-				*valid = VALIDATION_REVOKED;
-			}
-			else
-			{
-				/* if the cert is on hold, a newer CRL might not contain it */
-				*valid = VALIDATION_ON_HOLD;
-			}
-			enumerator->destroy(enumerator);
-			DESTROY_IF(best);
-			return cand;
+			*valid = VALIDATION_REVOKED;
 		}
+		else
+		{
+			/* if the cert is on hold, a newer CRL might not contain it */
+			*valid = VALIDATION_ON_HOLD;
+		}
+		DESTROY_IF(best);
+		return cand;
 	}
-	enumerator->destroy(enumerator);
 
 	/* select the better of the two CRLs */
 	if (best == NULL || crl_is_newer(crl, (crl_t*)best))
@@ -451,7 +493,8 @@ static certificate_t *get_better_crl(certificate_t *cand, certificate_t *best,
 /**
  * Find or fetch a certificate for a given crlIssuer
  */
-static cert_validation_t find_crl(x509_t *subject, identification_t *issuer,
+static cert_validation_t find_crl(private_revocation_validator_t *this,
+								  x509_t *subject, identification_t *issuer,
 								  auth_cfg_t *auth, crl_t *base,
 								  certificate_t **best, bool *uri_found)
 {
@@ -484,7 +527,7 @@ static cert_validation_t find_crl(x509_t *subject, identification_t *issuer,
 		while (enumerator->enumerate(enumerator, &uri))
 		{
 			*uri_found = TRUE;
-			current = fetch_crl(uri);
+			current = fetch_crl(this, uri);
 			if (current)
 			{
 				if (!current->has_issuer(current, issuer))
@@ -510,8 +553,9 @@ static cert_validation_t find_crl(x509_t *subject, identification_t *issuer,
 /**
  * Look for a delta CRL for a given base CRL
  */
-static cert_validation_t check_delta_crl(x509_t *subject, x509_t *issuer,
-					crl_t *base, cert_validation_t base_valid, auth_cfg_t *auth)
+static cert_validation_t check_delta_crl(private_revocation_validator_t *this,
+					x509_t *subject, x509_t *issuer, crl_t *base,
+					cert_validation_t base_valid, auth_cfg_t *auth)
 {
 	cert_validation_t valid = VALIDATION_SKIPPED;
 	certificate_t *best = NULL, *current;
@@ -526,7 +570,7 @@ static cert_validation_t check_delta_crl(x509_t *subject, x509_t *issuer,
 	if (chunk.len)
 	{
 		id = identification_create_from_encoding(ID_KEY_ID, chunk);
-		valid = find_crl(subject, id, auth, base, &best, &uri);
+		valid = find_crl(this, subject, id, auth, base, &best, &uri);
 		id->destroy(id);
 	}
 
@@ -537,7 +581,8 @@ static cert_validation_t check_delta_crl(x509_t *subject, x509_t *issuer,
 	{
 		if (cdp->issuer)
 		{
-			valid = find_crl(subject, cdp->issuer, auth, base, &best, &uri);
+			valid = find_crl(this, subject, cdp->issuer, auth, base,
+							 &best, &uri);
 		}
 	}
 	enumerator->destroy(enumerator);
@@ -547,7 +592,7 @@ static cert_validation_t check_delta_crl(x509_t *subject, x509_t *issuer,
 	while (valid != VALIDATION_GOOD && valid != VALIDATION_REVOKED &&
 		   enumerator->enumerate(enumerator, &cdp))
 	{
-		current = fetch_crl(cdp->uri);
+		current = fetch_crl(this, cdp->uri);
 		if (current)
 		{
 			if (cdp->issuer && !current->has_issuer(current, cdp->issuer))
@@ -577,10 +622,71 @@ static cert_validation_t check_delta_crl(x509_t *subject, x509_t *issuer,
 }
 
 
+/**
+ * Refresh a CRL about to expire in the background, and use the result of an
+ * earlier refresh if there is one
+ */
+static certificate_t *refresh_crl(private_revocation_validator_t *this,
+						certificate_t *best, x509_t *subject, x509_t *issuer,
+						cert_validation_t *valid)
+{
+	cert_validation_t refreshed = VALIDATION_SKIPPED;
+	certificate_t *current = NULL;
+	enumerator_t *enumerator;
+	identification_t *id;
+	x509_cdp_t *cdp;
+	bool found = FALSE;
+	chunk_t chunk;
+	char *uri;
+
+	chunk = issuer->get_subjectKeyIdentifier(issuer);
+	if (chunk.len)
+	{
+		id = identification_create_from_encoding(ID_KEY_ID, chunk);
+		enumerator = lib->credmgr->create_cdp_enumerator(lib->credmgr,
+														 CERT_X509_CRL, id);
+		found = enumerator->enumerate(enumerator, &uri);
+		if (found)
+		{
+			current = this->fetcher->fetch_crl(this->fetcher, uri, FALSE);
+		}
+		enumerator->destroy(enumerator);
+		id->destroy(id);
+	}
+	if (!found)
+	{
+		enumerator = subject->create_crl_uri_enumerator(subject);
+		if (enumerator->enumerate(enumerator, &cdp))
+		{
+			current = this->fetcher->fetch_crl(this->fetcher, cdp->uri, FALSE);
+		}
+		enumerator->destroy(enumerator);
+	}
+
+	if (current)
+	{
+		if (!current->has_issuer(current, best->get_issuer(best)))
+		{
+			current->destroy(current);
+			return best;
+		}
+		/* caches a newer CRL, but only a revocation changes the result of
+		 * this validation */
+		best = get_better_crl(current, best, subject, &refreshed, NULL,
+							  TRUE, NULL);
+		if (refreshed == VALIDATION_REVOKED || refreshed == VALIDATION_ON_HOLD)
+		{
+			*valid = refreshed;
+		}
+	}
+	return best;
+}
+
 /**
  * validate a x509 certificate using CRL
  */
-static cert_validation_t check_crl(x509_t *subject, x509_t *issuer,
+static cert_validation_t check_crl(private_revocation_validator_t *this,
+								   x509_t *subject, x509_t *issuer,
 								   auth_cfg_t *auth)
 {
 	cert_validation_t valid = VALIDATION_SKIPPED;
@@ -597,7 +703,7 @@ static cert_validation_t check_crl(x509_t *subject, x509_t *issuer,
 	if (chunk.len)
 	{
 		id = identification_create_from_encoding(ID_KEY_ID, chunk);
-		valid = find_crl(subject, id, auth, NULL, &best, &uri_found);
+		valid = find_crl(this, subject, id, auth, NULL, &best, &uri_found);
 		id->destroy(id);
 	}
 
@@ -608,7 +714,7 @@ static cert_validation_t check_crl(x509_t *subject, x509_t *issuer,
 	{
 		if (cdp->issuer)
 		{
-			valid = find_crl(subject, cdp->issuer, auth, NULL,
+			valid = find_crl(this, subject, cdp->issuer, auth, NULL,
 							 &best, &uri_found);
 		}
 	}
@@ -621,7 +727,7 @@ static cert_validation_t check_crl(x509_t *subject, x509_t *issuer,
 		while (enumerator->enumerate(enumerator, &cdp))
 		{
 			uri_found = TRUE;
-			current = fetch_crl(cdp->uri);
+			current = fetch_crl(this, cdp->uri);
 			if (current)
 			{
 				if (cdp->issuer && !current->has_issuer(current, cdp->issuer))
@@ -643,10 +749,17 @@ static cert_validation_t check_crl(x509_t *subject, x509_t *issuer,
 		enumerator->destroy(enumerator);
 	}
 
+	/* refresh a cached CRL before it expires */
+	if (best && valid == VALIDATION_GOOD && expires_soon(this, best))
+	{
+		best = refresh_crl(this, best, subject, issuer, &valid);
+	}
+
 	/* look for delta CRLs */
 	if (best && (valid == VALIDATION_GOOD || valid == VALIDATION_STALE))
 	{
-		valid = check_delta_crl(subject, issuer, (crl_t*)best, valid, auth);
+		valid = check_delta_crl(this, subject, issuer, (crl_t*)best,
+								valid, auth);
 	}
 
 	/* an uri was found, but no result. switch validation state to failed */
@@ -682,7 +795,7 @@ METHOD(cert_validator_t, validate, bool,
 	{
 		DBG1(DBG_CFG, "checking certificate status of \"%Y\"",
 					   subject->get_subject(subject));
-		switch (check_ocsp((x509_t*)subject, (x509_t*)issuer,
+		switch (check_ocsp(this, (x509_t*)subject, (x509_t*)issuer,
 						   pathlen ? NULL : auth))
 		{
 			case VALIDATION_GOOD:
@@ -702,7 +815,7 @@ METHOD(cert_validator_t, validate, bool,
 				DBG1(DBG_CFG, "ocsp check failed, fallback to crl");
 				break;
 		}
-		switch (check_crl((x509_t*)subject, (x509_t*)issuer,
+		switch (check_crl(this, (x509_t*)subject, (x509_t*)issuer,
 						  pathlen ? NULL : auth))
 		{
 			case VALIDATION_GOOD:
@@ -727,13 +840,14 @@ METHOD(cert_validator_t, validate, bool,
 METHOD(revocation_validator_t, destroy, void,
 	private_revocation_validator_t *this)
 {
+	this->fetcher->destroy(this->fetcher);
 	free(this);
 }
 
 /**
  * See header
  */
-revocation_validator_t *revocation_validator_create()
+revocation_validator_t *revocation_validator_create(revocation_cache_t *cache)
 {
 	private_revocation_validator_t *this;
 
@@ -742,7 +856,15 @@ revocation_validator_t *revocation_validator_create()
 			.validator.validate = _validate,
 			.destroy = _destroy,
 		},
+		.fetcher = revocation_fetcher_create(),
+		.cache = cache,
+		.refresh = lib->settings->get_time(lib->settings,
+						"libstrongswan.plugins.revocation.refresh", 600),
 	);
-
+	if (!this->fetcher)
+	{
+		free(this);
+		return NULL;
+	}
 	return &this->public;
 }
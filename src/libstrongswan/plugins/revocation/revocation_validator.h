@@ -21,6 +21,8 @@
 #ifndef REVOCATION_VALIDATOR_H_
 #define REVOCATION_VALIDATOR_H_
 
+#include "revocation_cache.h"
+
 #include <credentials/cert_validator.h>
 
 typedef struct revocation_validator_t revocation_validator_t;
@@ -43,7 +45,9 @@ struct revocation_validator_t {
 
 /**
  * Create a revocation_validator instance.
+ *
+ * @param cache		persistent cache for OCSP responses, NULL for none
  */
-revocation_validator_t *revocation_validator_create();
+revocation_validator_t *revocation_validator_create(revocation_cache_t *cache);
 
 #endif /** REVOCATION_VALIDATOR_H_ @}*/
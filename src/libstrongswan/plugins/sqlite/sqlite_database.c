@@ -19,7 +19,10 @@
 #include <unistd.h>
 #include <library.h>
 #include <debug.h>
+#include <threading/thread.h>
 #include <threading/mutex.h>
+#include <utils/linked_list.h>
+#include <utils/hashtable.h>
 
 typedef struct private_sqlite_database_t private_sqlite_database_t;
 
@@ -33,91 +36,385 @@ struct private_sqlite_database_t {
 	 */
 	sqlite_database_t public;
 
+	/**
+	 * database file
+	 */
+	char *file;
+
+	/**
+	 * connection pool, contains conn_t
+	 */
+	linked_list_t *pool;
+
+	/**
+	 * mutex to lock pool
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * maximum number of connections in pool
+	 */
+	u_int pool_size;
+
+	/**
+	 * maximum number of prepared statements cached per connection
+	 */
+	u_int cache_size;
+};
+
+typedef struct conn_t conn_t;
+
+/**
+ * connection pool entry
+ */
+struct conn_t {
+
 	/**
 	 * sqlite database connection
 	 */
 	sqlite3 *db;
 
 	/**
-	 * mutex used to lock execute()
+	 * thread that acquired the connection
+	 */
+	u_int thread;
+
+	/**
+	 * number of users of this connection
+	 */
+	u_int refs;
+
+	/**
+	 * TRUE if a transaction is open on this connection
+	 */
+	bool transaction;
+
+	/**
+	 * cached prepared statements, char* => stmt_t
+	 */
+	hashtable_t *stmts;
+
+	/**
+	 * mutex used to lock execute() and the statement cache
 	 */
 	mutex_t *mutex;
 };
 
+typedef struct stmt_t stmt_t;
+
+/**
+ * prepared statement
+ */
+struct stmt_t {
+
+	/**
+	 * SQL string of a cached statement, NULL if not cached
+	 */
+	char *sql;
+
+	/**
+	 * sqlite statement
+	 */
+	sqlite3_stmt *stmt;
+
+	/**
+	 * statement in use?
+	 */
+	bool in_use;
+};
+
 /**
- * Create and run a sqlite stmt using a sql string and args
+ * Hash an SQL string
  */
-static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
-						 va_list *args)
+static u_int stmt_hash(char *sql)
 {
-	sqlite3_stmt *stmt = NULL;
-	int params, i, res = SQLITE_OK;
+	return chunk_hash(chunk_create(sql, strlen(sql)));
+}
+
+/**
+ * Compare two SQL strings
+ */
+static bool stmt_equals(char *a, char *b)
+{
+	return streq(a, b);
+}
+
+/**
+ * Destroy a prepared statement
+ */
+static void stmt_destroy(stmt_t *this)
+{
+	sqlite3_finalize(this->stmt);
+	free(this->sql);
+	free(this);
+}
+
+/**
+ * Busy handler implementation
+ */
+static int busy_handler(private_sqlite_database_t *this, int count)
+{
+	/* add a backoff time, quadratically increasing with every try */
+	usleep(count * count * 1000);
+	/* always retry */
+	return 1;
+}
+
+/**
+ * Destroy a sqlite connection
+ */
+static void conn_destroy(conn_t *this)
+{
+	enumerator_t *enumerator;
+	stmt_t *stmt;
+	char *sql;
+
+	enumerator = this->stmts->create_enumerator(this->stmts);
+	while (enumerator->enumerate(enumerator, &sql, &stmt))
+	{
+		stmt_destroy(stmt);
+	}
+	enumerator->destroy(enumerator);
+	this->stmts->destroy(this->stmts);
+	sqlite3_close(this->db);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/**
+ * Open a new sqlite connection
+ */
+static conn_t *conn_create(private_sqlite_database_t *this)
+{
+	conn_t *conn;
+
+	INIT(conn,
+		.stmts = hashtable_create((hashtable_hash_t)stmt_hash,
+								  (hashtable_equals_t)stmt_equals, 8),
+		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+	);
+
+	if (sqlite3_open(this->file, &conn->db) != SQLITE_OK)
+	{
+		DBG1(DBG_LIB, "opening SQLite database '%s' failed: %s",
+			 this->file, sqlite3_errmsg(conn->db));
+		conn_destroy(conn);
+		return NULL;
+	}
+	sqlite3_busy_handler(conn->db, (void*)busy_handler, this);
+	return conn;
+}
+
+/**
+ * Acquire a connection for the calling thread.
+ *
+ * A thread reuses the connection it currently uses in nested queries or with
+ * an open transaction. Otherwise an idle connection is acquired, a new one
+ * gets opened or, if the pool is exhausted, the least used connection is
+ * shared with other threads.
+ */
+static conn_t *conn_get(private_sqlite_database_t *this)
+{
+	conn_t *current, *own = NULL, *idle = NULL, *shared = NULL, *found;
+	enumerator_t *enumerator;
+	u_int thread;
+
+	thread = thread_current_id();
+
+	this->mutex->lock(this->mutex);
+	enumerator = this->pool->create_enumerator(this->pool);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->thread == thread &&
+			(current->refs || current->transaction))
+		{
+			own = current;
+			break;
+		}
+		if (!idle && !current->refs && !current->transaction)
+		{
+			idle = current;
+		}
+		if (!shared || current->refs < shared->refs)
+		{
+			shared = current;
+		}
+	}
+	enumerator->destroy(enumerator);
 
+	found = own ?: idle;
+	if (!found && this->pool->get_count(this->pool) < this->pool_size)
+	{
+		found = conn_create(this);
+		if (found)
+		{
+			this->pool->insert_last(this->pool, found);
+			DBG2(DBG_LIB, "increased SQLite connection pool size to %d",
+				 this->pool->get_count(this->pool));
+		}
+	}
+	if (found)
+	{
+		found->thread = thread;
+	}
+	else
+	{
+		found = shared;
+	}
+	if (found)
+	{
+		found->refs++;
+	}
+	this->mutex->unlock(this->mutex);
+	return found;
+}
+
+/**
+ * Release a connection acquired with conn_get()
+ */
+static void conn_release(private_sqlite_database_t *this, conn_t *conn)
+{
+	this->mutex->lock(this->mutex);
+	/* keep the connection for this thread until the transaction ends */
+	conn->transaction = !sqlite3_get_autocommit(conn->db);
+	conn->refs--;
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Get a cached prepared statement for the given SQL string, or prepare it
+ */
+static stmt_t *stmt_get(private_sqlite_database_t *this, conn_t *conn,
+						char *sql)
+{
+	stmt_t *stmt;
+	bool cache;
+	int res;
+
+	conn->mutex->lock(conn->mutex);
+	stmt = conn->stmts->get(conn->stmts, sql);
+	if (stmt && !stmt->in_use)
+	{
+		stmt->in_use = TRUE;
+		conn->mutex->unlock(conn->mutex);
+		return stmt;
+	}
+	/* cache it unless the cached statement is used by an active query */
+	cache = !stmt && conn->stmts->get_count(conn->stmts) < this->cache_size;
+
+	INIT(stmt,
+		.in_use = TRUE,
+	);
 #ifdef HAVE_SQLITE3_PREPARE_V2
-	if (sqlite3_prepare_v2(this->db, sql, -1, &stmt, NULL) == SQLITE_OK)
+	res = sqlite3_prepare_v2(conn->db, sql, -1, &stmt->stmt, NULL);
 #else
-	if (sqlite3_prepare(this->db, sql, -1, &stmt, NULL) == SQLITE_OK)
+	res = sqlite3_prepare(conn->db, sql, -1, &stmt->stmt, NULL);
 #endif
+	if (res != SQLITE_OK)
+	{
+		DBG1(DBG_LIB, "preparing sqlite statement failed: %s",
+			 sqlite3_errmsg(conn->db));
+		conn->mutex->unlock(conn->mutex);
+		free(stmt);
+		return NULL;
+	}
+	if (cache)
+	{
+		stmt->sql = strdup(sql);
+		conn->stmts->put(conn->stmts, stmt->sql, stmt);
+	}
+	conn->mutex->unlock(conn->mutex);
+	return stmt;
+}
+
+/**
+ * Release a statement acquired with stmt_get()
+ */
+static void stmt_release(conn_t *conn, stmt_t *stmt)
+{
+	if (stmt->sql)
+	{
+		sqlite3_reset(stmt->stmt);
+		sqlite3_clear_bindings(stmt->stmt);
+		conn->mutex->lock(conn->mutex);
+		stmt->in_use = FALSE;
+		conn->mutex->unlock(conn->mutex);
+	}
+	else
+	{
+		stmt_destroy(stmt);
+	}
+}
+
+/**
+ * Get a prepared sqlite stmt for a sql string and bind args
+ */
+static stmt_t* run(private_sqlite_database_t *this, conn_t *conn, char *sql,
+				   va_list *args)
+{
+	stmt_t *stmt;
+	int params, i, res = SQLITE_OK;
+
+	stmt = stmt_get(this, conn, sql);
+	if (!stmt)
 	{
-		params = sqlite3_bind_parameter_count(stmt);
-		for (i = 1; i <= params; i++)
+		return NULL;
+	}
+	params = sqlite3_bind_parameter_count(stmt->stmt);
+	for (i = 1; i <= params; i++)
+	{
+		switch (va_arg(*args, db_type_t))
 		{
-			switch (va_arg(*args, db_type_t))
+			case DB_INT:
 			{
-				case DB_INT:
-				{
-					res = sqlite3_bind_int(stmt, i, va_arg(*args, int));
-					break;
-				}
-				case DB_UINT:
-				{
-					res = sqlite3_bind_int64(stmt, i, va_arg(*args, u_int));
-					break;
-				}
-				case DB_TEXT:
-				{
-					const char *text = va_arg(*args, const char*);
-					res = sqlite3_bind_text(stmt, i, text, -1, SQLITE_STATIC);
-					break;
-				}
-				case DB_BLOB:
-				{
-					chunk_t c = va_arg(*args, chunk_t);
-					res = sqlite3_bind_blob(stmt, i, c.ptr, c.len, SQLITE_STATIC);
-					break;
-				}
-				case DB_DOUBLE:
-				{
-					res = sqlite3_bind_double(stmt, i, va_arg(*args, double));
-					break;
-				}
-				case DB_NULL:
-				{
-					res = sqlite3_bind_null(stmt, i);
-					break;
-				}
-				default:
-				{
-					res = SQLITE_MISUSE;
-					break;
-				}
+				res = sqlite3_bind_int(stmt->stmt, i, va_arg(*args, int));
+				break;
 			}
-			if (res != SQLITE_OK)
+			case DB_UINT:
 			{
+				res = sqlite3_bind_int64(stmt->stmt, i, va_arg(*args, u_int));
+				break;
+			}
+			case DB_TEXT:
+			{
+				const char *text = va_arg(*args, const char*);
+				res = sqlite3_bind_text(stmt->stmt, i, text, -1,
+										SQLITE_STATIC);
+				break;
+			}
+			case DB_BLOB:
+			{
+				chunk_t c = va_arg(*args, chunk_t);
+				res = sqlite3_bind_blob(stmt->stmt, i, c.ptr, c.len,
+										SQLITE_STATIC);
+				break;
+			}
+			case DB_DOUBLE:
+			{
+				res = sqlite3_bind_double(stmt->stmt, i, va_arg(*args, double));
+				break;
+			}
+			case DB_NULL:
+			{
+				res = sqlite3_bind_null(stmt->stmt, i);
+				break;
+			}
+			default:
+			{
+				res = SQLITE_MISUSE;
 				break;
 			}
 		}
-	}
-	else
-	{
-		DBG1(DBG_LIB, "preparing sqlite statement failed: %s",
-			 sqlite3_errmsg(this->db));
+		if (res != SQLITE_OK)
+		{
+			break;
+		}
 	}
 	if (res != SQLITE_OK)
 	{
 		DBG1(DBG_LIB, "binding sqlite statement failed: %s",
-			 sqlite3_errmsg(this->db));
-		sqlite3_finalize(stmt);
+			 sqlite3_errmsg(conn->db));
+		stmt_release(conn, stmt);
 		return NULL;
 	}
 	return stmt;
@@ -126,8 +423,10 @@ static sqlite3_stmt* run(private_sqlite_database_t *this, char *sql,
 typedef struct {
 	/** implements enumerator_t */
 	enumerator_t public;
-	/** associated sqlite statement */
-	sqlite3_stmt *stmt;
+	/** associated prepared statement */
+	stmt_t *stmt;
+	/** pooled connection handle */
+	conn_t *conn;
 	/** number of result columns */
 	int count;
 	/** column types */
@@ -141,10 +440,11 @@ typedef struct {
  */
 static void sqlite_enumerator_destroy(sqlite_enumerator_t *this)
 {
-	sqlite3_finalize(this->stmt);
+	stmt_release(this->conn, this->stmt);
 #if SQLITE_VERSION_NUMBER < 3005000
-	this->database->mutex->unlock(this->database->mutex);
+	this->conn->mutex->unlock(this->conn->mutex);
 #endif
+	conn_release(this->database, this->conn);
 	free(this->columns);
 	free(this);
 }
@@ -154,16 +454,17 @@ static void sqlite_enumerator_destroy(sqlite_enumerator_t *this)
  */
 static bool sqlite_enumerator_enumerate(sqlite_enumerator_t *this, ...)
 {
+	sqlite3_stmt *stmt = this->stmt->stmt;
 	int i;
 	va_list args;
 
-	switch (sqlite3_step(this->stmt))
+	switch (sqlite3_step(stmt))
 	{
 		case SQLITE_ROW:
 			break;
 		default:
 			DBG1(DBG_LIB, "stepping sqlite statement failed: %s",
-				 sqlite3_errmsg(this->database->db));
+				 sqlite3_errmsg(this->conn->db));
 			/* fall */
 		case SQLITE_DONE:
 			return FALSE;
@@ -176,32 +477,32 @@ static bool sqlite_enumerator_enumerate(sqlite_enumerator_t *this, ...)
 			case DB_INT:
 			{
 				int *value = va_arg(args, int*);
-				*value = sqlite3_column_int(this->stmt, i);
+				*value = sqlite3_column_int(stmt, i);
 				break;
 			}
 			case DB_UINT:
 			{
 				u_int *value = va_arg(args, u_int*);
-				*value = (u_int)sqlite3_column_int64(this->stmt, i);
+				*value = (u_int)sqlite3_column_int64(stmt, i);
 				break;
 			}
 			case DB_TEXT:
 			{
 				const unsigned char **value = va_arg(args, const unsigned char**);
-				*value = sqlite3_column_text(this->stmt, i);
+				*value = sqlite3_column_text(stmt, i);
 				break;
 			}
 			case DB_BLOB:
 			{
 				chunk_t *chunk = va_arg(args, chunk_t*);
-				chunk->len = sqlite3_column_bytes(this->stmt, i);
-				chunk->ptr = (u_char*)sqlite3_column_blob(this->stmt, i);
+				chunk->len = sqlite3_column_bytes(stmt, i);
+				chunk->ptr = (u_char*)sqlite3_column_blob(stmt, i);
 				break;
 			}
 			case DB_DOUBLE:
 			{
 				double *value = va_arg(args, double*);
-				*value = sqlite3_column_double(this->stmt, i);
+				*value = sqlite3_column_double(stmt, i);
 				break;
 			}
 			default:
@@ -217,25 +518,32 @@ static bool sqlite_enumerator_enumerate(sqlite_enumerator_t *this, ...)
 METHOD(database_t, query, enumerator_t*,
 	private_sqlite_database_t *this, char *sql, ...)
 {
-	sqlite3_stmt *stmt;
+	stmt_t *stmt;
+	conn_t *conn;
 	va_list args;
 	sqlite_enumerator_t *enumerator = NULL;
 	int i;
 
+	conn = conn_get(this);
+	if (!conn)
+	{
+		return NULL;
+	}
 #if SQLITE_VERSION_NUMBER < 3005000
 	/* sqlite connections prior to 3.5 may be used by a single thread only, */
-	this->mutex->lock(this->mutex);
+	conn->mutex->lock(conn->mutex);
 #endif
 
 	va_start(args, sql);
-	stmt = run(this, sql, &args);
+	stmt = run(this, conn, sql, &args);
 	if (stmt)
 	{
 		enumerator = malloc_thing(sqlite_enumerator_t);
 		enumerator->public.enumerate = (void*)sqlite_enumerator_enumerate;
 		enumerator->public.destroy = (void*)sqlite_enumerator_destroy;
 		enumerator->stmt = stmt;
-		enumerator->count = sqlite3_column_count(stmt);
+		enumerator->conn = conn;
+		enumerator->count = sqlite3_column_count(stmt->stmt);
 		enumerator->columns = malloc(sizeof(db_type_t) * enumerator->count);
 		enumerator->database = this;
 		for (i = 0; i < enumerator->count; i++)
@@ -243,6 +551,13 @@ METHOD(database_t, query, enumerator_t*,
 			enumerator->columns[i] = va_arg(args, db_type_t);
 		}
 	}
+	else
+	{
+#if SQLITE_VERSION_NUMBER < 3005000
+		conn->mutex->unlock(conn->mutex);
+#endif
+		conn_release(this, conn);
+	}
 	va_end(args);
 	return (enumerator_t*)enumerator;
 }
@@ -250,33 +565,40 @@ METHOD(database_t, query, enumerator_t*,
 METHOD(database_t, execute, int,
 	private_sqlite_database_t *this, int *rowid, char *sql, ...)
 {
-	sqlite3_stmt *stmt;
+	stmt_t *stmt;
+	conn_t *conn;
 	int affected = -1;
 	va_list args;
 
+	conn = conn_get(this);
+	if (!conn)
+	{
+		return -1;
+	}
 	/* we need a lock to get our rowid/changes correctly */
-	this->mutex->lock(this->mutex);
+	conn->mutex->lock(conn->mutex);
 	va_start(args, sql);
-	stmt = run(this, sql, &args);
+	stmt = run(this, conn, sql, &args);
 	va_end(args);
 	if (stmt)
 	{
-		if (sqlite3_step(stmt) == SQLITE_DONE)
+		if (sqlite3_step(stmt->stmt) == SQLITE_DONE)
 		{
 			if (rowid)
 			{
-				*rowid = sqlite3_last_insert_rowid(this->db);
+				*rowid = sqlite3_last_insert_rowid(conn->db);
 			}
-			affected = sqlite3_changes(this->db);
+			affected = sqlite3_changes(conn->db);
 		}
 		else
 		{
 			DBG1(DBG_LIB, "sqlite execute failed: %s",
-				 sqlite3_errmsg(this->db));
+				 sqlite3_errmsg(conn->db));
 		}
-		sqlite3_finalize(stmt);
+		stmt_release(conn, stmt);
 	}
-	this->mutex->unlock(this->mutex);
+	conn->mutex->unlock(conn->mutex);
+	conn_release(this, conn);
 	return affected;
 }
 
@@ -286,22 +608,12 @@ METHOD(database_t, get_driver, db_driver_t,
 	return DB_SQLITE;
 }
 
-/**
- * Busy handler implementation
- */
-static int busy_handler(private_sqlite_database_t *this, int count)
-{
-	/* add a backoff time, quadratically increasing with every try */
-	usleep(count * count * 1000);
-	/* always retry */
-	return 1;
-}
-
 METHOD(database_t, destroy, void,
 	private_sqlite_database_t *this)
 {
-	sqlite3_close(this->db);
+	this->pool->destroy_function(this->pool, (void*)conn_destroy);
 	this->mutex->destroy(this->mutex);
+	free(this->file);
 	free(this);
 }
 
@@ -310,8 +622,8 @@ METHOD(database_t, destroy, void,
  */
 sqlite_database_t *sqlite_database_create(char *uri)
 {
-	char *file;
 	private_sqlite_database_t *this;
+	conn_t *conn;
 
 	/**
 	 * parse sqlite:///path/to/file.db uri
@@ -320,7 +632,6 @@ sqlite_database_t *sqlite_database_create(char *uri)
 	{
 		return NULL;
 	}
-	file = uri + 9;
 
 	INIT(this,
 		.public = {
@@ -331,19 +642,31 @@ sqlite_database_t *sqlite_database_create(char *uri)
 				.destroy = _destroy,
 			},
 		},
-		.mutex = mutex_create(MUTEX_TYPE_RECURSIVE),
+		.file = strdup(uri + 9),
+		.pool = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.pool_size = max(1, lib->settings->get_int(lib->settings,
+							"libstrongswan.plugins.sqlite.pool_size", 1)),
+		.cache_size = max(0, lib->settings->get_int(lib->settings,
+							"libstrongswan.plugins.sqlite.statement_cache", 32)),
 	);
 
-	if (sqlite3_open(file, &this->db) != SQLITE_OK)
+	if (streq(this->file, ":memory:"))
+	{	/* each connection opens its own in-memory database */
+		this->pool_size = 1;
+	}
+#ifndef HAVE_SQLITE3_PREPARE_V2
+	/* statements prepared with the legacy interface expire on schema changes */
+	this->cache_size = 0;
+#endif
+
+	/* check connectivity */
+	conn = conn_get(this);
+	if (!conn)
 	{
-		DBG1(DBG_LIB, "opening SQLite database '%s' failed: %s",
-			 file, sqlite3_errmsg(this->db));
 		_destroy(this);
 		return NULL;
 	}
-
-	sqlite3_busy_handler(this->db, (void*)busy_handler, this);
-
+	conn_release(this, conn);
 	return &this->public;
 }
-
@@ -28,6 +28,7 @@ typedef struct revoked_t revoked_t;
 #include <credentials/certificates/x509.h>
 #include <credentials/keys/private_key.h>
 #include <utils/linked_list.h>
+#include <utils/hashtable.h>
 
 /**
  * entry for a revoked certificate
@@ -99,6 +100,11 @@ struct private_x509_crl_t {
 	 */
 	linked_list_t *revoked;
 
+	/**
+	 * revoked certificates (revoked_t) indexed by serial, shares the entries
+	 */
+	hashtable_t *revoked_index;
+
 	/**
 	 * List of Freshest CRL distribution points
 	 */
@@ -214,6 +220,35 @@ static const asn1Object_t crlObjects[] = {
 #define CRL_OBJ_ALGORITHM				27
 #define CRL_OBJ_SIGNATURE				28
 
+/**
+ * Hashtable hash function for revoked serials
+ */
+static u_int serial_hash(chunk_t *serial)
+{
+	return chunk_hash(*serial);
+}
+
+/**
+ * Hashtable equals function for revoked serials
+ */
+static bool serial_equals(chunk_t *a, chunk_t *b)
+{
+	return chunk_equals(*a, *b);
+}
+
+/**
+ * Add a revoked certificate to the list and the serial index
+ */
+static void add_revoked(private_x509_crl_t *this, revoked_t *revoked)
+{
+	this->revoked->insert_last(this->revoked, revoked);
+	if (!this->revoked_index->get(this->revoked_index, &revoked->serial))
+	{	/* on duplicates, the first entry is authoritative */
+		this->revoked_index->put(this->revoked_index, &revoked->serial,
+								 revoked);
+	}
+}
+
 /**
  *  Parses an X.509 Certificate Revocation List (CRL)
  */
@@ -265,7 +300,7 @@ static bool parse(private_x509_crl_t *this)
 				revoked->serial = chunk_clone(userCertificate);
 				revoked->date = asn1_parse_time(object, level);
 				revoked->reason = CRL_REASON_UNSPECIFIED;
-				this->revoked->insert_last(this->revoked, (void *)revoked);
+				add_revoked(this, revoked);
 				break;
 			case CRL_OBJ_CRL_ENTRY_EXTN_ID:
 			case CRL_OBJ_EXTN_ID:
@@ -418,6 +453,28 @@ METHOD(crl_t, create_enumerator, enumerator_t*,
 								(void*)filter, NULL, NULL);
 }
 
+METHOD(crl_t, is_revoked, bool,
+	private_x509_crl_t *this, chunk_t serial, time_t *date,
+	crl_reason_t *reason)
+{
+	revoked_t *revoked;
+
+	revoked = this->revoked_index->get(this->revoked_index, &serial);
+	if (!revoked)
+	{
+		return FALSE;
+	}
+	if (date)
+	{
+		*date = revoked->date;
+	}
+	if (reason)
+	{
+		*reason = revoked->reason;
+	}
+	return TRUE;
+}
+
 METHOD(certificate_t, get_type, certificate_type_t,
 	private_x509_crl_t *this)
 {
@@ -586,6 +643,7 @@ METHOD(certificate_t, destroy, void,
 {
 	if (ref_put(&this->ref))
 	{
+		this->revoked_index->destroy(this->revoked_index);
 		this->revoked->destroy_function(this->revoked, (void*)revoked_destroy);
 		this->crl_uris->destroy_function(this->crl_uris, (void*)cdp_destroy);
 		DESTROY_IF(this->issuer);
@@ -631,9 +689,12 @@ static private_x509_crl_t* create_empty(void)
 				.is_delta_crl = _is_delta_crl,
 				.create_delta_crl_uri_enumerator = _create_delta_crl_uri_enumerator,
 				.create_enumerator = _create_enumerator,
+				.is_revoked = _is_revoked,
 			},
 		},
 		.revoked = linked_list_create(),
+		.revoked_index = hashtable_create((hashtable_hash_t)serial_hash,
+									(hashtable_equals_t)serial_equals, 32),
 		.crl_uris = linked_list_create(),
 		.ref = 1,
 	);
@@ -692,7 +753,7 @@ static void read_revoked(private_x509_crl_t *crl, enumerator_t *enumerator)
 			.date = date,
 			.reason = reason,
 		);
-		crl->revoked->insert_last(crl->revoked, revoked);
+		add_revoked(crl, revoked);
 	}
 }
 
@@ -241,6 +241,49 @@ METHOD(ocsp_response_t, create_cert_enumerator, enumerator_t*,
 	return this->certs->create_enumerator(this->certs);
 }
 
+/**
+ * Filter function for single responses
+ */
+static bool response_filter(void *data, single_response_t **response,
+							chunk_t *serial, void *p2, chunk_t *keyid, void *p3,
+							cert_validation_t *status, void *p4,
+							time_t *this_update, void *p5, time_t *next_update)
+{
+	if (serial)
+	{
+		*serial = (*response)->serialNumber;
+	}
+	if (keyid)
+	{
+		*keyid = chunk_empty;
+		if ((*response)->hashAlgorithm == OID_SHA1)
+		{
+			*keyid = (*response)->issuerKeyHash;
+		}
+	}
+	if (status)
+	{
+		*status = (*response)->status;
+	}
+	if (this_update)
+	{
+		*this_update = (*response)->thisUpdate;
+	}
+	if (next_update)
+	{
+		*next_update = (*response)->nextUpdate;
+	}
+	return TRUE;
+}
+
+METHOD(ocsp_response_t, create_response_enumerator, enumerator_t*,
+	private_x509_ocsp_response_t *this)
+{
+	return enumerator_create_filter(
+						this->responses->create_enumerator(this->responses),
+						(void*)response_filter, NULL, NULL);
+}
+
 /**
  * ASN.1 definition of singleResponse
  */
@@ -842,6 +885,7 @@ static x509_ocsp_response_t *load(chunk_t blob)
 				},
 				.get_status = _get_status,
 				.create_cert_enumerator = _create_cert_enumerator,
+				.create_response_enumerator = _create_response_enumerator,
 			},
 		},
 		.ref = 1,
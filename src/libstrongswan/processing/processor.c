@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "processor.h"
 
@@ -30,6 +31,29 @@
 #include <utils/linked_list.h>
 
 typedef struct private_processor_t private_processor_t;
+typedef struct job_queue_t job_queue_t;
+
+/**
+ * A job queue, shared by the worker threads assigned to it
+ */
+struct job_queue_t {
+
+	/**
+	 * Queued jobs for each priority
+	 */
+	linked_list_t *jobs[JOB_PRIO_MAX];
+
+	/**
+	 * Lock for the job lists and the jobs assigned to the workers of this
+	 * queue, held only to insert/remove/assign a single job
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Number of jobs workers of this queue stole from other queues
+	 */
+	refcount_t steals;
+};
 
 /**
  * Private data of processor_t class.
@@ -54,7 +78,7 @@ struct private_processor_t {
 	/**
 	 * Number of threads currently working, for each priority
 	 */
-	u_int working_threads[JOB_PRIO_MAX];
+	refcount_t working_threads[JOB_PRIO_MAX];
 
 	/**
 	 * All threads managed in the pool (including threads that have been
@@ -63,9 +87,39 @@ struct private_processor_t {
 	linked_list_t *threads;
 
 	/**
-	 * A list of queued jobs for each priority
+	 * Job queues, each worker thread has one assigned as its home queue
 	 */
-	linked_list_t *jobs[JOB_PRIO_MAX];
+	job_queue_t *queues;
+
+	/**
+	 * Number of job queues
+	 */
+	u_int queue_count;
+
+	/**
+	 * Home queue assigned to the next worker thread created
+	 */
+	u_int next_queue;
+
+	/**
+	 * Queue used for the next job queued from a non-worker thread
+	 */
+	u_int next_job_queue;
+
+	/**
+	 * Number of queued jobs over all queues, for each priority
+	 */
+	refcount_t queued[JOB_PRIO_MAX];
+
+	/**
+	 * Incremented whenever a job gets queued, to detect missed jobs
+	 */
+	refcount_t queue_seq;
+
+	/**
+	 * Number of threads waiting in job_added
+	 */
+	refcount_t sleeping;
 
 	/**
 	 * Threads reserved for each priority
@@ -73,7 +127,22 @@ struct private_processor_t {
 	int prio_threads[JOB_PRIO_MAX];
 
 	/**
-	 * access to job lists is locked through this mutex
+	 * TRUE if any threads are reserved via prio_threads
+	 */
+	bool reservations;
+
+	/**
+	 * Serializes job selection if threads are reserved
+	 */
+	mutex_t *reserve_lock;
+
+	/**
+	 * The worker thread (worker_thread_t) we are currently running in
+	 */
+	thread_value_t *current;
+
+	/**
+	 * access to the thread pool and the idle state is locked through this mutex
 	 */
 	mutex_t *mutex;
 
@@ -103,6 +172,11 @@ typedef struct {
 	 */
 	thread_t *thread;
 
+	/**
+	 * Queue this worker primarily fetches jobs from
+	 */
+	job_queue_t *queue;
+
 	/**
 	 * Job currently being executed by this worker thread
 	 */
@@ -117,39 +191,171 @@ typedef struct {
 
 static void process_jobs(worker_thread_t *worker);
 
+/**
+ * Create a worker thread, processor mutex must be held
+ */
+static worker_thread_t *create_worker(private_processor_t *this)
+{
+	worker_thread_t *worker;
+
+	INIT(worker,
+		.processor = this,
+		.queue = &this->queues[this->next_queue++ % this->queue_count],
+	);
+	worker->thread = thread_create((thread_main_t)process_jobs, worker);
+	if (!worker->thread)
+	{
+		free(worker);
+		return NULL;
+	}
+	this->threads->insert_last(this->threads, worker);
+	return worker;
+}
+
+/**
+ * Get number of idle threads
+ */
+static u_int get_idle_threads_nolock(private_processor_t *this)
+{
+	u_int count, i;
+
+	count = this->total_threads;
+	for (i = 0; i < JOB_PRIO_MAX; i++)
+	{
+		count -= this->working_threads[i];
+	}
+	return count;
+}
+
+/**
+ * Insert a job into a queue and wake up a waiting worker, if any
+ */
+static void enqueue(private_processor_t *this, job_queue_t *queue,
+					job_priority_t prio, job_t *job)
+{
+	job->status = JOB_STATUS_QUEUED;
+
+	queue->mutex->lock(queue->mutex);
+	queue->jobs[prio]->insert_last(queue->jobs[prio], job);
+	queue->mutex->unlock(queue->mutex);
+	ref_get(&this->queued[prio]);
+	ref_get(&this->queue_seq);
+
+	if (this->sleeping)
+	{
+		this->mutex->lock(this->mutex);
+		this->job_added->signal(this->job_added);
+		this->mutex->unlock(this->mutex);
+	}
+}
+
+/**
+ * Try to remove a job of the given priority from a queue
+ */
+static job_t *dequeue(private_processor_t *this, job_queue_t *queue,
+					  job_priority_t prio)
+{
+	job_t *job = NULL;
+
+	queue->mutex->lock(queue->mutex);
+	if (queue->jobs[prio]->remove_first(queue->jobs[prio],
+										(void**)&job) != SUCCESS)
+	{
+		job = NULL;
+	}
+	queue->mutex->unlock(queue->mutex);
+	if (job)
+	{
+		ignore_result(ref_put(&this->queued[prio]));
+	}
+	return job;
+}
+
+/**
+ * Fetch a job of the given priority, from the home queue or by stealing it
+ * from any other queue
+ */
+static job_t *fetch_job(private_processor_t *this, worker_thread_t *worker,
+						job_priority_t prio)
+{
+	job_queue_t *queue;
+	job_t *job;
+	u_int i, home;
+
+	if (!this->queued[prio])
+	{
+		return NULL;
+	}
+	job = dequeue(this, worker->queue, prio);
+	if (job)
+	{
+		return job;
+	}
+	home = worker->queue - this->queues;
+	for (i = 1; i < this->queue_count; i++)
+	{
+		queue = &this->queues[(home + i) % this->queue_count];
+		job = dequeue(this, queue, prio);
+		if (job)
+		{
+			ref_get(&worker->queue->steals);
+			return job;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Assign a job to a worker, the worker can be canceled while executing it
+ */
+static void assign_job(private_processor_t *this, worker_thread_t *worker,
+					   job_t *job, job_priority_t prio)
+{
+	ref_get(&this->working_threads[prio]);
+	worker->queue->mutex->lock(worker->queue->mutex);
+	worker->job = job;
+	worker->priority = prio;
+	worker->queue->mutex->unlock(worker->queue->mutex);
+}
+
+/**
+ * Detach the job from a worker, so it does not get canceled anymore
+ */
+static job_t *detach_job(private_processor_t *this, worker_thread_t *worker)
+{
+	job_t *job;
+
+	worker->queue->mutex->lock(worker->queue->mutex);
+	job = worker->job;
+	worker->job = NULL;
+	worker->queue->mutex->unlock(worker->queue->mutex);
+	ignore_result(ref_put(&this->working_threads[worker->priority]));
+	return job;
+}
+
 /**
  * restart a terminated thread
  */
 static void restart(worker_thread_t *worker)
 {
 	private_processor_t *this = worker->processor;
+	job_t *job;
 
 	DBG2(DBG_JOB, "terminated worker thread %.2u", thread_current_id());
 
-	this->mutex->lock(this->mutex);
 	/* cleanup worker thread  */
-	this->working_threads[worker->priority]--;
-	worker->job->status = JOB_STATUS_CANCELED;
-	worker->job->destroy(worker->job);
-	worker->job = NULL;
+	job = detach_job(this, worker);
+	job->status = JOB_STATUS_CANCELED;
+	job->destroy(job);
+
+	this->mutex->lock(this->mutex);
 
 	/* respawn thread if required */
-	if (this->desired_threads >= this->total_threads)
+	if (this->desired_threads >= this->total_threads &&
+		create_worker(this))
 	{
-		worker_thread_t *new_worker;
-
-		INIT(new_worker,
-			.processor = this,
-		);
-		new_worker->thread = thread_create((thread_main_t)process_jobs,
-										   new_worker);
-		if (new_worker->thread)
-		{
-			this->threads->insert_last(this->threads, new_worker);
-			this->mutex->unlock(this->mutex);
-			return;
-		}
-		free(new_worker);
+		this->mutex->unlock(this->mutex);
+		return;
 	}
 	this->total_threads--;
 	this->thread_terminated->signal(this->thread_terminated);
@@ -157,18 +363,120 @@ static void restart(worker_thread_t *worker)
 }
 
 /**
- * Get number of idle threads, non-locking variant
+ * Assign the highest priority job we are allowed to process to the worker,
+ * considering the threads reserved for higher priorities
  */
-static u_int get_idle_threads_nolock(private_processor_t *this)
+static bool get_job(private_processor_t *this, worker_thread_t *worker)
 {
-	u_int count, i;
+	int i, reserved = 0, idle, delayed = -1;
+	job_t *job = NULL;
 
-	count = this->total_threads;
+	if (!this->reservations)
+	{
+		for (i = 0; i < JOB_PRIO_MAX; i++)
+		{
+			job = fetch_job(this, worker, i);
+			if (job)
+			{
+				assign_job(this, worker, job, i);
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+
+	this->reserve_lock->lock(this->reserve_lock);
+	idle = get_idle_threads_nolock(this);
 	for (i = 0; i < JOB_PRIO_MAX; i++)
 	{
-		count -= this->working_threads[i];
+		if (reserved && reserved >= idle)
+		{
+			delayed = i;
+			break;
+		}
+		if (this->working_threads[i] < this->prio_threads[i])
+		{
+			reserved += this->prio_threads[i] - this->working_threads[i];
+		}
+		job = fetch_job(this, worker, i);
+		if (job)
+		{
+			assign_job(this, worker, job, i);
+			break;
+		}
+	}
+	this->reserve_lock->unlock(this->reserve_lock);
+	if (delayed >= 0)
+	{
+		DBG2(DBG_JOB, "delaying %N priority jobs: %d threads idle, "
+			 "but %d reserved for higher priorities",
+			 job_priority_names, delayed, idle, reserved);
+	}
+	return job != NULL;
+}
+
+/**
+ * Execute the job assigned to a worker and handle its requeueing
+ */
+static void execute_job(private_processor_t *this, worker_thread_t *worker)
+{
+	job_requeue_t requeue;
+	job_t *job;
+
+	worker->job->status = JOB_STATUS_EXECUTING;
+	/* canceled threads are restarted to get a constant pool */
+	thread_cleanup_push((thread_cleanup_t)restart, worker);
+	while (TRUE)
+	{
+		requeue = worker->job->execute(worker->job);
+		if (requeue.type != JOB_REQUEUE_TYPE_DIRECT)
+		{
+			break;
+		}
+		else if (!worker->job->cancel)
+		{	/* only allow cancelable jobs to requeue directly */
+			requeue.type = JOB_REQUEUE_TYPE_FAIR;
+			break;
+		}
+	}
+	thread_cleanup_pop(FALSE);
+	job = detach_job(this, worker);
+	if (job->status == JOB_STATUS_CANCELED)
+	{	/* job was canceled via a custom cancel() method or did not
+		 * use JOB_REQUEUE_TYPE_DIRECT */
+		job->destroy(job);
+		return;
+	}
+	switch (requeue.type)
+	{
+		case JOB_REQUEUE_TYPE_NONE:
+			job->status = JOB_STATUS_DONE;
+			job->destroy(job);
+			break;
+		case JOB_REQUEUE_TYPE_FAIR:
+			enqueue(this, worker->queue, worker->priority, job);
+			break;
+		case JOB_REQUEUE_TYPE_SCHEDULE:
+			/* scheduler_t does not hold its lock when queeuing jobs */
+			switch (requeue.schedule)
+			{
+				case JOB_SCHEDULE:
+					lib->scheduler->schedule_job(lib->scheduler,
+								job, requeue.time.rel);
+					break;
+				case JOB_SCHEDULE_MS:
+					lib->scheduler->schedule_job_ms(lib->scheduler,
+								job, requeue.time.rel);
+					break;
+				case JOB_SCHEDULE_TV:
+					lib->scheduler->schedule_job_tv(lib->scheduler,
+								job, requeue.time.abs);
+					break;
+			}
+			break;
+		default:
+			break;
 	}
-	return count;
 }
 
 /**
@@ -177,108 +485,41 @@ static u_int get_idle_threads_nolock(private_processor_t *this)
 static void process_jobs(worker_thread_t *worker)
 {
 	private_processor_t *this = worker->processor;
+	u_int seq;
 
 	/* worker threads are not cancelable by default */
 	thread_cancelability(FALSE);
 
 	DBG2(DBG_JOB, "started worker thread %.2u", thread_current_id());
 
-	this->mutex->lock(this->mutex);
-	while (this->desired_threads >= this->total_threads)
+	this->current->set(this->current, worker);
+	while (TRUE)
 	{
-		int i, reserved = 0, idle;
-
-		idle = get_idle_threads_nolock(this);
-
-		for (i = 0; i < JOB_PRIO_MAX; i++)
+		this->mutex->lock(this->mutex);
+		if (this->desired_threads < this->total_threads)
 		{
-			if (reserved && reserved >= idle)
-			{
-				DBG2(DBG_JOB, "delaying %N priority jobs: %d threads idle, "
-					 "but %d reserved for higher priorities",
-					 job_priority_names, i, idle, reserved);
-				break;
-			}
-			if (this->working_threads[i] < this->prio_threads[i])
-			{
-				reserved += this->prio_threads[i] - this->working_threads[i];
-			}
-			if (this->jobs[i]->remove_first(this->jobs[i],
-											(void**)&worker->job) == SUCCESS)
-			{
-				job_requeue_t requeue;
-
-				this->working_threads[i]++;
-				worker->job->status = JOB_STATUS_EXECUTING;
-				worker->priority = i;
-				this->mutex->unlock(this->mutex);
-				/* canceled threads are restarted to get a constant pool */
-				thread_cleanup_push((thread_cleanup_t)restart, worker);
-				while (TRUE)
-				{
-					requeue = worker->job->execute(worker->job);
-					if (requeue.type != JOB_REQUEUE_TYPE_DIRECT)
-					{
-						break;
-					}
-					else if (!worker->job->cancel)
-					{	/* only allow cancelable jobs to requeue directly */
-						requeue.type = JOB_REQUEUE_TYPE_FAIR;
-						break;
-					}
-				}
-				thread_cleanup_pop(FALSE);
-				this->mutex->lock(this->mutex);
-				this->working_threads[i]--;
-				if (worker->job->status == JOB_STATUS_CANCELED)
-				{	/* job was canceled via a custom cancel() method or did not
-					 * use JOB_REQUEUE_TYPE_DIRECT */
-					worker->job->destroy(worker->job);
-					break;
-				}
-				switch (requeue.type)
-				{
-					case JOB_REQUEUE_TYPE_NONE:
-						worker->job->status = JOB_STATUS_DONE;
-						worker->job->destroy(worker->job);
-						break;
-					case JOB_REQUEUE_TYPE_FAIR:
-						worker->job->status = JOB_STATUS_QUEUED;
-						this->jobs[i]->insert_last(this->jobs[i],
-												   worker->job);
-						this->job_added->signal(this->job_added);
-						break;
-					case JOB_REQUEUE_TYPE_SCHEDULE:
-						/* scheduler_t does not hold its lock when queeuing jobs
-						 * so this should be safe without unlocking our mutex */
-						switch (requeue.schedule)
-						{
-							case JOB_SCHEDULE:
-								lib->scheduler->schedule_job(lib->scheduler,
-											worker->job, requeue.time.rel);
-								break;
-							case JOB_SCHEDULE_MS:
-								lib->scheduler->schedule_job_ms(lib->scheduler,
-											worker->job, requeue.time.rel);
-								break;
-							case JOB_SCHEDULE_TV:
-								lib->scheduler->schedule_job_tv(lib->scheduler,
-											worker->job, requeue.time.abs);
-								break;
-						}
-						break;
-					default:
-						break;
-				}
-				break;
-			}
+			break;
+		}
+		this->mutex->unlock(this->mutex);
+		seq = this->queue_seq;
+		if (get_job(this, worker))
+		{
+			execute_job(this, worker);
+			continue;
 		}
-		if (!worker->job)
+		this->mutex->lock(this->mutex);
+		ref_get(&this->sleeping);
+		/* jobs queued after we looked for one are not missed, as enqueue()
+		 * signals us if it sees us sleeping */
+		if (seq == this->queue_seq &&
+			this->desired_threads >= this->total_threads)
 		{
 			this->job_added->wait(this->job_added, this->mutex);
 		}
-		worker->job = NULL;
+		ignore_result(ref_put(&this->sleeping));
+		this->mutex->unlock(this->mutex);
 	}
+	this->current->set(this->current, NULL);
 	this->total_threads--;
 	this->thread_terminated->signal(this->thread_terminated);
 	this->mutex->unlock(this->mutex);
@@ -321,38 +562,64 @@ static job_priority_t sane_prio(job_priority_t prio)
 METHOD(processor_t, get_working_threads, u_int,
 	private_processor_t *this, job_priority_t prio)
 {
-	u_int count;
-
-	this->mutex->lock(this->mutex);
-	count = this->working_threads[sane_prio(prio)];
-	this->mutex->unlock(this->mutex);
-	return count;
+	return this->working_threads[sane_prio(prio)];
 }
 
 METHOD(processor_t, get_job_load, u_int,
 	private_processor_t *this, job_priority_t prio)
 {
+	return this->queued[sane_prio(prio)];
+}
+
+METHOD(processor_t, get_queue_count, u_int,
+	private_processor_t *this)
+{
+	return this->queue_count;
+}
+
+METHOD(processor_t, get_queue_load, u_int,
+	private_processor_t *this, u_int index, job_priority_t prio,
+	u_int *steals)
+{
+	job_queue_t *queue;
 	u_int load;
 
+	if (index >= this->queue_count)
+	{
+		if (steals)
+		{
+			*steals = 0;
+		}
+		return 0;
+	}
 	prio = sane_prio(prio);
-	this->mutex->lock(this->mutex);
-	load = this->jobs[prio]->get_count(this->jobs[prio]);
-	this->mutex->unlock(this->mutex);
+	queue = &this->queues[index];
+	queue->mutex->lock(queue->mutex);
+	load = queue->jobs[prio]->get_count(queue->jobs[prio]);
+	queue->mutex->unlock(queue->mutex);
+	if (steals)
+	{
+		*steals = queue->steals;
+	}
 	return load;
 }
 
 METHOD(processor_t, queue_job, void,
 	private_processor_t *this, job_t *job)
 {
-	job_priority_t prio;
-
-	prio = sane_prio(job->get_priority(job));
-	job->status = JOB_STATUS_QUEUED;
+	worker_thread_t *worker;
+	job_queue_t *queue;
 
-	this->mutex->lock(this->mutex);
-	this->jobs[prio]->insert_last(this->jobs[prio], job);
-	this->job_added->signal(this->job_added);
-	this->mutex->unlock(this->mutex);
+	worker = this->current->get(this->current);
+	if (worker)
+	{	/* keep jobs queued by a worker local, idle workers steal them */
+		queue = worker->queue;
+	}
+	else
+	{
+		queue = &this->queues[this->next_job_queue++ % this->queue_count];
+	}
+	enqueue(this, queue, sane_prio(job->get_priority(job)), job);
 }
 
 METHOD(processor_t, set_threads, void,
@@ -361,26 +628,16 @@ METHOD(processor_t, set_threads, void,
 	this->mutex->lock(this->mutex);
 	if (count > this->total_threads)
 	{	/* increase thread count */
-		worker_thread_t *worker;
 		int i;
 
 		this->desired_threads = count;
 		DBG1(DBG_JOB, "spawning %d worker threads", count - this->total_threads);
 		for (i = this->total_threads; i < count; i++)
 		{
-			INIT(worker,
-				.processor = this,
-			);
-			worker->thread = thread_create((thread_main_t)process_jobs, worker);
-			if (worker->thread)
+			if (create_worker(this))
 			{
-				this->threads->insert_last(this->threads, worker);
 				this->total_threads++;
 			}
-			else
-			{
-				free(worker);
-			}
 		}
 	}
 	else if (count < this->total_threads)
@@ -403,6 +660,7 @@ METHOD(processor_t, cancel, void,
 	enumerator = this->threads->create_enumerator(this->threads);
 	while (enumerator->enumerate(enumerator, (void**)&worker))
 	{
+		worker->queue->mutex->lock(worker->queue->mutex);
 		if (worker->job && worker->job->cancel)
 		{
 			worker->job->status = JOB_STATUS_CANCELED;
@@ -412,6 +670,7 @@ METHOD(processor_t, cancel, void,
 				worker->thread->cancel(worker->thread);
 			}
 		}
+		worker->queue->mutex->unlock(worker->queue->mutex);
 	}
 	enumerator->destroy(enumerator);
 	while (this->total_threads > 0)
@@ -431,16 +690,26 @@ METHOD(processor_t, cancel, void,
 METHOD(processor_t, destroy, void,
 	private_processor_t *this)
 {
-	int i;
+	job_queue_t *queue;
+	int i, j;
 
 	cancel(this);
 	this->thread_terminated->destroy(this->thread_terminated);
 	this->job_added->destroy(this->job_added);
 	this->mutex->destroy(this->mutex);
-	for (i = 0; i < JOB_PRIO_MAX; i++)
+	this->reserve_lock->destroy(this->reserve_lock);
+	this->current->destroy(this->current);
+	for (i = 0; i < this->queue_count; i++)
 	{
-		this->jobs[i]->destroy_offset(this->jobs[i], offsetof(job_t, destroy));
+		queue = &this->queues[i];
+		for (j = 0; j < JOB_PRIO_MAX; j++)
+		{
+			queue->jobs[j]->destroy_offset(queue->jobs[j],
+										   offsetof(job_t, destroy));
+		}
+		queue->mutex->destroy(queue->mutex);
 	}
+	free(this->queues);
 	this->threads->destroy(this->threads);
 	free(this);
 }
@@ -451,7 +720,13 @@ METHOD(processor_t, destroy, void,
 processor_t *processor_create()
 {
 	private_processor_t *this;
-	int i;
+	int i, j, queues = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	queues = max(1, sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	queues = lib->settings->get_int(lib->settings,
+						"libstrongswan.processor.queues", queues);
 
 	INIT(this,
 		.public = {
@@ -459,24 +734,40 @@ processor_t *processor_create()
 			.get_idle_threads = _get_idle_threads,
 			.get_working_threads = _get_working_threads,
 			.get_job_load = _get_job_load,
+			.get_queue_count = _get_queue_count,
+			.get_queue_load = _get_queue_load,
 			.queue_job = _queue_job,
 			.set_threads = _set_threads,
 			.cancel = _cancel,
 			.destroy = _destroy,
 		},
 		.threads = linked_list_create(),
+		.queue_count = max(1, queues),
+		.reserve_lock = mutex_create(MUTEX_TYPE_DEFAULT),
+		.current = thread_value_create(NULL),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.job_added = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.thread_terminated = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
+	this->queues = calloc(this->queue_count, sizeof(job_queue_t));
+	for (i = 0; i < this->queue_count; i++)
+	{
+		this->queues[i].mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+		for (j = 0; j < JOB_PRIO_MAX; j++)
+		{
+			this->queues[i].jobs[j] = linked_list_create();
+		}
+	}
 	for (i = 0; i < JOB_PRIO_MAX; i++)
 	{
-		this->jobs[i] = linked_list_create();
 		this->prio_threads[i] = lib->settings->get_int(lib->settings,
 						"libstrongswan.processor.priority_threads.%N", 0,
 						job_priority_names, i);
+		if (this->prio_threads[i] > 0)
+		{
+			this->reservations = TRUE;
+		}
 	}
 
 	return &this->public;
 }
-
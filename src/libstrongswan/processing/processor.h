@@ -65,6 +65,28 @@ struct processor_t {
 	 */
 	u_int (*get_job_load) (processor_t *this, job_priority_t prio);
 
+	/**
+	 * Get the number of job queues.
+	 *
+	 * Each worker thread fetches jobs from its home queue first, and steals
+	 * jobs from the other queues if its own queue is empty.
+	 *
+	 * @return				number of job queues
+	 */
+	u_int (*get_queue_count)(processor_t *this);
+
+	/**
+	 * Get the number of queued jobs of a single job queue.
+	 *
+	 * @param queue			index of the queue, below get_queue_count()
+	 * @param prio			priority class to get job load for
+	 * @param steals		number of jobs the workers of this queue stole
+	 *						from other queues, if not NULL
+	 * @return				number of items in queue
+	 */
+	u_int (*get_queue_load)(processor_t *this, u_int queue,
+							job_priority_t prio, u_int *steals);
+
 	/**
 	 * Adds a job to the queue.
 	 *
@@ -25,9 +25,34 @@
 #include <threading/thread.h>
 #include <threading/condvar.h>
 #include <threading/mutex.h>
+#include <utils/hashtable.h>
 
-/* the initial size of the heap */
-#define HEAP_SIZE_DEFAULT 64
+/** number of wheels */
+#define WHEELS 5
+
+/** number of bits of a tick covered by the innermost wheel */
+#define INNER_BITS 8
+
+/** number of bits of a tick covered by each outer wheel */
+#define OUTER_BITS 6
+
+/** number of slots of the innermost wheel */
+#define INNER_SLOTS (1 << INNER_BITS)
+
+/** number of slots of each outer wheel */
+#define OUTER_SLOTS (1 << OUTER_BITS)
+
+/** number of bits to shift a tick to get the slot of a wheel */
+#define WHEEL_SHIFT(w) ((w) ? INNER_BITS + ((w) - 1) * OUTER_BITS : 0)
+
+/** number of slots of a wheel */
+#define WHEEL_SLOTS(w) ((w) ? OUTER_SLOTS : INNER_SLOTS)
+
+/** number of ticks covered by all wheels */
+#define WHEEL_RANGE (1ULL << WHEEL_SHIFT(WHEELS))
+
+/** marker for a scheduler thread waiting without timeout */
+#define NO_WAKEUP (~0ULL)
 
 typedef struct event_t event_t;
 
@@ -35,15 +60,36 @@ typedef struct event_t event_t;
  * Event containing a job and a schedule time
  */
 struct event_t {
+
 	/**
-	 * Time to fire the event.
+	 * Tick at which to fire the event.
 	 */
-	timeval_t time;
+	u_int64_t tick;
+
+	/**
+	 * Identifier of the event.
+	 */
+	scheduler_id_t id;
+
+	/**
+	 * Wheel the event is linked to.
+	 */
+	u_int wheel;
 
 	/**
 	 * Every event has its assigned job.
 	 */
 	job_t *job;
+
+	/**
+	 * Next event in the same slot.
+	 */
+	event_t *next;
+
+	/**
+	 * Pointer to the pointer referencing this event.
+	 */
+	event_t **pprev;
 };
 
 /**
@@ -68,22 +114,42 @@ struct private_scheduler_t {
 	 scheduler_t public;
 
 	/**
-	 * The heap in which the events are stored.
+	 * Slots of the innermost wheel.
+	 */
+	event_t *inner[INNER_SLOTS];
+
+	/**
+	 * Slots of the outer wheels, outer[0] is unused.
+	 */
+	event_t *outer[WHEELS][OUTER_SLOTS];
+
+	/**
+	 * Number of events per wheel.
+	 */
+	u_int count[WHEELS];
+
+	/**
+	 * Next tick to process, all events before have been fired.
+	 */
+	u_int64_t tick;
+
+	/**
+	 * Tick the scheduler thread is waiting for, NO_WAKEUP if none.
 	 */
-	event_t **heap;
+	u_int64_t wakeup;
 
 	/**
-	 * The size of the heap.
+	 * Identifier to assign to the next event.
 	 */
-	u_int heap_size;
+	scheduler_id_t next_id;
 
 	/**
-	 * The number of scheduled events.
+	 * Events by identifier, scheduler_id_t => event_t.
 	 */
-	u_int event_count;
+	hashtable_t *events;
 
 	/**
-	 * Exclusive access to list
+	 * Exclusive access to wheels
 	 */
 	mutex_t *mutex;
 
@@ -94,128 +160,246 @@ struct private_scheduler_t {
 };
 
 /**
- * Comparse two timevals, return >0 if a > b, <0 if a < b and =0 if equal
+ * Hashtable hash function for identifiers
  */
-static int timeval_cmp(timeval_t *a, timeval_t *b)
+static u_int id_hash(scheduler_id_t *id)
 {
-	if (a->tv_sec > b->tv_sec)
+	return chunk_hash(chunk_from_thing(*id));
+}
+
+/**
+ * Hashtable equals function for identifiers
+ */
+static bool id_equals(scheduler_id_t *a, scheduler_id_t *b)
+{
+	return *a == *b;
+}
+
+/**
+ * Convert a monotonic timeval to a tick, rounding up
+ */
+static u_int64_t tv2tick(timeval_t *tv)
+{
+	return (u_int64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+/**
+ * Get the current tick, rounding down
+ */
+static u_int64_t current_tick()
+{
+	timeval_t tv;
+
+	time_monotonic(&tv);
+	return (u_int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/**
+ * Get a slot head of a wheel
+ */
+static inline event_t **get_slot(private_scheduler_t *this, u_int wheel,
+								 u_int64_t tick)
+{
+	if (wheel)
 	{
-		return 1;
+		return &this->outer[wheel][(tick >> WHEEL_SHIFT(wheel)) &
+								   (OUTER_SLOTS - 1)];
 	}
-	if (a->tv_sec < b->tv_sec)
-	{
-		return -1;
+	return &this->inner[tick & (INNER_SLOTS - 1)];
+}
+
+/**
+ * Link an event to the slot of the innermost wheel covering its tick
+ */
+static void link_event(private_scheduler_t *this, event_t *event)
+{
+	u_int64_t tick = event->tick, delta;
+	event_t **slot;
+	u_int wheel;
+
+	if (tick < this->tick)
+	{	/* already expired, fire with the next tick processed */
+		tick = this->tick;
+	}
+	delta = tick - this->tick;
+	if (delta >= WHEEL_RANGE)
+	{	/* beyond the outermost wheel, gets cascaded until covered */
+		delta = WHEEL_RANGE - 1;
+		tick = this->tick + delta;
 	}
-	if (a->tv_usec > b->tv_usec)
+	for (wheel = 0; wheel < WHEELS - 1; wheel++)
 	{
-		return 1;
+		if (delta < (1ULL << WHEEL_SHIFT(wheel + 1)))
+		{
+			break;
+		}
 	}
-	if (a->tv_usec < b->tv_usec)
+	slot = get_slot(this, wheel, tick);
+	event->wheel = wheel;
+	event->next = *slot;
+	if (event->next)
 	{
-		return -1;
+		event->next->pprev = &event->next;
 	}
-	return 0;
+	event->pprev = slot;
+	*slot = event;
+	this->count[wheel]++;
 }
 
 /**
- * Returns the top event without removing it. Returns NULL if the heap is empty.
+ * Unlink an event from its slot
  */
-static event_t *peek_event(private_scheduler_t *this)
+static void unlink_event(private_scheduler_t *this, event_t *event)
 {
-	return this->event_count > 0 ? this->heap[1] : NULL;
+	*event->pprev = event->next;
+	if (event->next)
+	{
+		event->next->pprev = event->pprev;
+	}
+	this->count[event->wheel]--;
 }
 
 /**
- * Removes the top event from the heap and returns it. Returns NULL if the heap
- * is empty.
+ * Detach all events of a slot, returns them as singly linked list
  */
-static event_t *remove_event(private_scheduler_t *this)
+static event_t *detach_slot(private_scheduler_t *this, u_int wheel,
+							u_int64_t tick)
 {
-	event_t *event, *top;
-	if (!this->event_count)
+	event_t **slot, *event, *list;
+
+	slot = get_slot(this, wheel, tick);
+	list = *slot;
+	*slot = NULL;
+	for (event = list; event; event = event->next)
 	{
-		return NULL;
+		this->count[wheel]--;
 	}
+	return list;
+}
 
-	/* store the value to return */
-	event = this->heap[1];
-	/* move the bottom event to the top */
-	top = this->heap[1] = this->heap[this->event_count];
+/**
+ * Get the next tick at which the wheels have to be processed, i.e. the
+ * earliest tick of a non-empty innermost slot or the earliest tick at which a
+ * non-empty slot of an outer wheel gets cascaded.
+ */
+static u_int64_t get_next_tick(private_scheduler_t *this)
+{
+	u_int64_t next = NO_WAKEUP, first, mask;
+	u_int wheel, i, shift;
 
-	if (--this->event_count > 1)
+	for (wheel = 0; wheel < WHEELS; wheel++)
 	{
-		/* seep down the top event */
-		u_int position = 1;
-		while ((position << 1) <= this->event_count)
+		if (!this->count[wheel])
 		{
-			u_int child = position << 1;
-
-			if ((child + 1) <= this->event_count &&
-				timeval_cmp(&this->heap[child + 1]->time,
-							&this->heap[child]->time) < 0)
+			continue;
+		}
+		shift = WHEEL_SHIFT(wheel);
+		mask = (1ULL << shift) - 1;
+		first = (this->tick + mask) >> shift;
+		for (i = 0; i < WHEEL_SLOTS(wheel); i++)
+		{
+			if (((first + i) << shift) >= next)
 			{
-				/* the "right" child is smaller */
-				child++;
+				break;
 			}
-
-			if (timeval_cmp(&top->time, &this->heap[child]->time) <= 0)
+			if (*get_slot(this, wheel, (first + i) << shift))
 			{
-				/* the top event fires before the smaller of the two children,
-				 * stop */
+				next = (first + i) << shift;
 				break;
 			}
+		}
+	}
+	return next;
+}
+
+/**
+ * Process all ticks up to now, returns the due events as singly linked list
+ */
+static event_t *process_ticks(private_scheduler_t *this, u_int64_t now)
+{
+	event_t *due = NULL, *event, *list;
+	u_int64_t tick;
+	u_int wheel;
 
-			/* swap with the smaller child */
-			this->heap[position] = this->heap[child];
-			position = child;
+	while (TRUE)
+	{
+		tick = get_next_tick(this);
+		if (tick > now)
+		{
+			break;
+		}
+		this->tick = tick;
+		for (wheel = WHEELS - 1; wheel > 0; wheel--)
+		{
+			if (tick & ((1ULL << WHEEL_SHIFT(wheel)) - 1))
+			{
+				continue;
+			}
+			list = detach_slot(this, wheel, tick);
+			while (list)
+			{
+				event = list;
+				list = list->next;
+				link_event(this, event);
+			}
 		}
-		this->heap[position] = top;
+		list = detach_slot(this, 0, tick);
+		while (list)
+		{
+			event = list;
+			list = list->next;
+			this->events->remove(this->events, &event->id);
+			event->next = due;
+			due = event;
+		}
+		this->tick = tick + 1;
+	}
+	if (!this->events->get_count(this->events))
+	{	/* nothing scheduled, skip idle ticks */
+		this->tick = max(this->tick, now + 1);
 	}
-	return event;
+	return due;
 }
 
 /**
- * Get events from the queue and pass it to the processor
+ * Get events from the wheels and pass them to the processor
  */
 static job_requeue_t schedule(private_scheduler_t * this)
 {
-	timeval_t now;
-	event_t *event;
-	bool timed = FALSE, oldstate;
+	timeval_t tv;
+	event_t *due, *event;
+	u_int64_t now;
+	bool oldstate;
 
 	this->mutex->lock(this->mutex);
 
-	time_monotonic(&now);
-
-	if ((event = peek_event(this)) != NULL)
+	now = current_tick();
+	due = process_ticks(this, now);
+	if (due)
 	{
-		if (timeval_cmp(&now, &event->time) >= 0)
+		this->wakeup = 0;
+		this->mutex->unlock(this->mutex);
+		while (due)
 		{
-			remove_event(this);
-			this->mutex->unlock(this->mutex);
+			event = due;
+			due = due->next;
 			DBG2(DBG_JOB, "got event, queuing job for execution");
 			lib->processor->queue_job(lib->processor, event->job);
 			free(event);
-			return JOB_REQUEUE_DIRECT;
-		}
-		timersub(&event->time, &now, &now);
-		if (now.tv_sec)
-		{
-			DBG2(DBG_JOB, "next event in %ds %dms, waiting",
-				 now.tv_sec, now.tv_usec/1000);
-		}
-		else
-		{
-			DBG2(DBG_JOB, "next event in %dms, waiting", now.tv_usec/1000);
 		}
-		timed = TRUE;
+		return JOB_REQUEUE_DIRECT;
 	}
+	this->wakeup = get_next_tick(this);
+
 	thread_cleanup_push((thread_cleanup_t)this->mutex->unlock, this->mutex);
 	oldstate = thread_cancelability(TRUE);
 
-	if (timed)
+	if (this->wakeup != NO_WAKEUP)
 	{
-		this->condvar->timed_wait_abs(this->condvar, this->mutex, event->time);
+		DBG2(DBG_JOB, "next event in %llums, waiting", this->wakeup - now);
+		tv.tv_sec = this->wakeup / 1000;
+		tv.tv_usec = (this->wakeup % 1000) * 1000;
+		this->condvar->timed_wait_abs(this->condvar, this->mutex, tv);
 	}
 	else
 	{
@@ -227,55 +411,56 @@ static job_requeue_t schedule(private_scheduler_t * this)
 	return JOB_REQUEUE_DIRECT;
 }
 
+/**
+ * Wake up the scheduler thread if an event fires before its wakeup time
+ */
+static void check_wakeup(private_scheduler_t *this, event_t *event)
+{
+	if (event->tick < this->wakeup)
+	{
+		this->wakeup = event->tick;
+		this->condvar->signal(this->condvar);
+	}
+}
+
 METHOD(scheduler_t, get_job_load, u_int,
 	private_scheduler_t *this)
 {
 	int count;
 	this->mutex->lock(this->mutex);
-	count = this->event_count;
+	count = this->events->get_count(this->events);
 	this->mutex->unlock(this->mutex);
 	return count;
 }
 
-METHOD(scheduler_t, schedule_job_tv, void,
+METHOD(scheduler_t, schedule_job_tv, scheduler_id_t,
 	private_scheduler_t *this, job_t *job, timeval_t tv)
 {
 	event_t *event;
-	u_int position;
+	scheduler_id_t id;
 
-	event = malloc_thing(event_t);
-	event->job = job;
+	INIT(event,
+		.job = job,
+		.tick = tv2tick(&tv),
+	);
 	event->job->status = JOB_STATUS_QUEUED;
-	event->time = tv;
 
 	this->mutex->lock(this->mutex);
 
-	this->event_count++;
-	if (this->event_count > this->heap_size)
-	{
-		/* double the size of the heap */
-		this->heap_size <<= 1;
-		this->heap = (event_t**)realloc(this->heap,
-									(this->heap_size + 1) * sizeof(event_t*));
+	if (!this->events->get_count(this->events))
+	{	/* skip idle ticks before linking to avoid needless cascading */
+		this->tick = max(this->tick, current_tick());
 	}
-	/* "put" the event to the bottom */
-	position = this->event_count;
+	id = event->id = this->next_id++;
+	this->events->put(this->events, &event->id, event);
+	link_event(this, event);
+	check_wakeup(this, event);
 
-	/* then bubble it up */
-	while (position > 1 && timeval_cmp(&this->heap[position >> 1]->time,
-									   &event->time) > 0)
-	{
-		/* parent has to be fired after the new event, move up */
-		this->heap[position] = this->heap[position >> 1];
-		position >>= 1;
-	}
-	this->heap[position] = event;
-
-	this->condvar->signal(this->condvar);
 	this->mutex->unlock(this->mutex);
+	return id;
 }
 
-METHOD(scheduler_t, schedule_job, void,
+METHOD(scheduler_t, schedule_job, scheduler_id_t,
 	private_scheduler_t *this, job_t *job, u_int32_t s)
 {
 	timeval_t tv;
@@ -283,10 +468,10 @@ METHOD(scheduler_t, schedule_job, void,
 	time_monotonic(&tv);
 	tv.tv_sec += s;
 
-	schedule_job_tv(this, job, tv);
+	return schedule_job_tv(this, job, tv);
 }
 
-METHOD(scheduler_t, schedule_job_ms, void,
+METHOD(scheduler_t, schedule_job_ms, scheduler_id_t,
 	private_scheduler_t *this, job_t *job, u_int32_t ms)
 {
 	timeval_t tv, add;
@@ -297,20 +482,74 @@ METHOD(scheduler_t, schedule_job_ms, void,
 
 	timeradd(&tv, &add, &tv);
 
-	schedule_job_tv(this, job, tv);
+	return schedule_job_tv(this, job, tv);
+}
+
+METHOD(scheduler_t, cancel, bool,
+	private_scheduler_t *this, scheduler_id_t id)
+{
+	event_t *event;
+
+	this->mutex->lock(this->mutex);
+	event = this->events->remove(this->events, &id);
+	if (event)
+	{
+		unlink_event(this, event);
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!event)
+	{
+		return FALSE;
+	}
+	event_destroy(event);
+	return TRUE;
+}
+
+METHOD(scheduler_t, reschedule_ms, bool,
+	private_scheduler_t *this, scheduler_id_t id, u_int32_t ms)
+{
+	event_t *event;
+	u_int64_t tick;
+
+	tick = current_tick() + ms;
+
+	this->mutex->lock(this->mutex);
+	event = this->events->get(this->events, &id);
+	if (event)
+	{
+		unlink_event(this, event);
+		event->tick = tick;
+		link_event(this, event);
+		check_wakeup(this, event);
+	}
+	this->mutex->unlock(this->mutex);
+
+	return event != NULL;
+}
+
+METHOD(scheduler_t, reschedule, bool,
+	private_scheduler_t *this, scheduler_id_t id, u_int32_t s)
+{
+	return reschedule_ms(this, id, s * 1000);
 }
 
 METHOD(scheduler_t, destroy, void,
 	private_scheduler_t *this)
 {
+	enumerator_t *enumerator;
 	event_t *event;
+	void *key;
+
 	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
-	while ((event = remove_event(this)) != NULL)
+	enumerator = this->events->create_enumerator(this->events);
+	while (enumerator->enumerate(enumerator, &key, &event))
 	{
 		event_destroy(event);
 	}
-	free(this->heap);
+	enumerator->destroy(enumerator);
+	this->events->destroy(this->events);
 	free(this);
 }
 
@@ -328,19 +567,23 @@ scheduler_t * scheduler_create()
 			.schedule_job = _schedule_job,
 			.schedule_job_ms = _schedule_job_ms,
 			.schedule_job_tv = _schedule_job_tv,
+			.cancel = _cancel,
+			.reschedule = _reschedule,
+			.reschedule_ms = _reschedule_ms,
 			.destroy = _destroy,
 		},
-		.heap_size = HEAP_SIZE_DEFAULT,
+		.tick = current_tick(),
+		.wakeup = NO_WAKEUP,
+		.next_id = 1,
+		.events = hashtable_create((hashtable_hash_t)id_hash,
+								   (hashtable_equals_t)id_equals, 64),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
-	this->heap = (event_t**)calloc(this->heap_size + 1, sizeof(event_t*));
-
 	job = callback_job_create_with_prio((callback_job_cb_t)schedule, this,
 										NULL, return_false, JOB_PRIO_CRITICAL);
 	lib->processor->queue_job(lib->processor, (job_t*)job);
 
 	return &this->public;
 }
-
@@ -29,54 +29,35 @@ typedef struct scheduler_t scheduler_t;
 #include <processing/jobs/job.h>
 
 /**
- * The scheduler queues timed events which are then passed to the processor.
- *
- * The scheduler is implemented as a heap. A heap is a special kind of tree-
- * based data structure that satisfies the following property: if B is a child
- * node of A, then key(A) >= (or <=) key(B). So either the element with the
- * greatest (max-heap) or the smallest (min-heap) key is the root of the heap.
- * We use a min-heap with the key being the absolute unix time at which an
- * event is scheduled. So the root is always the event that will fire next.
+ * Identifier of a scheduled job, used to cancel or reschedule it.
  *
- * An earlier implementation of the scheduler used a sorted linked list to store
- * the events. That had the advantage that removing the next event was extremely
- * fast, also, adding an event scheduled before or after all other events was
- * equally fast (all in O(1)). The problem was, though, that adding an event
- * in-between got slower, as the number of events grew larger (O(n)).
- * For each connection there could be several events: IKE-rekey, NAT-keepalive,
- * retransmissions, expire (half-open), and others. So a gateway that probably
- * has to handle thousands of concurrent connnections has to be able to queue a
- * large number of events as fast as possible. Locking makes this even worse, to
- * provide thread-safety, no events can be processed, while an event is queued,
- * so making the insertion fast is even more important.
+ * Identifiers are never reused, 0 is never assigned to a job.
+ */
+typedef u_int64_t scheduler_id_t;
+
+/**
+ * The scheduler queues timed events which are then passed to the processor.
  *
- * That's the advantage of the heap. Adding an element to the heap can be
- * achieved in O(log n) - on the other hand, removing the root node also
- * requires O(log n) operations. Consider 10000 queued events. Inserting a new
- * event in the list implementation required up to 10000 comparisons. In the
- * heap implementation, the worst case is about 13.3 comparisons. That's a
- * drastic improvement.
+ * The scheduler is implemented as a hierarchical timing wheel. Time is
+ * divided into ticks of one millisecond. The first wheel has a slot for each
+ * of the next 256 ticks. Each of the four outer wheels has 64 slots, each
+ * covering a full turn of the next inner wheel, i.e. a slot of the second
+ * wheel covers all 256 ticks of the first wheel. An event is linked into the
+ * slot of the innermost wheel covering its time, so adding and removing an
+ * event takes O(1), regardless of the number of scheduled events.
  *
- * The implementation itself uses a binary tree mapped to a one-based array to
- * store the elements. This reduces storage overhead and simplifies navigation:
- * the children of the node at position n are at position 2n and 2n+1 (likewise
- * the parent node of the node at position n is at position [n/2]). Thus,
- * navigating up and down the tree is reduced to simple index computations.
+ * Whenever the first wheel completes a turn, the events of the next slot of
+ * the second wheel get redistributed ("cascaded") to the first wheel, and so
+ * on. Each event gets cascaded at most once per wheel.
  *
- * Adding an element to the heap works as follows: The heap is always filled
- * from left to right, until a row is full, then the next row is filled. Mapped
- * to an array this gets as simple as putting the new element to the first free
- * position. In a one-based array that position equals the number of elements
- * currently stored in the heap. Then the heap property has to be restored, i.e.
- * the new element has to be "bubbled up" the tree until the parent node's key
- * is smaller or the element got the new root of the tree.
+ * The wheels cover about 49 days, events scheduled further in the future
+ * get cascaded until their time is covered.
  *
- * Removing the next event from the heap works similarly. The event itself is
- * the root node and stored at position 1 of the array. After removing it, the
- * root has to be replaced and the heap property has to be restored. This is
- * done by moving the bottom element (last row, rightmost element) to the root
- * and then "seep it down" by swapping it with child nodes until none of the
- * children has a smaller key or it is again a leaf node.
+ * Many events get obsolete before they fire, for instance retransmissions
+ * after a response has been received, or the rekeying of an IKE_SA that has
+ * been deleted. The identifier returned when scheduling a job allows its
+ * owner to cancel or reschedule it in O(1), avoiding that the scheduler
+ * accumulates dead events.
  */
 struct scheduler_t {
 
@@ -85,16 +66,19 @@ struct scheduler_t {
 	 *
 	 * @param job			job to schedule
 	 * @param time			relative time to schedule job, in s
+	 * @return				identifier of the scheduled job
 	 */
-	void (*schedule_job) (scheduler_t *this, job_t *job, u_int32_t s);
+	scheduler_id_t (*schedule_job) (scheduler_t *this, job_t *job, u_int32_t s);
 
 	/**
 	 * Adds a event to the queue, using a relative time offset in ms.
 	 *
 	 * @param job			job to schedule
 	 * @param time			relative time to schedule job, in ms
+	 * @return				identifier of the scheduled job
 	 */
-	void (*schedule_job_ms) (scheduler_t *this, job_t *job, u_int32_t ms);
+	scheduler_id_t (*schedule_job_ms) (scheduler_t *this, job_t *job,
+									   u_int32_t ms);
 
 	/**
 	 * Adds a event to the queue, using an absolut time.
@@ -104,8 +88,36 @@ struct scheduler_t {
 	 *
 	 * @param job			job to schedule
 	 * @param time			absolut time to schedule job
+	 * @return				identifier of the scheduled job
+	 */
+	scheduler_id_t (*schedule_job_tv) (scheduler_t *this, job_t *job,
+									   timeval_t tv);
+
+	/**
+	 * Cancel a scheduled job, the job gets destroyed.
+	 *
+	 * @param id			identifier of the scheduled job
+	 * @return				TRUE if cancelled, FALSE if not scheduled anymore
+	 */
+	bool (*cancel)(scheduler_t *this, scheduler_id_t id);
+
+	/**
+	 * Change the time of a scheduled job, using a relative time in s.
+	 *
+	 * @param id			identifier of the scheduled job
+	 * @param s				new relative time to schedule job, in s
+	 * @return				TRUE if rescheduled, FALSE if not scheduled anymore
+	 */
+	bool (*reschedule)(scheduler_t *this, scheduler_id_t id, u_int32_t s);
+
+	/**
+	 * Change the time of a scheduled job, using a relative time in ms.
+	 *
+	 * @param id			identifier of the scheduled job
+	 * @param ms			new relative time to schedule job, in ms
+	 * @return				TRUE if rescheduled, FALSE if not scheduled anymore
 	 */
-	void (*schedule_job_tv) (scheduler_t *this, job_t *job, timeval_t tv);
+	bool (*reschedule_ms)(scheduler_t *this, scheduler_id_t id, u_int32_t ms);
 
 	/**
 	 * Returns number of jobs scheduled.
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "cpu_feature.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+#include <cpuid.h>
+
+/**
+ * Feature flags in ECX of CPUID leaf 1
+ */
+#define CPUID_ECX_PCLMULQDQ	(1 << 1)
+#define CPUID_ECX_SSSE3		(1 << 9)
+#define CPUID_ECX_AESNI		(1 << 25)
+
+/**
+ * Query the CPU using CPUID
+ */
+static cpu_feature_t get_cpu_features()
+{
+	u_int eax, ebx, ecx, edx;
+	cpu_feature_t features = 0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		return 0;
+	}
+	if (ecx & CPUID_ECX_SSSE3)
+	{
+		features |= CPU_FEATURE_SSSE3;
+	}
+	if (ecx & CPUID_ECX_AESNI)
+	{
+		features |= CPU_FEATURE_AESNI;
+	}
+	if (ecx & CPUID_ECX_PCLMULQDQ)
+	{
+		features |= CPU_FEATURE_PCLMULQDQ;
+	}
+	return features;
+}
+
+#else /* !x86 */
+
+/**
+ * No features detected on other architectures
+ */
+static cpu_feature_t get_cpu_features()
+{
+	return 0;
+}
+
+#endif
+
+/**
+ * Described in header.
+ */
+cpu_feature_t cpu_feature_get_all()
+{
+	static cpu_feature_t features;
+	static bool detected = FALSE;
+
+	if (!detected)
+	{	/* the result is always the same, so races are harmless */
+		features = get_cpu_features();
+		detected = TRUE;
+	}
+	return features;
+}
+
+/**
+ * Described in header.
+ */
+bool cpu_feature_available(cpu_feature_t feature)
+{
+	return (cpu_feature_get_all() & feature) == feature;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2012 Hochschule fuer Technik Rapperswil
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup cpu_feature cpu_feature
+ * @{ @ingroup utils
+ */
+
+#ifndef CPU_FEATURE_H_
+#define CPU_FEATURE_H_
+
+#include <library.h>
+
+typedef enum cpu_feature_t cpu_feature_t;
+
+/**
+ * CPU features relevant for cryptographic operations, detected at runtime.
+ */
+enum cpu_feature_t {
+	/** Supplemental Streaming SIMD Extensions 3 */
+	CPU_FEATURE_SSSE3 =			(1 << 0),
+	/** AES New Instructions */
+	CPU_FEATURE_AESNI =			(1 << 1),
+	/** Carry-less multiplication (PCLMULQDQ) */
+	CPU_FEATURE_PCLMULQDQ =		(1 << 2),
+};
+
+/**
+ * Get all features supported by the CPU we are running on.
+ *
+ * @return			bitmask of cpu_feature_t
+ */
+cpu_feature_t cpu_feature_get_all();
+
+/**
+ * Check if the CPU we are running on supports a set of features.
+ *
+ * @param feature	feature(s) to check, as bitmask
+ * @return			TRUE if all features are supported
+ */
+bool cpu_feature_available(cpu_feature_t feature);
+
+#endif /** CPU_FEATURE_H_ @}*/
@@ -226,6 +226,21 @@ struct identification_t {
 	 */
 	bool (*equals) (identification_t *this, identification_t *other);
 
+	/**
+	 * Hash this identification, consistent with equals() for identities of
+	 * the same type.
+	 *
+	 * Identities of the same type comparing equal get the same hash,
+	 * allowing them to be used as keys in a hashtable. As the type is
+	 * included in the hash, but equals() ignores it for DNs and for
+	 * case-insensitive string types, identities of different types may
+	 * compare equal but hash differently.
+	 *
+	 * @param inc		value to incorporate into the hash
+	 * @return			hash value
+	 */
+	u_int (*hash) (identification_t *this, u_int inc);
+
 	/**
 	 * Check if an ID matches a wildcard ID.
 	 *